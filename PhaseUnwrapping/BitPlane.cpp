@@ -0,0 +1,371 @@
+#include "BitPlane.h"
+#include "Parallel.h"
+#include "Profiling.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace pu
+{
+	namespace masks
+	{
+		namespace
+		{
+			typedef BitPlane::word_type word_type;
+			const int WORD_BITS = BitPlane::WORD_BITS;
+
+			inline int TrailingZeros(word_type word)
+			{
+#ifdef _MSC_VER
+				unsigned long index;
+				_BitScanForward64(&index, word);
+				return static_cast<int>(index);
+#else
+				return __builtin_ctzll(word);
+#endif
+			}
+
+			/// <summary>
+			/// dst bit c = src bit c + shift (shift may be negative), bits
+			/// shifted in from outside of the row are 0
+			/// </summary>
+			void Shift(const word_type* src, word_type* dst, int words, int shift)
+			{
+				if(shift >= 0)
+				{
+					const int ws = shift / WORD_BITS, bs = shift % WORD_BITS;
+					for(int w = 0; w < words; w++)
+					{
+						word_type lo = w + ws < words ? src[w + ws] : 0;
+						word_type hi = w + ws + 1 < words ? src[w + ws + 1] : 0;
+						dst[w] = bs ? (lo >> bs) | (hi << (WORD_BITS - bs)) : lo;
+					}
+				}
+				else
+				{
+					const int ws = -shift / WORD_BITS, bs = -shift % WORD_BITS;
+					for(int w = 0; w < words; w++)
+					{
+						word_type hi = w - ws >= 0 ? src[w - ws] : 0;
+						word_type lo = w - ws - 1 >= 0 ? src[w - ws - 1] : 0;
+						dst[w] = bs ? (hi << bs) | (lo >> (WORD_BITS - bs)) : hi;
+					}
+				}
+			}
+
+			/// <summary>
+			/// run bit c = OR of bits [c, c + length] of run (direction 1) or
+			/// [c - length, c] (direction -1), spans are doubled so that it
+			/// takes log2(length) shifts. Bits are only taken from the side
+			/// which stays inside the row, so none are lost at row ends.
+			/// </summary>
+			void Spread(std::vector<word_type>& run, std::vector<word_type>& shifted, int length, int direction)
+			{
+				const int words = static_cast<int>(run.size());
+				for(int span = 1; span <= length;)
+				{
+					int step = std::min(span, length + 1 - span);
+					Shift(run.data(), shifted.data(), words, step * direction);
+					for(int w = 0; w < words; w++)
+					{
+						run[w] |= shifted[w];
+					}
+					span += step;
+				}
+			}
+
+			/// <summary>
+			/// dst bit c = OR of src bits [c - left, c + right]
+			/// </summary>
+			void DilateRow(const word_type* src, word_type* dst, int left, int right,
+						   std::vector<word_type>& run, std::vector<word_type>& shifted)
+			{
+				const int words = static_cast<int>(run.size());
+
+				std::copy(src, src + words, run.begin());
+				Spread(run, shifted, left, -1);
+				std::copy(run.begin(), run.end(), dst);
+
+				std::copy(src, src + words, run.begin());
+				Spread(run, shifted, right, 1);
+				for(int w = 0; w < words; w++)
+				{
+					dst[w] |= run[w];
+				}
+			}
+		}
+
+		int PopCount(uint64_t word)
+		{
+#ifdef _MSC_VER
+			return static_cast<int>(__popcnt64(word));
+#else
+			return __builtin_popcountll(word);
+#endif
+		}
+
+		BitPlane::BitPlane(cv::Size size, bool value)
+			: size(size), words_per_row((size.width + WORD_BITS - 1) / WORD_BITS), tail_bits(size.width % WORD_BITS)
+		{
+			assert(size.width >= 0 && size.height >= 0 && "[BitPlane] Invalid size");
+
+			words.assign(static_cast<size_t>(words_per_row) * size.height, value ? ~word_type(0) : 0);
+			if(value && tail_bits)
+			{
+				for(int row = 0; row < size.height; row++)
+				{
+					Row(row)[words_per_row - 1] = WordMask(words_per_row - 1);
+				}
+			}
+		}
+
+		BitPlane::BitPlane(const cv::Mat & bitflags, bitflag_type flag)
+			: BitPlane(bitflags.size())
+		{
+			assert(!bitflags.empty() &&
+				   bitflags.type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+				   "[BitPlane] Invalid bitflags image");
+
+			PU_PROFILE_SCOPE("BitPlane");
+
+			const int cols = size.width;
+			parallel::ForRows(cv::Range(0, size.height), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const bitflag_type* src = bitflags.ptr<bitflag_type>(row);
+					word_type* dst = Row(row);
+					for(int w = 0; w < words_per_row; w++)
+					{
+						const int begin = w * WORD_BITS, end = std::min(begin + WORD_BITS, cols);
+						word_type word = 0;
+						for(int col = begin; col < end; col++)
+						{
+							word |= word_type((src[col] & flag) != 0) << (col - begin);
+						}
+						dst[w] = word;
+					}
+				}
+			});
+
+			PU_PROFILE_COUNT("BitPlane", PixelsProcessed, static_cast<long long>(size.area()));
+		}
+
+		long long BitPlane::Count() const
+		{
+			long long count = 0;
+			for(word_type word : words)
+			{
+				count += PopCount(word);
+			}
+			return count;
+		}
+
+		bool BitPlane::Any() const
+		{
+			return std::any_of(words.begin(), words.end(), [](word_type word) { return word != 0; });
+		}
+
+		bool BitPlane::AnyInRect(cv::Rect rect) const
+		{
+			rect &= cv::Rect(0, 0, size.width, size.height);
+			if(rect.area() == 0) return false;
+
+			const int first = rect.x / WORD_BITS, last = (rect.x + rect.width - 1) / WORD_BITS;
+			const int head = rect.x % WORD_BITS, tail = (rect.x + rect.width) % WORD_BITS;
+			for(int row = rect.y; row < rect.y + rect.height; row++)
+			{
+				const word_type* src = Row(row);
+				for(int w = first; w <= last; w++)
+				{
+					word_type mask = ~word_type(0);
+					if(w == first) mask &= ~word_type(0) << head;
+					if(w == last && tail) mask &= (word_type(1) << tail) - 1;
+					if(src[w] & mask) return true;
+				}
+			}
+			return false;
+		}
+
+		long long BitPlane::CountInRect(cv::Rect rect) const
+		{
+			rect &= cv::Rect(0, 0, size.width, size.height);
+			if(rect.area() == 0) return 0;
+
+			const int first = rect.x / WORD_BITS, last = (rect.x + rect.width - 1) / WORD_BITS;
+			const int head = rect.x % WORD_BITS, tail = (rect.x + rect.width) % WORD_BITS;
+			long long count = 0;
+			for(int row = rect.y; row < rect.y + rect.height; row++)
+			{
+				const word_type* src = Row(row);
+				for(int w = first; w <= last; w++)
+				{
+					word_type mask = ~word_type(0);
+					if(w == first) mask &= ~word_type(0) << head;
+					if(w == last && tail) mask &= (word_type(1) << tail) - 1;
+					count += PopCount(src[w] & mask);
+				}
+			}
+			return count;
+		}
+
+		BitPlane & BitPlane::operator|=(const BitPlane & other)
+		{
+			assert(other.size == size && "[BitPlane::operator|=] Planes of different size");
+
+			for(size_t i = 0; i < words.size(); i++)
+			{
+				words[i] |= other.words[i];
+			}
+			return *this;
+		}
+
+		BitPlane & BitPlane::operator&=(const BitPlane & other)
+		{
+			assert(other.size == size && "[BitPlane::operator&=] Planes of different size");
+
+			for(size_t i = 0; i < words.size(); i++)
+			{
+				words[i] &= other.words[i];
+			}
+			return *this;
+		}
+
+		BitPlane BitPlane::Inverted() const
+		{
+			BitPlane inverted{ size };
+			for(int row = 0; row < size.height; row++)
+			{
+				const word_type* src = Row(row);
+				word_type* dst = inverted.Row(row);
+				for(int w = 0; w < words_per_row; w++)
+				{
+					dst[w] = ~src[w] & WordMask(w);
+				}
+			}
+			return inverted;
+		}
+
+		BitPlane BitPlane::Dilate(cv::Size window) const
+		{
+			assert(window.width > 0 && window.height > 0 && "[BitPlane::Dilate] Invalid window size");
+
+			PU_PROFILE_SCOPE("BitPlaneDilate");
+
+			if(Empty()) return *this;
+
+			const int rows = size.height;
+			const int left = window.width / 2;
+			const int top = window.height / 2, bottom = window.height - 1 - top;
+
+			// Horizontal pass, only when window is wider than a pixel
+			BitPlane horizontal;
+			const BitPlane* src = this;
+			if(window.width > 1)
+			{
+				horizontal = BitPlane(size);
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					std::vector<word_type> run(words_per_row), shifted(words_per_row);
+					for(int row = range.start; row < range.end; row++)
+					{
+						word_type* dst = horizontal.Row(row);
+						DilateRow(Row(row), dst, left, window.width - 1 - left, run, shifted);
+						dst[words_per_row - 1] &= WordMask(words_per_row - 1);
+					}
+				});
+				src = &horizontal;
+			}
+
+			if(window.height == 1)
+			{
+				return src == this ? *this : horizontal;
+			}
+
+			// Vertical pass ORs whole words of window rows
+			BitPlane dilated{ size };
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					word_type* dst = dilated.Row(row);
+					const int first = std::max(row - top, 0), last = std::min(row + bottom, rows - 1);
+					for(int r = first; r <= last; r++)
+					{
+						const word_type* line = src->Row(r);
+						for(int w = 0; w < words_per_row; w++)
+						{
+							dst[w] |= line[w];
+						}
+					}
+				}
+			});
+
+			PU_PROFILE_WORK(static_cast<long long>(rows) * words_per_row);
+
+			return dilated;
+		}
+
+		BitPlane BitPlane::Erode(cv::Size window) const
+		{
+			// Outside pixels are not set in complement, so they count as set here
+			return Inverted().Dilate(window).Inverted();
+		}
+
+		void BitPlane::Mark(cv::Mat & bitflags, bitflag_type flag) const
+		{
+			if(bitflags.empty())
+			{
+				bitflags = cv::Mat(size.height, size.width, CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1), cv::Scalar(0));
+			}
+
+			assert(bitflags.size() == size &&
+				   bitflags.type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+				   "[BitPlane::Mark] Invalid bitflags image");
+
+			parallel::ForRows(cv::Range(0, size.height), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const word_type* src = Row(row);
+					bitflag_type* dst = bitflags.ptr<bitflag_type>(row);
+					for(int w = 0; w < words_per_row; w++)
+					{
+						// Visits only set bits, clean words cost one test
+						for(word_type word = src[w]; word; word &= word - 1)
+						{
+							dst[w * WORD_BITS + TrailingZeros(word)] |= flag;
+						}
+					}
+				}
+			});
+		}
+
+		cv::Mat BitPlane::ToMask() const
+		{
+			cv::Mat mask{ size.height, size.width, CV_8UC1, cv::Scalar(0) };
+			for(int row = 0; row < size.height; row++)
+			{
+				const word_type* src = Row(row);
+				unsigned char* dst = mask.ptr<unsigned char>(row);
+				for(int w = 0; w < words_per_row; w++)
+				{
+					for(word_type word = src[w]; word; word &= word - 1)
+					{
+						dst[w * WORD_BITS + TrailingZeros(word)] = 255;
+					}
+				}
+			}
+			return mask;
+		}
+
+		BitPlane operator|(BitPlane a, const BitPlane & b)
+		{
+			return a |= b;
+		}
+
+		BitPlane operator&(BitPlane a, const BitPlane & b)
+		{
+			return a &= b;
+		}
+	}
+}
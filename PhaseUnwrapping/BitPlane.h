@@ -0,0 +1,152 @@
+#pragma once
+#include "Bitflags.h"
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace pu
+{
+	namespace masks
+	{
+		/// <summary>
+		/// Number of set bits of the word
+		/// </summary>
+		int PopCount(uint64_t word);
+
+		/// <summary>
+		/// Single bitflag (or union of bitflags) packed to 1 bit per pixel,
+		/// 64 pixels per word, rows padded to whole words. Pixel (row, col) is
+		/// bit col % 64 of word col / 64 of the row. Padding bits past the
+		/// last column are always 0. Takes 16 times less memory than bitflags
+		/// image, and operations below process 64 pixels per instruction.
+		/// </summary>
+		class BitPlane
+		{
+		public:
+			typedef uint64_t word_type;
+			static const int WORD_BITS = 64;
+
+			BitPlane() = default;
+
+			/// <summary>
+			/// Plane with all pixels set to value
+			/// </summary>
+			explicit BitPlane(cv::Size size, bool value = false);
+
+			/// <summary>
+			/// Pixels with any of flag in bitflags are set.
+			/// </summary>
+			/// <param name="bitflags">
+			/// Bitflags image, 1 channel, bitflag_type pixels.
+			/// </param>
+			/// <param name="flag">
+			/// Flag (or union of flags) to pack.
+			/// </param>
+			BitPlane(const cv::Mat& bitflags, bitflag_type flag);
+
+			cv::Size Size() const { return size; }
+			bool Empty() const { return words.empty(); }
+			int WordsPerRow() const { return words_per_row; }
+
+			const word_type* Row(int row) const { return words.data() + static_cast<size_t>(row) * words_per_row; }
+			word_type* Row(int row) { return words.data() + static_cast<size_t>(row) * words_per_row; }
+
+			/// <summary>
+			/// Bits of the word which belong to image columns (all ones except
+			/// the padded last word of a row)
+			/// </summary>
+			word_type WordMask(int word) const
+			{
+				return word + 1 < words_per_row || tail_bits == 0 ? ~word_type(0) : (word_type(1) << tail_bits) - 1;
+			}
+
+			bool Get(int row, int col) const
+			{
+				return (Row(row)[col / WORD_BITS] >> (col % WORD_BITS)) & 1;
+			}
+
+			void Set(int row, int col, bool value = true)
+			{
+				word_type bit = word_type(1) << (col % WORD_BITS);
+				word_type& word = Row(row)[col / WORD_BITS];
+				word = value ? word | bit : word & ~bit;
+			}
+
+			/// <summary>
+			/// Number of set pixels
+			/// </summary>
+			long long Count() const;
+
+			/// <summary>
+			/// Whether any pixel is set, stops at the first non zero word
+			/// </summary>
+			bool Any() const;
+
+			/// <summary>
+			/// Whether any pixel of the rectangle (clipped to the plane) is set.
+			/// Tests whole words, partial words at rectangle edges are masked.
+			/// </summary>
+			bool AnyInRect(cv::Rect rect) const;
+
+			/// <summary>
+			/// Number of set pixels of the rectangle (clipped to the plane),
+			/// popcount of whole words with edge words masked as in AnyInRect.
+			/// </summary>
+			long long CountInRect(cv::Rect rect) const;
+
+			BitPlane& operator|=(const BitPlane& other);
+			BitPlane& operator&=(const BitPlane& other);
+
+			/// <summary>
+			/// Complement, padding bits stay 0
+			/// </summary>
+			BitPlane Inverted() const;
+
+			/// <summary>
+			/// Pixel is set when any pixel of the window centered on it (anchor
+			/// at window / 2, as in cv::boxFilter) is set, pixels outside of
+			/// the plane count as not set. Rows are dilated with shifted ORs
+			/// doubling the covered span (log2 of window width word passes),
+			/// columns by ORing whole words of window rows.
+			/// </summary>
+			BitPlane Dilate(cv::Size window) const;
+
+			/// <summary>
+			/// Pixel stays set when all pixels of the window are set, pixels
+			/// outside of the plane count as set (as cv::erode border).
+			/// </summary>
+			BitPlane Erode(cv::Size window) const;
+
+			/// <summary>
+			/// Whether the window of each pixel has any set pixel, same as
+			/// Dilate. Zero word means none of the 64 windows touches a set
+			/// pixel, so that the whole run can take unmasked path.
+			/// </summary>
+			BitPlane AnyInWindow(cv::Size window) const { return Dilate(window); }
+
+			/// <summary>
+			/// Adds flag to bitflags pixels which are set, other pixels are left
+			/// untouched.
+			/// </summary>
+			/// <param name="bitflags">
+			/// Bitflags image of plane size, allocated (zeroed) if empty.
+			/// </param>
+			void Mark(cv::Mat& bitflags, bitflag_type flag) const;
+
+			/// <summary>
+			/// Mask image, CV_8UC1, 255 at set pixels, 0 elsewhere.
+			/// </summary>
+			cv::Mat ToMask() const;
+
+		private:
+			cv::Size size;
+			int words_per_row = 0;
+			int tail_bits = 0;
+			std::vector<word_type> words;
+		};
+
+		BitPlane operator|(BitPlane a, const BitPlane& b);
+		BitPlane operator&(BitPlane a, const BitPlane& b);
+	}
+}
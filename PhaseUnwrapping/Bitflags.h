@@ -23,6 +23,21 @@ namespace pu
 		/// <summary>
 		/// Indicates image border
 		/// </summary>
-		Border = 0x0001
+		Border = 0x0001,
+
+		/// <summary>
+		/// Indicates residue of positive charge (top left pixel of the loop)
+		/// </summary>
+		PositiveResidue = 0x0002,
+
+		/// <summary>
+		/// Indicates residue of negative charge (top left pixel of the loop)
+		/// </summary>
+		NegativeResidue = 0x0004,
+
+		/// <summary>
+		/// Indicates residue of any charge
+		/// </summary>
+		Residue = PositiveResidue | NegativeResidue
 	};
 }
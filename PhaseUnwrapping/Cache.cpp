@@ -0,0 +1,720 @@
+#include "Cache.h"
+#include "Filters.h"
+#include "IO.h"
+#include "Masks.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "QualityMaps.h"
+#include "Unwrappers.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace pu
+{
+	namespace cache
+	{
+		namespace
+		{
+			// Bumped when stored results change meaning, so old files are not reused
+			const uint64_t KEY_VERSION = 1;
+
+			const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+			const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+			const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+			const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+			const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+			const char FILE_PREFIX[] = "pu_";
+			const char FILE_SUFFIX[] = ".npy";
+
+			inline uint64_t RotateLeft(uint64_t value, int bits)
+			{
+				return (value << bits) | (value >> (64 - bits));
+			}
+
+			inline uint64_t Read64(const unsigned char* p)
+			{
+				uint64_t value;
+				std::memcpy(&value, p, sizeof(value));
+				return value;
+			}
+
+			inline uint32_t Read32(const unsigned char* p)
+			{
+				uint32_t value;
+				std::memcpy(&value, p, sizeof(value));
+				return value;
+			}
+
+			inline uint64_t Round(uint64_t acc, uint64_t input)
+			{
+				acc += input * PRIME2;
+				return RotateLeft(acc, 31) * PRIME1;
+			}
+
+			inline uint64_t Merge(uint64_t acc, uint64_t value)
+			{
+				acc ^= Round(0, value);
+				return acc * PRIME1 + PRIME4;
+			}
+
+			/// <summary>
+			/// XXH64 of the bytes, 4 independent lanes over 32 byte stripes
+			/// </summary>
+			uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+			{
+				const unsigned char* p = static_cast<const unsigned char*>(data);
+				const unsigned char* const end = p + size;
+
+				uint64_t hash;
+				if(size >= 32)
+				{
+					uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+					for(; p + 32 <= end; p += 32)
+					{
+						v1 = Round(v1, Read64(p));
+						v2 = Round(v2, Read64(p + 8));
+						v3 = Round(v3, Read64(p + 16));
+						v4 = Round(v4, Read64(p + 24));
+					}
+					hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+					hash = Merge(Merge(Merge(Merge(hash, v1), v2), v3), v4);
+				}
+				else
+				{
+					hash = seed + PRIME5;
+				}
+
+				hash += size;
+				for(; p + 8 <= end; p += 8)
+				{
+					hash ^= Round(0, Read64(p));
+					hash = RotateLeft(hash, 27) * PRIME1 + PRIME4;
+				}
+				if(p + 4 <= end)
+				{
+					hash ^= Read32(p) * PRIME1;
+					hash = RotateLeft(hash, 23) * PRIME2 + PRIME3;
+					p += 4;
+				}
+				for(; p < end; p++)
+				{
+					hash ^= *p * PRIME5;
+					hash = RotateLeft(hash, 11) * PRIME1;
+				}
+
+				hash ^= hash >> 33;
+				hash *= PRIME2;
+				hash ^= hash >> 29;
+				hash *= PRIME3;
+				hash ^= hash >> 32;
+				return hash;
+			}
+
+			size_t Bytes(const cv::Mat& image)
+			{
+				return image.total() * image.elemSize();
+			}
+
+			std::string FileName(uint64_t key)
+			{
+				char name[sizeof(FILE_PREFIX) + 16 + sizeof(FILE_SUFFIX)];
+				std::snprintf(name, sizeof(name), "%s%016llx%s", FILE_PREFIX, static_cast<unsigned long long>(key), FILE_SUFFIX);
+				return name;
+			}
+
+			/// <summary>
+			/// Key of cache file name, false for other files
+			/// </summary>
+			bool ParseFileName(const std::string& name, uint64_t& key)
+			{
+				const size_t prefix = sizeof(FILE_PREFIX) - 1, suffix = sizeof(FILE_SUFFIX) - 1;
+				if(name.size() != prefix + 16 + suffix ||
+				   name.compare(0, prefix, FILE_PREFIX) != 0 ||
+				   name.compare(prefix + 16, suffix, FILE_SUFFIX) != 0)
+				{
+					return false;
+				}
+
+				std::string digits = name.substr(prefix, 16);
+				char* last = nullptr;
+				key = std::strtoull(digits.c_str(), &last, 16);
+				return last == digits.c_str() + digits.size();
+			}
+
+			std::string Join(const std::string& directory, const std::string& name)
+			{
+				if(directory.empty()) return name;
+				char last = directory.back();
+				return last == '/' || last == '\\' ? directory + name : directory + "/" + name;
+			}
+
+			struct FileEntry
+			{
+				uint64_t key;
+				size_t bytes;
+				long long time;
+			};
+
+			/// <summary>
+			/// Cache files in the directory, with their size and last
+			/// modification time
+			/// </summary>
+			std::vector<FileEntry> ListFiles(const std::string& directory)
+			{
+				std::vector<FileEntry> files;
+				auto add = [&](const std::string& name, size_t size, long long time) {
+					FileEntry entry;
+					if(ParseFileName(name, entry.key))
+					{
+						entry.bytes = size;
+						entry.time = time;
+						files.push_back(entry);
+					}
+				};
+
+#ifdef _WIN32
+				WIN32_FIND_DATAA data;
+				HANDLE find = FindFirstFileA(Join(directory, "*").c_str(), &data);
+				if(find == INVALID_HANDLE_VALUE) return files;
+				do
+				{
+					if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+					size_t size = (static_cast<size_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+					long long time = (static_cast<long long>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+					add(data.cFileName, size, time);
+				} while(FindNextFileA(find, &data));
+				FindClose(find);
+#else
+				DIR* dir = opendir(directory.c_str());
+				if(!dir) return files;
+				while(dirent* item = readdir(dir))
+				{
+					struct stat info;
+					if(stat(Join(directory, item->d_name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+					{
+						add(item->d_name, static_cast<size_t>(info.st_size), static_cast<long long>(info.st_mtime));
+					}
+				}
+				closedir(dir);
+#endif
+				return files;
+			}
+
+			/// <summary>
+			/// LRU list (most recent at front) with index by key
+			/// </summary>
+			template<typename Value>
+			class LruTier
+			{
+			public:
+				struct Entry
+				{
+					uint64_t key;
+					Value value;
+					size_t bytes;
+				};
+
+				size_t capacity = 0;
+				size_t bytes = 0;
+
+				/// <summary>
+				/// Entry moved to front, null if missing
+				/// </summary>
+				Entry* Touch(uint64_t key)
+				{
+					auto found = index.find(key);
+					if(found == index.end()) return nullptr;
+					entries.splice(entries.begin(), entries, found->second);
+					return &*found->second;
+				}
+
+				void Insert(uint64_t key, const Value& value, size_t size)
+				{
+					Erase(key);
+					entries.push_front(Entry{ key, value, size });
+					index[key] = entries.begin();
+					bytes += size;
+				}
+
+				void Erase(uint64_t key)
+				{
+					auto found = index.find(key);
+					if(found == index.end()) return;
+					bytes -= found->second->bytes;
+					entries.erase(found->second);
+					index.erase(found);
+				}
+
+				/// <summary>
+				/// Removes least recently used entries until under capacity
+				/// (0 = unlimited when unlimited is set, everything otherwise)
+				/// </summary>
+				std::vector<Entry> Evict(bool unlimited)
+				{
+					std::vector<Entry> evicted;
+					while(!entries.empty() && bytes > capacity && !(unlimited && capacity == 0))
+					{
+						evicted.push_back(entries.back());
+						bytes -= entries.back().bytes;
+						index.erase(entries.back().key);
+						entries.pop_back();
+					}
+					return evicted;
+				}
+
+				std::vector<Entry> Clear()
+				{
+					std::vector<Entry> all(entries.begin(), entries.end());
+					entries.clear();
+					index.clear();
+					bytes = 0;
+					return all;
+				}
+
+				int Count() const { return static_cast<int>(entries.size()); }
+
+			private:
+				std::list<Entry> entries;
+				std::unordered_map<uint64_t, typename std::list<Entry>::iterator> index;
+			};
+
+			struct State
+			{
+				std::mutex mutex;
+				CacheOptions options;
+				LruTier<cv::Mat> memory;
+				// Value is unused, files are named by key
+				LruTier<bool> disk;
+				CacheStatistics statistics;
+			};
+
+			State& GetState()
+			{
+				static State state;
+				return state;
+			}
+
+			void RemoveFiles(const std::string& directory, const std::vector<LruTier<bool>::Entry>& files)
+			{
+				for(const auto& file : files)
+				{
+					std::remove(Join(directory, FileName(file.key)).c_str());
+				}
+			}
+
+			/// <summary>
+			/// Inserts into memory tier, lock must be held
+			/// </summary>
+			void InsertMemory(State& state, uint64_t key, const cv::Mat& image)
+			{
+				const size_t bytes = Bytes(image);
+				if(bytes > state.memory.capacity) return;
+				state.memory.Insert(key, image, bytes);
+				state.statistics.evictions += static_cast<long long>(state.memory.Evict(false).size());
+			}
+
+			/// <summary>
+			/// Writes the file under temporary name first, so that readers
+			/// never see partially written one
+			/// </summary>
+			bool WriteFile(const std::string& path, const cv::Mat& image)
+			{
+				const std::string temporary = path + ".tmp";
+				if(!io::Write(temporary, image, io::Format::Npy))
+				{
+					std::remove(temporary.c_str());
+					return false;
+				}
+				if(std::rename(temporary.c_str(), path.c_str()) != 0)
+				{
+					// Windows does not replace existing files
+					std::remove(path.c_str());
+					if(std::rename(temporary.c_str(), path.c_str()) != 0)
+					{
+						std::remove(temporary.c_str());
+						return false;
+					}
+				}
+				return true;
+			}
+
+			bool Storable(const cv::Mat& image)
+			{
+				switch(image.type())
+				{
+				case CV_32FC1:
+				case CV_64FC1:
+				case CV_8UC1:
+				case CV_MAKETYPE(CV_8S, 1):
+				case CV_16UC1:
+				case CV_16SC1:
+				case CV_32SC1:
+					return image.dims == 2;
+				default:
+					return false;
+				}
+			}
+		}
+
+		uint64_t Hash(const cv::Mat & image, uint64_t seed)
+		{
+			PU_PROFILE_SCOPE("CacheHash");
+
+			const int64_t header[] = { image.dims, image.rows, image.cols, image.type() };
+			uint64_t hash = HashBytes(header, sizeof(header), seed);
+			if(image.empty()) return hash;
+
+			assert(image.dims == 2 && "[Hash] Only 2D images are supported");
+
+			const size_t row_bytes = image.cols * image.elemSize();
+			std::vector<uint64_t> rows(image.rows);
+			parallel::ForRows(cv::Range(0, image.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					rows[row] = HashBytes(image.ptr(row), row_bytes, row);
+				}
+			});
+
+			PU_PROFILE_COUNT("CacheHash", PixelsProcessed, static_cast<long long>(image.total()));
+
+			return HashBytes(rows.data(), rows.size() * sizeof(uint64_t), hash);
+		}
+
+		Key::Key(const std::string & stage)
+			: value(HashBytes(stage.data(), stage.size(), KEY_VERSION))
+		{
+		}
+
+		Key & Key::Add(const cv::Mat & image)
+		{
+			value = Hash(image, value);
+			return *this;
+		}
+
+		Key & Key::Add(int value)
+		{
+			return Add(static_cast<long long>(value));
+		}
+
+		Key & Key::Add(long long value)
+		{
+			this->value = HashBytes(&value, sizeof(value), this->value);
+			return *this;
+		}
+
+		Key & Key::Add(double value)
+		{
+			this->value = HashBytes(&value, sizeof(value), this->value);
+			return *this;
+		}
+
+		Key & Key::Add(cv::Size size)
+		{
+			return Add(size.width).Add(size.height);
+		}
+
+		Key & Key::Add(const cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			if(!bitflags || ignore_flag == Bitflag::NoFlag)
+			{
+				return Add(0);
+			}
+
+			cv::Mat ignored;
+			cv::bitwise_and(*bitflags, cv::Scalar(ignore_flag), ignored);
+			return Add(static_cast<int>(ignore_flag)).Add(ignored);
+		}
+
+		void Configure(const CacheOptions & options)
+		{
+			std::vector<FileEntry> files;
+			if(!options.directory.empty())
+			{
+				files = ListFiles(options.directory);
+				std::sort(files.begin(), files.end(), [](const FileEntry& a, const FileEntry& b) { return a.time < b.time; });
+			}
+
+			State& state = GetState();
+			std::vector<LruTier<bool>::Entry> evicted;
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if(options.directory != state.options.directory)
+				{
+					state.disk.Clear();
+					// Oldest first, so the newest end up in front
+					for(const FileEntry& file : files)
+					{
+						state.disk.Insert(file.key, true, file.bytes);
+					}
+				}
+
+				state.options = options;
+				state.memory.capacity = options.memory_capacity;
+				state.disk.capacity = options.disk_capacity;
+
+				state.statistics.evictions += static_cast<long long>(state.memory.Evict(false).size());
+				evicted = state.disk.Evict(true);
+				state.statistics.evictions += static_cast<long long>(evicted.size());
+			}
+
+			RemoveFiles(options.directory, evicted);
+		}
+
+		CacheOptions Options()
+		{
+			std::lock_guard<std::mutex> lock(GetState().mutex);
+			return GetState().options;
+		}
+
+		bool Enabled()
+		{
+			std::lock_guard<std::mutex> lock(GetState().mutex);
+			const CacheOptions& options = GetState().options;
+			return options.memory_capacity > 0 || !options.directory.empty();
+		}
+
+		void Clear(bool disk)
+		{
+			State& state = GetState();
+			std::vector<LruTier<bool>::Entry> files;
+			std::string directory;
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				state.memory.Clear();
+				if(disk)
+				{
+					files = state.disk.Clear();
+					directory = state.options.directory;
+				}
+				state.statistics = CacheStatistics();
+			}
+
+			RemoveFiles(directory, files);
+		}
+
+		CacheStatistics Statistics()
+		{
+			State& state = GetState();
+			std::lock_guard<std::mutex> lock(state.mutex);
+			CacheStatistics statistics = state.statistics;
+			statistics.memory_bytes = state.memory.bytes;
+			statistics.memory_entries = state.memory.Count();
+			statistics.disk_bytes = state.disk.bytes;
+			statistics.disk_entries = state.disk.Count();
+			return statistics;
+		}
+
+		bool Lookup(const Key & key, cv::Mat & result)
+		{
+			PU_PROFILE_SCOPE("CacheLookup");
+
+			State& state = GetState();
+			std::string path;
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if(auto entry = state.memory.Touch(key.Value()))
+				{
+					state.statistics.memory_hits++;
+					// Cached images are never modified, so the shared header
+					// stays valid even if the entry is evicted meanwhile
+					result = entry->value;
+				}
+				else if(state.disk.Touch(key.Value()))
+				{
+					path = Join(state.options.directory, FileName(key.Value()));
+				}
+				else
+				{
+					state.statistics.misses++;
+					return false;
+				}
+			}
+
+			if(path.empty())
+			{
+				result = result.clone();
+				return true;
+			}
+
+			// Copied out of the mapping, so that the file can be evicted
+			cv::Mat loaded;
+			{
+				io::MappedImage mapped = io::MapNpy(path);
+				if(!mapped.empty()) loaded = mapped.mat.clone();
+			}
+
+			std::lock_guard<std::mutex> lock(state.mutex);
+			if(loaded.empty())
+			{
+				// Removed or damaged behind our back
+				state.disk.Erase(key.Value());
+				state.statistics.misses++;
+				return false;
+			}
+
+			state.statistics.disk_hits++;
+			InsertMemory(state, key.Value(), loaded);
+			result = loaded.clone();
+			return true;
+		}
+
+		void Store(const Key & key, const cv::Mat & result)
+		{
+			PU_PROFILE_SCOPE("CacheStore");
+
+			State& state = GetState();
+			const size_t bytes = Bytes(result);
+			cv::Mat copy = result.clone();
+
+			std::string directory;
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				InsertMemory(state, key.Value(), copy);
+
+				const CacheOptions& options = state.options;
+				if(!options.directory.empty() && Storable(copy) && !state.disk.Touch(key.Value()) &&
+				   (options.disk_capacity == 0 || bytes <= options.disk_capacity))
+				{
+					directory = options.directory;
+				}
+			}
+
+			const std::string path = Join(directory, FileName(key.Value()));
+			if(directory.empty() || !WriteFile(path, copy))
+			{
+				return;
+			}
+
+			size_t file_bytes;
+			{
+				io::MappedFile file;
+				file_bytes = file.Open(path) ? file.Size() : bytes;
+			}
+
+			std::vector<LruTier<bool>::Entry> evicted;
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				// Directory changed while writing, the file belongs to the old one
+				if(state.options.directory != directory) return;
+				state.disk.Insert(key.Value(), true, file_bytes);
+				evicted = state.disk.Evict(true);
+				state.statistics.evictions += static_cast<long long>(evicted.size());
+			}
+
+			RemoveFiles(directory, evicted);
+		}
+
+		cv::Mat Cached(const Key & key, const std::function<cv::Mat()>& compute)
+		{
+			if(!Enabled())
+			{
+				return compute();
+			}
+
+			cv::Mat result;
+			if(Lookup(key, result))
+			{
+				return result;
+			}
+
+			result = compute();
+			Store(key, result);
+			return result;
+		}
+
+		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, int k, int levels)
+		{
+			return MeanPhaseFilter(wrapped, cv::Size(k, k), levels);
+		}
+
+		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, cv::Size window, int levels)
+		{
+			if(!Enabled()) return filters::MeanPhaseFilter(wrapped, window, levels);
+
+			Key key{ "MeanPhaseFilter" };
+			key.Add(wrapped).Add(window).Add(levels);
+			return Cached(key, [&] { return filters::MeanPhaseFilter(wrapped, window, levels); });
+		}
+
+		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, int k, int levels)
+		{
+			return MedianPhaseFilter(wrapped, cv::Size(k, k), levels);
+		}
+
+		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, cv::Size window, int levels)
+		{
+			if(!Enabled()) return filters::MedianPhaseFilter(wrapped, window, levels);
+
+			Key key{ "MedianPhaseFilter" };
+			key.Add(wrapped).Add(window).Add(levels);
+			return Cached(key, [&] { return filters::MedianPhaseFilter(wrapped, window, levels); });
+		}
+
+		cv::Mat PDV(const cv::Mat & wrapped_phase, int k, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			return PDV(wrapped_phase, cv::Size(k, k), bitflags, ignore_flag);
+		}
+
+		cv::Mat PDV(const cv::Mat & wrapped_phase, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			if(!Enabled()) return quality_maps::PDV(wrapped_phase, window, bitflags, ignore_flag);
+
+			Key key{ "PDV" };
+			key.Add(wrapped_phase).Add(window).Add(bitflags, ignore_flag);
+			return Cached(key, [&] { return quality_maps::PDV(wrapped_phase, window, bitflags, ignore_flag); });
+		}
+
+		cv::Mat MaxAbsGrad(const cv::Mat & wrapped_phase, int k, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			return MaxAbsGrad(wrapped_phase, cv::Size(k, k), bitflags, ignore_flag);
+		}
+
+		cv::Mat MaxAbsGrad(const cv::Mat & wrapped_phase, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			if(!Enabled()) return quality_maps::MaxAbsGrad(wrapped_phase, window, bitflags, ignore_flag);
+
+			Key key{ "MaxAbsGrad" };
+			key.Add(wrapped_phase).Add(window).Add(bitflags, ignore_flag);
+			return Cached(key, [&] { return quality_maps::MaxAbsGrad(wrapped_phase, window, bitflags, ignore_flag); });
+		}
+
+		cv::Mat Residues(const cv::Mat & wrapped)
+		{
+			if(!Enabled()) return masks::Residues(wrapped);
+
+			Key key{ "Residues" };
+			key.Add(wrapped);
+			return Cached(key, [&] { return masks::Residues(wrapped); });
+		}
+
+		cv::Mat QualityGuided(const cv::Mat & wrapped, const cv::Mat & quality, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			if(!Enabled()) return unwrappers::QualityGuided(wrapped, quality, bitflags, ignore_flag);
+
+			Key key{ "QualityGuided" };
+			key.Add(wrapped).Add(quality).Add(bitflags, ignore_flag);
+			return Cached(key, [&] { return unwrappers::QualityGuided(wrapped, quality, bitflags, ignore_flag); });
+		}
+	}
+}
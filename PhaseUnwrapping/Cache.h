@@ -0,0 +1,202 @@
+#pragma once
+#include "Bitflags.h"
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace pu
+{
+	/// <summary>
+	/// Optional cache of expensive intermediates (filtered phase, quality
+	/// maps, residues, unwrapped phase), so that reprocessing the same frames
+	/// with the same settings skips the stages whose inputs did not change.
+	/// Entries are keyed by the stage name, a hash of its input images and
+	/// its parameters. Two tiers, both with LRU eviction and a size cap: in
+	/// memory, and optionally a directory of .npy files which survives the
+	/// process. Disabled (everything is computed) until Configure enables a
+	/// tier. Thread safe; concurrent misses of the same key compute it each.
+	/// </summary>
+	namespace cache
+	{
+		/// <summary>
+		/// Hashes image contents together with its size and type (XXH64,
+		/// not cryptographic). Rows are hashed in parallel, padding of non
+		/// continuous images is skipped, so a ROI view hashes the same as its
+		/// copy.
+		/// </summary>
+		/// <param name="image">
+		/// Image of any type, may be empty.
+		/// </param>
+		/// <param name="seed">
+		/// [default = 0] Seed, e.g. hash of preceding key parts.
+		/// </param>
+		uint64_t Hash(const cv::Mat& image, uint64_t seed = 0);
+
+		/// <summary>
+		/// Cache key of a stage result: stage name, input images and
+		/// parameters, combined in the order of Add calls.
+		/// </summary>
+		class Key
+		{
+		public:
+			/// <summary>
+			/// Key of a stage, name must differ from other stages (and change
+			/// when stage results change, old entries on disk are reused
+			/// otherwise).
+			/// </summary>
+			explicit Key(const std::string& stage);
+
+			Key& Add(const cv::Mat& image);
+			Key& Add(int value);
+			Key& Add(long long value);
+			Key& Add(double value);
+			Key& Add(cv::Size size);
+
+			/// <summary>
+			/// Adds bitflags as seen by a stage ignoring given flags: only
+			/// the ignored bits are hashed, so flags the stage does not read
+			/// (e.g. residues marked later) do not change the key.
+			/// </summary>
+			Key& Add(const cv::Mat* bitflags, Bitflag ignore_flag);
+
+			uint64_t Value() const { return value; }
+
+		private:
+			uint64_t value;
+		};
+
+		struct CacheOptions
+		{
+			/// <summary>
+			/// Capacity of in memory tier in bytes of pixel data, 0 disables it
+			/// </summary>
+			size_t memory_capacity = 0;
+
+			/// <summary>
+			/// Existing directory of on disk tier (files pu_KEY.npy), empty
+			/// disables it. Files found there are reused, least recently
+			/// modified are evicted first.
+			/// </summary>
+			std::string directory;
+
+			/// <summary>
+			/// Capacity of on disk tier in bytes of files, 0 = unlimited
+			/// </summary>
+			size_t disk_capacity = 0;
+		};
+
+		struct CacheStatistics
+		{
+			long long memory_hits = 0;
+			long long disk_hits = 0;
+			long long misses = 0;
+			long long evictions = 0;
+			size_t memory_bytes = 0;
+			size_t disk_bytes = 0;
+			int memory_entries = 0;
+			int disk_entries = 0;
+		};
+
+		/// <summary>
+		/// Sets capacities and directory, entries over the new capacities are
+		/// evicted. Entries of previous directory are forgotten (not deleted).
+		/// </summary>
+		void Configure(const CacheOptions& options);
+
+		CacheOptions Options();
+
+		/// <summary>
+		/// Whether any tier is enabled
+		/// </summary>
+		bool Enabled();
+
+		/// <summary>
+		/// Drops all in memory entries, and deletes files of on disk tier if
+		/// disk is true. Resets statistics.
+		/// </summary>
+		void Clear(bool disk = false);
+
+		CacheStatistics Statistics();
+
+		/// <summary>
+		/// Looks the key up in memory, then on disk (disk hits are promoted to
+		/// memory).
+		/// </summary>
+		/// <param name="key">
+		/// Key of the result.
+		/// </param>
+		/// <param name="result">
+		/// Copy of the cached result (caller may modify it), on hit.
+		/// </param>
+		/// <returns>
+		/// True on hit.
+		/// </returns>
+		bool Lookup(const Key& key, cv::Mat& result);
+
+		/// <summary>
+		/// Stores copy of the result in enabled tiers. Results larger than a
+		/// tier capacity are not stored in it, types not supported by .npy
+		/// files (see io::Write) are kept in memory only.
+		/// </summary>
+		void Store(const Key& key, const cv::Mat& result);
+
+		/// <summary>
+		/// Cached result, computed and stored on miss, computed directly if
+		/// the cache is disabled.
+		/// </summary>
+		cv::Mat Cached(const Key& key, const std::function<cv::Mat()>& compute);
+
+		/// <summary>
+		/// Cached filters::MeanPhaseFilter
+		/// </summary>
+		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, int k, int levels = 0);
+
+		/// <summary>
+		/// Cached filters::MeanPhaseFilter over rectangular window
+		/// </summary>
+		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, cv::Size window, int levels = 0);
+
+		/// <summary>
+		/// Cached filters::MedianPhaseFilter
+		/// </summary>
+		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, int k, int levels = 0);
+
+		/// <summary>
+		/// Cached filters::MedianPhaseFilter over rectangular window
+		/// </summary>
+		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, cv::Size window, int levels = 0);
+
+		/// <summary>
+		/// Cached quality_maps::PDV
+		/// </summary>
+		cv::Mat PDV(const cv::Mat& wrapped_phase, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Cached quality_maps::PDV over rectangular window
+		/// </summary>
+		cv::Mat PDV(const cv::Mat& wrapped_phase, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Cached quality_maps::MaxAbsGrad
+		/// </summary>
+		cv::Mat MaxAbsGrad(const cv::Mat& wrapped_phase, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Cached quality_maps::MaxAbsGrad over rectangular window
+		/// </summary>
+		cv::Mat MaxAbsGrad(const cv::Mat& wrapped_phase, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Cached masks::Residues
+		/// </summary>
+		cv::Mat Residues(const cv::Mat& wrapped);
+
+		/// <summary>
+		/// Cached unwrappers::QualityGuided
+		/// </summary>
+		cv::Mat QualityGuided(const cv::Mat& wrapped, const cv::Mat& quality, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+	}
+}
@@ -0,0 +1,93 @@
+#include "Dataset.h"
+#include "Masks.h"
+#include "Profiling.h"
+#include "Wrappers.h"
+
+#include <algorithm>
+
+namespace pu
+{
+	namespace
+	{
+		const char* Extension(io::Format format)
+		{
+			switch(format)
+			{
+			case io::Format::Npy: return ".npy";
+			case io::Format::Tiff: return ".tif";
+			default: return ".raw";
+			}
+		}
+
+		/// <summary>
+		/// Copies first rows of band into rows [first, first + rows) of output
+		/// </summary>
+		void CopyRows(const cv::Mat& band, const io::MappedImage& output, int first, int rows)
+		{
+			cv::Mat dst = output.mat.rowRange(first, first + rows);
+			band.rowRange(0, rows).copyTo(dst);
+		}
+	}
+
+	DatasetFiles GetDatasetFiles(const std::string & prefix, io::Format format)
+	{
+		std::string extension = Extension(format);
+
+		DatasetFiles files;
+		files.truth = prefix + "_truth" + extension;
+		files.wrapped = prefix + "_wrapped" + extension;
+		files.noisy = prefix + "_noisy" + extension;
+		files.residues = prefix + "_residues" + extension;
+		return files;
+	}
+
+	bool GenerateDataset(const std::string & prefix, const DatasetOptions & options)
+	{
+		assert(options.rows > 0 && options.cols > 0 && "[GenerateDataset] Invalid dimensions");
+		assert(options.band_rows > 0 && "[GenerateDataset] Invalid band size");
+
+		PU_PROFILE_SCOPE("GenerateDataset");
+
+		const int rows = options.rows, cols = options.cols;
+		DatasetFiles files = GetDatasetFiles(prefix, options.format);
+
+		io::MappedImage truth = io::Create(files.truth, options.format, rows, cols, CV_32FC1);
+		io::MappedImage wrapped = io::Create(files.wrapped, options.format, rows, cols, CV_32FC1);
+		io::MappedImage noisy = io::Create(files.noisy, options.format, rows, cols, CV_32FC1);
+		io::MappedImage residues = io::Create(files.residues, options.format, rows, cols, CV_8SC1);
+
+		if(truth.empty() || wrapped.empty() || noisy.empty() || residues.empty())
+		{
+			return false;
+		}
+
+		for(int first = 0; first < rows; first += options.band_rows)
+		{
+			int band = std::min(options.band_rows, rows - first);
+
+			// Residues of the last band row need the next row (halo)
+			int halo = first + band < rows ? 1 : 0;
+			cv::Rect region{ 0, first, cols, band + halo };
+
+			cv::Mat truth_band = GenerateSurface(options.surface, region, rows, cols, options.minVal, options.maxVal);
+
+			// Noise is keyed by global pixel index so bands join seamlessly
+			cv::Mat noisy_band = truth_band.clone();
+			AddNoise(noisy_band, options.noise, options.sigma, options.seed, region.tl(), cols);
+			noisy_band = WrapNormalized(noisy_band);
+
+			CopyRows(truth_band, truth, first, band);
+			CopyRows(WrapNormalized(truth_band), wrapped, first, band);
+			CopyRows(noisy_band, noisy, first, band);
+			CopyRows(masks::Residues(noisy_band), residues, first, band);
+
+			// Start write back so dirty pages do not pile up
+			truth.Flush();
+			wrapped.Flush();
+			noisy.Flush();
+			residues.Flush();
+		}
+
+		return truth.Flush(false) && wrapped.Flush(false) && noisy.Flush(false) && residues.Flush(false);
+	}
+}
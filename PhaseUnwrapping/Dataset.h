@@ -0,0 +1,87 @@
+#pragma once
+#include "IO.h"
+#include "TestData.h"
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+namespace pu
+{
+	/// <summary>
+	/// Parameters of generated dataset
+	/// </summary>
+	struct DatasetOptions
+	{
+		Surface surface = Surface::Peaks;
+		int rows = 4096;
+		int cols = 4096;
+
+		/// <summary>
+		/// Range of the ground truth (unwrapped) phase, in radians
+		/// </summary>
+		float minVal = DEFAULT_TEST_MIN;
+		float maxVal = DEFAULT_TEST_MAX;
+
+		/// <summary>
+		/// Noise added to the ground truth before wrapping into noisy image
+		/// </summary>
+		NoiseType noise = NoiseType::Phase;
+		float sigma = 0.3f;
+		uint64_t seed = DEFAULT_NOISE_SEED;
+
+		/// <summary>
+		/// Number of rows generated at once, bounds memory use
+		/// </summary>
+		int band_rows = 256;
+
+		io::Format format = io::Format::Npy;
+	};
+
+	/// <summary>
+	/// Paths of files making up dataset
+	/// </summary>
+	struct DatasetFiles
+	{
+		/// <summary>
+		/// Ground truth, unwrapped phase in radians, CV_32FC1
+		/// </summary>
+		std::string truth;
+
+		/// <summary>
+		/// Wrapped ground truth, normalized to [0, 1) (see WrapNormalized), CV_32FC1
+		/// </summary>
+		std::string wrapped;
+
+		/// <summary>
+		/// Wrapped noisy phase, normalized to [0, 1), CV_32FC1
+		/// </summary>
+		std::string noisy;
+
+		/// <summary>
+		/// Residues of noisy phase (see masks::Residues), CV_8SC1
+		/// </summary>
+		std::string residues;
+	};
+
+	/// <summary>
+	/// File names of dataset with given prefix: prefix_truth.npy etc.
+	/// </summary>
+	DatasetFiles GetDatasetFiles(const std::string& prefix, io::Format format = io::Format::Npy);
+
+	/// <summary>
+	/// Generates dataset and streams it to disk. Images are computed in bands
+	/// of rows (all of them in parallel) straight into memory mapped output
+	/// files, so image size is limited by disk space only. Result does not
+	/// depend on band size.
+	/// </summary>
+	/// <param name="prefix">
+	/// Prefix of output files, see GetDatasetFiles.
+	/// </param>
+	/// <param name="options">
+	/// Dataset parameters.
+	/// </param>
+	/// <returns>
+	/// True on success, false if any of the files could not be created.
+	/// </returns>
+	bool GenerateDataset(const std::string& prefix, const DatasetOptions& options);
+}
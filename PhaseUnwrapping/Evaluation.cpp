@@ -0,0 +1,371 @@
+#include "Evaluation.h"
+#include "Profiling.h"
+#include "QualityMaps.h"
+#include "Unwrappers.h"
+#include "Wrappers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace pu
+{
+	namespace evaluation
+	{
+		namespace
+		{
+#if defined(__linux__)
+			/// <summary>
+			/// Value of /proc/self/status field (VmRSS, VmHWM) in bytes, 0 if
+			/// it cannot be read
+			/// </summary>
+			size_t StatusBytes(const char* field)
+			{
+				FILE* file = std::fopen("/proc/self/status", "r");
+				if(!file) return 0;
+
+				const size_t length = std::strlen(field);
+				char line[256];
+				unsigned long long kb = 0;
+				while(std::fgets(line, sizeof(line), file))
+				{
+					if(std::strncmp(line, field, length) == 0 && line[length] == ':')
+					{
+						std::sscanf(line + length + 1, "%llu", &kb);
+						break;
+					}
+				}
+				std::fclose(file);
+				return static_cast<size_t>(kb) * 1024;
+			}
+#endif
+
+			/// <summary>
+			/// Resident size of the process in bytes, 0 if unknown
+			/// </summary>
+			size_t ResidentBytes()
+			{
+#ifdef _WIN32
+				PROCESS_MEMORY_COUNTERS counters;
+				return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#elif defined(__linux__)
+				return StatusBytes("VmRSS");
+#else
+				return 0;
+#endif
+			}
+
+			/// <summary>
+			/// Resets kernel peak of resident size to the current size, false
+			/// if the platform (or its configuration) does not allow it
+			/// </summary>
+			bool ResetPeakResident()
+			{
+#if defined(__linux__)
+				// Writing 5 to clear_refs resets VmHWM (Linux 4.0+)
+				FILE* file = std::fopen("/proc/self/clear_refs", "w");
+				if(!file) return false;
+				const bool written = std::fputs("5", file) >= 0;
+				return std::fclose(file) == 0 && written;
+#else
+				return false;
+#endif
+			}
+
+			/// <summary>
+			/// Kernel peak of resident size since ResetPeakResident
+			/// </summary>
+			size_t PeakResident()
+			{
+#if defined(__linux__)
+				return StatusBytes("VmHWM");
+#else
+				return 0;
+#endif
+			}
+
+			double Seconds(int64_t ticks)
+			{
+				return static_cast<double>(ticks) / cv::getTickFrequency();
+			}
+		}
+
+		std::vector<Unwrapper> DefaultUnwrappers()
+		{
+			std::vector<Unwrapper> list;
+
+			Unwrapper itoh;
+			itoh.name = "Itoh";
+			itoh.unwrap = [](const cv::Mat& wrapped, const cv::Mat&) { return unwrappers::Itoh(wrapped); };
+			list.push_back(itoh);
+
+			Unwrapper least_squares;
+			least_squares.name = "LeastSquares";
+			least_squares.unwrap = [](const cv::Mat& wrapped, const cv::Mat&) { return unwrappers::LeastSquares(wrapped); };
+			list.push_back(least_squares);
+
+			Unwrapper quality_guided;
+			quality_guided.name = "QualityGuided";
+			quality_guided.unwrap = [](const cv::Mat& wrapped, const cv::Mat& quality) { return unwrappers::QualityGuided(wrapped, quality); };
+			quality_guided.uses_quality = true;
+			list.push_back(quality_guided);
+
+			Unwrapper multi_seed;
+			multi_seed.name = "MultiSeedQualityGuided";
+			multi_seed.unwrap = [](const cv::Mat& wrapped, const cv::Mat& quality) { return unwrappers::MultiSeedQualityGuided(wrapped, quality); };
+			multi_seed.uses_quality = true;
+			list.push_back(multi_seed);
+
+			Unwrapper branch_cut;
+			branch_cut.name = "BranchCut";
+			branch_cut.unwrap = [](const cv::Mat& wrapped, const cv::Mat&) { return unwrappers::BranchCut(wrapped); };
+			list.push_back(branch_cut);
+
+			Unwrapper pyramid;
+			pyramid.name = "Pyramid";
+			pyramid.unwrap = [](const cv::Mat& wrapped, const cv::Mat&) { return unwrappers::Pyramid(wrapped); };
+			list.push_back(pyramid);
+
+			Unwrapper automatic;
+			automatic.name = "Auto";
+			automatic.unwrap = [](const cv::Mat& wrapped, const cv::Mat&) {
+				unwrappers::AutoOptions options;
+				options.log = false;
+				return unwrappers::Auto(wrapped, nullptr, Bitflag::NoFlag, options);
+			};
+			list.push_back(automatic);
+
+			return list;
+		}
+
+		std::vector<QualityMap> DefaultQualityMaps()
+		{
+			std::vector<QualityMap> maps;
+			for(int k : { 3, 5 })
+			{
+				maps.push_back({ "PDV" + std::to_string(k), [k](const cv::Mat& wrapped) { return quality_maps::PDV(wrapped, k); } });
+				maps.push_back({ "MaxAbsGrad" + std::to_string(k), [k](const cv::Mat& wrapped) { return quality_maps::MaxAbsGrad(wrapped, k); } });
+				maps.push_back({ "PseudoCorrelation" + std::to_string(k), [k](const cv::Mat& wrapped) { return quality_maps::PseudoCorrelation(wrapped, k); } });
+			}
+			maps.push_back({ "SecondDifference", [](const cv::Mat& wrapped) { return quality_maps::SecondDifference(wrapped); } });
+			return maps;
+		}
+
+		Accuracy Compare(const cv::Mat & unwrapped, const cv::Mat & truth)
+		{
+			assert(!unwrapped.empty() &&
+				   unwrapped.type() == CV_32FC1 &&
+				   unwrapped.size() == truth.size() &&
+				   truth.type() == CV_32FC1 &&
+				   "[Compare] Invalid images");
+
+			const int rows = truth.rows, cols = truth.cols;
+			const double two_pi = 2.0 * CV_PI;
+			const double n = static_cast<double>(truth.total());
+
+			// Fractional part of the offset: circular mean of the error
+			double re = 0, im = 0;
+			for(int row = 0; row < rows; row++)
+			{
+				const float* u = unwrapped.ptr<float>(row);
+				const float* t = truth.ptr<float>(row);
+				for(int col = 0; col < cols; col++)
+				{
+					double e = static_cast<double>(u[col]) - t[col];
+					re += std::cos(e);
+					im += std::sin(e);
+				}
+			}
+			double fraction = std::atan2(im, re);
+
+			// Whole cycles of the offset: median, robust to badly unwrapped regions
+			std::vector<int> cycles(truth.total());
+			for(int row = 0; row < rows; row++)
+			{
+				const float* u = unwrapped.ptr<float>(row);
+				const float* t = truth.ptr<float>(row);
+				for(int col = 0; col < cols; col++)
+				{
+					double e = static_cast<double>(u[col]) - t[col] - fraction;
+					cycles[static_cast<size_t>(row) * cols + col] = static_cast<int>(std::floor(e / two_pi + 0.5));
+				}
+			}
+			std::nth_element(cycles.begin(), cycles.begin() + cycles.size() / 2, cycles.end());
+
+			Accuracy accuracy;
+			accuracy.offset = fraction + two_pi * cycles[cycles.size() / 2];
+
+			double sqr = 0;
+			size_t correct = 0;
+			for(int row = 0; row < rows; row++)
+			{
+				const float* u = unwrapped.ptr<float>(row);
+				const float* t = truth.ptr<float>(row);
+				for(int col = 0; col < cols; col++)
+				{
+					double e = static_cast<double>(u[col]) - t[col] - accuracy.offset;
+					sqr += e * e;
+					correct += std::abs(e) < CV_PI;
+				}
+			}
+
+			accuracy.rms = std::sqrt(sqr / n);
+			accuracy.correct = correct / n;
+			return accuracy;
+		}
+
+		MemoryTracker::MemoryTracker()
+		{
+			Reset();
+			if(kernel_peak) return;
+
+			sampler = std::thread([this] {
+				while(!stop)
+				{
+					size_t now = ResidentBytes();
+					size_t seen = sampled.load();
+					while(now > seen && !sampled.compare_exchange_weak(seen, now));
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			});
+		}
+
+		MemoryTracker::~MemoryTracker()
+		{
+			stop = true;
+			if(sampler.joinable())
+			{
+				sampler.join();
+			}
+		}
+
+		size_t MemoryTracker::Peak() const
+		{
+			size_t peak = kernel_peak ? PeakResident() : std::max(sampled.load(), ResidentBytes());
+			return peak > base ? peak - base : 0;
+		}
+
+		void MemoryTracker::Reset()
+		{
+#if defined(__GLIBC__)
+			// Free heap left by earlier runs would otherwise be reused and
+			// hide part of the next peak
+			malloc_trim(0);
+#endif
+			base = ResidentBytes();
+			kernel_peak = ResetPeakResident();
+			sampled = base;
+		}
+
+		std::vector<Result> Evaluate(const Options & options, const std::vector<Unwrapper>& unwrappers, const std::vector<QualityMap>& quality_maps)
+		{
+			assert(options.rows > 0 && options.cols > 0 && options.repeats > 0 && "[Evaluate] Invalid options");
+
+			PU_PROFILE_SCOPE("Evaluate");
+
+			std::vector<Result> results;
+			const cv::Rect whole{ 0, 0, options.cols, options.rows };
+
+			for(Surface surface : options.surfaces)
+			{
+				cv::Mat truth = GenerateSurface(surface, whole, options.rows, options.cols);
+
+				for(float sigma : options.noise_levels)
+				{
+					cv::Mat noisy = truth.clone();
+					AddNoise(noisy, options.noise, sigma, options.seed, cv::Point(0, 0), options.cols);
+					cv::Mat wrapped = WrapNormalized(noisy);
+
+					// Runs unwrapper (with quality map if given) and fills the row
+					auto run = [&](const Unwrapper& unwrapper, const QualityMap* quality_map) {
+						Result result;
+						result.surface = SurfaceName(surface);
+						result.noise = sigma;
+						result.method = unwrapper.name + (quality_map ? "+" + quality_map->name : "");
+
+						cv::Mat unwrapped;
+						for(int repeat = 0; repeat < options.repeats; repeat++)
+						{
+							MemoryTracker tracker;
+							int64_t start = cv::getTickCount();
+
+							cv::Mat quality = quality_map ? quality_map->compute(wrapped) : cv::Mat();
+							unwrapped = unwrapper.unwrap(wrapped, quality);
+
+							double seconds = Seconds(cv::getTickCount() - start);
+							if(repeat == 0 || seconds < result.seconds) result.seconds = seconds;
+							result.peak_bytes = std::max(result.peak_bytes, tracker.Peak());
+						}
+
+						result.accuracy = Compare(unwrapped, truth);
+						results.push_back(result);
+					};
+
+					for(const Unwrapper& unwrapper : unwrappers)
+					{
+						if(!unwrapper.uses_quality)
+						{
+							run(unwrapper, nullptr);
+							continue;
+						}
+
+						for(const QualityMap& quality_map : quality_maps)
+						{
+							run(unwrapper, &quality_map);
+						}
+					}
+				}
+			}
+
+			return results;
+		}
+
+		std::string FormatTable(const std::vector<Result>& results)
+		{
+			std::ostringstream out;
+			char line[256];
+
+			std::snprintf(line, sizeof(line), "%-16s %6s %-28s %10s %9s %10s %10s\n",
+						  "surface", "noise", "method", "rms [rad]", "correct", "time [ms]", "peak [MB]");
+			out << line;
+
+			for(const Result& r : results)
+			{
+				std::snprintf(line, sizeof(line), "%-16s %6.2f %-28s %10.4f %8.2f%% %10.2f %10.2f\n",
+							  r.surface.c_str(), r.noise, r.method.c_str(),
+							  r.accuracy.rms, r.accuracy.correct * 100.0,
+							  r.seconds * 1e3, r.peak_bytes / (1024.0 * 1024.0));
+				out << line;
+			}
+
+			return out.str();
+		}
+
+		std::string SurfaceName(Surface surface)
+		{
+			switch(surface)
+			{
+			case Surface::VerticalPlane: return "VerticalPlane";
+			case Surface::HorizontalPlane: return "HorizontalPlane";
+			case Surface::ShearPlanes: return "ShearPlanes";
+			case Surface::SpiralShear: return "SpiralShear";
+			default: return "Peaks";
+			}
+		}
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+#include "TestData.h"
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pu
+{
+	namespace evaluation
+	{
+		/// <summary>
+		/// Unwrapper under evaluation. Unwrappers which use quality map are
+		/// evaluated with each of the quality maps.
+		/// </summary>
+		struct Unwrapper
+		{
+			std::string name;
+
+			/// <summary>
+			/// unwrap(wrapped, quality) returns unwrapped phase in radians,
+			/// quality is empty for unwrappers which do not use it
+			/// </summary>
+			std::function<cv::Mat(const cv::Mat&, const cv::Mat&)> unwrap;
+
+			bool uses_quality = false;
+		};
+
+		/// <summary>
+		/// Quality map under evaluation
+		/// </summary>
+		struct QualityMap
+		{
+			std::string name;
+			std::function<cv::Mat(const cv::Mat&)> compute;
+		};
+
+		/// <summary>
+		/// All the unwrappers available in the library
+		/// </summary>
+		std::vector<Unwrapper> DefaultUnwrappers();
+
+		/// <summary>
+		/// All the quality maps available in the library
+		/// </summary>
+		std::vector<QualityMap> DefaultQualityMaps();
+
+		/// <summary>
+		/// Accuracy of unwrapped phase
+		/// </summary>
+		struct Accuracy
+		{
+			/// <summary>
+			/// Global offset removed before computing errors, in radians
+			/// </summary>
+			double offset = 0;
+
+			/// <summary>
+			/// RMS error after removing offset, in radians
+			/// </summary>
+			double rms = 0;
+
+			/// <summary>
+			/// Fraction of pixels with error (after removing offset) less than PI
+			/// </summary>
+			double correct = 0;
+		};
+
+		/// <summary>
+		/// Compares unwrapped phase with ground truth. Unwrapped phase may
+		/// differ from truth by constant, which is found as circular mean of
+		/// the error (fractional part) plus median whole number of cycles,
+		/// so a few badly unwrapped regions do not bias it.
+		/// </summary>
+		/// <param name="unwrapped">
+		/// Unwrapped phase in radians, 1 channel, floating point.
+		/// </param>
+		/// <param name="truth">
+		/// Ground truth in radians, same size and type.
+		/// </param>
+		Accuracy Compare(const cv::Mat& unwrapped, const cv::Mat& truth);
+
+		/// <summary>
+		/// Tracks peak resident memory of the process while alive, so every
+		/// allocation counts (cv::Mat, std containers, thread stacks), made by
+		/// any thread. On Linux the kernel peak (VmHWM) is reset for each
+		/// tracker, elsewhere (Windows, or when the reset is not permitted)
+		/// resident size is sampled every millisecond by a helper thread. Only
+		/// one tracker may be alive at once, the peak is process wide.
+		/// </summary>
+		class MemoryTracker
+		{
+		public:
+			MemoryTracker();
+			~MemoryTracker();
+
+			MemoryTracker(const MemoryTracker&) = delete;
+			MemoryTracker& operator=(const MemoryTracker&) = delete;
+
+			/// <summary>
+			/// Peak of resident bytes since construction (or last Reset), not
+			/// counting the ones resident at that time
+			/// </summary>
+			size_t Peak() const;
+
+			/// <summary>
+			/// Restarts peak tracking from bytes currently resident
+			/// </summary>
+			void Reset();
+
+		private:
+			size_t base = 0;
+
+			/// <summary>
+			/// Whether the kernel peak was reset, otherwise it is sampled
+			/// </summary>
+			bool kernel_peak = false;
+
+			std::atomic<size_t> sampled{ 0 };
+			std::atomic<bool> stop{ false };
+			std::thread sampler;
+		};
+
+		/// <summary>
+		/// Evaluation parameters
+		/// </summary>
+		struct Options
+		{
+			int rows = 512;
+			int cols = 512;
+			std::vector<Surface> surfaces = { Surface::VerticalPlane, Surface::ShearPlanes, Surface::SpiralShear, Surface::Peaks };
+
+			/// <summary>
+			/// Sigma of the noise added to the ground truth before wrapping
+			/// </summary>
+			NoiseType noise = NoiseType::Phase;
+			std::vector<float> noise_levels = { 0.0f, 0.3f, 0.6f, 1.0f };
+			uint64_t seed = DEFAULT_NOISE_SEED;
+
+			/// <summary>
+			/// Number of runs of each method, best runtime is reported
+			/// </summary>
+			int repeats = 1;
+		};
+
+		/// <summary>
+		/// Single table row
+		/// </summary>
+		struct Result
+		{
+			std::string surface;
+			float noise = 0;
+			std::string method;
+			Accuracy accuracy;
+			double seconds = 0;
+			size_t peak_bytes = 0;
+		};
+
+		/// <summary>
+		/// Runs every unwrapper (with every quality map if it uses one) over
+		/// every surface at every noise level. Runtime and peak memory include
+		/// computing the quality map.
+		/// </summary>
+		std::vector<Result> Evaluate(const Options& options,
+									 const std::vector<Unwrapper>& unwrappers = DefaultUnwrappers(),
+									 const std::vector<QualityMap>& quality_maps = DefaultQualityMaps());
+
+		/// <summary>
+		/// Formats results as text table.
+		/// </summary>
+		std::string FormatTable(const std::vector<Result>& results);
+
+		/// <summary>
+		/// Name of the surface, as used by command line
+		/// </summary>
+		std::string SurfaceName(Surface surface);
+	}
+}
@@ -1,135 +1,555 @@
 #include "Filters.h"
+#include "Gradients.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "Storage.h"
+#include "Trigonometry.h"
+#include "WindowKernels.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace pu
 {
 	namespace filters
 	{
-		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, int k)
+		namespace
 		{
-			assert(!wrapped.empty() &&
-				   wrapped.type() == CV_32FC1 &&
-				   "[MeanPhaseFilter] Invalid wrapped phase image");
+			/// <summary>
+			/// Mean or median phase filter over valid region, before and with
+			/// normalization of valid pixels to [0, 1]
+			/// </summary>
+			cv::Mat RegionPhaseFilter(const cv::Mat& wrapped, cv::Size window, const masks::ValidRegion& region, int levels, bool median)
+			{
+				const int rows = wrapped.rows, cols = wrapped.cols;
+				const int count = region.Count();
+				const int kx2 = window.width / 2, ky2 = window.height / 2;
+
+				// Packed cos/sin planes, tables as in kernels::CosSin
+				const std::vector<float> phase = region.GatherPhase(wrapped);
+				const PhaseLut* lut = nullptr;
+				if(wrapped.type() == CV_16UC1) lut = &GetPhaseLut(FIXED16_LEVELS);
+				else if(levels > 0) lut = &GetPhaseLut(levels);
+
+				std::vector<float> cos_values(count), sin_values(count);
+				for(int i = 0; i < count; i++)
+				{
+					float angle = phase[i] * static_cast<float>(CV_PI * 2.0);
+					cos_values[i] = lut ? lut->Cos(phase[i]) : std::cos(angle);
+					sin_values[i] = lut ? lut->Sin(phase[i]) : std::sin(angle);
+				}
+
+				// Mean needs only window row sums, from packed prefix sums
+				std::vector<double> cos_sums, sin_sums;
+				if(!median)
+				{
+					cos_sums.assign(count + 1, 0.0);
+					sin_sums.assign(count + 1, 0.0);
+					for(int i = 0; i < count; i++)
+					{
+						cos_sums[i + 1] = cos_sums[i] + cos_values[i];
+						sin_sums[i + 1] = sin_sums[i] + sin_values[i];
+					}
+				}
+
+				std::vector<float> filtered(count);
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					std::vector<float> re, im;
+
+					for(int i = range.start; i < range.end; i++)
+					{
+						const cv::Point p = region.Position(i);
+						const int first_col = std::max(p.x - kx2, 0), end_col = std::min(p.x + kx2, cols - 1) + 1;
+						const int last_row = std::min(p.y + ky2, rows - 1);
+
+						double c = 0, s = 0;
+						re.clear();
+						im.clear();
+						for(int row = std::max(p.y - ky2, 0); row <= last_row; row++)
+						{
+							const int lo = region.Lower(row, first_col), hi = region.Lower(row, end_col);
+							if(median)
+							{
+								re.insert(re.end(), cos_values.begin() + lo, cos_values.begin() + hi);
+								im.insert(im.end(), sin_values.begin() + lo, sin_values.begin() + hi);
+							}
+							else
+							{
+								c += cos_sums[hi] - cos_sums[lo];
+								s += sin_sums[hi] - sin_sums[lo];
+							}
+						}
+
+						if(median)
+						{
+							const int n = static_cast<int>(re.size());
+							filtered[i] = std::atan2(kernels::Median(im.data(), n), kernels::Median(re.data(), n));
+						}
+						else
+						{
+							filtered[i] = static_cast<float>(std::atan2(s, c));
+						}
+					}
 
+					PU_PROFILE_WORK(range.end - range.start);
+				});
+
+				// Scale valid pixels to [0,1] range
+				if(count > 0)
+				{
+					auto bounds = std::minmax_element(filtered.begin(), filtered.end());
+					const float low = *bounds.first, high = *bounds.second;
+					const float scale = high > low ? 1.0f / (high - low) : 0.0f;
+					for(float& value : filtered)
+					{
+						value = (value - low) * scale;
+					}
+				}
+
+				return region.Scatter(filtered, 0.0f);
+			}
+
+			/// <summary>
+			/// Mean phase filter before normalization. Common square windows
+			/// have compile time specialized kernels, any other window uses
+			/// separable box filters.
+			/// </summary>
+			cv::Mat MeanKernel(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window)
+			{
+				switch(window.width == window.height ? window.width : 0)
+				{
+				case 3: return kernels::MeanPhase<3>(cos_plane, sin_plane);
+				case 5: return kernels::MeanPhase<5>(cos_plane, sin_plane);
+				case 7: return kernels::MeanPhase<7>(cos_plane, sin_plane);
+				case 9: return kernels::MeanPhase<9>(cos_plane, sin_plane);
+				default: return kernels::MeanPhase(cos_plane, sin_plane, window);
+				}
+			}
+
+			/// <summary>
+			/// Median phase filter before normalization. Common square windows
+			/// have compile time specialized kernels, any other window uses
+			/// whole window gather (narrow ones) or exact sliding median.
+			/// </summary>
+			cv::Mat MedianKernel(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window)
+			{
+				switch(window.width == window.height ? window.width : 0)
+				{
+				case 3: return kernels::MedianPhase<3>(cos_plane, sin_plane);
+				case 5: return kernels::MedianPhase<5>(cos_plane, sin_plane);
+				case 7: return kernels::MedianPhase<7>(cos_plane, sin_plane);
+				case 9: return kernels::MedianPhase<9>(cos_plane, sin_plane);
+				default: return kernels::MedianPhase(cos_plane, sin_plane, window);
+				}
+			}
+
+			/// <summary>
+			/// Mean or median phase filter inside ROI: planes of the ROI grown
+			/// by half of the window, result cropped to the ROI and phase
+			/// mapped per pixel to [0, 1)
+			/// </summary>
+			cv::Mat RoiPhaseFilter(const cv::Mat& wrapped, cv::Size window, cv::Rect roi, int levels, bool median)
+			{
+				roi &= cv::Rect(0, 0, wrapped.cols, wrapped.rows);
+				assert(roi.area() > 0 && "[PhaseFilter] ROI does not overlap the image");
+
+				const int hx = window.width / 2, hy = window.height / 2;
+				const cv::Rect read = cv::Rect(roi.x - hx, roi.y - hy, roi.width + 2 * hx, roi.height + 2 * hy) &
+					cv::Rect(0, 0, wrapped.cols, wrapped.rows);
+				const cv::Mat phase = wrapped(read);
+
+				if(levels < 0)
+				{
+					levels = DetectPhaseLevels(phase);
+				}
+
+				cv::Mat cos_plane, sin_plane;
+				kernels::CosSin(phase, cos_plane, sin_plane, levels);
+				cv::Mat filtered = median ? MedianKernel(cos_plane, sin_plane, window) : MeanKernel(cos_plane, sin_plane, window);
+
+				cv::Mat result;
+				filtered(roi - read.tl()).convertTo(result, CV_32FC1, 1.0 / (2.0 * CV_PI), 0.5);
+				PU_PROFILE_COUNT("PhaseFilter", PixelsProcessed, read.area());
+				return result;
+			}
+		}
+
+		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, int k, int levels)
+		{
 			assert(k >= 3 &&
 				(k % 2) == 1 &&
 				   "[MeanPhaseFilter] K must be odd, greater equal 3");
 
-			// Dimensions and image rect
-			int rows = wrapped.rows, cols = wrapped.cols;
-			cv::Rect rect{ 0,0,cols, rows };
+			return MeanPhaseFilter(wrapped, cv::Size(k, k), levels);
+		}
 
-			// Half window size rounded down
-			int k2 = k / 2;
+		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, cv::Size window, int levels)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[MeanPhaseFilter] Invalid wrapped phase image");
 
-			// Image for the result
-			cv::Mat filtered{ rows, cols, CV_32FC1, cv::Scalar(0) };
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MeanPhaseFilter] Window sides must be odd, greater equal 1");
 
-			wrapped.forEach<float>([&](const float& px, const int * pos) -> void {
-				int row = pos[0], col = pos[1];
+			PU_PROFILE_SCOPE("MeanPhaseFilter");
 
-				// "Cut out" the region of interest
-				cv::Rect roi = rect & cv::Rect(col - k2, row - k2, k, k);
-				cv::Mat window = wrapped(roi);
+			if(levels < 0)
+			{
+				levels = DetectPhaseLevels(wrapped);
+			}
 
-				// Recompute Re and Im from Phase in the window
-				cv::Mat cplx{ window.rows, window.cols, CV_32FC2, cv::Scalar(0) };
-				window.forEach<float>([&](const float& win_px, const int * win_pos) -> void {
-					int win_row = win_pos[0], win_col = win_pos[1];
-					// Phase is in range [0,1]
-					float phase = win_px * CV_PI * 2.0f;
-					float re = std::cosf(phase);
-					float im = std::sinf(phase);
-					cplx.at<cv::Vec2f>(win_row, win_col) = cv::Vec2f(re, im);
-				});
+			// Kernels work on cos/sin planes computed once for the whole image
+			cv::Mat cos_plane, sin_plane;
+			kernels::CosSin(wrapped, cos_plane, sin_plane, levels);
 
-				// Compute mean 
-				cv::Scalar mean = cv::mean(cplx);
-				float re = mean[0];
-				float im = mean[1];
+			cv::Mat filtered = MeanKernel(cos_plane, sin_plane, window);
+			PU_PROFILE_COUNT("MeanPhaseFilter", Allocations, 3);
+			PU_PROFILE_COUNT("MeanPhaseFilter", PixelsProcessed, wrapped.rows * wrapped.cols);
 
-				filtered.at<float>(row, col) = std::atan2f(im, re);
-			});
-			
 			// Scale result to [0,1] range
 			cv::normalize(filtered, filtered, 0, 1, cv::NORM_MINMAX);
 
 			return filtered;
 		}
 
-		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, int k)
+		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, cv::Size window, cv::Rect roi, int levels)
 		{
 			assert(!wrapped.empty() &&
-				   wrapped.type() == CV_32FC1 &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
 				   "[MeanPhaseFilter] Invalid wrapped phase image");
 
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MeanPhaseFilter] Window sides must be odd, greater equal 1");
+
+			PU_PROFILE_SCOPE("MeanPhaseFilter");
+
+			return RoiPhaseFilter(wrapped, window, roi, levels, false);
+		}
+
+		cv::Mat MeanPhaseFilter(const cv::Mat & wrapped, cv::Size window, const masks::ValidRegion & region, int levels)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[MeanPhaseFilter] Invalid wrapped phase image");
+
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MeanPhaseFilter] Window sides must be odd, greater equal 1");
+
+			assert(region.Size() == wrapped.size() &&
+				   "[MeanPhaseFilter] Invalid valid region");
+
+			PU_PROFILE_SCOPE("MeanPhaseFilter");
+
+			if(levels < 0)
+			{
+				levels = DetectPhaseLevels(wrapped);
+			}
+
+			PU_PROFILE_COUNT("MeanPhaseFilter", Allocations, 3);
+			PU_PROFILE_COUNT("MeanPhaseFilter", PixelsProcessed, region.Count());
+			PU_PROFILE_COUNT("MeanPhaseFilter", MaskedPixelsSkipped, static_cast<long long>(wrapped.rows) * wrapped.cols - region.Count());
+
+			return RegionPhaseFilter(wrapped, window, region, levels, false);
+		}
+
+		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, int k, int levels)
+		{
 			assert(k >= 3 &&
 				(k % 2) == 1 &&
-				   "[MeanPhaseFilter] K must be odd, greater equal 3");
+				   "[MedianPhaseFilter] K must be odd, greater equal 3");
 
-			// Dimensions and image rect
-			int rows = wrapped.rows, cols = wrapped.cols;
-			cv::Rect rect{ 0,0,cols, rows };
-
-			// Half window size rounded down
-			int k2 = k / 2;
-
-			// Image for the result
-			cv::Mat filtered{ rows, cols, CV_32FC1, cv::Scalar(0) };
-
-			wrapped.forEach<float>([&](const float& px, const int * pos) -> void {
-				int row = pos[0], col = pos[1];
-
-				// "Cut out" the region of interest
-				cv::Rect roi = rect & cv::Rect(col - k2, row - k2, k, k);
-				cv::Mat window = wrapped(roi);
-
-				// Recompute Re and Im from Phase in the window
-				cv::Mat re_part{ window.rows, window.cols, CV_32FC1, cv::Scalar(0) };
-				cv::Mat im_part{ window.rows, window.cols, CV_32FC1, cv::Scalar(0) };
-				window.forEach<float>([&](const float& win_px, const int * win_pos) -> void {
-					int win_row = win_pos[0], win_col = win_pos[1];
-					// Phase is in range [0,1]
-					float phase = win_px * CV_PI * 2.0f;
-					float re = std::cosf(phase);
-					float im = std::sinf(phase);
-					re_part.at<float>(win_row, win_col) = re;
-					im_part.at<float>(win_row, win_col) = im;
-				});
+			return MedianPhaseFilter(wrapped, cv::Size(k, k), levels);
+		}
 
-				int n2 = window.total() / 2;
-				
-				// Partialy sort Re and Im so that middle element(s) (needed for median) are on their place
-				auto re_begin = re_part.begin<float>();
-				auto re_mid = re_part.begin<float>() + n2 + 1;
-				auto re_end = re_part.end<float>();
-				std::nth_element(re_begin, re_mid, re_end);
-
-				auto im_begin = im_part.begin<float>();
-				auto im_mid = im_part.begin<float>() + n2 + 1;
-				auto im_end = im_part.end<float>();
-				std::nth_element(im_begin, im_mid, im_end);
-
-				// Compute Re and Im median
-				// Odd number of pixels - take only middle element 
-				float re, im;
-				if(window.total() % 2)
+		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, cv::Size window, int levels)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[MedianPhaseFilter] Invalid wrapped phase image");
+
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MedianPhaseFilter] Window sides must be odd, greater equal 1");
+
+			PU_PROFILE_SCOPE("MedianPhaseFilter");
+
+			if(levels < 0)
+			{
+				levels = DetectPhaseLevels(wrapped);
+			}
+
+			// Kernels work on cos/sin planes computed once for the whole image
+			cv::Mat cos_plane, sin_plane;
+			kernels::CosSin(wrapped, cos_plane, sin_plane, levels);
+
+			cv::Mat filtered = MedianKernel(cos_plane, sin_plane, window);
+			PU_PROFILE_COUNT("MedianPhaseFilter", Allocations, 3);
+			PU_PROFILE_COUNT("MedianPhaseFilter", PixelsProcessed, wrapped.rows * wrapped.cols);
+
+			// Scale result to [0,1] range
+			cv::normalize(filtered, filtered, 0, 1, cv::NORM_MINMAX);
+
+			return filtered;
+		}
+
+		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, cv::Size window, cv::Rect roi, int levels)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[MedianPhaseFilter] Invalid wrapped phase image");
+
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MedianPhaseFilter] Window sides must be odd, greater equal 1");
+
+			PU_PROFILE_SCOPE("MedianPhaseFilter");
+
+			return RoiPhaseFilter(wrapped, window, roi, levels, true);
+		}
+
+		cv::Mat MedianPhaseFilter(const cv::Mat & wrapped, cv::Size window, const masks::ValidRegion & region, int levels)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[MedianPhaseFilter] Invalid wrapped phase image");
+
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MedianPhaseFilter] Window sides must be odd, greater equal 1");
+
+			assert(region.Size() == wrapped.size() &&
+				   "[MedianPhaseFilter] Invalid valid region");
+
+			PU_PROFILE_SCOPE("MedianPhaseFilter");
+
+			if(levels < 0)
+			{
+				levels = DetectPhaseLevels(wrapped);
+			}
+
+			PU_PROFILE_COUNT("MedianPhaseFilter", Allocations, 3);
+			PU_PROFILE_COUNT("MedianPhaseFilter", PixelsProcessed, region.Count());
+			PU_PROFILE_COUNT("MedianPhaseFilter", MaskedPixelsSkipped, static_cast<long long>(wrapped.rows) * wrapped.cols - region.Count());
+
+			return RegionPhaseFilter(wrapped, window, region, levels, true);
+		}
+	
+
+		namespace
+		{
+			/// <summary>
+			/// Appends absolute wrapped second differences along rows of every
+			/// stride-th row of gradient image of type T, scaled to cycles
+			/// </summary>
+			template<typename T>
+			void AppendSecondDifferences(const cv::Mat& dx, int stride, float scale, std::vector<float>& samples)
+			{
+				for(int row = 0; row < dx.rows; row += stride)
 				{
-					re = *(re_part.begin<float>() + n2);
-					im = *(im_part.begin<float>() + n2);
+					const T* d = dx.ptr<T>(row);
+
+					// Last gradient of the row is backward difference, not used
+					for(int col = 1; col < dx.cols - 1; col++)
+					{
+						float h = (static_cast<float>(d[col]) - static_cast<float>(d[col - 1])) * scale;
+						samples.push_back(std::abs(h - std::round(h)));
+					}
+				}
+			}
+
+			/// <summary>
+			/// Robust estimate of phase noise standard deviation in radians,
+			/// from median absolute second difference (fringes contribute
+			/// little to second differences, noise sqrt(6) times its deviation)
+			/// </summary>
+			double EstimatePhaseNoise(const cv::Mat& wrapped)
+			{
+				cv::Mat dx = DxGradient(wrapped);
+
+				// At most about million samples
+				const int stride = std::max(1, static_cast<int>(static_cast<long long>(dx.rows) * dx.cols >> 20));
+
+				std::vector<float> samples;
+				if(dx.type() == CV_16SC1)
+				{
+					AppendSecondDifferences<short>(dx, stride, 1.0f / FIXED16_ONE, samples);
 				}
-				// Even number of pixels - take average of two middle elements
 				else
 				{
-					re = (*(re_part.begin<float>() + n2) + *(re_part.begin<float>() + n2 + 1)) / 2.0f;
-					im = (*(im_part.begin<float>() + n2) + *(im_part.begin<float>() + n2 + 1)) / 2.0f;
+					AppendSecondDifferences<float>(dx, stride, 1.0f, samples);
+				}
+
+				if(samples.empty())
+				{
+					return 0;
 				}
 
-				// Compute median phase
-				filtered.at<float>(row, col) = std::atan2f(im, re);
+				auto mid = samples.begin() + samples.size() / 2;
+				std::nth_element(samples.begin(), mid, samples.end());
+
+				// Median of |N(0, s)| is 0.6745 s
+				return *mid * CV_PI * 2.0 / 0.6745 / std::sqrt(6.0);
+			}
+		}
+
+		cv::Mat WindowedFourierFilter(const cv::Mat & wrapped, const WindowedFourierOptions & options)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[WindowedFourierFilter] Invalid wrapped phase image");
+
+			assert(options.block >= 4 &&
+				   options.step >= 1 && options.step <= options.block &&
+				   "[WindowedFourierFilter] Invalid block layout");
+
+			PU_PROFILE_SCOPE("WindowedFourierFilter");
+
+			const int block = options.block, step = options.step;
+			const int rows = wrapped.rows, cols = wrapped.cols;
+
+			// Zero margin, so that every pixel is covered by the same number of blocks
+			const int pad = block - step;
+			auto padded = [&](int n) {
+				int p = std::max(n + 2 * pad, block);
+				return p + (step - (p - block) % step) % step;
+			};
+			const int padded_rows = padded(rows), padded_cols = padded(cols);
+
+			// Unit phasors of the phase
+			cv::Mat cos_plane, sin_plane;
+			kernels::CosSin(wrapped, cos_plane, sin_plane);
+
+			cv::Mat phasors{ padded_rows, padded_cols, CV_32FC2, cv::Scalar(0, 0) };
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const float* c = cos_plane.ptr<float>(row);
+					const float* s = sin_plane.ptr<float>(row);
+					cv::Vec2f* dst = phasors.ptr<cv::Vec2f>(row + pad) + pad;
+					for(int col = 0; col < cols; col++)
+					{
+						dst[col] = cv::Vec2f(c[col], s[col]);
+					}
+				}
 			});
 
-			// Scale result to [0,1] range
-			cv::normalize(filtered, filtered, 0, 1, cv::NORM_MINMAX);
+			// Gaussian window, 3 sigma from the center to the block edges
+			cv::Mat window{ block, block, CV_32FC1 };
+			const double sigma = block / 6.0, center = (block - 1) / 2.0;
+			double energy = 0;
+			for(int row = 0; row < block; row++)
+			{
+				for(int col = 0; col < block; col++)
+				{
+					double r2 = (row - center) * (row - center) + (col - center) * (col - center);
+					float w = static_cast<float>(std::exp(-r2 / (2 * sigma * sigma)));
+					window.at<float>(row, col) = w;
+					energy += w * w;
+				}
+			}
+
+			// Small phase noise with deviation s makes phasor noise of the same
+			// deviation, its windowed DFT coefficients have s * sqrt(energy)
+			const double noise_sigma = options.noise_sigma > 0 ? options.noise_sigma : EstimatePhaseNoise(wrapped);
+			const float threshold = static_cast<float>(options.threshold_factor * noise_sigma * std::sqrt(energy));
+			const float threshold2 = threshold * threshold;
+
+			// Only the phase of the sum is used, so accumulated phasors need no
+			// normalization by the window weights
+			cv::Mat sum{ padded_rows, padded_cols, CV_32FC2, cv::Scalar(0, 0) };
+			PU_PROFILE_COUNT("WindowedFourierFilter", Allocations, 6);
+			PU_PROFILE_COUNT("WindowedFourierFilter", PixelsProcessed, rows * cols);
+
+			const int block_rows = (padded_rows - block) / step + 1;
+			const int block_cols = (padded_cols - block) / step + 1;
+
+			// Block rows rounds apart do not overlap, so each round accumulates
+			// in parallel without locks
+			const int rounds = (block + step - 1) / step;
+			for(int round = 0; round < rounds; round++)
+			{
+				const int count = (block_rows - round + rounds - 1) / rounds;
+				if(count <= 0)
+				{
+					continue;
+				}
+
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					// Reused for all the blocks of the task
+					cv::Mat windowed{ block, block, CV_32FC2 };
+					cv::Mat spectrum{ block, block, CV_32FC2 };
+
+					for(int i = range.start; i < range.end; i++)
+					{
+						const int y = (round + i * rounds) * step;
+
+						for(int x = 0; x < block_cols * step; x += step)
+						{
+							for(int row = 0; row < block; row++)
+							{
+								const cv::Vec2f* src = phasors.ptr<cv::Vec2f>(y + row) + x;
+								const float* w = window.ptr<float>(row);
+								cv::Vec2f* dst = windowed.ptr<cv::Vec2f>(row);
+								for(int col = 0; col < block; col++)
+								{
+									dst[col] = cv::Vec2f(src[col][0] * w[col], src[col][1] * w[col]);
+								}
+							}
+
+							cv::dft(windowed, spectrum);
+
+							// Hard threshold of the spectrum
+							for(int row = 0; row < block; row++)
+							{
+								cv::Vec2f* z = spectrum.ptr<cv::Vec2f>(row);
+								for(int col = 0; col < block; col++)
+								{
+									if(z[col][0] * z[col][0] + z[col][1] * z[col][1] < threshold2)
+									{
+										z[col] = cv::Vec2f(0, 0);
+									}
+								}
+							}
+
+							cv::dft(spectrum, windowed, cv::DFT_INVERSE | cv::DFT_SCALE);
+
+							for(int row = 0; row < block; row++)
+							{
+								const cv::Vec2f* src = windowed.ptr<cv::Vec2f>(row);
+								const float* w = window.ptr<float>(row);
+								cv::Vec2f* dst = sum.ptr<cv::Vec2f>(y + row) + x;
+								for(int col = 0; col < block; col++)
+								{
+									dst[col][0] += src[col][0] * w[col];
+									dst[col][1] += src[col][1] * w[col];
+								}
+							}
+						}
+					}
+
+					PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * block_cols * block * block);
+				});
+			}
+
+			// Phase of the filtered phasors in range [0, 1)
+			cv::Mat filtered = parallel::Allocate(rows, cols, CV_32FC1);
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const cv::Vec2f* src = sum.ptr<cv::Vec2f>(row + pad) + pad;
+					float* dst = filtered.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						float phase = std::atan2(src[col][1], src[col][0]) / static_cast<float>(CV_PI * 2.0);
+						phase = phase < 0 ? phase + 1.0f : phase;
+						dst[col] = phase < 1.0f ? phase : 0.0f;
+					}
+				}
+			});
 
 			return filtered;
 		}
@@ -1,5 +1,6 @@
 #pragma once
-#include <opencv2\opencv.hpp>
+#include "ValidRegion.h"
+#include <opencv2/opencv.hpp>
 
 namespace pu
 {
@@ -12,16 +13,61 @@ namespace pu
 		/// </summary>
 		/// <param name="wrapped">
 		/// Image with the wrapped phase, single channel, floating point,
-		/// values should be in range [0, 1]
+		/// values should be in range [0, 1], or 16-bit fixed point (CV_16UC1)
 		/// </param>
 		/// <param name="k">
 		/// Size of window, must be odd, greater or equal 3
 		/// </param>
+		/// <param name="levels">
+		/// [default = 0] Number of phase quantization levels (phase = i / levels,
+		/// see DetectPhaseLevels). When greater than 0 cos and sin are taken
+		/// from precomputed tables, 0 computes them exactly, negative value
+		/// detects levels from the image. Fixed point phase always uses tables.
+		/// </param>
 		/// <returns>
 		/// Filtered image, single channel, floating point noramlized to
 		/// range [0, 1]
 		/// </returns>
-		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, int k);
+		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, int k, int levels = 0);
+
+		/// <summary>
+		/// Computes "mean" phase filter over rectangular window, see MeanPhaseFilter.
+		/// Window cos/sin sums come from separable box
+		/// filters, so the cost per pixel does not depend on the window size.
+		/// </summary>
+		/// <param name="window">
+		/// Window width (kx) and height (ky), both odd, greater equal 1
+		/// </param>
+		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, cv::Size window, int levels = 0);
+
+		/// <summary>
+		/// Computes "mean" phase filter over valid region only, see MeanPhaseFilter.
+		/// Only valid pixels are visited and windows leave out masked pixels,
+		/// so the cost scales with the region area.
+		/// </summary>
+		/// <param name="region">
+		/// Valid region, same size as wrapped phase
+		/// </param>
+		/// <returns>
+		/// Filtered image, single channel, floating point, valid pixels
+		/// normalized to range [0, 1], others 0
+		/// </returns>
+		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, cv::Size window, const masks::ValidRegion& region, int levels = 0);
+
+		/// <summary>
+		/// Computes "mean" phase filter inside a region of interest only, see
+		/// MeanPhaseFilter. Reads just the ROI grown by half of the window,
+		/// so the cost scales with the ROI, not the frame.
+		/// </summary>
+		/// <param name="roi">
+		/// Region of interest, clipped to the image, not empty
+		/// </param>
+		/// <returns>
+		/// Filtered image of ROI size, single channel, floating point. Phase
+		/// is mapped per pixel to range [0, 1] as (phase + PI) / 2PI instead
+		/// of min max normalization, which would depend on the whole frame.
+		/// </returns>
+		cv::Mat MeanPhaseFilter(const cv::Mat& wrapped, cv::Size window, cv::Rect roi, int levels = 0);
 
 		/// <summary>
 		/// Computes "median" phase filter. It recomputes complex Re and Im
@@ -30,15 +76,107 @@ namespace pu
 		/// </summary>
 		/// <param name="wrapped">
 		/// Image with the wrapped phase, single channel, floating point,
-		/// values should be in range [0, 1]
+		/// values should be in range [0, 1], or 16-bit fixed point (CV_16UC1)
 		/// </param>
 		/// <param name="k">
 		/// Size of window, must be odd, greater or equal 3
 		/// </param>
+		/// <param name="levels">
+		/// [default = 0] Number of phase quantization levels (phase = i / levels,
+		/// see DetectPhaseLevels). When greater than 0 cos and sin are taken
+		/// from precomputed tables, 0 computes them exactly, negative value
+		/// detects levels from the image. Fixed point phase always uses tables.
+		/// </param>
 		/// <returns>
 		/// Filtered image, single channel, floating point noramlized to
 		/// range [0, 1]
 		/// </returns>
-		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, int k);
+		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, int k, int levels = 0);
+
+		/// <summary>
+		/// Computes "median" phase filter over rectangular window, see MedianPhaseFilter.
+		/// Median is not separable: windows narrower than 7 columns are
+		/// gathered whole, wider ones slide along rows keeping window values
+		/// ordered, so the cost per pixel grows with the window height times
+		/// log of the row band size. Both are exact.
+		/// </summary>
+		/// <param name="window">
+		/// Window width (kx) and height (ky), both odd, greater equal 1
+		/// </param>
+		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, cv::Size window, int levels = 0);
+
+		/// <summary>
+		/// Computes "median" phase filter over valid region only, see MedianPhaseFilter.
+		/// Only valid pixels are visited and windows leave out masked pixels,
+		/// so the cost scales with the region area.
+		/// </summary>
+		/// <param name="region">
+		/// Valid region, same size as wrapped phase
+		/// </param>
+		/// <returns>
+		/// Filtered image, single channel, floating point, valid pixels
+		/// normalized to range [0, 1], others 0
+		/// </returns>
+		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, cv::Size window, const masks::ValidRegion& region, int levels = 0);
+
+		/// <summary>
+		/// Computes "median" phase filter inside a region of interest only,
+		/// see MeanPhaseFilter with ROI.
+		/// </summary>
+		cv::Mat MedianPhaseFilter(const cv::Mat& wrapped, cv::Size window, cv::Rect roi, int levels = 0);
+	
+
+		/// <summary>
+		/// Parameters of WindowedFourierFilter
+		/// </summary>
+		struct WindowedFourierOptions
+		{
+			/// <summary>
+			/// Side of square blocks transformed with DFT, power of two
+			/// is fastest (e.g. 16, 32, 64)
+			/// </summary>
+			int block = 32;
+
+			/// <summary>
+			/// Distance between neighbouring blocks, each pixel is covered by
+			/// (block / step)^2 blocks. Smaller step suppresses block artifacts
+			/// at higher cost.
+			/// </summary>
+			int step = 8;
+
+			/// <summary>
+			/// Standard deviation of phase noise in radians, 0 (or negative)
+			/// estimates it from second differences of the phase
+			/// </summary>
+			double noise_sigma = 0;
+
+			/// <summary>
+			/// Spectrum coefficients weaker than threshold_factor times the
+			/// expected noise coefficient magnitude are removed
+			/// </summary>
+			double threshold_factor = 3;
+		};
+
+		/// <summary>
+		/// Windowed Fourier filter (Kemao WFF). Phase is turned into unit
+		/// phasors, which are cut into overlapping blocks multiplied by Gaussian
+		/// window. Spectrum of each block is thresholded (fringes concentrate
+		/// into few strong coefficients, noise spreads evenly over all of
+		/// them), transformed back, windowed again and accumulated. Keeps
+		/// dense fringes which mean and median filters blur. Blocks are
+		/// processed in parallel, in rounds of non-overlapping block rows.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with the wrapped phase, single channel, floating point,
+		/// values should be in range [0, 1], or 16-bit fixed point (CV_16UC1)
+		/// </param>
+		/// <param name="options">
+		/// [default = WindowedFourierOptions()] Block layout and threshold
+		/// </param>
+		/// <returns>
+		/// Filtered wrapped phase, single channel, floating point, range
+		/// [0, 1), same scale as floating point input (not normalized)
+		/// </returns>
+		cv::Mat WindowedFourierFilter(const cv::Mat& wrapped, const WindowedFourierOptions& options = WindowedFourierOptions());
 	}
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "Gradients.h"
+#include "Parallel.h"
+#include "Profiling.h"
 
 namespace pu
 {
@@ -14,31 +16,91 @@ namespace pu
 		return r;
 	}
 
+	short Gradient(unsigned short current, unsigned short other)
+	{
+		// Difference modulo 2^16 reinterpreted as signed is already wrapped
+		// to [-0.5, 0.5) of the cycle
+		return static_cast<short>(static_cast<unsigned short>(current - other));
+	}
+
+	namespace
+	{
+		/// <summary>
+		/// Gradient of fixed point phase along rows (dx) or columns (dy)
+		/// </summary>
+		cv::Mat Fixed16Gradient(const cv::Mat& wrapped_phase, bool along_rows)
+		{
+			int rows = wrapped_phase.rows, cols = wrapped_phase.cols;
+
+			cv::Mat grad = parallel::Allocate(rows, cols, CV_16SC1);
+
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const unsigned short* src = wrapped_phase.ptr<unsigned short>(row);
+					short* dst = grad.ptr<short>(row);
+
+					if(along_rows)
+					{
+						// Same convention as float version: next - curr, for the last prev - curr
+						for(int col = 0; col < cols - 1; col++)
+						{
+							dst[col] = Gradient(src[col + 1], src[col]);
+						}
+						dst[cols - 1] = cols > 1 ? Gradient(src[cols - 1], src[cols - 2]) : 0;
+					}
+					else
+					{
+						bool last = row == rows - 1;
+						const unsigned short* other = wrapped_phase.ptr<unsigned short>(last ? std::max(row - 1, 0) : row + 1);
+						for(int col = 0; col < cols; col++)
+						{
+							dst[col] = last ? Gradient(src[col], other[col]) : Gradient(other[col], src[col]);
+						}
+					}
+				}
+			});
+
+			return grad;
+		}
+	}
+
 	cv::Mat DxGradient(const cv::Mat & wrapped_phase)
 	{
 		assert(!wrapped_phase.empty() &&
-			   wrapped_phase.type() == CV_32FC1 &&
+			   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
 			   "[DxGradient] Invalid wrapped phase image");
 
+		PU_PROFILE_SCOPE("DxGradient");
+
+		if(wrapped_phase.type() == CV_16UC1)
+		{
+			PU_PROFILE_COUNT("DxGradient", Allocations, 1);
+			PU_PROFILE_COUNT("DxGradient", PixelsProcessed, wrapped_phase.rows * wrapped_phase.cols);
+			return Fixed16Gradient(wrapped_phase, true);
+		}
+
 		int rows = wrapped_phase.rows, cols = wrapped_phase.cols;
 
 		// Result image
-		cv::Mat dx{ rows, cols, CV_32FC1, cv::Scalar(0.0) };
+		cv::Mat dx = parallel::Allocate(rows, cols, CV_32FC1);
+		PU_PROFILE_COUNT("DxGradient", Allocations, 1);
+		PU_PROFILE_COUNT("DxGradient", PixelsProcessed, rows * cols);
 
-		wrapped_phase.forEach<float>([&](const float& px, const int* pos) -> void {
-			int row = pos[0], col = pos[1];
-
-			// For pixels not last in row take diff: next - curr 
-			if(col < cols - 1)
-			{
-				float current = wrapped_phase.at<float>(row, col + 1);
-				dx.at<float>(row, col) = Gradient(current, px);
-			}
-			// For the last pixels in row take diff: prev - curr
-			else
+		parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+			for(int row = range.start; row < range.end; row++)
 			{
-				float current = wrapped_phase.at<float>(row, col - 1);
-				dx.at<float>(row, col) = Gradient(px, current);
+				const float* src = wrapped_phase.ptr<float>(row);
+				float* dst = dx.ptr<float>(row);
+
+				// For pixels not last in row take diff: next - curr
+				for(int col = 0; col < cols - 1; col++)
+				{
+					dst[col] = Gradient(src[col + 1], src[col]);
+				}
+
+				// For the last pixels in row take diff: prev - curr
+				dst[cols - 1] = cols > 1 ? Gradient(src[cols - 1], src[cols - 2]) : 0.0f;
 			}
 		});
 
@@ -48,28 +110,49 @@ namespace pu
 	cv::Mat DyGradient(const cv::Mat & wrapped_phase)
 	{
 		assert(!wrapped_phase.empty() &&
-			   wrapped_phase.type() == CV_32FC1 &&
+			   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
 			   "[DyGradient] Invalid wrapped phase image");
 
+		PU_PROFILE_SCOPE("DyGradient");
+
+		if(wrapped_phase.type() == CV_16UC1)
+		{
+			PU_PROFILE_COUNT("DyGradient", Allocations, 1);
+			PU_PROFILE_COUNT("DyGradient", PixelsProcessed, wrapped_phase.rows * wrapped_phase.cols);
+			return Fixed16Gradient(wrapped_phase, false);
+		}
+
 		int rows = wrapped_phase.rows, cols = wrapped_phase.cols;
 
 		// Result image
-		cv::Mat dy{ rows, cols, CV_32FC1, cv::Scalar(0.0) };
-
-		wrapped_phase.forEach<float>([&](const float& px, const int* pos) -> void {
-			int row = pos[0], col = pos[1];
+		cv::Mat dy = parallel::Allocate(rows, cols, CV_32FC1);
+		PU_PROFILE_COUNT("DyGradient", Allocations, 1);
+		PU_PROFILE_COUNT("DyGradient", PixelsProcessed, rows * cols);
 
-			// For pixels not last in col take diff: next- curr 
-			if(row < rows - 1)
+		parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+			for(int row = range.start; row < range.end; row++)
 			{
-				float current = wrapped_phase.at<float>(row + 1, col);
-				dy.at<float>(row, col) = Gradient(current, px);
-			}
-			// For the last pixels in col take diff: prev - curr
-			else
-			{
-				float current = wrapped_phase.at<float>(row - 1, col);
-				dy.at<float>(row, col) = Gradient(px, current);
+				const float* src = wrapped_phase.ptr<float>(row);
+				float* dst = dy.ptr<float>(row);
+
+				// For pixels not last in col take diff: next - curr
+				if(row < rows - 1)
+				{
+					const float* next = wrapped_phase.ptr<float>(row + 1);
+					for(int col = 0; col < cols; col++)
+					{
+						dst[col] = Gradient(next[col], src[col]);
+					}
+				}
+				// For the last pixels in col take diff: prev - curr
+				else if(rows > 1)
+				{
+					const float* prev = wrapped_phase.ptr<float>(row - 1);
+					for(int col = 0; col < cols; col++)
+					{
+						dst[col] = Gradient(src[col], prev[col]);
+					}
+				}
 			}
 		});
 
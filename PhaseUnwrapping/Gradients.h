@@ -1,5 +1,5 @@
 #pragma once
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 
 namespace pu
 {
@@ -17,16 +17,33 @@ namespace pu
 	/// </returns>
 	float Gradient(float current, float other);
 
+	/// <summary>
+	/// Computes gradient of 16-bit fixed point wrapped phase between current
+	/// and other. Wrapping is done by integer overflow.
+	/// </summary>
+	/// <param name="current">
+	/// "Reference" phase value (to subtract from), fixed point.
+	/// </param>
+	/// <param name="other">
+	/// Phase value being subtracted, fixed point.
+	/// </param>
+	/// <returns>
+	/// Phase gradient, fixed point, range [-0.5, 0.5) * 65536.
+	/// </returns>
+	short Gradient(unsigned short current, unsigned short other);
+
 	/// <summary>
 	/// Computes wrapped phase gradient in 0X direction (each row).
 	/// </summary>
 	/// <param name="wrapped_phase">
 	/// Wrapped phase image, not empty, single channel, floating point.
-	/// Phase values should lay in range [0, 1].
+	/// Phase values should lay in range [0, 1]. Alternatively 16-bit fixed
+	/// point phase (CV_16UC1, see ToFixed16).
 	/// </param>
 	/// <returns>
 	/// Image with computed gradient, single channel, floating point,
-	/// same size as input image. Values lay in range [0, 1].
+	/// same size as input image. Values lay in range [0, 1]. For fixed
+	/// point input gradient is fixed point too (CV_16SC1).
 	/// </returns>
 	cv::Mat DxGradient(const cv::Mat & wrapped_phase);
 
@@ -35,11 +52,13 @@ namespace pu
 	/// </summary>
 	/// <param name="wrapped_phase">
 	/// Wrapped phase image, not empty, single channel, floating point.
-	/// Phase values should lay in range [0, 1].
+	/// Phase values should lay in range [0, 1]. Alternatively 16-bit fixed
+	/// point phase (CV_16UC1, see ToFixed16).
 	/// </param>
 	/// <returns>
 	/// Image with computed gradient, single channel, floating point,
-	/// same size as input image. Values lay in range [0, 1].
+	/// same size as input image. Values lay in range [0, 1]. For fixed
+	/// point input gradient is fixed point too (CV_16SC1).
 	/// </returns>
 	cv::Mat DyGradient(const cv::Mat & wrapped_phase);
 }
\ No newline at end of file
@@ -0,0 +1,770 @@
+#include "IO.h"
+#include "Profiling.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pu
+{
+	namespace io
+	{
+		namespace
+		{
+			// Pixel data offset in created files, keeps data aligned for SIMD loads
+			// (mapping itself is page aligned)
+			constexpr size_t DATA_ALIGNMENT = 64;
+
+			// TIFF tags used by reader and writer
+			enum TiffTag : uint16_t
+			{
+				ImageWidth = 256,
+				ImageLength = 257,
+				BitsPerSample = 258,
+				Compression = 259,
+				Photometric = 262,
+				StripOffsets = 273,
+				SamplesPerPixel = 277,
+				RowsPerStrip = 278,
+				StripByteCounts = 279,
+				PlanarConfig = 284,
+				TileWidth = 322,
+				TileLength = 323,
+				TileOffsets = 324,
+				TileByteCounts = 325,
+				SampleFormat = 339
+			};
+
+			size_t AlignUp(size_t value, size_t alignment)
+			{
+				return (value + alignment - 1) / alignment * alignment;
+			}
+
+			template<typename T>
+			T ReadLE(const unsigned char* p)
+			{
+				// Files are little endian, same as all supported platforms
+				T value;
+				std::memcpy(&value, p, sizeof(T));
+				return value;
+			}
+
+			template<typename T>
+			void WriteLE(unsigned char* p, T value)
+			{
+				std::memcpy(p, &value, sizeof(T));
+			}
+
+			/// <summary>
+			/// Maps .npy dtype descriptor to OpenCV type, -1 if unsupported
+			/// </summary>
+			int TypeFromNpy(const std::string& descr)
+			{
+				if(descr == "<f4") return CV_32FC1;
+				if(descr == "<f8") return CV_64FC1;
+				if(descr == "|u1" || descr == "<u1") return CV_8UC1;
+				if(descr == "|i1" || descr == "<i1") return CV_MAKETYPE(CV_8S, 1);
+				if(descr == "<u2") return CV_16UC1;
+				if(descr == "<i2") return CV_16SC1;
+				if(descr == "<i4") return CV_32SC1;
+				return -1;
+			}
+
+			/// <summary>
+			/// Maps OpenCV type to .npy dtype descriptor, empty if unsupported
+			/// </summary>
+			std::string NpyFromType(int type)
+			{
+				switch(type)
+				{
+				case CV_32FC1: return "<f4";
+				case CV_64FC1: return "<f8";
+				case CV_8UC1: return "|u1";
+				case CV_MAKETYPE(CV_8S, 1): return "|i1";
+				case CV_16UC1: return "<u2";
+				case CV_16SC1: return "<i2";
+				case CV_32SC1: return "<i4";
+				default: return "";
+				}
+			}
+
+			/// <summary>
+			/// Maps TIFF BitsPerSample and SampleFormat to OpenCV type, -1 if unsupported
+			/// </summary>
+			int TypeFromTiff(uint64_t bits, uint64_t format)
+			{
+				// SampleFormat: 1 = unsigned, 2 = signed, 3 = floating point
+				if(format == 3 && bits == 32) return CV_32FC1;
+				if(format == 3 && bits == 64) return CV_64FC1;
+				if(format == 1 && bits == 8) return CV_8UC1;
+				if(format == 2 && bits == 8) return CV_MAKETYPE(CV_8S, 1);
+				if(format == 1 && bits == 16) return CV_16UC1;
+				if(format == 2 && bits == 16) return CV_16SC1;
+				if(format == 2 && bits == 32) return CV_32SC1;
+				return -1;
+			}
+
+			/// <summary>
+			/// Inverse of TypeFromTiff, returns false if unsupported
+			/// </summary>
+			bool TiffFromType(int type, uint16_t& bits, uint16_t& format)
+			{
+				switch(CV_MAT_DEPTH(type))
+				{
+				case CV_32F: bits = 32; format = 3; break;
+				case CV_64F: bits = 64; format = 3; break;
+				case CV_8U: bits = 8; format = 1; break;
+				case CV_8S: bits = 8; format = 2; break;
+				case CV_16U: bits = 16; format = 1; break;
+				case CV_16S: bits = 16; format = 2; break;
+				case CV_32S: bits = 32; format = 2; break;
+				default: return false;
+				}
+				return true;
+			}
+
+			/// <summary>
+			/// Reads values of a classic TIFF IFD entry (SHORT or LONG), empty if
+			/// entry is malformed
+			/// </summary>
+			std::vector<uint64_t> TiffValues(const MappedFile& file, const unsigned char* entry)
+			{
+				std::vector<uint64_t> values;
+
+				uint16_t type = ReadLE<uint16_t>(entry + 2);
+				uint32_t count = ReadLE<uint32_t>(entry + 4);
+
+				size_t type_size = type == 3 ? 2 : type == 4 ? 4 : 0;
+				if(type_size == 0)
+				{
+					return values;
+				}
+
+				// Values fitting in 4 bytes are stored inline, otherwise entry holds offset
+				const unsigned char* p = entry + 8;
+				if(type_size * count > 4)
+				{
+					size_t offset = ReadLE<uint32_t>(entry + 8);
+					if(offset + type_size * count > file.Size())
+					{
+						return values;
+					}
+					p = file.Data() + offset;
+				}
+
+				values.resize(count);
+				for(uint32_t i = 0; i < count; i++)
+				{
+					values[i] = type_size == 2 ? ReadLE<uint16_t>(p + i * 2) : ReadLE<uint32_t>(p + i * 4);
+				}
+
+				return values;
+			}
+
+			/// <summary>
+			/// Fills single block (whole image) of the mapped image
+			/// </summary>
+			void SetContiguous(MappedImage& image, unsigned char* data, int rows, int cols, int type)
+			{
+				image.size = cv::Size(cols, rows);
+				image.type = type;
+				image.mat = cv::Mat(rows, cols, type, data);
+				image.blocks.assign(1, cv::Rect(0, 0, cols, rows));
+				image.block_mats.assign(1, image.mat);
+			}
+
+			/// <summary>
+			/// Writes .npy header, returns data offset or 0 if type is unsupported
+			/// </summary>
+			size_t NpyHeader(int rows, int cols, int type, std::string& header)
+			{
+				std::string descr = NpyFromType(type);
+				if(descr.empty())
+				{
+					return 0;
+				}
+
+				std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" +
+					std::to_string(rows) + ", " + std::to_string(cols) + "), }";
+
+				// Magic (6) + version (2) + header length (2) + dict padded with
+				// spaces and terminated with new line, total aligned
+				size_t total = AlignUp(10 + dict.size() + 1, DATA_ALIGNMENT);
+				dict.append(total - 10 - dict.size() - 1, ' ');
+				dict.push_back('\n');
+
+				header.assign("\x93NUMPY\x01\x00", 8);
+				header.push_back(static_cast<char>(dict.size() & 0xFF));
+				header.push_back(static_cast<char>(dict.size() >> 8));
+				header += dict;
+
+				return header.size();
+			}
+		}
+
+		MappedFile::~MappedFile()
+		{
+			Close();
+		}
+
+		bool MappedFile::Open(const std::string & path, bool writable)
+		{
+			Close();
+
+#ifdef _WIN32
+			DWORD access = writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+			HANDLE f = CreateFileA(path.c_str(), access, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(f == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			LARGE_INTEGER file_size;
+			if(!GetFileSizeEx(f, &file_size) || file_size.QuadPart == 0)
+			{
+				CloseHandle(f);
+				return false;
+			}
+
+			HANDLE m = CreateFileMappingA(f, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+			if(!m)
+			{
+				CloseHandle(f);
+				return false;
+			}
+
+			void* view = MapViewOfFile(m, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+			if(!view)
+			{
+				CloseHandle(m);
+				CloseHandle(f);
+				return false;
+			}
+
+			file = f;
+			mapping = m;
+			size = static_cast<size_t>(file_size.QuadPart);
+			data = static_cast<unsigned char*>(view);
+#else
+			int f = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+			if(f < 0)
+			{
+				return false;
+			}
+
+			struct stat st;
+			if(fstat(f, &st) != 0 || st.st_size == 0)
+			{
+				::close(f);
+				return false;
+			}
+
+			void* view = mmap(nullptr, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, f, 0);
+			if(view == MAP_FAILED)
+			{
+				::close(f);
+				return false;
+			}
+
+			fd = f;
+			size = static_cast<size_t>(st.st_size);
+			data = static_cast<unsigned char*>(view);
+#endif
+			this->writable = writable;
+			return true;
+		}
+
+		bool MappedFile::Create(const std::string & path, size_t size)
+		{
+			Close();
+
+			assert(size > 0 && "[MappedFile::Create] Invalid size");
+
+#ifdef _WIN32
+			HANDLE f = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(f == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			// Mapping of the requested size extends the file
+			LARGE_INTEGER file_size;
+			file_size.QuadPart = static_cast<LONGLONG>(size);
+			HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READWRITE, file_size.HighPart, file_size.LowPart, nullptr);
+			if(!m)
+			{
+				CloseHandle(f);
+				return false;
+			}
+
+			void* view = MapViewOfFile(m, FILE_MAP_WRITE, 0, 0, 0);
+			if(!view)
+			{
+				CloseHandle(m);
+				CloseHandle(f);
+				return false;
+			}
+
+			file = f;
+			mapping = m;
+			data = static_cast<unsigned char*>(view);
+#else
+			int f = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if(f < 0)
+			{
+				return false;
+			}
+
+			// File is sparse until written, so creating even huge files is cheap
+			if(ftruncate(f, static_cast<off_t>(size)) != 0)
+			{
+				::close(f);
+				return false;
+			}
+
+			void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+			if(view == MAP_FAILED)
+			{
+				::close(f);
+				return false;
+			}
+
+			fd = f;
+			data = static_cast<unsigned char*>(view);
+#endif
+			this->size = size;
+			writable = true;
+			return true;
+		}
+
+		bool MappedFile::Flush(bool async)
+		{
+			if(!data || !writable)
+			{
+				return false;
+			}
+
+#ifdef _WIN32
+			// FlushViewOfFile only initiates write back, FlushFileBuffers waits for it
+			bool ok = FlushViewOfFile(data, 0) != 0;
+			if(!async)
+			{
+				ok = ok && FlushFileBuffers(static_cast<HANDLE>(file)) != 0;
+			}
+			return ok;
+#else
+			return msync(data, size, async ? MS_ASYNC : MS_SYNC) == 0;
+#endif
+		}
+
+		void MappedFile::Close()
+		{
+			if(!data)
+			{
+				return;
+			}
+
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+			CloseHandle(static_cast<HANDLE>(mapping));
+			CloseHandle(static_cast<HANDLE>(file));
+			mapping = nullptr;
+			file = nullptr;
+#else
+			munmap(data, size);
+			::close(fd);
+			fd = -1;
+#endif
+			data = nullptr;
+			size = 0;
+			writable = false;
+		}
+
+		cv::Mat MappedImage::Read(const cv::Rect & roi) const
+		{
+			assert(!empty() && "[MappedImage::Read] Empty image");
+			assert((roi & cv::Rect(0, 0, size.width, size.height)) == roi && "[MappedImage::Read] ROI out of image");
+
+			// Zero copy view if roi is within single block
+			for(size_t i = 0; i < blocks.size(); i++)
+			{
+				if((roi & blocks[i]) == roi)
+				{
+					return block_mats[i](roi - blocks[i].tl());
+				}
+			}
+
+			// Otherwise assemble roi from all the blocks it intersects
+			cv::Mat res{ roi.height, roi.width, type };
+			PU_PROFILE_COUNT("MappedImage::Read", Allocations, 1);
+			for(size_t i = 0; i < blocks.size(); i++)
+			{
+				cv::Rect common = roi & blocks[i];
+				if(common.area() > 0)
+				{
+					block_mats[i](common - blocks[i].tl()).copyTo(res(common - roi.tl()));
+				}
+			}
+
+			return res;
+		}
+
+		bool MappedImage::Flush(bool async) const
+		{
+			return file && file->Flush(async);
+		}
+
+		MappedImage MapRaw(const std::string & path, int rows, int cols, int type, size_t offset, bool writable)
+		{
+			assert(rows > 0 && cols > 0 && "[MapRaw] Invalid dimensions");
+			assert(CV_MAT_CN(type) == 1 && "[MapRaw] Only single channel images are supported");
+
+			MappedImage image;
+			auto file = std::make_shared<MappedFile>();
+			if(!file->Open(path, writable))
+			{
+				return image;
+			}
+
+			size_t bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+			if(offset + bytes > file->Size())
+			{
+				return image;
+			}
+
+			image.file = file;
+			SetContiguous(image, file->Data() + offset, rows, cols, type);
+			return image;
+		}
+
+		MappedImage MapNpy(const std::string & path, bool writable)
+		{
+			MappedImage image;
+			auto file = std::make_shared<MappedFile>();
+			if(!file->Open(path, writable) || file->Size() < 10 ||
+			   std::memcmp(file->Data(), "\x93NUMPY", 6) != 0)
+			{
+				return image;
+			}
+
+			// Version 1.x has 2 byte header length, 2.x and 3.x have 4 byte one
+			const unsigned char* p = file->Data();
+			int major = p[6];
+			size_t header_start = major == 1 ? 10 : 12;
+			if(file->Size() < header_start)
+			{
+				return image;
+			}
+
+			size_t header_len = major == 1 ? ReadLE<uint16_t>(p + 8) : ReadLE<uint32_t>(p + 8);
+			size_t data_offset = header_start + header_len;
+			if(data_offset > file->Size())
+			{
+				return image;
+			}
+
+			std::string header(reinterpret_cast<const char*>(p) + header_start, header_len);
+
+			// Header is python dict literal, values are looked up after their keys
+			auto value_after = [&](const std::string& key) -> std::string {
+				size_t pos = header.find(key);
+				if(pos == std::string::npos) return "";
+				pos = header.find(':', pos + key.size());
+				if(pos == std::string::npos) return "";
+				size_t end = header.find_first_of(",}", pos);
+				// Shape is a tuple so it ends at closing parenthesis
+				if(header.find('(', pos) < end) end = header.find(')', pos) + 1;
+				return header.substr(pos + 1, end - pos - 1);
+			};
+
+			std::string descr = value_after("'descr'");
+			std::string fortran = value_after("'fortran_order'");
+			std::string shape = value_after("'shape'");
+
+			descr.erase(std::remove_if(descr.begin(), descr.end(), [](char c) { return c == '\'' || c == ' '; }), descr.end());
+			int type = TypeFromNpy(descr);
+
+			int rows = 0, cols = 0;
+			if(std::sscanf(shape.c_str(), " (%d , %d )", &rows, &cols) != 2 ||
+			   type < 0 || fortran.find("True") != std::string::npos ||
+			   rows <= 0 || cols <= 0)
+			{
+				return image;
+			}
+
+			// Rows are counted against the remaining bytes, the total size
+			// of a bogus shape could overflow
+			size_t row_bytes = static_cast<size_t>(cols) * CV_ELEM_SIZE(type);
+			if(static_cast<size_t>(rows) > (file->Size() - data_offset) / row_bytes)
+			{
+				return image;
+			}
+
+			image.file = file;
+			SetContiguous(image, file->Data() + data_offset, rows, cols, type);
+			return image;
+		}
+
+		MappedImage MapTiff(const std::string & path, bool writable)
+		{
+			MappedImage image;
+			auto file = std::make_shared<MappedFile>();
+			if(!file->Open(path, writable) || file->Size() < 8 ||
+			   std::memcmp(file->Data(), "II\x2A\x00", 4) != 0)
+			{
+				return image;
+			}
+
+			const unsigned char* p = file->Data();
+			size_t ifd = ReadLE<uint32_t>(p + 4);
+			if(ifd + 2 > file->Size())
+			{
+				return image;
+			}
+
+			uint16_t entries = ReadLE<uint16_t>(p + ifd);
+			if(ifd + 2 + entries * 12 > file->Size())
+			{
+				return image;
+			}
+
+			// Collect tags of the first IFD
+			uint64_t width = 0, height = 0, bits = 0, compression = 1, samples = 1, planar = 1, sample_format = 1;
+			uint64_t rows_per_strip = 0, tile_width = 0, tile_height = 0;
+			std::vector<uint64_t> offsets;
+			for(uint16_t i = 0; i < entries; i++)
+			{
+				const unsigned char* entry = p + ifd + 2 + i * 12;
+				std::vector<uint64_t> values = TiffValues(*file, entry);
+				if(values.empty())
+				{
+					continue;
+				}
+
+				switch(ReadLE<uint16_t>(entry))
+				{
+				case ImageWidth: width = values[0]; break;
+				case ImageLength: height = values[0]; break;
+				case BitsPerSample: bits = values[0]; break;
+				case Compression: compression = values[0]; break;
+				case SamplesPerPixel: samples = values[0]; break;
+				case PlanarConfig: planar = values[0]; break;
+				case SampleFormat: sample_format = values[0]; break;
+				case RowsPerStrip: rows_per_strip = values[0]; break;
+				case TileWidth: tile_width = values[0]; break;
+				case TileLength: tile_height = values[0]; break;
+				case StripOffsets: case TileOffsets: offsets = values; break;
+				default: break;
+				}
+			}
+
+			int type = TypeFromTiff(bits, sample_format);
+			if(type < 0 || compression != 1 || samples != 1 || planar != 1 ||
+			   width == 0 || height == 0 || offsets.empty() ||
+			   width > INT_MAX || height > INT_MAX || tile_width > INT_MAX || tile_height > INT_MAX)
+			{
+				return image;
+			}
+
+			int rows = static_cast<int>(height), cols = static_cast<int>(width);
+			size_t elem = CV_ELEM_SIZE(type);
+
+			// Strips are handled as tiles spanning whole image width
+			bool tiled = tile_width > 0 && tile_height > 0;
+			if(!tiled)
+			{
+				tile_width = width;
+				tile_height = rows_per_strip == 0 || rows_per_strip > height ? height : rows_per_strip;
+			}
+
+			// Tile (strip) larger than the file cannot be mapped, this also
+			// keeps byte counts below from overflowing
+			if(tile_width > file->Size() / elem / tile_height)
+			{
+				return image;
+			}
+
+			size_t tiles_across = (width + tile_width - 1) / tile_width;
+			size_t tiles_down = (height + tile_height - 1) / tile_height;
+			if(offsets.size() < tiles_across * tiles_down)
+			{
+				return image;
+			}
+
+			// Tiles are always stored whole (padded at image edges), last strip only up to image end
+			size_t tile_bytes = tile_width * tile_height * elem;
+			bool contiguous = !tiled || (tiles_across == 1 && tile_width == width);
+			for(size_t ty = 0; ty < tiles_down; ty++)
+			{
+				for(size_t tx = 0; tx < tiles_across; tx++)
+				{
+					size_t index = ty * tiles_across + tx;
+					cv::Rect rect = cv::Rect(static_cast<int>(tx * tile_width), static_cast<int>(ty * tile_height),
+											 static_cast<int>(tile_width), static_cast<int>(tile_height)) & cv::Rect(0, 0, cols, rows);
+
+					size_t needed = tiled ? tile_bytes : rect.height * width * elem;
+					if(offsets[index] > file->Size() || needed > file->Size() - offsets[index])
+					{
+						return image;
+					}
+
+					cv::Mat tile{ tiled ? static_cast<int>(tile_height) : rect.height, static_cast<int>(tile_width),
+								  type, file->Data() + offsets[index], tile_width * elem };
+					image.blocks.push_back(rect);
+					image.block_mats.push_back(tile(cv::Rect(0, 0, rect.width, rect.height)));
+
+					contiguous = contiguous && offsets[index] == offsets[0] + index * tile_bytes;
+				}
+			}
+
+			image.file = file;
+			image.size = cv::Size(cols, rows);
+			image.type = type;
+
+			// Full width blocks stored one after another form single zero copy frame
+			if(contiguous)
+			{
+				SetContiguous(image, file->Data() + offsets[0], rows, cols, type);
+			}
+
+			return image;
+		}
+
+		MappedImage Map(const std::string & path, bool writable)
+		{
+			MappedImage image = MapNpy(path, writable);
+			if(image.empty())
+			{
+				image = MapTiff(path, writable);
+			}
+			return image;
+		}
+
+		MappedImage Create(const std::string & path, Format format, int rows, int cols, int type)
+		{
+			assert(rows > 0 && cols > 0 && "[Create] Invalid dimensions");
+			assert(CV_MAT_CN(type) == 1 && "[Create] Only single channel images are supported");
+
+			MappedImage image;
+			size_t bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+
+			// Header bytes and offset of the pixel data
+			std::string header;
+			size_t data_offset = 0;
+
+			if(format == Format::Npy)
+			{
+				data_offset = NpyHeader(rows, cols, type, header);
+				if(data_offset == 0)
+				{
+					return image;
+				}
+			}
+			else if(format == Format::Tiff)
+			{
+				uint16_t bits, sample_format;
+				if(!TiffFromType(type, bits, sample_format))
+				{
+					return image;
+				}
+
+				// Single strip, uncompressed: 8 byte header followed by IFD with 11 entries
+				const uint16_t entries = 11;
+				data_offset = AlignUp(8 + 2 + entries * 12 + 4, DATA_ALIGNMENT);
+
+				// Classic TIFF uses 32 bit offsets
+				if(data_offset + bytes > 0xFFFFFFFFull)
+				{
+					return image;
+				}
+
+				header.assign(data_offset, '\0');
+				unsigned char* h = reinterpret_cast<unsigned char*>(&header[0]);
+				std::memcpy(h, "II\x2A\x00", 4);
+				WriteLE<uint32_t>(h + 4, 8);
+				WriteLE<uint16_t>(h + 8, entries);
+
+				// Entries must be sorted by tag
+				unsigned char* e = h + 10;
+				auto entry = [&](uint16_t tag, uint16_t tiff_type, uint32_t value) {
+					WriteLE<uint16_t>(e, tag);
+					WriteLE<uint16_t>(e + 2, tiff_type);
+					WriteLE<uint32_t>(e + 4, 1);
+					if(tiff_type == 3) WriteLE<uint16_t>(e + 8, static_cast<uint16_t>(value));
+					else WriteLE<uint32_t>(e + 8, value);
+					e += 12;
+				};
+				entry(ImageWidth, 4, cols);
+				entry(ImageLength, 4, rows);
+				entry(BitsPerSample, 3, bits);
+				entry(Compression, 3, 1);
+				entry(Photometric, 3, 1);
+				entry(StripOffsets, 4, static_cast<uint32_t>(data_offset));
+				entry(SamplesPerPixel, 3, 1);
+				entry(RowsPerStrip, 4, rows);
+				entry(StripByteCounts, 4, static_cast<uint32_t>(bytes));
+				entry(PlanarConfig, 3, 1);
+				entry(SampleFormat, 3, sample_format);
+				// Next IFD offset (none) is already zeroed
+			}
+
+			auto file = std::make_shared<MappedFile>();
+			if(!file->Create(path, data_offset + bytes))
+			{
+				return image;
+			}
+
+			if(!header.empty())
+			{
+				std::memcpy(file->Data(), header.data(), header.size());
+			}
+
+			image.file = file;
+			SetContiguous(image, file->Data() + data_offset, rows, cols, type);
+			return image;
+		}
+
+		bool Write(const std::string & path, const cv::Mat & image, Format format)
+		{
+			assert(!image.empty() && image.channels() == 1 && "[Write] Invalid image");
+
+			PU_PROFILE_SCOPE("io::Write");
+
+			MappedImage mapped = Create(path, format, image.rows, image.cols, image.type());
+			if(mapped.empty())
+			{
+				return false;
+			}
+
+			// Destination has matching size and type so it is written in place
+			image.copyTo(mapped.mat);
+			return mapped.Flush(false);
+		}
+
+		std::future<bool> WriteAsync(const std::string & path, const cv::Mat & image, Format format)
+		{
+			// Mat is captured by value, which only adds reference to the buffer
+			return std::async(std::launch::async, [path, image, format]() -> bool {
+				return Write(path, image, format);
+			});
+		}
+	}
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pu
+{
+	namespace io
+	{
+		/// <summary>
+		/// Supported on-disk formats. All of them are little endian and
+		/// uncompressed so the pixel data can be used straight from mapping.
+		/// </summary>
+		enum class Format
+		{
+			/// <summary>
+			/// Headerless raw pixels, dimensions and type must be known
+			/// </summary>
+			Raw,
+
+			/// <summary>
+			/// NumPy .npy, C order, 2D
+			/// </summary>
+			Npy,
+
+			/// <summary>
+			/// Classic (not Big) TIFF, uncompressed, single channel, stripped
+			/// or tiled
+			/// </summary>
+			Tiff
+		};
+
+		/// <summary>
+		/// RAII wrapper over memory mapped file (mmap / MapViewOfFile).
+		/// </summary>
+		class MappedFile
+		{
+		public:
+			MappedFile() = default;
+			~MappedFile();
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+
+			/// <summary>
+			/// Maps whole existing file.
+			/// </summary>
+			/// <param name="path">
+			/// Path of the file to map.
+			/// </param>
+			/// <param name="writable">
+			/// Whether mapping should be writable (changes go back to file)
+			/// </param>
+			/// <returns>
+			/// True on success.
+			/// </returns>
+			bool Open(const std::string& path, bool writable = false);
+
+			/// <summary>
+			/// Creates (or truncates) file of given size and maps it writable.
+			/// </summary>
+			bool Create(const std::string& path, size_t size);
+
+			/// <summary>
+			/// Schedules (async = true) or performs write back of dirty pages.
+			/// </summary>
+			bool Flush(bool async = true);
+
+			/// <summary>
+			/// Unmaps and closes the file, pending changes are left to the OS
+			/// write back (call Flush(false) first for durability).
+			/// </summary>
+			void Close();
+
+			unsigned char* Data() const { return data; }
+			size_t Size() const { return size; }
+			bool IsOpen() const { return data != nullptr; }
+			bool IsWritable() const { return writable; }
+
+		private:
+			unsigned char* data = nullptr;
+			size_t size = 0;
+			bool writable = false;
+#ifdef _WIN32
+			void* file = nullptr;
+			void* mapping = nullptr;
+#else
+			int fd = -1;
+#endif
+		};
+
+		/// <summary>
+		/// Image backed by mapped file. Mats returned from it are headers
+		/// pointing directly into the mapping (no decode copy), they stay valid
+		/// as long as the MappedImage (or a copy of it) is alive.
+		/// </summary>
+		struct MappedImage
+		{
+			std::shared_ptr<MappedFile> file;
+
+			/// <summary>
+			/// Whole frame view, empty if pixels are not stored contiguously
+			/// (tiled or non contiguous stripped TIFF), use Read in such case
+			/// </summary>
+			cv::Mat mat;
+
+			/// <summary>
+			/// Image size (valid also when mat is empty)
+			/// </summary>
+			cv::Size size;
+
+			/// <summary>
+			/// Pixel type, one of CV_XXC1
+			/// </summary>
+			int type = -1;
+
+			/// <summary>
+			/// Rects (in image coordinates) and views of stored blocks,
+			/// tiles or strips for TIFF, single block for other formats
+			/// </summary>
+			std::vector<cv::Rect> blocks;
+			std::vector<cv::Mat> block_mats;
+
+			bool empty() const { return !file || size.area() == 0; }
+
+			/// <summary>
+			/// Reads region of interest. If roi lays within one contiguous block
+			/// result is a zero copy view, otherwise required blocks are copied.
+			/// </summary>
+			/// <param name="roi">
+			/// Region to read, must lay within image.
+			/// </param>
+			cv::Mat Read(const cv::Rect& roi) const;
+
+			/// <summary>
+			/// Flushes changes made through views, see MappedFile::Flush.
+			/// </summary>
+			bool Flush(bool async = true) const;
+		};
+
+		/// <summary>
+		/// Maps headerless raw file.
+		/// </summary>
+		/// <param name="path">
+		/// Path to the file.
+		/// </param>
+		/// <param name="rows">
+		/// Number of image rows.
+		/// </param>
+		/// <param name="cols">
+		/// Number of image cols.
+		/// </param>
+		/// <param name="type">
+		/// [default = CV_32FC1] Single channel pixel type.
+		/// </param>
+		/// <param name="offset">
+		/// [default = 0] Offset of first pixel in bytes (e.g. to skip header).
+		/// </param>
+		/// <param name="writable">
+		/// [default = false] Whether changes through views go back to file.
+		/// </param>
+		/// <returns>
+		/// Mapped image, empty on error (missing file, too small file).
+		/// </returns>
+		MappedImage MapRaw(const std::string& path, int rows, int cols, int type = CV_32FC1, size_t offset = 0, bool writable = false);
+
+		/// <summary>
+		/// Maps .npy file, supported dtypes: f4, f8, u1, u2, i2, i4 (little
+		/// endian), C order, 2D shape.
+		/// </summary>
+		/// <returns>
+		/// Mapped image, empty on error or unsupported file.
+		/// </returns>
+		MappedImage MapNpy(const std::string& path, bool writable = false);
+
+		/// <summary>
+		/// Maps classic little endian TIFF, uncompressed, single sample per
+		/// pixel (float 32/64, unsigned/signed 8/16/32 bit), stripped or tiled.
+		/// Only first image (IFD) is mapped.
+		/// </summary>
+		/// <returns>
+		/// Mapped image, empty on error or unsupported file.
+		/// </returns>
+		MappedImage MapTiff(const std::string& path, bool writable = false);
+
+		/// <summary>
+		/// Maps file detecting its format by magic (.npy, TIFF).
+		/// </summary>
+		MappedImage Map(const std::string& path, bool writable = false);
+
+		/// <summary>
+		/// Creates file of given format and maps it writable so results can be
+		/// computed straight into it (mat is always contiguous).
+		/// </summary>
+		/// <param name="path">
+		/// Path to the file, overwritten if exists.
+		/// </param>
+		/// <param name="format">
+		/// File format.
+		/// </param>
+		/// <param name="rows">
+		/// Number of image rows.
+		/// </param>
+		/// <param name="cols">
+		/// Number of image cols.
+		/// </param>
+		/// <param name="type">
+		/// [default = CV_32FC1] Single channel pixel type.
+		/// </param>
+		/// <returns>
+		/// Mapped image, empty on error.
+		/// </returns>
+		MappedImage Create(const std::string& path, Format format, int rows, int cols, int type = CV_32FC1);
+
+		/// <summary>
+		/// Writes image to a file of given format.
+		/// </summary>
+		/// <param name="path">
+		/// Path to the file, overwritten if exists.
+		/// </param>
+		/// <param name="image">
+		/// Single channel image.
+		/// </param>
+		/// <param name="format">
+		/// File format.
+		/// </param>
+		/// <returns>
+		/// True on success.
+		/// </returns>
+		bool Write(const std::string& path, const cv::Mat& image, Format format);
+
+		/// <summary>
+		/// Writes image in background thread. Image buffer is shared (not
+		/// copied), so it must not be modified until the future is ready.
+		/// </summary>
+		std::future<bool> WriteAsync(const std::string& path, const cv::Mat& image, Format format);
+	}
+}
@@ -3,166 +3,534 @@
 #include "QualityMaps.h"
 #include "Wrappers.h"
 #include "Filters.h"
+#include "Profiling.h"
+#include "Dataset.h"
+#include "Evaluation.h"
+#include "SelfCheck.h"
+#include "Server.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace pu;
 
-int main()
+namespace
 {
-	cv::namedWindow("VerticalPlane", cv::WINDOW_NORMAL);
-	cv::namedWindow("HorizontalPlane", cv::WINDOW_NORMAL);
-	cv::namedWindow("ShearPlanes", cv::WINDOW_NORMAL);
-	cv::namedWindow("SpiralShear", cv::WINDOW_NORMAL);
-	cv::namedWindow("Peaks", cv::WINDOW_NORMAL);
-
-	cv::Mat verticalplane = VerticalPlane();
-	cv::Mat horizontalplane = HorizontalPlane();
-	cv::Mat shearplane = ShearPlanes();
-	cv::Mat spiralshear = SpiralShear();
-	cv::Mat peaks = Peaks();
-
-	cv::imshow("VerticalPlane", ToDisplayable(verticalplane));
-	cv::imshow("HorizontalPlane", ToDisplayable(horizontalplane));
-	cv::imshow("ShearPlanes", ToDisplayable(shearplane));
-	cv::imshow("SpiralShear", ToDisplayable(spiralshear));
-	cv::imshow("Peaks", ToDisplayable(peaks));
-	cv::waitKey(0);
-
-	verticalplane = Wrap(verticalplane);
-	horizontalplane = Wrap(horizontalplane);
-	shearplane = Wrap(shearplane);
-	spiralshear = Wrap(spiralshear);
-	peaks = Wrap(peaks);
-
-	cv::imshow("VerticalPlane", verticalplane);
-	cv::imshow("HorizontalPlane", horizontalplane);
-	cv::imshow("ShearPlanes", shearplane);
-	cv::imshow("SpiralShear", spiralshear);
-	cv::imshow("Peaks", peaks);
-	cv::waitKey(0);
-	/*
-	int k = 5;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
-	cv::waitKey(0);
-
-	k = 9;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
-	cv::waitKey(0);
-
-	k = 5;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
-	cv::waitKey(0);
-
-	k = 9;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
-	cv::waitKey(0);
-
-	AddSaltPepperNoise(verticalplane);
-	AddSaltPepperNoise(horizontalplane);
-	AddSaltPepperNoise(shearplane);
-	AddSaltPepperNoise(spiralshear);
-	AddSaltPepperNoise(peaks);
-	cv::imshow("VerticalPlane", ToDisplayable(verticalplane));
-	cv::imshow("HorizontalPlane", ToDisplayable(horizontalplane));
-	cv::imshow("ShearPlanes", ToDisplayable(shearplane));
-	cv::imshow("SpiralShear", ToDisplayable(spiralshear));
-	cv::imshow("Peaks", ToDisplayable(peaks));
-	cv::waitKey(0);
+	/// <summary>
+	/// Command options given as --name value pairs
+	/// </summary>
+	typedef std::map<std::string, std::string> Arguments;
+
+	Arguments ParseArguments(int argc, char** argv, int first)
+	{
+		Arguments args;
+		for(int i = first; i < argc; i++)
+		{
+			std::string name = argv[i];
+			if(name.compare(0, 2, "--") != 0)
+			{
+				continue;
+			}
+
+			// Options without value are switches
+			bool has_value = i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0;
+			args[name.substr(2)] = has_value ? argv[++i] : "1";
+		}
+		return args;
+	}
+
+	std::string Get(const Arguments& args, const std::string& name, const std::string& default_value)
+	{
+		auto it = args.find(name);
+		return it != args.end() ? it->second : default_value;
+	}
+
+	void Usage()
+	{
+		std::cout <<
+			"Usage:\n"
+			"  PhaseUnwrapping                     interactive demo\n"
+			"  PhaseUnwrapping generate <prefix>   generate dataset\n"
+			"      --surface vertical|horizontal|shear|spiral|peaks (peaks)\n"
+			"      --rows N --cols N (4096) --min R --max R (-10PI, 10PI)\n"
+			"      --noise none|gaussian|speckle|phase (phase) --sigma S (0.3)\n"
+			"      --seed N --band N (256) --format npy|tiff|raw (npy)\n"
+			"  PhaseUnwrapping evaluate            compare unwrappers with ground truth\n"
+			"      --rows N --cols N (512) --noise-levels S,S,... (0,0.3,0.6,1)\n"
+			"      --surfaces vertical,shear,... (vertical,shear,spiral,peaks)\n"
+			"      --seed N --repeats N (1)\n"
+			"  PhaseUnwrapping selfcheck           check fast paths against references, exit code 1 on failure\n"
+			"      --rows N (96) --cols N (128) --seed N\n"
+			"  PhaseUnwrapping serve               run unwrapping daemon until SIGINT/SIGTERM\n"
+			"      --socket PATH (/tmp/phase_unwrapping.sock) --workers N (2) --queue N (64)\n"
+			"      --quiet\n"
+			"  PhaseUnwrapping client              send synthetic frames to the daemon\n"
+			"      --socket PATH --frames N (8) --rows N --cols N (512)\n"
+			"      --operation auto|itoh|ls|quality|branchcut (auto)\n"
+			"      --surface vertical|horizontal|shear|spiral|peaks (peaks) --sigma S (0.3)\n";
+	}
+
+	/// <summary>
+	/// Splits comma separated list
+	/// </summary>
+	std::vector<std::string> Split(const std::string& list)
+	{
+		std::vector<std::string> items;
+		std::istringstream stream(list);
+		std::string item;
+		while(std::getline(stream, item, ','))
+		{
+			if(!item.empty()) items.push_back(item);
+		}
+		return items;
+	}
+
+	const std::map<std::string, Surface>& Surfaces()
+	{
+		static const std::map<std::string, Surface> surfaces = {
+			{ "vertical", Surface::VerticalPlane },
+			{ "horizontal", Surface::HorizontalPlane },
+			{ "shear", Surface::ShearPlanes },
+			{ "spiral", Surface::SpiralShear },
+			{ "peaks", Surface::Peaks }
+		};
+		return surfaces;
+	}
+
+	int Generate(const std::string& prefix, const Arguments& args)
+	{
+		const std::map<std::string, Surface>& surfaces = Surfaces();
+		static const std::map<std::string, NoiseType> noises = {
+			{ "none", NoiseType::None },
+			{ "gaussian", NoiseType::Gaussian },
+			{ "speckle", NoiseType::Speckle },
+			{ "phase", NoiseType::Phase }
+		};
+		static const std::map<std::string, io::Format> formats = {
+			{ "npy", io::Format::Npy },
+			{ "tiff", io::Format::Tiff },
+			{ "raw", io::Format::Raw }
+		};
+
+		DatasetOptions options;
+		auto surface = surfaces.find(Get(args, "surface", "peaks"));
+		auto noise = noises.find(Get(args, "noise", "phase"));
+		auto format = formats.find(Get(args, "format", "npy"));
+		if(surface == surfaces.end() || noise == noises.end() || format == formats.end())
+		{
+			Usage();
+			return 1;
+		}
+
+		options.surface = surface->second;
+		options.noise = noise->second;
+		options.format = format->second;
+		options.rows = std::stoi(Get(args, "rows", std::to_string(options.rows)));
+		options.cols = std::stoi(Get(args, "cols", std::to_string(options.cols)));
+		options.minVal = std::stof(Get(args, "min", std::to_string(options.minVal)));
+		options.maxVal = std::stof(Get(args, "max", std::to_string(options.maxVal)));
+		options.sigma = std::stof(Get(args, "sigma", std::to_string(options.sigma)));
+		options.seed = std::stoull(Get(args, "seed", std::to_string(options.seed)));
+		options.band_rows = std::stoi(Get(args, "band", std::to_string(options.band_rows)));
+
+		if(!GenerateDataset(prefix, options))
+		{
+			std::cerr << "Could not write dataset " << prefix << std::endl;
+			return 1;
+		}
+
+		DatasetFiles files = GetDatasetFiles(prefix, options.format);
+		std::cout << files.truth << "\n" << files.wrapped << "\n" << files.noisy << "\n" << files.residues << std::endl;
+		return 0;
+	}
+
+	int Evaluate(const Arguments& args)
+	{
+		evaluation::Options options;
+		options.rows = std::stoi(Get(args, "rows", std::to_string(options.rows)));
+		options.cols = std::stoi(Get(args, "cols", std::to_string(options.cols)));
+		options.seed = std::stoull(Get(args, "seed", std::to_string(options.seed)));
+		options.repeats = std::stoi(Get(args, "repeats", std::to_string(options.repeats)));
+
+		if(args.count("noise-levels"))
+		{
+			options.noise_levels.clear();
+			for(const std::string& level : Split(args.at("noise-levels")))
+			{
+				options.noise_levels.push_back(std::stof(level));
+			}
+		}
+
+		if(args.count("surfaces"))
+		{
+			options.surfaces.clear();
+			for(const std::string& name : Split(args.at("surfaces")))
+			{
+				auto surface = Surfaces().find(name);
+				if(surface == Surfaces().end())
+				{
+					Usage();
+					return 1;
+				}
+				options.surfaces.push_back(surface->second);
+			}
+		}
+
+		std::cout << evaluation::FormatTable(evaluation::Evaluate(options));
+		return 0;
+	}
+
+	int SelfCheck(const Arguments& args)
+	{
+		evaluation::SelfCheckOptions options;
+		options.rows = std::stoi(Get(args, "rows", std::to_string(options.rows)));
+		options.cols = std::stoi(Get(args, "cols", std::to_string(options.cols)));
+		options.seed = std::stoull(Get(args, "seed", std::to_string(options.seed)));
+		if(options.rows < 16 || options.cols < 16)
+		{
+			Usage();
+			return 1;
+		}
+
+		std::vector<evaluation::Check> checks = evaluation::SelfCheck(options);
+		std::cout << evaluation::FormatChecks(checks);
+		return evaluation::Passed(checks) ? 0 : 1;
+	}
+
+	volatile std::sig_atomic_t stop_requested = 0;
+
+	void RequestStop(int)
+	{
+		stop_requested = 1;
+	}
+
+	int Serve(const Arguments& args)
+	{
+		server::ServerOptions options;
+		options.socket_path = Get(args, "socket", options.socket_path);
+		options.workers = std::stoi(Get(args, "workers", std::to_string(options.workers)));
+		options.queue_capacity = std::stoul(Get(args, "queue", std::to_string(options.queue_capacity)));
+		options.log = !args.count("quiet");
+
+		server::Server daemon(options);
+		if(!daemon.Start())
+		{
+			std::cerr << "Could not listen on " << options.socket_path << std::endl;
+			return 1;
+		}
+		std::clog << "Listening on " << options.socket_path << " with " << options.workers << " workers" << std::endl;
+
+		std::signal(SIGINT, RequestStop);
+		std::signal(SIGTERM, RequestStop);
+		while(!stop_requested)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		daemon.Stop();
+		return 0;
+	}
+
+	int Client(const Arguments& args)
+	{
+		static const std::map<std::string, server::Operation> operations = {
+			{ "auto", server::Operation::Auto },
+			{ "itoh", server::Operation::Itoh },
+			{ "ls", server::Operation::LeastSquares },
+			{ "quality", server::Operation::QualityGuided },
+			{ "branchcut", server::Operation::BranchCut }
+		};
+
+		auto operation = operations.find(Get(args, "operation", "auto"));
+		auto surface = Surfaces().find(Get(args, "surface", "peaks"));
+		if(operation == operations.end() || surface == Surfaces().end())
+		{
+			Usage();
+			return 1;
+		}
+
+		const int rows = std::stoi(Get(args, "rows", "512"));
+		const int cols = std::stoi(Get(args, "cols", "512"));
+		const int count = std::stoi(Get(args, "frames", "8"));
+		const float sigma = std::stof(Get(args, "sigma", "0.3"));
+
+		server::Client client;
+		if(!client.Connect(Get(args, "socket", server::DEFAULT_SOCKET_PATH)))
+		{
+			std::cerr << "Could not connect to the server" << std::endl;
+			return 1;
+		}
+
+		// Each frame gets its own noise and shared memory object, all of them
+		// are sent at once and answered as the workers finish
+		cv::Mat truth = GenerateSurface(surface->second, cv::Rect(0, 0, cols, rows), rows, cols);
+		std::vector<std::unique_ptr<server::SharedFrame>> frames;
+		const std::string prefix = "/pu_client_" + std::to_string(cv::getTickCount() % 1000000007) + "_";
+		for(int i = 0; i < count; i++)
+		{
+			frames.emplace_back(new server::SharedFrame());
+			std::string name = prefix + std::to_string(i);
+			if(!frames.back()->Create(name, rows, cols))
+			{
+				std::cerr << "Could not create shared memory " << name << std::endl;
+				return 1;
+			}
+
+			cv::Mat noisy = truth.clone();
+			AddNoise(noisy, NoiseType::Phase, sigma, DEFAULT_NOISE_SEED + i, cv::Point(0, 0), cols);
+			WrapNormalized(noisy).copyTo(frames.back()->Input());
+		}
+
+		int64_t start = cv::getTickCount();
+		for(int i = 0; i < count; i++)
+		{
+			client.Send(frames[i]->MakeRequest(operation->second, static_cast<uint64_t>(i)));
+		}
+
+		int failed = 0;
+		for(int i = 0; i < count; i++)
+		{
+			server::Response response;
+			if(!client.Receive(response))
+			{
+				std::cerr << "Connection closed" << std::endl;
+				return 1;
+			}
+
+			char line[256];
+			if(response.status != server::Status::Ok || response.id >= frames.size())
+			{
+				std::snprintf(line, sizeof(line), "frame %llu: %s\n", static_cast<unsigned long long>(response.id), server::StatusName(response.status));
+				std::cout << line;
+				failed++;
+				continue;
+			}
+
+			evaluation::Accuracy accuracy = evaluation::Compare(frames[response.id]->Output(), truth);
+			std::snprintf(line, sizeof(line), "frame %llu: %-13s correct %6.2f%%  queued %7.2f ms  compute %7.2f ms  total %7.2f ms\n",
+						  static_cast<unsigned long long>(response.id), unwrappers::MethodName(response.method),
+						  accuracy.correct * 100.0, response.timings.queued * 1e3, response.timings.compute * 1e3, response.timings.total * 1e3);
+			std::cout << line;
+		}
+
+		double seconds = static_cast<double>(cv::getTickCount() - start) / cv::getTickFrequency();
+		std::cout << count << " frames in " << seconds * 1e3 << " ms" << std::endl;
+		return failed ? 1 : 0;
+	}
+
+	int Demo()
+	{
+		cv::namedWindow("VerticalPlane", cv::WINDOW_NORMAL);
+		cv::namedWindow("HorizontalPlane", cv::WINDOW_NORMAL);
+		cv::namedWindow("ShearPlanes", cv::WINDOW_NORMAL);
+		cv::namedWindow("SpiralShear", cv::WINDOW_NORMAL);
+		cv::namedWindow("Peaks", cv::WINDOW_NORMAL);
+
+		cv::Mat verticalplane = VerticalPlane();
+		cv::Mat horizontalplane = HorizontalPlane();
+		cv::Mat shearplane = ShearPlanes();
+		cv::Mat spiralshear = SpiralShear();
+		cv::Mat peaks = Peaks();
+
+		cv::imshow("VerticalPlane", ToDisplayable(verticalplane));
+		cv::imshow("HorizontalPlane", ToDisplayable(horizontalplane));
+		cv::imshow("ShearPlanes", ToDisplayable(shearplane));
+		cv::imshow("SpiralShear", ToDisplayable(spiralshear));
+		cv::imshow("Peaks", ToDisplayable(peaks));
+		cv::waitKey(0);
+
+		verticalplane = Wrap(verticalplane);
+		horizontalplane = Wrap(horizontalplane);
+		shearplane = Wrap(shearplane);
+		spiralshear = Wrap(spiralshear);
+		peaks = Wrap(peaks);
+
+		cv::imshow("VerticalPlane", verticalplane);
+		cv::imshow("HorizontalPlane", horizontalplane);
+		cv::imshow("ShearPlanes", shearplane);
+		cv::imshow("SpiralShear", spiralshear);
+		cv::imshow("Peaks", peaks);
+		cv::waitKey(0);
+		/*
+		int k = 5;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
+		cv::waitKey(0);
+
+		k = 9;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
+		cv::waitKey(0);
+
+		k = 5;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
+		cv::waitKey(0);
+
+		k = 9;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
+		cv::waitKey(0);
+
+		// Different seed for each image so noise patterns differ
+		AddSaltPepperNoise(verticalplane, 0.01f, DEFAULT_NOISE_SEED);
+		AddSaltPepperNoise(horizontalplane, 0.01f, DEFAULT_NOISE_SEED + 1);
+		AddSaltPepperNoise(shearplane, 0.01f, DEFAULT_NOISE_SEED + 2);
+		AddSaltPepperNoise(spiralshear, 0.01f, DEFAULT_NOISE_SEED + 3);
+		AddSaltPepperNoise(peaks, 0.01f, DEFAULT_NOISE_SEED + 4);
+		cv::imshow("VerticalPlane", ToDisplayable(verticalplane));
+		cv::imshow("HorizontalPlane", ToDisplayable(horizontalplane));
+		cv::imshow("ShearPlanes", ToDisplayable(shearplane));
+		cv::imshow("SpiralShear", ToDisplayable(spiralshear));
+		cv::imshow("Peaks", ToDisplayable(peaks));
+		cv::waitKey(0);
 	
-	k = 5;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
-	cv::waitKey(0);
-
-	k = 9;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
-	cv::waitKey(0);
-
-	k = 5;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
-	cv::waitKey(0);
-
-	k = 9;
-	cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
-	cv::waitKey(0);
-	*/
-	int k = 3;
-	cv::imshow("VerticalPlane", ToDisplayable(filters::MeanPhaseFilter(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(filters::MeanPhaseFilter(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(filters::MeanPhaseFilter(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(filters::MeanPhaseFilter(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(filters::MeanPhaseFilter(peaks, k)));
-	cv::waitKey(0);
-
-	k = 5;
-	cv::imshow("VerticalPlane", ToDisplayable(filters::MeanPhaseFilter(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(filters::MeanPhaseFilter(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(filters::MeanPhaseFilter(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(filters::MeanPhaseFilter(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(filters::MeanPhaseFilter(peaks, k)));
-	cv::waitKey(0);
-
-	k = 9;
-	cv::imshow("VerticalPlane", ToDisplayable(filters::MeanPhaseFilter(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(filters::MeanPhaseFilter(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(filters::MeanPhaseFilter(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(filters::MeanPhaseFilter(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(filters::MeanPhaseFilter(peaks, k)));
-	cv::waitKey(0);
-
-	k = 3;
-	cv::imshow("VerticalPlane", ToDisplayable(filters::MedianPhaseFilter(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(filters::MedianPhaseFilter(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(filters::MedianPhaseFilter(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(filters::MedianPhaseFilter(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(filters::MedianPhaseFilter(peaks, k)));
-	cv::waitKey(0);
-
-	k = 5;
-	cv::imshow("VerticalPlane", ToDisplayable(filters::MedianPhaseFilter(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(filters::MedianPhaseFilter(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(filters::MedianPhaseFilter(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(filters::MedianPhaseFilter(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(filters::MedianPhaseFilter(peaks, k)));
-	cv::waitKey(0);
-
-	k = 9;
-	cv::imshow("VerticalPlane", ToDisplayable(filters::MedianPhaseFilter(verticalplane, k)));
-	cv::imshow("HorizontalPlane", ToDisplayable(filters::MedianPhaseFilter(horizontalplane, k)));
-	cv::imshow("ShearPlanes", ToDisplayable(filters::MedianPhaseFilter(shearplane, k)));
-	cv::imshow("SpiralShear", ToDisplayable(filters::MedianPhaseFilter(spiralshear, k)));
-	cv::imshow("Peaks", ToDisplayable(filters::MedianPhaseFilter(peaks, k)));
-	cv::waitKey(0);
-
-	cv::destroyAllWindows();
+		k = 5;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
+		cv::waitKey(0);
+
+		k = 9;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::PDV(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::PDV(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::PDV(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::PDV(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::PDV(peaks, k)));
+		cv::waitKey(0);
+
+		k = 5;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
+		cv::waitKey(0);
+
+		k = 9;
+		cv::imshow("VerticalPlane", ToDisplayable(quality_maps::MaxAbsGrad(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(quality_maps::MaxAbsGrad(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(quality_maps::MaxAbsGrad(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(quality_maps::MaxAbsGrad(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(quality_maps::MaxAbsGrad(peaks, k)));
+		cv::waitKey(0);
+		*/
+		int k = 3;
+		cv::imshow("VerticalPlane", ToDisplayable(filters::MeanPhaseFilter(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(filters::MeanPhaseFilter(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(filters::MeanPhaseFilter(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(filters::MeanPhaseFilter(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(filters::MeanPhaseFilter(peaks, k)));
+		cv::waitKey(0);
+
+		k = 5;
+		cv::imshow("VerticalPlane", ToDisplayable(filters::MeanPhaseFilter(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(filters::MeanPhaseFilter(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(filters::MeanPhaseFilter(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(filters::MeanPhaseFilter(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(filters::MeanPhaseFilter(peaks, k)));
+		cv::waitKey(0);
+
+		k = 9;
+		cv::imshow("VerticalPlane", ToDisplayable(filters::MeanPhaseFilter(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(filters::MeanPhaseFilter(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(filters::MeanPhaseFilter(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(filters::MeanPhaseFilter(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(filters::MeanPhaseFilter(peaks, k)));
+		cv::waitKey(0);
+
+		k = 3;
+		cv::imshow("VerticalPlane", ToDisplayable(filters::MedianPhaseFilter(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(filters::MedianPhaseFilter(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(filters::MedianPhaseFilter(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(filters::MedianPhaseFilter(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(filters::MedianPhaseFilter(peaks, k)));
+		cv::waitKey(0);
+
+		k = 5;
+		cv::imshow("VerticalPlane", ToDisplayable(filters::MedianPhaseFilter(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(filters::MedianPhaseFilter(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(filters::MedianPhaseFilter(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(filters::MedianPhaseFilter(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(filters::MedianPhaseFilter(peaks, k)));
+		cv::waitKey(0);
+
+		k = 9;
+		cv::imshow("VerticalPlane", ToDisplayable(filters::MedianPhaseFilter(verticalplane, k)));
+		cv::imshow("HorizontalPlane", ToDisplayable(filters::MedianPhaseFilter(horizontalplane, k)));
+		cv::imshow("ShearPlanes", ToDisplayable(filters::MedianPhaseFilter(shearplane, k)));
+		cv::imshow("SpiralShear", ToDisplayable(filters::MedianPhaseFilter(spiralshear, k)));
+		cv::imshow("Peaks", ToDisplayable(filters::MedianPhaseFilter(peaks, k)));
+		cv::waitKey(0);
+
+		cv::destroyAllWindows();
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int result = 0;
+	std::string command = argc > 1 ? argv[1] : "";
+
+	if(command.empty())
+	{
+		result = Demo();
+	}
+	else if(command == "generate" && argc > 2)
+	{
+		result = Generate(argv[2], ParseArguments(argc, argv, 3));
+	}
+	else if(command == "evaluate")
+	{
+		result = Evaluate(ParseArguments(argc, argv, 2));
+	}
+	else if(command == "selfcheck")
+	{
+		result = SelfCheck(ParseArguments(argc, argv, 2));
+	}
+	else if(command == "serve")
+	{
+		result = Serve(ParseArguments(argc, argv, 2));
+	}
+	else if(command == "client")
+	{
+		result = Client(ParseArguments(argc, argv, 2));
+	}
+	else
+	{
+		Usage();
+		result = 1;
+	}
+
+	// Dump instrumentation if it was compiled in (PU_PROFILING)
+	if(profiling::Enabled())
+	{
+		std::cout << profiling::Format(profiling::Collect());
+		profiling::ExportChromeTrace("trace.json");
+	}
+
+	return result;
 }
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "Masks.h"
+#include "Gradients.h"
+#include "Parallel.h"
+#include "Profiling.h"
+
+#include <atomic>
+
+namespace pu
+{
+	namespace masks
+	{
+		namespace
+		{
+			/// <summary>
+			/// Charge of the loop with top left corner in (row, col), floating
+			/// point phase. Sum of wrapped gradients is a whole number of cycles.
+			/// </summary>
+			inline signed char Charge(const float* top, const float* bottom, int col)
+			{
+				float sum = Gradient(top[col + 1], top[col])
+					+ Gradient(bottom[col + 1], top[col + 1])
+					+ Gradient(bottom[col], bottom[col + 1])
+					+ Gradient(top[col], bottom[col]);
+				return static_cast<signed char>(std::floor(sum + 0.5f));
+			}
+
+			/// <summary>
+			/// Charge of the loop, fixed point phase (sum is a multiple of 65536)
+			/// </summary>
+			inline signed char Charge(const unsigned short* top, const unsigned short* bottom, int col)
+			{
+				int sum = Gradient(top[col + 1], top[col])
+					+ Gradient(bottom[col + 1], top[col + 1])
+					+ Gradient(bottom[col], bottom[col + 1])
+					+ Gradient(top[col], bottom[col]);
+				return static_cast<signed char>(sum / 65536);
+			}
+
+			template<typename T>
+			void ComputeResidues(const cv::Mat& wrapped, cv::Mat& residues)
+			{
+				parallel::ForRows(cv::Range(0, wrapped.rows - 1), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						const T* top = wrapped.ptr<T>(row);
+						const T* bottom = wrapped.ptr<T>(row + 1);
+						signed char* dst = residues.ptr<signed char>(row);
+						for(int col = 0; col < wrapped.cols - 1; col++)
+						{
+							dst[col] = Charge(top, bottom, col);
+						}
+					}
+				});
+			}
+		}
+
+		cv::Mat Residues(const cv::Mat & wrapped)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[Residues] Invalid wrapped phase image");
+
+			PU_PROFILE_SCOPE("Residues");
+
+			cv::Mat residues = parallel::Allocate(wrapped.rows, wrapped.cols, CV_8SC1);
+			PU_PROFILE_COUNT("Residues", Allocations, 1);
+			PU_PROFILE_COUNT("Residues", PixelsProcessed, wrapped.rows * wrapped.cols);
+
+			if(wrapped.type() == CV_16UC1)
+			{
+				ComputeResidues<unsigned short>(wrapped, residues);
+			}
+			else
+			{
+				ComputeResidues<float>(wrapped, residues);
+			}
+
+			return residues;
+		}
+
+		int MarkResidues(const cv::Mat & wrapped, cv::Mat & bitflags)
+		{
+			if(bitflags.empty())
+			{
+				bitflags = cv::Mat(wrapped.rows, wrapped.cols, CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1), cv::Scalar(0));
+			}
+
+			assert(bitflags.type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+				   bitflags.size() == wrapped.size() &&
+				   "[MarkResidues] Invalid bitflags image");
+
+			cv::Mat residues = Residues(wrapped);
+
+			std::atomic<int> count{ 0 };
+			parallel::ForRows(cv::Range(0, residues.rows), [&](const cv::Range& range) {
+				int found = 0;
+				for(int row = range.start; row < range.end; row++)
+				{
+					const signed char* src = residues.ptr<signed char>(row);
+					bitflag_type* dst = bitflags.ptr<bitflag_type>(row);
+					for(int col = 0; col < residues.cols; col++)
+					{
+						if(src[col] > 0) dst[col] |= PositiveResidue;
+						else if(src[col] < 0) dst[col] |= NegativeResidue;
+						found += src[col] != 0;
+					}
+				}
+				count += found;
+			});
+
+			PU_PROFILE_COUNT("MarkResidues", ResiduesFound, count.load());
+
+			return count;
+		}
+	}
+}
@@ -1,10 +1,41 @@
 #pragma once
-#include <opencv2\opencv.hpp>
+#include "Bitflags.h"
+#include <opencv2/opencv.hpp>
 
 namespace pu
 {
 	namespace masks
 	{
+		/// <summary>
+		/// Computes residues of wrapped phase. Residue charge is the sum of
+		/// wrapped gradients around the 2x2 loop (row, col) -> (row, col + 1)
+		/// -> (row + 1, col + 1) -> (row + 1, col) -> (row, col), in cycles.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, 1 channel, floating point, range [0, 1],
+		/// or 16-bit fixed point (CV_16UC1).
+		/// </param>
+		/// <returns>
+		/// Image of residue charges, same size as wrapped phase, CV_8SC1,
+		/// values -1, 0, 1 stored at top left pixel of the loop. Last row
+		/// and column (no loop) are 0.
+		/// </returns>
+		cv::Mat Residues(const cv::Mat& wrapped);
 
+		/// <summary>
+		/// Marks residues (see Residues) in bitflags with PositiveResidue and
+		/// NegativeResidue flags, other flags are left untouched.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see Residues.
+		/// </param>
+		/// <param name="bitflags">
+		/// Bitflags image, same size as wrapped phase, allocated (zeroed) if
+		/// empty.
+		/// </param>
+		/// <returns>
+		/// Number of residues found.
+		/// </returns>
+		int MarkResidues(const cv::Mat& wrapped, cv::Mat& bitflags);
 	}
 }
\ No newline at end of file
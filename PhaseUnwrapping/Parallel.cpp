@@ -0,0 +1,417 @@
+#include "Parallel.h"
+#include "Profiling.h"
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace pu
+{
+	namespace parallel
+	{
+		namespace
+		{
+			const size_t DEFAULT_CACHE_SIZE = 512 * 1024;
+
+			/// <summary>
+			/// Nesting depth of tasks on this thread, loops started from a task
+			/// run serially
+			/// </summary>
+			thread_local int task_depth = 0;
+
+			int HardwareThreads()
+			{
+				return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+			}
+
+			/// <summary>
+			/// Binds calling thread to the logical CPU
+			/// </summary>
+			void Pin(int cpu)
+			{
+#if defined(_WIN32)
+				SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (cpu % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+				(void)cpu;
+#endif
+			}
+
+			/// <summary>
+			/// Tasks [begin, end) of a thread, the owner takes them from the
+			/// front, thieves from the back
+			/// </summary>
+			struct Queue
+			{
+				std::mutex mutex;
+				int begin = 0;
+				int end = 0;
+			};
+
+			class Pool
+			{
+			public:
+				Pool(int threads, bool pin)
+				{
+					for(int i = 0; i < threads; i++)
+					{
+						queues.emplace_back(new Queue());
+					}
+
+					// Thread 0 is the one calling Run
+					for(int i = 1; i < threads; i++)
+					{
+						workers.emplace_back([this, i, pin] {
+							if(pin) Pin(i % HardwareThreads());
+							WorkLoop(i);
+						});
+					}
+				}
+
+				~Pool()
+				{
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						stopping = true;
+					}
+					start.notify_all();
+
+					for(std::thread& worker : workers)
+					{
+						worker.join();
+					}
+				}
+
+				int Threads() const { return static_cast<int>(queues.size()); }
+
+				void Run(int tasks, const std::function<void(int)>& task)
+				{
+					// Nested loop or another thread's loop in progress
+					std::unique_lock<std::mutex> running(run_mutex, std::defer_lock);
+					if(tasks == 1 || Threads() == 1 || task_depth > 0 || !running.try_lock())
+					{
+						task_depth++;
+						try
+						{
+							for(int i = 0; i < tasks; i++)
+							{
+								task(i);
+							}
+						}
+						catch(...)
+						{
+							task_depth--;
+							throw;
+						}
+						task_depth--;
+						return;
+					}
+
+					// Contiguous blocks, the same for the same task count, so that
+					// threads revisit data they touched in previous loops
+					const int threads = Threads();
+					for(int i = 0; i < threads; i++)
+					{
+						std::lock_guard<std::mutex> lock(queues[i]->mutex);
+						queues[i]->begin = static_cast<int>(static_cast<long long>(tasks) * i / threads);
+						queues[i]->end = static_cast<int>(static_cast<long long>(tasks) * (i + 1) / threads);
+					}
+
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						job = &task;
+						error = nullptr;
+						active = threads - 1;
+						generation++;
+					}
+					start.notify_all();
+
+					Work(0);
+
+					std::exception_ptr failure;
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						done.wait(lock, [this] { return active == 0; });
+						job = nullptr;
+						failure = error;
+					}
+
+					if(failure)
+					{
+						std::rethrow_exception(failure);
+					}
+				}
+
+			private:
+				void WorkLoop(int index)
+				{
+					unsigned long long seen = 0;
+					while(true)
+					{
+						{
+							std::unique_lock<std::mutex> lock(mutex);
+							start.wait(lock, [&] { return stopping || generation != seen; });
+							if(stopping) return;
+							seen = generation;
+						}
+
+						Work(index);
+
+						{
+							std::lock_guard<std::mutex> lock(mutex);
+							if(--active == 0) done.notify_one();
+						}
+					}
+				}
+
+				/// <summary>
+				/// Runs tasks of own queue, then steals until all queues are empty
+				/// </summary>
+				void Work(int index)
+				{
+					task_depth++;
+
+					int task;
+					bool stolen;
+					while(Next(index, task, stolen))
+					{
+						if(stolen)
+						{
+							PU_PROFILE_COUNT("ParallelTask", TasksStolen, 1);
+						}
+
+						try
+						{
+							PU_PROFILE_SCOPE("ParallelTask");
+							(*job)(task);
+						}
+						catch(...)
+						{
+							std::lock_guard<std::mutex> lock(mutex);
+							if(!error) error = std::current_exception();
+						}
+					}
+
+					task_depth--;
+				}
+
+				bool Next(int index, int& task, bool& stolen)
+				{
+					{
+						Queue& own = *queues[index];
+						std::lock_guard<std::mutex> lock(own.mutex);
+						if(own.begin < own.end)
+						{
+							task = own.begin++;
+							stolen = false;
+							return true;
+						}
+					}
+
+					const int threads = Threads();
+					for(int k = 1; k < threads; k++)
+					{
+						Queue& victim = *queues[(index + k) % threads];
+						std::lock_guard<std::mutex> lock(victim.mutex);
+						if(victim.begin < victim.end)
+						{
+							task = --victim.end;
+							stolen = true;
+							return true;
+						}
+					}
+
+					return false;
+				}
+
+				std::vector<std::unique_ptr<Queue>> queues;
+				std::vector<std::thread> workers;
+
+				// Held by the thread running a loop
+				std::mutex run_mutex;
+
+				std::mutex mutex;
+				std::condition_variable start;
+				std::condition_variable done;
+				const std::function<void(int)>* job = nullptr;
+				unsigned long long generation = 0;
+				int active = 0;
+				bool stopping = false;
+				std::exception_ptr error;
+			};
+
+			struct Settings
+			{
+				std::mutex mutex;
+				std::shared_ptr<Pool> pool;
+				int threads = 0;
+				bool pin = false;
+				cv::Size tile;
+			};
+
+			Settings& GetSettings()
+			{
+				static Settings settings;
+				return settings;
+			}
+
+			/// <summary>
+			/// Current pool, shared so that a loop keeps its pool alive even if
+			/// SetThreadCount or SetAffinity replaces it meanwhile
+			/// </summary>
+			std::shared_ptr<Pool> GetPool()
+			{
+				Settings& settings = GetSettings();
+				std::lock_guard<std::mutex> lock(settings.mutex);
+				if(!settings.pool)
+				{
+					settings.pool = std::make_shared<Pool>(settings.threads > 0 ? settings.threads : HardwareThreads(), settings.pin);
+				}
+				return settings.pool;
+			}
+
+			/// <summary>
+			/// Drops the pool, next loop creates it with current settings. Loops
+			/// still running finish on the old pool, it stops with the last one.
+			/// </summary>
+			void ResetPool()
+			{
+				Settings& settings = GetSettings();
+				std::shared_ptr<Pool> pool;
+				{
+					std::lock_guard<std::mutex> lock(settings.mutex);
+					pool.swap(settings.pool);
+				}
+			}
+		}
+
+		int ThreadCount()
+		{
+			return GetPool()->Threads();
+		}
+
+		void SetThreadCount(int threads)
+		{
+			{
+				std::lock_guard<std::mutex> lock(GetSettings().mutex);
+				GetSettings().threads = threads;
+			}
+			ResetPool();
+
+			cv::setNumThreads(threads > 0 ? threads : -1);
+		}
+
+		int ThreadCountSetting()
+		{
+			std::lock_guard<std::mutex> lock(GetSettings().mutex);
+			return GetSettings().threads;
+		}
+
+		void SetAffinity(bool pin)
+		{
+			{
+				std::lock_guard<std::mutex> lock(GetSettings().mutex);
+				if(GetSettings().pin == pin) return;
+				GetSettings().pin = pin;
+			}
+			ResetPool();
+		}
+
+		bool Affinity()
+		{
+			std::lock_guard<std::mutex> lock(GetSettings().mutex);
+			return GetSettings().pin;
+		}
+
+		size_t CacheSize()
+		{
+			static const size_t size = [] {
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+				long detected = sysconf(_SC_LEVEL2_CACHE_SIZE);
+				if(detected > 0) return static_cast<size_t>(detected);
+#endif
+				return DEFAULT_CACHE_SIZE;
+			}();
+			return size;
+		}
+
+		void SetTileSize(cv::Size tile)
+		{
+			std::lock_guard<std::mutex> lock(GetSettings().mutex);
+			GetSettings().tile = tile;
+		}
+
+		cv::Size TileSize(cv::Size image, int bytes_per_pixel)
+		{
+			{
+				std::lock_guard<std::mutex> lock(GetSettings().mutex);
+				const cv::Size& tile = GetSettings().tile;
+				if(tile.width > 0 && tile.height > 0)
+				{
+					return cv::Size(std::min(tile.width, image.width), std::min(tile.height, image.height));
+				}
+			}
+
+			const size_t budget = CacheSize() / 2;
+			const size_t pixel = static_cast<size_t>(std::max(bytes_per_pixel, 1));
+
+			// Columns are split evenly, in whole words of 64 pixels
+			int width = image.width;
+			if(static_cast<size_t>(width) * pixel * 16 > budget)
+			{
+				int widest = std::max(64, static_cast<int>(budget / (pixel * 16)));
+				int strips = (image.width + widest - 1) / widest;
+				width = std::min((image.width / strips + 63) / 64 * 64, image.width);
+			}
+
+			int height = static_cast<int>(std::min<size_t>(budget / (static_cast<size_t>(width) * pixel), image.height));
+			height = std::max(height, 1);
+
+			// Enough tiles for stealing to balance the load
+			const int across = (image.width + width - 1) / width;
+			const int wanted = ThreadCount() * 4;
+			if(across * ((image.height + height - 1) / height) < wanted)
+			{
+				height = std::max(1, image.height * across / wanted);
+			}
+
+			return cv::Size(width, height);
+		}
+
+		void Run(int tasks, const std::function<void(int)>& task)
+		{
+			if(tasks <= 0) return;
+			std::shared_ptr<Pool> pool = GetPool();
+			pool->Run(tasks, task);
+		}
+
+		cv::Mat Allocate(int rows, int cols, int type, const cv::Scalar & value)
+		{
+			cv::Mat image{ rows, cols, type };
+			ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				image.rowRange(range.start, range.end).setTo(value);
+			});
+			return image;
+		}
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+
+namespace pu
+{
+	/// <summary>
+	/// Project wide parallel loops. Single pool of persistent worker threads
+	/// (the calling thread takes part as well) with per-thread task deques:
+	/// tasks of a loop are first split into contiguous blocks, one per
+	/// thread, so a thread keeps working on the same part of the image
+	/// between loops (and NUMA node, see Allocate), idle threads steal tasks
+	/// from the other end of other threads' blocks. Loops started from a
+	/// task, or while another thread runs a loop, run serially on the
+	/// calling thread instead of oversubscribing the machine.
+	/// </summary>
+	namespace parallel
+	{
+		/// <summary>
+		/// Number of threads running loops, including the calling thread
+		/// </summary>
+		int ThreadCount();
+
+		/// <summary>
+		/// Recreates the pool with given number of threads, hardware
+		/// concurrency if threads <= 0, serial execution if 1. Applied to
+		/// OpenCV functions (cv::setNumThreads) as well. Must not be called
+		/// while a loop is running.
+		/// </summary>
+		void SetThreadCount(int threads);
+
+		/// <summary>
+		/// Count last given to SetThreadCount (<= 0 for hardware concurrency),
+		/// unlike ThreadCount not resolved, so it can be restored as it was
+		/// </summary>
+		int ThreadCountSetting();
+
+		/// <summary>
+		/// Pins worker threads to consecutive logical CPUs (pool thread i to
+		/// CPU i, the calling thread 0 is left alone), so that first touched
+		/// pages and caches stay local to the thread. Off by default, no effect on
+		/// platforms without affinity API.
+		/// </summary>
+		void SetAffinity(bool pin);
+
+		bool Affinity();
+
+		/// <summary>
+		/// L2 cache size in bytes used for tile sizing, detected where the
+		/// platform reports it, 512 kB otherwise
+		/// </summary>
+		size_t CacheSize();
+
+		/// <summary>
+		/// Overrides tile size returned by TileSize, empty size restores
+		/// automatic sizing.
+		/// </summary>
+		void SetTileSize(cv::Size tile);
+
+		/// <summary>
+		/// Tile for 2-D loops over image of given size: working set of the
+		/// tile (bytes_per_pixel summed over all images a kernel touches)
+		/// takes half of L2. Tiles span whole rows unless 16 of them do not
+		/// fit, then columns are split in multiples of 64 (whole bitplane
+		/// words). Height is reduced to give every thread several tiles.
+		/// </summary>
+		cv::Size TileSize(cv::Size image, int bytes_per_pixel);
+
+		/// <summary>
+		/// Runs task(i) for i in [0, tasks) on the pool and waits for all
+		/// of them. Exception thrown by a task is rethrown (first one only).
+		/// </summary>
+		void Run(int tasks, const std::function<void(int)>& task);
+
+		/// <summary>
+		/// Parallel loop over rows, body(cv::Range) gets consecutive row
+		/// bands, drop in replacement of cv::parallel_for_.
+		/// </summary>
+		/// <param name="grain">
+		/// Rows per band, 0 = about 4 bands per thread.
+		/// </param>
+		template<typename Body>
+		void ForRows(const cv::Range& range, Body body, int grain = 0)
+		{
+			const int n = range.end - range.start;
+			if(n <= 0) return;
+
+			const int chunk = grain > 0 ? grain : std::max(1, (n + ThreadCount() * 4 - 1) / (ThreadCount() * 4));
+			const int tasks = (n + chunk - 1) / chunk;
+			if(tasks == 1)
+			{
+				body(range);
+				return;
+			}
+
+			Run(tasks, [&](int task) {
+				int first = range.start + task * chunk;
+				body(cv::Range(first, std::min(first + chunk, range.end)));
+			});
+		}
+
+		/// <summary>
+		/// Parallel loop over 2-D tiles of the image (row major tile order),
+		/// body(cv::Rect) gets the tile, clipped to the image.
+		/// </summary>
+		template<typename Body>
+		void ForTiles(cv::Size size, cv::Size tile, Body body)
+		{
+			if(size.width <= 0 || size.height <= 0) return;
+
+			tile.width = std::max(1, std::min(tile.width, size.width));
+			tile.height = std::max(1, std::min(tile.height, size.height));
+			const int across = (size.width + tile.width - 1) / tile.width;
+			const int down = (size.height + tile.height - 1) / tile.height;
+
+			Run(across * down, [&](int task) {
+				int x = (task % across) * tile.width, y = (task / across) * tile.height;
+				body(cv::Rect(x, y, std::min(tile.width, size.width - x), std::min(tile.height, size.height - y)));
+			});
+		}
+
+		/// <summary>
+		/// Allocates image filled with value, rows are filled by the pool
+		/// threads in the same bands ForRows hands out, so with first touch
+		/// page placement they land on the NUMA node of the thread which
+		/// processes them.
+		/// </summary>
+		cv::Mat Allocate(int rows, int cols, int type, const cv::Scalar& value = cv::Scalar(0));
+	}
+}
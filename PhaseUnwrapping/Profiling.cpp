@@ -0,0 +1,391 @@
+#include "Profiling.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#if PU_PROFILING
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#endif
+
+namespace pu
+{
+	namespace profiling
+	{
+#if PU_PROFILING
+		namespace
+		{
+			// Upper limits so per thread storage can be preallocated, events
+			// are kept in a ring (power of two size) holding the latest ones
+			constexpr int MAX_STAGES = 128;
+			constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+			typedef std::chrono::steady_clock clock;
+
+			/// <summary>
+			/// Single complete ("X") trace event
+			/// </summary>
+			struct Event
+			{
+				int stage;
+				long long start_ns;
+				long long duration_ns;
+			};
+
+			/// <summary>
+			/// Timings of single stage on single thread
+			/// </summary>
+			struct StageTimes
+			{
+				std::atomic<long long> calls;
+				std::atomic<long long> total_ns;
+				std::atomic<long long> min_ns;
+				std::atomic<long long> max_ns;
+			};
+
+			/// <summary>
+			/// Adds n to atomic written by the owning thread only, so plain
+			/// load and store are enough
+			/// </summary>
+			void Accumulate(std::atomic<long long>& value, long long n)
+			{
+				value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+			}
+
+			/// <summary>
+			/// Data collected by single thread. Counters and timings are atomics
+			/// only so that Collect can read them while other threads run, they
+			/// are written by the owning thread only (relaxed, uncontended).
+			/// Trace events go to a preallocated ring, also written by the owning
+			/// thread only without any lock, the oldest events are overwritten
+			/// when it is full. Readers take events below recorded (release /
+			/// acquire pair).
+			/// </summary>
+			struct ThreadData
+			{
+				int index = 0;
+				int depth = 0;
+				std::atomic<long long> busy_ns{ 0 };
+				std::atomic<long long> work{ 0 };
+				std::atomic<long long> counters[MAX_STAGES][CounterCount];
+				StageTimes times[MAX_STAGES];
+
+				std::unique_ptr<Event[]> events{ new Event[EVENTS_PER_THREAD] };
+				std::atomic<size_t> recorded{ 0 };
+
+				ThreadData()
+				{
+					Clear();
+				}
+
+				void Clear()
+				{
+					busy_ns.store(0, std::memory_order_relaxed);
+					work.store(0, std::memory_order_relaxed);
+					for(auto& stage : counters)
+					{
+						for(auto& counter : stage)
+						{
+							counter.store(0, std::memory_order_relaxed);
+						}
+					}
+					for(auto& stage : times)
+					{
+						stage.calls.store(0, std::memory_order_relaxed);
+						stage.total_ns.store(0, std::memory_order_relaxed);
+						stage.min_ns.store(std::numeric_limits<long long>::max(), std::memory_order_relaxed);
+						stage.max_ns.store(0, std::memory_order_relaxed);
+					}
+					recorded.store(0, std::memory_order_relaxed);
+				}
+			};
+
+			/// <summary>
+			/// Global registry of stages and threads
+			/// </summary>
+			struct Registry
+			{
+				std::mutex mtx;
+				std::vector<std::string> stages;
+				std::vector<std::unique_ptr<ThreadData>> threads;
+				clock::time_point epoch = clock::now();
+			};
+
+			Registry& GetRegistry()
+			{
+				static Registry registry;
+				return registry;
+			}
+
+			ThreadData& GetThreadData()
+			{
+				// Thread data is owned by registry so it outlives the thread
+				thread_local ThreadData* data = nullptr;
+				if(!data)
+				{
+					Registry& registry = GetRegistry();
+					std::lock_guard<std::mutex> lock(registry.mtx);
+					registry.threads.emplace_back(new ThreadData());
+					data = registry.threads.back().get();
+					data->index = static_cast<int>(registry.threads.size()) - 1;
+				}
+				return *data;
+			}
+
+			long long SinceEpoch(clock::time_point t)
+			{
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(t - GetRegistry().epoch).count();
+			}
+
+			std::string Escape(const std::string& s)
+			{
+				std::string res;
+				for(char c : s)
+				{
+					if(c == '"' || c == '\\') res += '\\';
+					res += c;
+				}
+				return res;
+			}
+		}
+
+		bool Enabled()
+		{
+			return true;
+		}
+
+		int RegisterStage(const char* name)
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mtx);
+
+			// Same name used at several call sites maps to the same stage
+			for(size_t i = 0; i < registry.stages.size(); i++)
+			{
+				if(registry.stages[i] == name)
+				{
+					return static_cast<int>(i);
+				}
+			}
+
+			assert(registry.stages.size() < MAX_STAGES && "[RegisterStage] Too many stages");
+			registry.stages.push_back(name);
+			return static_cast<int>(registry.stages.size()) - 1;
+		}
+
+		void AddCount(int stage, Counter counter, long long n)
+		{
+			Accumulate(GetThreadData().counters[stage][counter], n);
+		}
+
+		void AddWork(long long n)
+		{
+			Accumulate(GetThreadData().work, n);
+		}
+
+		ScopedTimer::ScopedTimer(int stage) : stage(stage), start(clock::now())
+		{
+			GetThreadData().depth++;
+		}
+
+		ScopedTimer::~ScopedTimer()
+		{
+			auto end = clock::now();
+			ThreadData& data = GetThreadData();
+
+			long long duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+			// Only outermost scopes count as busy time, nested ones are already covered
+			if(--data.depth == 0)
+			{
+				Accumulate(data.busy_ns, duration);
+			}
+
+			StageTimes& times = data.times[stage];
+			Accumulate(times.calls, 1);
+			Accumulate(times.total_ns, duration);
+			if(duration < times.min_ns.load(std::memory_order_relaxed)) times.min_ns.store(duration, std::memory_order_relaxed);
+			if(duration > times.max_ns.load(std::memory_order_relaxed)) times.max_ns.store(duration, std::memory_order_relaxed);
+
+			size_t n = data.recorded.load(std::memory_order_relaxed);
+			data.events[n & (EVENTS_PER_THREAD - 1)] = Event{ stage, SinceEpoch(start), duration };
+			data.recorded.store(n + 1, std::memory_order_release);
+		}
+
+		void Reset()
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mtx);
+
+			for(auto& thread : registry.threads)
+			{
+				thread->Clear();
+			}
+
+			registry.epoch = clock::now();
+		}
+
+		Report Collect()
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mtx);
+
+			Report report;
+			report.wall_ms = SinceEpoch(clock::now()) * 1e-6;
+			report.stages.resize(registry.stages.size());
+			for(size_t i = 0; i < registry.stages.size(); i++)
+			{
+				report.stages[i].name = registry.stages[i];
+			}
+
+			for(auto& thread : registry.threads)
+			{
+				// Counters
+				for(size_t s = 0; s < registry.stages.size(); s++)
+				{
+					for(int c = 0; c < CounterCount; c++)
+					{
+						report.stages[s].counters[c] += thread->counters[s][c].load(std::memory_order_relaxed);
+					}
+				}
+
+				// Timings, merged over threads
+				for(size_t s = 0; s < registry.stages.size(); s++)
+				{
+					const StageTimes& times = thread->times[s];
+					long long calls = times.calls.load(std::memory_order_relaxed);
+					if(calls == 0) continue;
+
+					StageStats& stage = report.stages[s];
+					double min_ms = times.min_ns.load(std::memory_order_relaxed) * 1e-6;
+					double max_ms = times.max_ns.load(std::memory_order_relaxed) * 1e-6;
+					stage.min_ms = stage.calls == 0 ? min_ms : std::min(stage.min_ms, min_ms);
+					stage.max_ms = stage.calls == 0 ? max_ms : std::max(stage.max_ms, max_ms);
+					stage.total_ms += times.total_ns.load(std::memory_order_relaxed) * 1e-6;
+					stage.calls += calls;
+				}
+
+				// Threads without any activity since reset are not reported
+				ThreadStats stats;
+				stats.thread = thread->index;
+				stats.busy_ms = thread->busy_ns.load(std::memory_order_relaxed) * 1e-6;
+				stats.work_items = thread->work.load(std::memory_order_relaxed);
+				stats.utilization = report.wall_ms > 0.0 ? std::min(1.0, stats.busy_ms / report.wall_ms) : 0.0;
+				if(stats.busy_ms > 0.0 || stats.work_items > 0)
+				{
+					report.threads.push_back(stats);
+				}
+			}
+
+			return report;
+		}
+
+		bool ExportChromeTrace(const std::string & path)
+		{
+			std::ofstream file(path);
+			if(!file)
+			{
+				return false;
+			}
+
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mtx);
+
+			file << "{\"traceEvents\":[\n";
+			bool first = true;
+			char buffer[512];
+			for(auto& thread : registry.threads)
+			{
+				// Only the latest events are left in the ring
+				const size_t recorded = thread->recorded.load(std::memory_order_acquire);
+				const size_t oldest = recorded > EVENTS_PER_THREAD ? recorded - EVENTS_PER_THREAD : 0;
+				for(size_t i = oldest; i < recorded; i++)
+				{
+					const Event& e = thread->events[i & (EVENTS_PER_THREAD - 1)];
+					// Chrome trace expects microseconds
+					std::snprintf(buffer, sizeof(buffer),
+								  "%s{\"name\":\"%s\",\"cat\":\"pu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+								  first ? "" : ",\n",
+								  Escape(registry.stages[e.stage]).c_str(),
+								  thread->index,
+								  e.start_ns * 1e-3,
+								  e.duration_ns * 1e-3);
+					file << buffer;
+					first = false;
+				}
+			}
+
+			file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+			return static_cast<bool>(file);
+		}
+#else
+		bool Enabled()
+		{
+			return false;
+		}
+
+		void Reset()
+		{
+		}
+
+		Report Collect()
+		{
+			return Report();
+		}
+
+		bool ExportChromeTrace(const std::string & path)
+		{
+			// Still write valid (empty) trace so tooling does not break
+			std::ofstream file(path);
+			file << "{\"traceEvents\":[]}\n";
+			return static_cast<bool>(file);
+		}
+#endif
+
+		std::string Format(const Report & report)
+		{
+			static const char* counter_names[CounterCount] = { "pixels", "masked", "allocs", "residues", "stolen" };
+
+			std::ostringstream out;
+			char buffer[256];
+
+			std::snprintf(buffer, sizeof(buffer), "%-24s %8s %12s %10s %10s", "stage", "calls", "total [ms]", "min [ms]", "max [ms]");
+			out << buffer;
+			for(const char* name : counter_names)
+			{
+				std::snprintf(buffer, sizeof(buffer), " %12s", name);
+				out << buffer;
+			}
+			out << "\n";
+
+			for(const StageStats& stage : report.stages)
+			{
+				std::snprintf(buffer, sizeof(buffer), "%-24s %8lld %12.3f %10.3f %10.3f",
+							  stage.name.c_str(), stage.calls, stage.total_ms, stage.min_ms, stage.max_ms);
+				out << buffer;
+				for(long long counter : stage.counters)
+				{
+					std::snprintf(buffer, sizeof(buffer), " %12lld", counter);
+					out << buffer;
+				}
+				out << "\n";
+			}
+
+			std::snprintf(buffer, sizeof(buffer), "\n%-8s %12s %14s %12s   (wall %.3f ms)\n", "thread", "busy [ms]", "work items", "utilization", report.wall_ms);
+			out << buffer;
+			for(const ThreadStats& thread : report.threads)
+			{
+				std::snprintf(buffer, sizeof(buffer), "%-8d %12.3f %14lld %11.1f%%\n",
+							  thread.thread, thread.busy_ms, thread.work_items, thread.utilization * 100.0);
+				out << buffer;
+			}
+
+			return out.str();
+		}
+	}
+}
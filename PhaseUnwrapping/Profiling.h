@@ -0,0 +1,196 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Instrumentation is compiled in only when PU_PROFILING is defined to non-zero
+// value (e.g. in project preprocessor definitions). Otherwise all the macros
+// expand to nothing and query functions return empty results.
+#ifndef PU_PROFILING
+#define PU_PROFILING 0
+#endif
+
+#if PU_PROFILING
+#include <chrono>
+#endif
+
+namespace pu
+{
+	namespace profiling
+	{
+		/// <summary>
+		/// Counters which can be accumulated per stage
+		/// </summary>
+		enum Counter : int
+		{
+			/// <summary>
+			/// Number of (center) pixels processed by the stage
+			/// </summary>
+			PixelsProcessed = 0,
+
+			/// <summary>
+			/// Number of pixels skipped because of ignored bitflags
+			/// </summary>
+			MaskedPixelsSkipped,
+
+			/// <summary>
+			/// Number of image (buffer) allocations made by the stage
+			/// </summary>
+			Allocations,
+
+			/// <summary>
+			/// Number of residues detected by the stage
+			/// </summary>
+			ResiduesFound,
+
+			/// <summary>
+			/// Number of parallel tasks taken from another thread's queue
+			/// </summary>
+			TasksStolen,
+
+			/// <summary>
+			/// Number of counters, not a counter itself
+			/// </summary>
+			CounterCount
+		};
+
+		/// <summary>
+		/// Aggregated statistics of single stage (named scope)
+		/// </summary>
+		struct StageStats
+		{
+			std::string name;
+			long long calls = 0;
+			double total_ms = 0.0;
+			double min_ms = 0.0;
+			double max_ms = 0.0;
+			long long counters[CounterCount] = {};
+		};
+
+		/// <summary>
+		/// Statistics of single thread which reported any activity
+		/// </summary>
+		struct ThreadStats
+		{
+			int thread = 0;
+			/// <summary>
+			/// Time spent in outermost scopes on the thread
+			/// </summary>
+			double busy_ms = 0.0;
+			/// <summary>
+			/// Work items (e.g. pixels) processed by the thread
+			/// </summary>
+			long long work_items = 0;
+			/// <summary>
+			/// busy_ms / wall_ms, range [0, 1]
+			/// </summary>
+			double utilization = 0.0;
+		};
+
+		/// <summary>
+		/// Snapshot of all collected data since last Reset
+		/// </summary>
+		struct Report
+		{
+			double wall_ms = 0.0;
+			std::vector<StageStats> stages;
+			std::vector<ThreadStats> threads;
+		};
+
+		/// <summary>
+		/// Whether instrumentation was compiled in.
+		/// </summary>
+		bool Enabled();
+
+		/// <summary>
+		/// Clears all collected events and counters and restarts wall clock.
+		/// Should not be called while instrumented code is running.
+		/// </summary>
+		void Reset();
+
+		/// <summary>
+		/// Merges per thread timings and counters into per stage and per
+		/// thread statistics. Can be called while instrumented code runs.
+		/// </summary>
+		/// <returns>
+		/// Report, empty if instrumentation is compiled out.
+		/// </returns>
+		Report Collect();
+
+		/// <summary>
+		/// Writes collected events as Chrome trace (chrome://tracing, Perfetto)
+		/// JSON file. Each thread keeps only its latest 65536 events. Should
+		/// not be called while instrumented code is running.
+		/// </summary>
+		/// <param name="path">
+		/// Path of the output file.
+		/// </param>
+		/// <returns>
+		/// True if file was written.
+		/// </returns>
+		bool ExportChromeTrace(const std::string& path);
+
+		/// <summary>
+		/// Prints report as a table, one row per stage and per thread.
+		/// </summary>
+		std::string Format(const Report& report);
+
+#if PU_PROFILING
+		/// <summary>
+		/// Registers stage name (once per call site) and returns its id.
+		/// </summary>
+		int RegisterStage(const char* name);
+
+		/// <summary>
+		/// Adds n to counter of the given stage on the calling thread
+		/// </summary>
+		void AddCount(int stage, Counter counter, long long n);
+
+		/// <summary>
+		/// Adds n to work items processed by the calling thread
+		/// </summary>
+		void AddWork(long long n);
+
+		/// <summary>
+		/// Times enclosing scope, adds it to stage timings and records it as
+		/// a single trace event, without taking any lock
+		/// </summary>
+		class ScopedTimer
+		{
+		public:
+			explicit ScopedTimer(int stage);
+			~ScopedTimer();
+
+			ScopedTimer(const ScopedTimer&) = delete;
+			ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+		private:
+			int stage;
+			std::chrono::steady_clock::time_point start;
+		};
+#endif
+	}
+}
+
+#if PU_PROFILING
+#define PU_PROFILE_CONCAT_IMPL(a, b) a##b
+#define PU_PROFILE_CONCAT(a, b) PU_PROFILE_CONCAT_IMPL(a, b)
+
+// Times enclosing scope as stage "name" (string literal)
+#define PU_PROFILE_SCOPE(name) \
+	static const int PU_PROFILE_CONCAT(pu_stage_, __LINE__) = ::pu::profiling::RegisterStage(name); \
+	::pu::profiling::ScopedTimer PU_PROFILE_CONCAT(pu_timer_, __LINE__)(PU_PROFILE_CONCAT(pu_stage_, __LINE__))
+
+// Adds n to counter (pu::profiling::Counter) of stage "name" (string literal)
+#define PU_PROFILE_COUNT(name, counter, n) \
+	do { \
+		static const int pu_stage = ::pu::profiling::RegisterStage(name); \
+		::pu::profiling::AddCount(pu_stage, ::pu::profiling::counter, (n)); \
+	} while(0)
+
+// Adds n to work items processed by the calling thread
+#define PU_PROFILE_WORK(n) ::pu::profiling::AddWork(n)
+#else
+#define PU_PROFILE_SCOPE(name)
+#define PU_PROFILE_COUNT(name, counter, n) do {} while(0)
+#define PU_PROFILE_WORK(n) do {} while(0)
+#endif
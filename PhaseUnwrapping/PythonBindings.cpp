@@ -0,0 +1,514 @@
+// Python module (pybind11), built by setup.py, not part of the executable
+#include "Cache.h"
+#include "Filters.h"
+#include "Gradients.h"
+#include "Masks.h"
+#include "Parallel.h"
+#include "QualityMaps.h"
+#include "Unwrappers.h"
+#include "Wrappers.h"
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+namespace py = pybind11;
+
+using namespace pu;
+
+namespace
+{
+	/// <summary>
+	/// OpenCV depth of NumPy dtype, -1 if not supported
+	/// </summary>
+	int Depth(const py::dtype& dtype)
+	{
+		switch(dtype.kind())
+		{
+		case 'f':
+			return dtype.itemsize() == 4 ? CV_32F : dtype.itemsize() == 8 ? CV_64F : -1;
+		case 'u':
+			return dtype.itemsize() == 1 ? CV_8U : dtype.itemsize() == 2 ? CV_16U : -1;
+		case 'i':
+			return dtype.itemsize() == 1 ? CV_8S : dtype.itemsize() == 2 ? CV_16S : dtype.itemsize() == 4 ? CV_32S : -1;
+		default:
+			return -1;
+		}
+	}
+
+	py::dtype DType(int depth)
+	{
+		switch(depth)
+		{
+		case CV_8U: return py::dtype::of<uint8_t>();
+		case CV_8S: return py::dtype::of<int8_t>();
+		case CV_16U: return py::dtype::of<uint16_t>();
+		case CV_16S: return py::dtype::of<int16_t>();
+		case CV_32S: return py::dtype::of<int32_t>();
+		case CV_64F: return py::dtype::of<double>();
+		default: return py::dtype::of<float>();
+		}
+	}
+
+	/// <summary>
+	/// Header over array data (no copy), 2D single channel. Arrays not
+	/// contiguous along rows (e.g. transposed) are replaced by a contiguous
+	/// copy first, the array must stay alive while the header is used.
+	/// Raises instead of asserting, so bad input does not kill interpreter.
+	/// </summary>
+	cv::Mat ToMat(py::array& array, const char* name, std::initializer_list<int> types)
+	{
+		if(array.ndim() != 2)
+		{
+			throw py::value_error(std::string(name) + " must be 2D array");
+		}
+
+		int depth = Depth(array.dtype());
+		int type = CV_MAKETYPE(depth, 1);
+		if(depth < 0 || std::find(types.begin(), types.end(), type) == types.end())
+		{
+			throw py::type_error(std::string(name) + " has unsupported dtype");
+		}
+
+		if(array.strides(1) != array.itemsize() || array.strides(0) < array.shape(1) * array.itemsize())
+		{
+			array = py::array::ensure(array, py::array::c_style);
+		}
+
+		// Input is only read, cv::Mat just has no const header
+		return cv::Mat{ static_cast<int>(array.shape(0)), static_cast<int>(array.shape(1)), type,
+						const_cast<void*>(array.data()), static_cast<size_t>(array.strides(0)) };
+	}
+
+	/// <summary>
+	/// Optional bitflags image, nullptr when None
+	/// </summary>
+	cv::Mat* ToBitflags(py::object& object, py::array& holder, cv::Mat& header, const cv::Mat& wrapped)
+	{
+		if(object.is_none())
+		{
+			return nullptr;
+		}
+
+		holder = py::array::ensure(object);
+		if(!holder)
+		{
+			throw py::type_error("bitflags must be array");
+		}
+
+		header = ToMat(holder, "bitflags", { CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) });
+		if(header.size() != wrapped.size())
+		{
+			throw py::value_error("bitflags must have the same shape as wrapped phase");
+		}
+		return &header;
+	}
+
+	/// <summary>
+	/// Optional region of interest given as (x, y, width, height), empty
+	/// rectangle when None
+	/// </summary>
+	cv::Rect ToRect(const py::object& object, const cv::Mat& wrapped)
+	{
+		if(object.is_none())
+		{
+			return cv::Rect();
+		}
+		py::tuple roi = py::tuple(object);
+		if(roi.size() != 4)
+		{
+			throw py::value_error("roi must be (x, y, width, height)");
+		}
+		cv::Rect rect(roi[0].cast<int>(), roi[1].cast<int>(), roi[2].cast<int>(), roi[3].cast<int>());
+		if((rect & cv::Rect(0, 0, wrapped.cols, wrapped.rows)).area() == 0)
+		{
+			throw py::value_error("roi does not overlap wrapped phase");
+		}
+		return rect;
+	}
+
+	/// <summary>
+	/// Window given as k (square k x k, odd, greater equal 3) or (kx, ky)
+	/// (rectangular, both odd, greater equal 1)
+	/// </summary>
+	cv::Size ToWindow(const py::object& object)
+	{
+		if(py::isinstance<py::int_>(object))
+		{
+			int k = object.cast<int>();
+			if(k < 3 || k % 2 == 0)
+			{
+				throw py::value_error("k must be odd, greater equal 3");
+			}
+			return cv::Size(k, k);
+		}
+
+		py::tuple window = py::tuple(object);
+		if(window.size() != 2)
+		{
+			throw py::value_error("k must be int or (kx, ky)");
+		}
+		cv::Size size(window[0].cast<int>(), window[1].cast<int>());
+		if(size.width < 1 || size.height < 1 || size.width % 2 == 0 || size.height % 2 == 0)
+		{
+			throw py::value_error("kx and ky must be odd, greater equal 1");
+		}
+		return size;
+	}
+
+	void CheckSameShape(const cv::Mat& a, const cv::Mat& b, const char* name)
+	{
+		if(a.size() != b.size())
+		{
+			throw py::value_error(std::string(name) + " must have the same shape as wrapped phase");
+		}
+	}
+
+	/// <summary>
+	/// Array sharing the Mat buffer (no copy), the buffer is released with
+	/// the array. Headers over memory not owned by cv::Mat are copied.
+	/// </summary>
+	py::array ToArray(const cv::Mat& mat)
+	{
+		cv::Mat* owner = new cv::Mat(mat.u ? mat : mat.clone());
+		py::capsule base(owner, [](void* p) { delete static_cast<cv::Mat*>(p); });
+
+		return py::array(DType(owner->depth()),
+						 { static_cast<py::ssize_t>(owner->rows), static_cast<py::ssize_t>(owner->cols) },
+						 { static_cast<py::ssize_t>(owner->step[0]), static_cast<py::ssize_t>(owner->elemSize()) },
+						 owner->data, base);
+	}
+
+	/// <summary>
+	/// Runs computation without holding the GIL, so other Python threads
+	/// (e.g. unwrapping other frames) run meanwhile
+	/// </summary>
+	template<typename Function>
+	py::array Compute(Function function)
+	{
+		cv::Mat result;
+		{
+			py::gil_scoped_release release;
+			result = function();
+		}
+		return ToArray(result);
+	}
+
+	const std::initializer_list<int> WRAPPED_TYPES = { CV_32FC1, CV_16UC1 };
+}
+
+PYBIND11_MODULE(phase_unwrapping, m)
+{
+	m.doc() = "Phase unwrapping: wrapping, gradients, quality maps, phase filters and unwrappers. "
+		"Wrapped phase is 2D float32 array with values in [0, 1] or uint16 fixed point. "
+		"Window sizes k are int (square window) or (kx, ky) tuple (rectangular window). "
+		"Arrays are passed without copying and the GIL is released during computations.";
+
+	m.def("wrap", [](py::array phase, bool normalize) {
+		cv::Mat mat = ToMat(phase, "phase", { CV_32FC1 });
+		return Compute([&] { return Wrap(mat, normalize); });
+	}, py::arg("phase"), py::arg("normalize") = true, "Wraps phase (radians) to [-PI, PI), or [0, 1] with min-max normalization");
+
+	m.def("wrap_normalized", [](py::array phase) {
+		cv::Mat mat = ToMat(phase, "phase", { CV_32FC1 });
+		return Compute([&] { return WrapNormalized(mat); });
+	}, py::arg("phase"), "Wraps phase (radians) to [0, 1), 0 corresponds to -PI");
+
+	m.def("wrap_fixed16", [](py::array phase) {
+		cv::Mat mat = ToMat(phase, "phase", { CV_32FC1 });
+		return Compute([&] { return WrapFixed16(mat); });
+	}, py::arg("phase"), "Wraps phase (radians) to uint16 fixed point cycles");
+
+	m.def("dx_gradient", [](py::array wrapped) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		return Compute([&] { return DxGradient(mat); });
+	}, py::arg("wrapped"), "Wrapped gradient along rows");
+
+	m.def("dy_gradient", [](py::array wrapped) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		return Compute([&] { return DyGradient(mat); });
+	}, py::arg("wrapped"), "Wrapped gradient along columns");
+
+	m.def("pdv", [](py::array wrapped, py::object k, py::object bitflags, bitflag_type ignore_flag, py::object roi) {
+		cv::Size window = ToWindow(k);
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		cv::Rect rect = ToRect(roi, mat);
+		return Compute([&] {
+			return rect.area() > 0 ? quality_maps::PDV(mat, window, rect, flags, static_cast<Bitflag>(ignore_flag))
+				: cache::PDV(mat, window, flags, static_cast<Bitflag>(ignore_flag));
+		});
+	}, py::arg("wrapped"), py::arg("k") = 3, py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0, py::arg("roi") = py::none(),
+		"Phase derivative variance quality map (negated, higher is better), of roi (x, y, width, height) only if given");
+
+	m.def("max_abs_grad", [](py::array wrapped, py::object k, py::object bitflags, bitflag_type ignore_flag, py::object roi) {
+		cv::Size window = ToWindow(k);
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		cv::Rect rect = ToRect(roi, mat);
+		return Compute([&] {
+			return rect.area() > 0 ? quality_maps::MaxAbsGrad(mat, window, rect, flags, static_cast<Bitflag>(ignore_flag))
+				: cache::MaxAbsGrad(mat, window, flags, static_cast<Bitflag>(ignore_flag));
+		});
+	}, py::arg("wrapped"), py::arg("k") = 3, py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0, py::arg("roi") = py::none(),
+		"Maximum absolute gradient quality map (negated, higher is better), of roi (x, y, width, height) only if given");
+
+	m.def("pseudo_correlation", [](py::array wrapped, py::object k, py::object bitflags, bitflag_type ignore_flag) {
+		cv::Size window = ToWindow(k);
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		return Compute([&] { return quality_maps::PseudoCorrelation(mat, window, flags, static_cast<Bitflag>(ignore_flag)); });
+	}, py::arg("wrapped"), py::arg("k") = 3, py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0,
+		"Pseudo-correlation quality map (range [0, 1], higher is better)");
+
+	m.def("second_difference", [](py::array wrapped, py::object bitflags, bitflag_type ignore_flag) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		return Compute([&] { return quality_maps::SecondDifference(mat, flags, static_cast<Bitflag>(ignore_flag)); });
+	}, py::arg("wrapped"), py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0,
+		"Second difference reliability map (negated, higher is better)");
+
+	m.def("map_statistics", [](py::array wrapped, const std::string& map, py::object k, py::object roi, py::object bitflags, bitflag_type ignore_flag,
+							   float stop_below, py::object percentiles) {
+		const quality_maps::MapFlag flag = map == "pdv" ? quality_maps::PDVMap
+			: map == "max_abs_grad" ? quality_maps::MaxAbsGradMap
+			: map == "pseudo_correlation" ? quality_maps::PseudoCorrelationMap
+			: map == "second_difference" ? quality_maps::SecondDifferenceMap
+			: throw py::value_error("map must be pdv, max_abs_grad, pseudo_correlation or second_difference");
+		cv::Size window = ToWindow(k);
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		cv::Rect rect = ToRect(roi, mat);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+
+		quality_maps::QualityStatistics statistics;
+		{
+			py::gil_scoped_release release;
+			statistics = quality_maps::MapStatistics(mat, flag, window, rect, flags, static_cast<Bitflag>(ignore_flag), stop_below);
+		}
+
+		py::dict info;
+		info["count"] = statistics.count;
+		info["min"] = statistics.min;
+		info["max"] = statistics.max;
+		info["mean"] = statistics.mean;
+		info["stopped"] = statistics.stopped;
+		py::dict values;
+		for(py::handle fraction : percentiles)
+		{
+			values[fraction] = statistics.Percentile(fraction.cast<double>());
+		}
+		info["percentiles"] = values;
+		return info;
+	}, py::arg("wrapped"), py::arg("map") = "pdv", py::arg("k") = 3, py::arg("roi") = py::none(), py::arg("bitflags") = py::none(),
+		py::arg("ignore_flag") = 0, py::arg("stop_below") = -std::numeric_limits<float>::infinity(),
+		py::arg("percentiles") = py::make_tuple(0.05, 0.25, 0.5, 0.75, 0.95),
+		"Summary of a quality map (count, min, max, mean, percentiles) computed tile by tile without the full map, "
+		"stops early once a value below stop_below is found");
+
+	m.def("mean_phase_filter", [](py::array wrapped, py::object k, int levels, py::object roi) {
+		cv::Size window = ToWindow(k);
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		cv::Rect rect = ToRect(roi, mat);
+		return Compute([&] {
+			return rect.area() > 0 ? filters::MeanPhaseFilter(mat, window, rect, levels) : cache::MeanPhaseFilter(mat, window, levels);
+		});
+	}, py::arg("wrapped"), py::arg("k") = 3, py::arg("levels") = 0, py::arg("roi") = py::none(), "Circular mean filter of wrapped phase, of roi (x, y, width, height) only if given");
+
+	m.def("median_phase_filter", [](py::array wrapped, py::object k, int levels, py::object roi) {
+		cv::Size window = ToWindow(k);
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		cv::Rect rect = ToRect(roi, mat);
+		return Compute([&] {
+			return rect.area() > 0 ? filters::MedianPhaseFilter(mat, window, rect, levels) : cache::MedianPhaseFilter(mat, window, levels);
+		});
+	}, py::arg("wrapped"), py::arg("k") = 3, py::arg("levels") = 0, py::arg("roi") = py::none(), "Median filter of wrapped phase, of roi (x, y, width, height) only if given");
+
+	m.def("windowed_fourier_filter", [](py::array wrapped, int block, int step, double noise_sigma, double threshold_factor) {
+		if(block < 4 || step < 1 || step > block)
+		{
+			throw py::value_error("block must be at least 4 and step in range [1, block]");
+		}
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		filters::WindowedFourierOptions options;
+		options.block = block;
+		options.step = step;
+		options.noise_sigma = noise_sigma;
+		options.threshold_factor = threshold_factor;
+		return Compute([&] { return filters::WindowedFourierFilter(mat, options); });
+	}, py::arg("wrapped"), py::arg("block") = 32, py::arg("step") = 8, py::arg("noise_sigma") = 0.0, py::arg("threshold_factor") = 3.0,
+		"Windowed Fourier filter of wrapped phase, result in range [0, 1)");
+
+	m.def("residues", [](py::array wrapped) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		return Compute([&] { return cache::Residues(mat); });
+	}, py::arg("wrapped"), "Residue charges (int8) at top left pixel of each 2x2 loop");
+
+	m.def("itoh", [](py::array wrapped) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		return Compute([&] { return unwrappers::Itoh(mat); });
+	}, py::arg("wrapped"), "Unwraps by integrating along rows, result in radians");
+
+	m.def("itoh_counts", [](py::array wrapped, bool int16) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		UnwrappedPhase unwrapped;
+		{
+			py::gil_scoped_release release;
+			unwrapped = unwrappers::ItohCounts(mat, int16 ? CV_16S : CV_32S);
+		}
+		return py::make_tuple(ToArray(unwrapped.Wraps()), ToArray(unwrapped.Wrapped()));
+	}, py::arg("wrapped"), py::arg("int16") = false,
+		"Itoh unwrapping in extended range, returns (wrap counts, wrapped phase in cycles)");
+
+	m.def("wrap_counts", [](py::array wrapped, py::array unwrapped, bool int16) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		cv::Mat unwrapped_mat = ToMat(unwrapped, "unwrapped", { CV_32FC1 });
+		CheckSameShape(unwrapped_mat, mat, "unwrapped");
+		UnwrappedPhase result;
+		{
+			py::gil_scoped_release release;
+			result = unwrappers::WrapCounts(mat, unwrapped_mat, int16 ? CV_16S : CV_32S);
+		}
+		return py::make_tuple(ToArray(result.Wraps()), ToArray(result.Wrapped()));
+	}, py::arg("wrapped"), py::arg("unwrapped"), py::arg("int16") = false,
+		"Splits unwrapped phase (radians) into (wrap counts, wrapped phase in cycles)");
+
+	m.def("from_counts", [](py::array wraps, py::array wrapped) {
+		cv::Mat wraps_mat = ToMat(wraps, "wraps", { CV_16SC1, CV_32SC1 });
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		CheckSameShape(wraps_mat, mat, "wraps");
+		return Compute([&] { return UnwrappedPhase(wraps_mat, mat).ToDouble(); });
+	}, py::arg("wraps"), py::arg("wrapped"), "Unwrapped phase in radians (float64) from wrap counts and wrapped phase");
+
+	m.def("least_squares", [](py::array wrapped, bool congruent) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		return Compute([&] { return unwrappers::LeastSquares(mat, congruent); });
+	}, py::arg("wrapped"), py::arg("congruent") = true, "Unweighted least squares (DCT) unwrapping, result in radians");
+
+	m.def("quality_guided", [](py::array wrapped, py::array quality, py::object bitflags, bitflag_type ignore_flag) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		cv::Mat quality_mat = ToMat(quality, "quality", { CV_32FC1 });
+		CheckSameShape(quality_mat, mat, "quality");
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		return Compute([&] { return cache::QualityGuided(mat, quality_mat, flags, static_cast<Bitflag>(ignore_flag)); });
+	}, py::arg("wrapped"), py::arg("quality"), py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0,
+		"Quality guided flood fill unwrapping, result in radians");
+
+	m.def("multi_seed_quality_guided", [](py::array wrapped, py::array quality, py::object bitflags, bitflag_type ignore_flag, int seeds) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		cv::Mat quality_mat = ToMat(quality, "quality", { CV_32FC1 });
+		CheckSameShape(quality_mat, mat, "quality");
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		return Compute([&] { return unwrappers::MultiSeedQualityGuided(mat, quality_mat, flags, static_cast<Bitflag>(ignore_flag), seeds); });
+	}, py::arg("wrapped"), py::arg("quality"), py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0, py::arg("seeds") = 0,
+		"Quality guided unwrapping grown from many seeds in parallel, result in radians");
+
+	m.def("branch_cut", [](py::array wrapped, int max_box, py::object bitflags, bitflag_type ignore_flag) {
+		if(max_box < 3)
+		{
+			throw py::value_error("max_box must be at least 3");
+		}
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+		return Compute([&] { return unwrappers::BranchCut(mat, max_box, flags, static_cast<Bitflag>(ignore_flag)); });
+	}, py::arg("wrapped"), py::arg("max_box") = 65, py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0,
+		"Goldstein branch cut unwrapping, result in radians");
+
+	m.def("auto", [](py::array wrapped, py::object bitflags, bitflag_type ignore_flag, bool log) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		py::array holder;
+		cv::Mat header;
+		cv::Mat* flags = ToBitflags(bitflags, holder, header, mat);
+
+		unwrappers::AutoOptions options;
+		options.log = log;
+		unwrappers::AutoDecision decision;
+		py::array unwrapped = Compute([&] { return unwrappers::Auto(mat, flags, static_cast<Bitflag>(ignore_flag), options, &decision); });
+
+		py::dict info;
+		info["method"] = unwrappers::MethodName(decision.method);
+		info["residues"] = decision.residues;
+		info["residue_density"] = decision.residue_density;
+		info["mean_pdv"] = decision.mean_pdv;
+		info["masked_fraction"] = decision.masked_fraction;
+		info["analysis_seconds"] = decision.analysis_seconds;
+		return py::make_tuple(unwrapped, info);
+	}, py::arg("wrapped"), py::arg("bitflags") = py::none(), py::arg("ignore_flag") = 0, py::arg("log") = false,
+		"Unwraps with automatically selected method, returns (unwrapped, decision)");
+
+	m.def("pyramid", [](py::array wrapped, int levels, int coarse_size, int refine_passes) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		unwrappers::PyramidOptions options;
+		options.levels = levels;
+		options.coarse_size = coarse_size;
+		options.refine_passes = refine_passes;
+		return Compute([&] { return unwrappers::Pyramid(mat, options); });
+	}, py::arg("wrapped"), py::arg("levels") = 0, py::arg("coarse_size") = 128, py::arg("refine_passes") = 2,
+		"Coarse to fine unwrapping of smooth phase, result in radians");
+
+	m.def("pyramid_preview", [](py::array wrapped, int levels, int coarse_size) {
+		cv::Mat mat = ToMat(wrapped, "wrapped", WRAPPED_TYPES);
+		unwrappers::PyramidOptions options;
+		options.levels = levels;
+		options.coarse_size = coarse_size;
+		return Compute([&] { return unwrappers::PyramidPreview(mat, options); });
+	}, py::arg("wrapped"), py::arg("levels") = 0, py::arg("coarse_size") = 128,
+		"Unwrapped coarsest pyramid level, result in radians");
+
+	m.def("thread_count", [] { return parallel::ThreadCount(); },
+		"Number of threads used by the computations");
+
+	m.def("set_thread_count", [](int threads) { parallel::SetThreadCount(threads); }, py::arg("threads") = 0,
+		"Sets number of threads used by the computations, 0 = all hardware threads");
+
+	m.def("set_affinity", [](bool pin) { parallel::SetAffinity(pin); }, py::arg("pin"),
+		"Pins worker threads to logical CPUs");
+
+	m.def("set_cache", [](size_t memory_capacity, const std::string& directory, size_t disk_capacity) {
+		cache::CacheOptions options;
+		options.memory_capacity = memory_capacity;
+		options.directory = directory;
+		options.disk_capacity = disk_capacity;
+		cache::Configure(options);
+	}, py::arg("memory_capacity") = 0, py::arg("directory") = "", py::arg("disk_capacity") = 0,
+		"Enables cache of pdv, max_abs_grad, mean/median_phase_filter (without roi), residues and quality_guided results, "
+		"keyed by input hash and parameters: memory_capacity bytes in memory, directory of .npy files (disk_capacity bytes, "
+		"0 = unlimited) if given. All zero / empty disables it");
+
+	m.def("clear_cache", [](bool disk) { cache::Clear(disk); }, py::arg("disk") = false,
+		"Drops cached results in memory, deletes cache files as well if disk is set");
+
+	m.def("cache_statistics", [] {
+		cache::CacheStatistics statistics = cache::Statistics();
+		py::dict result;
+		result["memory_hits"] = statistics.memory_hits;
+		result["disk_hits"] = statistics.disk_hits;
+		result["misses"] = statistics.misses;
+		result["evictions"] = statistics.evictions;
+		result["memory_bytes"] = statistics.memory_bytes;
+		result["disk_bytes"] = statistics.disk_bytes;
+		result["memory_entries"] = statistics.memory_entries;
+		result["disk_entries"] = statistics.disk_entries;
+		return result;
+	}, "Hits, misses, evictions and size of the cache tiers");
+}
@@ -1,16 +1,33 @@
 #include "QualityMaps.h"
 #include "Gradients.h"
-
+#include "Parallel.h"
+#include "Profiling.h"
+#include "Storage.h"
+#include "Trigonometry.h"
+#include "WindowKernels.h"
+
+#include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <vector>
 
 namespace pu
 {
 	namespace quality_maps
 	{
 		cv::Mat PDV(const cv::Mat & wrapped_phase, int k, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			assert(k >= 3 &&
+				(k % 2) == 1 &&
+				   "[PDV] K must be odd, greater equal 3");
+
+			return PDV(wrapped_phase, cv::Size(k, k), bitflags, ignore_flag);
+		}
+
+		cv::Mat PDV(const cv::Mat & wrapped_phase, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
 		{
 			assert(!wrapped_phase.empty() &&
-				   wrapped_phase.type() == CV_32FC1 &&
+				   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
 				   "[PDV] Invalid wrapped phase image");
 
 			if(bitflags)
@@ -20,35 +37,28 @@ namespace pu
 					   bitflags->size() == wrapped_phase.size() &&
 					   "[PDV] Invalid bitflags image");
 			}
-			assert(k >= 3 &&
-				(k % 2) == 1 &&
-				   "[PDV] K must be odd, greater equal 3");
-
-			// First compute dx derivative
-			cv::Mat dx = DxGradient(wrapped_phase);
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[PDV] Window sides must be odd, greater equal 1");
 
-			// Image for the results	
-			cv::Mat pdv = WindowedVariance(dx, k, bitflags, ignore_flag);
+			PU_PROFILE_SCOPE("PDV");
 
-			// Then compute dy derivative;
-			cv::Mat dy = DyGradient(wrapped_phase);
-
-			// And add dy variance to the results
-			pdv += WindowedVariance(dy, k, bitflags, ignore_flag);
+			return ComputeMaps(wrapped_phase, PDVMap, window, bitflags, ignore_flag).pdv;
+		}
 
-			// TODO Not sure but scaling might not be the best idea since it makes results not reflect quality properly, say quality has only 2 values; 0.01 and 0.02 -> scaling will deepen the gap from 0.01 to 0.99, i think it might not be ok later
-			// Scale image to range [0,1] 
-			// Since higher variance indicates worse pixels it needs to be inverted
-			// cv::normalize(-pdv, pdv, 0, 1, cv::NORM_MINMAX);
+		cv::Mat MaxAbsGrad(const cv::Mat & wrapped_phase, int k, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			assert(k >= 3 &&
+				(k % 2) == 1 &&
+				   "[MaxAbsGrad] K must be odd, greater equal 3");
 
-			// Since higher variance indicates worse pixels it needs to be inverted
-			return -pdv;
+			return MaxAbsGrad(wrapped_phase, cv::Size(k, k), bitflags, ignore_flag);
 		}
 
-		cv::Mat MaxAbsGrad(const cv::Mat & wrapped_phase, int k, cv::Mat * bitflags, Bitflag ignore_flag)
+		cv::Mat MaxAbsGrad(const cv::Mat & wrapped_phase, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
 		{
 			assert(!wrapped_phase.empty() &&
-				   wrapped_phase.type() == CV_32FC1 &&
+				   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
 				   "[MaxAbsGrad] Invalid wrapped phase image");
 
 			if(bitflags)
@@ -58,42 +68,253 @@ namespace pu
 					   bitflags->size() == wrapped_phase.size() &&
 					   "[MaxAbsGrad] Invalid bitflags image");
 			}
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[MaxAbsGrad] Window sides must be odd, greater equal 1");
+
+			PU_PROFILE_SCOPE("MaxAbsGrad");
+
+			return ComputeMaps(wrapped_phase, MaxAbsGradMap, window, bitflags, ignore_flag).max_abs_grad;
+		}
+
+		cv::Mat PseudoCorrelation(const cv::Mat & wrapped_phase, int k, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
 			assert(k >= 3 &&
 				(k % 2) == 1 &&
-				   "[MaxAbsGrad] K must be odd, greater equal 3");
+				   "[PseudoCorrelation] K must be odd, greater equal 3");
 
-			// Compute dx derivative
-			cv::Mat dx = DxGradient(wrapped_phase);
+			return PseudoCorrelation(wrapped_phase, cv::Size(k, k), bitflags, ignore_flag);
+		}
 
-			// Check maximum gradients for dx derivative	
-			cv::Mat maxgradx = WindowedMaxAbs(dx, k, bitflags, ignore_flag);
+		cv::Mat PseudoCorrelation(const cv::Mat & wrapped_phase, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			PU_PROFILE_SCOPE("PseudoCorrelation");
 
-			// Compute dy derivative;
-			cv::Mat dy = DyGradient(wrapped_phase);
+			return ComputeMaps(wrapped_phase, PseudoCorrelationMap, window, bitflags, ignore_flag).pseudo_correlation;
+		}
 
-			// Check maximum gradients for dy derivative	
-			cv::Mat maxgrady = WindowedMaxAbs(dy, k, bitflags, ignore_flag);
+		cv::Mat SecondDifference(const cv::Mat & wrapped_phase, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			PU_PROFILE_SCOPE("SecondDifference");
 
-			// Image for results - per pixel maximum of either maxgradx or maxgrady
-			cv::Mat maxgrad;
-			cv::max(maxgradx, maxgrady, maxgrad);
+			// Window is not used by this map
+			return ComputeMaps(wrapped_phase, SecondDifferenceMap, cv::Size(1, 1), bitflags, ignore_flag).second_difference;
+		}
 
-			// TODO Not sure but scaling might not be the best idea since it makes results not reflect quality properly, say quality has only 2 values; 0.01 and 0.02 -> scaling will deepen the gap from 0.01 to 0.99, i think it might not be ok later
-			// Scale image to range [0,1]
-			// Since higher variance indicates bad pixels it needs to be inverted
-			// cv::normalize(-maxgrad, maxgrad, 0, 1, cv::NORM_MINMAX);
+		namespace
+		{
+			/// <summary>
+			/// Gives pixels without any second difference (marked with 1) the
+			/// worst value of the map, or 0 if there is none.
+			/// </summary>
+			void FillMissingDifferences(cv::Mat& difference)
+			{
+				double worst = 0;
+				cv::minMaxLoc(difference, &worst);
+				worst = std::min(worst, 0.0);
+				for(int row = 0; row < difference.rows; row++)
+				{
+					float* dst = difference.ptr<float>(row);
+					for(int col = 0; col < difference.cols; col++)
+					{
+						if(dst[col] > 0) dst[col] = static_cast<float>(worst);
+					}
+				}
+			}
+
+			/// <summary>
+			/// ComputeMaps, except that SecondDifference pixels without any
+			/// difference are left marked for FillMissingDifferences, so the
+			/// ROI variant can fill them from the ROI only.
+			/// </summary>
+			QualityMapSet ComputeMapsUnfilled(const cv::Mat & wrapped_phase, unsigned maps, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
+			{
+				assert(!wrapped_phase.empty() &&
+					   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
+					   "[ComputeMaps] Invalid wrapped phase image");
+
+				if(bitflags)
+				{
+					assert(!bitflags->empty() &&
+						   bitflags->type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+						   bitflags->size() == wrapped_phase.size() &&
+						   "[ComputeMaps] Invalid bitflags image");
+				}
+				assert(window.width >= 1 && (window.width % 2) == 1 &&
+					   window.height >= 1 && (window.height % 2) == 1 &&
+					   "[ComputeMaps] Window sides must be odd, greater equal 1");
+
+				PU_PROFILE_SCOPE("ComputeMaps");
+
+				QualityMapSet result;
+
+				// Wrapped gradients are shared by all gradient based maps
+				cv::Mat dx, dy;
+				if(maps & (PDVMap | MaxAbsGradMap | SecondDifferenceMap))
+				{
+					dx = DxGradient(wrapped_phase);
+					dy = DyGradient(wrapped_phase);
+				}
+
+				if(maps & PDVMap)
+				{
+					cv::Mat pdv = WindowedVariance(dx, window, bitflags, ignore_flag);
+					pdv += WindowedVariance(dy, window, bitflags, ignore_flag);
+
+					// TODO Not sure but scaling might not be the best idea since it makes results not reflect quality properly, say quality has only 2 values; 0.01 and 0.02 -> scaling will deepen the gap from 0.01 to 0.99, i think it might not be ok later
+					// cv::normalize(-pdv, pdv, 0, 1, cv::NORM_MINMAX);
+
+					// Since higher variance indicates worse pixels it needs to be inverted
+					result.pdv = -pdv;
+				}
+
+				if(maps & MaxAbsGradMap)
+				{
+					// Per pixel maximum of either dx or dy windowed maximum
+					cv::Mat maxgrad;
+					cv::max(WindowedMaxAbs(dx, window, bitflags, ignore_flag), WindowedMaxAbs(dy, window, bitflags, ignore_flag), maxgrad);
+
+					// Since higher gradient indicates bad pixels it needs to be inverted
+					result.max_abs_grad = -maxgrad;
+				}
 
-			// Since higher gradient indicates bad pixels it needs to be inverted
-			return -maxgrad;
+				if(maps & PseudoCorrelationMap)
+				{
+					cv::Mat cos_plane, sin_plane;
+					kernels::CosSin(wrapped_phase, cos_plane, sin_plane);
+					PU_PROFILE_COUNT("PseudoCorrelation", Allocations, 5);
+					PU_PROFILE_COUNT("PseudoCorrelation", PixelsProcessed, wrapped_phase.rows * wrapped_phase.cols);
+
+					result.pseudo_correlation = kernels::PseudoCorrelation(cos_plane, sin_plane, window, bitflags, ignore_flag);
+				}
+
+				if(maps & SecondDifferenceMap)
+				{
+					result.second_difference = SecondDifferences(wrapped_phase, dx, dy, bitflags, ignore_flag);
+				}
+
+				return result;
+			}
+		}
+
+		QualityMapSet ComputeMaps(const cv::Mat & wrapped_phase, unsigned maps, cv::Size window, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			QualityMapSet result = ComputeMapsUnfilled(wrapped_phase, maps, window, bitflags, ignore_flag);
+			if(!result.second_difference.empty())
+			{
+				FillMissingDifferences(result.second_difference);
+			}
+			return result;
 		}
 
 		namespace
 		{
-			cv::Mat WindowedVariance(const cv::Mat & image, int k, cv::Mat* bitflags, Bitflag ignore_flag)
+			/// <summary>
+			/// Second differences of phase of type P (float or fixed point)
+			/// with gradients of type G, scaled to cycles. Pixels without any
+			/// difference get 1 (cannot occur otherwise), replaced afterwards.
+			/// </summary>
+			template<typename P, typename G>
+			void SecondDifferenceRows(const cv::Mat& wrapped_phase, const cv::Mat& dx, const cv::Mat& dy, const cv::Mat* bitflags, Bitflag ignore_flag, float scale, cv::Mat& difference)
+			{
+				const int rows = wrapped_phase.rows, cols = wrapped_phase.cols;
+				const bool masked = bitflags && ignore_flag != Bitflag::NoFlag;
+
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					long long skipped = 0;
+					for(int row = range.start; row < range.end; row++)
+					{
+						const bool has_up = row > 0, has_down = row < rows - 1;
+						const P* up = wrapped_phase.ptr<P>(has_up ? row - 1 : row);
+						const P* cur = wrapped_phase.ptr<P>(row);
+						const P* down = wrapped_phase.ptr<P>(has_down ? row + 1 : row);
+						const G* dx_cur = dx.ptr<G>(row);
+						const G* dy_cur = dy.ptr<G>(row);
+						const G* dy_up = dy.ptr<G>(has_up ? row - 1 : row);
+
+						const bitflag_type* f_up = masked ? bitflags->ptr<bitflag_type>(has_up ? row - 1 : row) : nullptr;
+						const bitflag_type* f_cur = masked ? bitflags->ptr<bitflag_type>(row) : nullptr;
+						const bitflag_type* f_down = masked ? bitflags->ptr<bitflag_type>(has_down ? row + 1 : row) : nullptr;
+						auto valid = [&](const bitflag_type* flags, int col) {
+							return !masked || !(flags[col] & ignore_flag);
+						};
+
+						float* dst = difference.ptr<float>(row);
+						for(int col = 0; col < cols; col++)
+						{
+							const bool has_left = col > 0, has_right = col < cols - 1;
+							float sum = 0;
+							int n = 0;
+
+							if(valid(f_cur, col))
+							{
+								// Gradients are forward differences except for the last
+								// column/row, which has no second difference anyway
+								if(has_left && has_right && valid(f_cur, col - 1) && valid(f_cur, col + 1))
+								{
+									float h = (static_cast<float>(dx_cur[col]) - static_cast<float>(dx_cur[col - 1])) * scale;
+									sum += h * h; n++;
+								}
+								if(has_up && has_down && valid(f_up, col) && valid(f_down, col))
+								{
+									float v = (static_cast<float>(dy_cur[col]) - static_cast<float>(dy_up[col])) * scale;
+									sum += v * v; n++;
+								}
+								if(has_up && has_down && has_left && has_right)
+								{
+									if(valid(f_up, col - 1) && valid(f_down, col + 1))
+									{
+										float d1 = (static_cast<float>(Gradient(down[col + 1], cur[col])) - static_cast<float>(Gradient(cur[col], up[col - 1]))) * scale;
+										sum += d1 * d1; n++;
+									}
+									if(valid(f_up, col + 1) && valid(f_down, col - 1))
+									{
+										float d2 = (static_cast<float>(Gradient(down[col - 1], cur[col])) - static_cast<float>(Gradient(cur[col], up[col + 1]))) * scale;
+										sum += d2 * d2; n++;
+									}
+								}
+							}
+							else
+							{
+								skipped++;
+							}
+
+							// Missing differences are compensated by scaling the sum
+							dst[col] = n > 0 ? -std::sqrt(sum * 4.0f / n) : 1.0f;
+						}
+					}
+
+					PU_PROFILE_COUNT("SecondDifference", MaskedPixelsSkipped, skipped);
+					PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * cols);
+				});
+			}
+
+			cv::Mat SecondDifferences(const cv::Mat & wrapped_phase, const cv::Mat & dx, const cv::Mat & dy, cv::Mat* bitflags, Bitflag ignore_flag)
+			{
+				assert(dx.size() == wrapped_phase.size() && dy.size() == wrapped_phase.size() &&
+					   "[SecondDifferences] Invalid gradient images");
+
+				PU_PROFILE_COUNT("SecondDifference", Allocations, 1);
+				PU_PROFILE_COUNT("SecondDifference", PixelsProcessed, wrapped_phase.rows * wrapped_phase.cols);
+
+				cv::Mat difference = parallel::Allocate(wrapped_phase.rows, wrapped_phase.cols, CV_32FC1);
+				if(wrapped_phase.type() == CV_16UC1)
+				{
+					SecondDifferenceRows<unsigned short, short>(wrapped_phase, dx, dy, bitflags, ignore_flag, 1.0f / FIXED16_ONE, difference);
+				}
+				else
+				{
+					SecondDifferenceRows<float, float>(wrapped_phase, dx, dy, bitflags, ignore_flag, 1.0f, difference);
+				}
+
+				return difference;
+			}
+
+			cv::Mat WindowedVariance(const cv::Mat & image, cv::Size window, cv::Mat* bitflags, Bitflag ignore_flag)
 			{
-				// Only floating point images are supported
+				// Floating point and fixed point (gradients of CV_16UC1 phase) images are supported
 				assert(!image.empty() &&
-					   image.type() == CV_32FC1 &&
+					   (image.type() == CV_32FC1 || image.type() == CV_16SC1) &&
 					   "[WindowedVariance] Invalid image");
 
 				// If user provided bitflags (double) check that it has proper size
@@ -103,141 +324,493 @@ namespace pu
 						   "[WindowedVariance] Invalid bitflags image");
 				}
 
-				// Dimensions and image rect
-				int rows = image.rows, cols = image.cols;
-				cv::Rect rect{ 0,0,cols, rows };
+				PU_PROFILE_SCOPE("WindowedVariance");
 
-				// Half window size rounded down
-				int k2 = k / 2;
+				PU_PROFILE_COUNT("WindowedVariance", Allocations, 1);
+				PU_PROFILE_COUNT("WindowedVariance", PixelsProcessed, image.rows * image.cols);
 
-				// Image for the results
-				cv::Mat variance{ rows,cols,CV_32FC1,cv::Scalar(0) };
+				// Fixed point values are widened and scaled inside of the kernels
+				const bool fixed = image.type() == CV_16SC1;
+				const float scale = fixed ? 1.0f / FIXED16_ONE : 1.0f;
 
-				// Compute dx derivative variance over window of size k and place it in result image
-				variance.forEach<float>([&](float &var_px, const int* pos) -> void {
-					// Coordinates of center pixel
-					int row = pos[0], col = pos[1];
+				// Common square windows have compile time specialized kernels
+				if(window.width == window.height)
+				{
+					switch(window.width)
+					{
+					case 3: return fixed ? kernels::WindowedVariance<3, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedVariance<3>(image, bitflags, ignore_flag);
+					case 5: return fixed ? kernels::WindowedVariance<5, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedVariance<5>(image, bitflags, ignore_flag);
+					case 7: return fixed ? kernels::WindowedVariance<7, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedVariance<7>(image, bitflags, ignore_flag);
+					case 9: return fixed ? kernels::WindowedVariance<9, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedVariance<9>(image, bitflags, ignore_flag);
+					default: break;
+					}
+				}
 
-					// Intersection of image and window centered at current pixel (clipping out of bounds pixels at edges)
-					// Ignored bitflags (if any) will be considered later
-					auto roi = rect & cv::Rect(col - k2, row - k2, k, k);
-					
-					// "Cut" the window of size k around [row,col] from dx derivative (may vary at edges)
-					cv::Mat window = image(roi);
+				// Any other window uses separable box filter sums
+				return fixed ?
+					kernels::WindowedVariance<short>(image, window, bitflags, ignore_flag, scale) :
+					kernels::WindowedVariance<float>(image, window, bitflags, ignore_flag);
+			}
 
-					// Variance = avgsqr - avg*avg
-					float avgsqr = 0, avg = 0;
+			cv::Mat WindowedMaxAbs(const cv::Mat & image, cv::Size window, cv::Mat* bitflags, Bitflag ignore_flag)
+			{
+				// Floating point and fixed point (gradients of CV_16UC1 phase) images are supported
+				assert(!image.empty() &&
+					   (image.type() == CV_32FC1 || image.type() == CV_16SC1) &&
+					   "[WindowedMaxAbs] Invalid image");
 
-					// n will vary depending on window placement (edges, corners) and optional pixels marked to be ignored with bitflags
-					int n = 0;
+				// If user provided bitflags (double) check that it has proper size
+				if(bitflags)
+				{
+					assert(bitflags->size() == image.size() &&
+						   "[WindowedMaxAbs] Invalid bitflags image");
+				}
+
+				PU_PROFILE_SCOPE("WindowedMaxAbs");
 
-					// Just to speed things up a bit make one initial check instead of in each loop 
-					// With bitflag checking
-					if(bitflags && ignore_flag != Bitflag::NoFlag)
+				PU_PROFILE_COUNT("WindowedMaxAbs", Allocations, 1);
+				PU_PROFILE_COUNT("WindowedMaxAbs", PixelsProcessed, image.rows * image.cols);
+
+				// Fixed point values are widened and scaled inside of the kernels
+				const bool fixed = image.type() == CV_16SC1;
+				const float scale = fixed ? 1.0f / FIXED16_ONE : 1.0f;
+
+				// Common square windows have compile time specialized kernels
+				if(window.width == window.height)
+				{
+					switch(window.width)
 					{
-						window.forEach<float>([&](float& win_px, const int* pos) -> void {
-							// Coordinates of window pixel (in IMAGE pixel coordinates reference)
-							int winRow = row + pos[0] - k2, winCol = col + pos[1] - k2;
+					case 3: return fixed ? kernels::WindowedMaxAbs<3, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedMaxAbs<3>(image, bitflags, ignore_flag);
+					case 5: return fixed ? kernels::WindowedMaxAbs<5, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedMaxAbs<5>(image, bitflags, ignore_flag);
+					case 7: return fixed ? kernels::WindowedMaxAbs<7, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedMaxAbs<7>(image, bitflags, ignore_flag);
+					case 9: return fixed ? kernels::WindowedMaxAbs<9, short>(image, bitflags, ignore_flag, scale) : kernels::WindowedMaxAbs<9>(image, bitflags, ignore_flag);
+					default: break;
+					}
+				}
 
-							// Check for ignore code in bitflags
-							if(bitflags->at<bitflag_type>(winRow, winCol) & ignore_flag)
+				// Any other window uses separable rectangular dilation
+				return fixed ?
+					kernels::WindowedMaxAbs<short>(image, window, bitflags, ignore_flag, scale) :
+					kernels::WindowedMaxAbs<float>(image, window, bitflags, ignore_flag);
+			}
+		}
+	
+
+		QualityMapSet ComputeMaps(const cv::Mat & wrapped_phase, unsigned maps, cv::Size window, const masks::ValidRegion & region)
+		{
+			assert(!wrapped_phase.empty() &&
+				   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
+				   "[ComputeMaps] Invalid wrapped phase image");
+			assert(region.Size() == wrapped_phase.size() &&
+				   "[ComputeMaps] Invalid valid region");
+			assert(window.width >= 1 && (window.width % 2) == 1 &&
+				   window.height >= 1 && (window.height % 2) == 1 &&
+				   "[ComputeMaps] Window sides must be odd, greater equal 1");
+
+			PU_PROFILE_SCOPE("ComputeMaps");
+
+			const int rows = wrapped_phase.rows, cols = wrapped_phase.cols;
+			const int count = region.Count();
+			const int kx2 = window.width / 2, ky2 = window.height / 2;
+			const bool fixed = wrapped_phase.type() == CV_16UC1;
+
+			PU_PROFILE_COUNT("ComputeMaps", PixelsProcessed, count);
+			PU_PROFILE_COUNT("ComputeMaps", MaskedPixelsSkipped, static_cast<long long>(rows) * cols - count);
+
+			// Wrapped difference of phase at a and b in cycles, same rounding
+			// as gradient images
+			auto difference = [&](int row_a, int col_a, int row_b, int col_b) {
+				if(fixed)
+				{
+					return Gradient(wrapped_phase.ptr<unsigned short>(row_a)[col_a], wrapped_phase.ptr<unsigned short>(row_b)[col_b]) / FIXED16_ONE;
+				}
+				return Gradient(wrapped_phase.ptr<float>(row_a)[col_a], wrapped_phase.ptr<float>(row_b)[col_b]);
+			};
+
+			// Calls visit(lo, hi) with packed range of each window row
+			auto for_window_rows = [&](cv::Point p, auto visit) {
+				const int first_col = std::max(p.x - kx2, 0), end_col = std::min(p.x + kx2, cols - 1) + 1;
+				const int last_row = std::min(p.y + ky2, rows - 1);
+				for(int row = std::max(p.y - ky2, 0); row <= last_row; row++)
+				{
+					visit(region.Lower(row, first_col), region.Lower(row, end_col));
+				}
+			};
+
+			// Packed prefix sums, window row sums are differences of two entries
+			auto prefix_sums = [&](const std::vector<float>& values, bool squares) {
+				std::vector<double> sums(values.size() + 1, 0.0);
+				for(size_t i = 0; i < values.size(); i++)
+				{
+					sums[i + 1] = sums[i] + (squares ? static_cast<double>(values[i]) * values[i] : values[i]);
+				}
+				return sums;
+			};
+
+			// Negated maps are lowest where worst, which masked pixels get
+			auto scatter_negated = [&](const std::vector<float>& values) {
+				float worst = values.empty() ? 0.0f : *std::min_element(values.begin(), values.end());
+				return region.Scatter(values, worst);
+			};
+
+			QualityMapSet result;
+
+			// Packed gradients, the same as in DxGradient and DyGradient
+			std::vector<float> dx, dy;
+			if(maps & (PDVMap | MaxAbsGradMap | SecondDifferenceMap))
+			{
+				dx.resize(count);
+				dy.resize(count);
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					for(int i = range.start; i < range.end; i++)
+					{
+						cv::Point p = region.Position(i);
+						dx[i] = p.x + 1 < cols ? difference(p.y, p.x + 1, p.y, p.x) : (cols > 1 ? difference(p.y, p.x, p.y, p.x - 1) : 0.0f);
+						dy[i] = p.y + 1 < rows ? difference(p.y + 1, p.x, p.y, p.x) : (rows > 1 ? difference(p.y, p.x, p.y - 1, p.x) : 0.0f);
+					}
+				});
+				PU_PROFILE_COUNT("ComputeMaps", Allocations, 2);
+			}
+
+			if(maps & PDVMap)
+			{
+				const std::vector<double> sx = prefix_sums(dx, false), qx = prefix_sums(dx, true);
+				const std::vector<double> sy = prefix_sums(dy, false), qy = prefix_sums(dy, true);
+
+				std::vector<float> pdv(count);
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					for(int i = range.start; i < range.end; i++)
+					{
+						double n = 0, s1 = 0, q1 = 0, s2 = 0, q2 = 0;
+						for_window_rows(region.Position(i), [&](int lo, int hi) {
+							n += hi - lo;
+							s1 += sx[hi] - sx[lo]; q1 += qx[hi] - qx[lo];
+							s2 += sy[hi] - sy[lo]; q2 += qy[hi] - qy[lo];
+						});
+
+						// Window always contains its valid center
+						s1 /= n; q1 /= n; s2 /= n; q2 /= n;
+						pdv[i] = -static_cast<float>(std::max(q1 - s1 * s1, 0.0) + std::max(q2 - s2 * s2, 0.0));
+					}
+					PU_PROFILE_WORK(range.end - range.start);
+				});
+				result.pdv = scatter_negated(pdv);
+			}
+
+			if(maps & MaxAbsGradMap)
+			{
+				std::vector<float> maxgrad(count);
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					for(int i = range.start; i < range.end; i++)
+					{
+						float m = 0;
+						for_window_rows(region.Position(i), [&](int lo, int hi) {
+							for(int j = lo; j < hi; j++)
 							{
-								return;
+								m = std::max(m, std::max(std::abs(dx[j]), std::abs(dy[j])));
 							}
-
-							avg += win_px;
-							avgsqr += win_px * win_px;
-							n++;
 						});
+						maxgrad[i] = -m;
 					}
-					// Without bitflag checking
-					else
+					PU_PROFILE_WORK(range.end - range.start);
+				});
+				result.max_abs_grad = scatter_negated(maxgrad);
+			}
+
+			if(maps & PseudoCorrelationMap)
+			{
+				// Fixed point phase takes cos and sin from tables, as CosSin
+				const std::vector<float> phase = region.GatherPhase(wrapped_phase);
+				const PhaseLut* lut = fixed ? &GetPhaseLut(FIXED16_LEVELS) : nullptr;
+				std::vector<float> cos_values(count), sin_values(count);
+				for(int i = 0; i < count; i++)
+				{
+					float angle = phase[i] * static_cast<float>(CV_PI * 2.0);
+					cos_values[i] = lut ? lut->Cos(phase[i]) : std::cos(angle);
+					sin_values[i] = lut ? lut->Sin(phase[i]) : std::sin(angle);
+				}
+				const std::vector<double> sc = prefix_sums(cos_values, false), ss = prefix_sums(sin_values, false);
+				PU_PROFILE_COUNT("ComputeMaps", Allocations, 5);
+
+				std::vector<float> correlation(count);
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					for(int i = range.start; i < range.end; i++)
 					{
-						window.forEach<float>([&](float& win_px, const int* pos) -> void {
-							avg += win_px;
-							avgsqr += win_px * win_px;
-							n++;
+						double n = 0, c = 0, s = 0;
+						for_window_rows(region.Position(i), [&](int lo, int hi) {
+							n += hi - lo;
+							c += sc[hi] - sc[lo];
+							s += ss[hi] - ss[lo];
 						});
+						correlation[i] = static_cast<float>(std::sqrt(c * c + s * s) / n);
 					}
+					PU_PROFILE_WORK(range.end - range.start);
+				});
+				result.pseudo_correlation = region.Scatter(correlation, 0.0f);
+			}
 
-					// To avoid division by zero and also to zero empty widnows
-					float m = n > 0 ? 1.0 / n : 0.0;
-					avgsqr *= m;
-					avg *= m;
+			if(maps & SecondDifferenceMap)
+			{
+				const std::vector<masks::ValidRegion::Neighbours>& neighbours = region.Neighbourhood();
 
-					var_px = avgsqr - avg*avg;
+				std::vector<float> second(count);
+				parallel::ForRows(cv::Range(0, count), [&](const cv::Range& range) {
+					for(int i = range.start; i < range.end; i++)
+					{
+						const cv::Point p = region.Position(i);
+						const masks::ValidRegion::Neighbours& nb = neighbours[i];
+						float sum = 0;
+						int n = 0;
+
+						if(nb.left >= 0 && nb.right >= 0)
+						{
+							float h = dx[i] - dx[nb.left];
+							sum += h * h; n++;
+						}
+						if(nb.up >= 0 && nb.down >= 0)
+						{
+							float v = dy[i] - dy[nb.up];
+							sum += v * v; n++;
+						}
+						if(region.Contains(p.y - 1, p.x - 1) && region.Contains(p.y + 1, p.x + 1))
+						{
+							float d1 = difference(p.y + 1, p.x + 1, p.y, p.x) - difference(p.y, p.x, p.y - 1, p.x - 1);
+							sum += d1 * d1; n++;
+						}
+						if(region.Contains(p.y - 1, p.x + 1) && region.Contains(p.y + 1, p.x - 1))
+						{
+							float d2 = difference(p.y + 1, p.x - 1, p.y, p.x) - difference(p.y, p.x, p.y - 1, p.x + 1);
+							sum += d2 * d2; n++;
+						}
+
+						// Missing differences are compensated by scaling the sum,
+						// pixels without any get the worst value below
+						second[i] = n > 0 ? -std::sqrt(sum * 4.0f / n) : 1.0f;
+					}
+					PU_PROFILE_WORK(range.end - range.start);
 				});
 
-				return variance;
+				float worst = 0;
+				for(float value : second)
+				{
+					worst = std::min(worst, value);
+				}
+				for(float& value : second)
+				{
+					if(value > 0) value = worst;
+				}
+				result.second_difference = region.Scatter(second, worst);
 			}
 
-			cv::Mat WindowedMaxAbs(const cv::Mat & image, int k, cv::Mat* bitflags, Bitflag ignore_flag)
+			return result;
+		}
+
+		QualityMapSet ComputeMaps(const cv::Mat & wrapped_phase, unsigned maps, cv::Size window, cv::Rect roi, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			assert(!wrapped_phase.empty() &&
+				   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
+				   "[ComputeMaps] Invalid wrapped phase image");
+
+			roi &= cv::Rect(0, 0, wrapped_phase.cols, wrapped_phase.rows);
+			assert(roi.area() > 0 && "[ComputeMaps] ROI does not overlap the image");
+
+			// Half window for windowed maps, one more for forward gradients
+			// (and second differences) at the far side of the window
+			const int hx = window.width / 2 + 1, hy = window.height / 2 + 1;
+			cv::Rect read = cv::Rect(roi.x - hx, roi.y - hy, roi.width + 2 * hx, roi.height + 2 * hy) &
+				cv::Rect(0, 0, wrapped_phase.cols, wrapped_phase.rows);
+
+			cv::Mat flags;
+			if(bitflags)
 			{
-				// Only floating point images are supported
-				assert(!image.empty() &&
-					   image.type() == CV_32FC1 &&
-					   "[WindowedMaxAbs] Invalid image");
+				assert(bitflags->size() == wrapped_phase.size() && "[ComputeMaps] Invalid bitflags image");
+				flags = (*bitflags)(read);
+			}
 
-				// If user provided bitflags (double) check that it has proper size
-				if(bitflags)
+			// Map edges inside the image are at least one pixel past any window
+			// of the ROI, so they do not change ROI values
+			QualityMapSet halo = ComputeMapsUnfilled(wrapped_phase(read), maps, window, bitflags ? &flags : nullptr, ignore_flag);
+
+			const cv::Rect crop = roi - read.tl();
+			QualityMapSet result;
+			for(auto map : { std::make_pair(&halo.pdv, &result.pdv), std::make_pair(&halo.max_abs_grad, &result.max_abs_grad),
+							 std::make_pair(&halo.pseudo_correlation, &result.pseudo_correlation),
+							 std::make_pair(&halo.second_difference, &result.second_difference) })
+			{
+				if(!map.first->empty())
 				{
-					assert(bitflags->size() == image.size() &&
-						   "[WindowedMaxAbs] Invalid bitflags image");
+					*map.second = (*map.first)(crop).clone();
 				}
+			}
 
-				// Dimensions and image rect
-				int rows = image.rows, cols = image.cols;
-				cv::Rect rect{ 0,0,cols, rows };
+			// Worst value is taken within the ROI, not the halo
+			if(!result.second_difference.empty())
+			{
+				FillMissingDifferences(result.second_difference);
+			}
+			return result;
+		}
 
-				// Half window size rounded down
-				int k2 = k / 2;
+		cv::Mat PDV(const cv::Mat & wrapped_phase, cv::Size window, cv::Rect roi, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			PU_PROFILE_SCOPE("PDV");
 
-				// Image for the results
-				cv::Mat maximum{ rows,cols,CV_32FC1,cv::Scalar(0) };
+			return ComputeMaps(wrapped_phase, PDVMap, window, roi, bitflags, ignore_flag).pdv;
+		}
 
-				// Compute dx derivative variance over window of size k and place it in result image
-				maximum.forEach<float>([&](float &max_px, const int* pos) -> void {
-					int row = pos[0], col = pos[1];
+		cv::Mat MaxAbsGrad(const cv::Mat & wrapped_phase, cv::Size window, cv::Rect roi, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			PU_PROFILE_SCOPE("MaxAbsGrad");
 
-					// Intersection of image and window centered at current pixel
-					auto roi = rect & cv::Rect(col - k2, row - k2, k, k);
+			return ComputeMaps(wrapped_phase, MaxAbsGradMap, window, roi, bitflags, ignore_flag).max_abs_grad;
+		}
 
-					// "Cut" the window from dx derivative
-					cv::Mat window = image(roi);
+		float QualityStatistics::Percentile(double fraction) const
+		{
+			if(count == 0 || histogram.empty()) return 0;
 
-					// Just to speed things up a bit make one initial check instead of in each loop 
-					// With bitflag checking
-					if(bitflags && ignore_flag != Bitflag::NoFlag)
-					{
-						std::mutex mtx;
-						window.forEach<float>([&](float& win_px, const int* pos) -> void {
-							// Coordinates of window pixel (in IMAGE pixel coordinates reference)
-							int winRow = row + pos[0] - k2, winCol = col + pos[1] - k2;
+			const double target = std::min(std::max(fraction, 0.0), 1.0) * count;
+			const double bin_width = (static_cast<double>(high) - low) / histogram.size();
 
-							// Check for ignore code in bitflags
-							if(bitflags->at<bitflag_type>(winRow, winCol) & ignore_flag)
-							{
-								return;
-							}
+			long long below = 0;
+			for(size_t bin = 0; bin < histogram.size(); bin++)
+			{
+				if(histogram[bin] > 0 && below + histogram[bin] >= target)
+				{
+					// Values are assumed spread evenly over the bin
+					double value = low + bin_width * (bin + (target - below) / histogram[bin]);
+					return std::min(std::max(static_cast<float>(value), min), max);
+				}
+				below += histogram[bin];
+			}
+			return max;
+		}
 
-							// Since forEach is multi threaded and updating max is not atomic lock need to be issued...
-							std::lock_guard<std::mutex> lock(mtx);
-							max_px = std::max(std::abs(win_px), max_px);
-						});
+		namespace
+		{
+			/// <summary>
+			/// Range of values of the map, histogram bounds
+			/// </summary>
+			void MapRange(MapFlag map, float& low, float& high)
+			{
+				switch(map)
+				{
+				case PseudoCorrelationMap: low = 0.0f; high = 1.0f; break;
+				case SecondDifferenceMap: low = -2.0f; high = 0.0f; break;
+				default: low = -0.5f; high = 0.0f; break;
+				}
+			}
 
-					}
-					// Without bitflag checking
-					else
+			const cv::Mat& MapOf(const QualityMapSet& set, MapFlag map)
+			{
+				switch(map)
+				{
+				case PDVMap: return set.pdv;
+				case MaxAbsGradMap: return set.max_abs_grad;
+				case PseudoCorrelationMap: return set.pseudo_correlation;
+				default: return set.second_difference;
+				}
+			}
+		}
+
+		QualityStatistics MapStatistics(const cv::Mat & wrapped_phase, MapFlag map, cv::Size window, cv::Rect roi,
+										cv::Mat * bitflags, Bitflag ignore_flag, float stop_below, int bins)
+		{
+			assert(!wrapped_phase.empty() &&
+				   (wrapped_phase.type() == CV_32FC1 || wrapped_phase.type() == CV_16UC1) &&
+				   "[MapStatistics] Invalid wrapped phase image");
+			assert((map == PDVMap || map == MaxAbsGradMap || map == PseudoCorrelationMap || map == SecondDifferenceMap) &&
+				   "[MapStatistics] Exactly one map must be requested");
+			assert(bins > 0 && "[MapStatistics] Number of bins must be positive");
+
+			PU_PROFILE_SCOPE("MapStatistics");
+
+			const cv::Rect frame(0, 0, wrapped_phase.cols, wrapped_phase.rows);
+			roi = roi.area() > 0 ? roi & frame : frame;
+
+			QualityStatistics statistics;
+			statistics.histogram.assign(bins, 0);
+			MapRange(map, statistics.low, statistics.high);
+			statistics.min = std::numeric_limits<float>::max();
+			statistics.max = std::numeric_limits<float>::lowest();
+			if(roi.area() == 0)
+			{
+				statistics.min = statistics.max = 0;
+				return statistics;
+			}
+
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag;
+			const float scale = bins / (statistics.high - statistics.low);
+
+			// Phase, gradients and map of a tile stay in cache, tiles are tall
+			// enough for the halo rows read twice not to matter
+			cv::Size tile = parallel::TileSize(roi.size(), 24);
+			tile.height = std::max(tile.height, 4 * (window.height / 2 + 1));
+
+			std::mutex mutex;
+			std::atomic<bool> stop{ false };
+			double sum = 0;
+
+			parallel::ForTiles(roi.size(), tile, [&](cv::Rect rect) {
+				if(stop) return;
+
+				rect += roi.tl();
+				const cv::Mat values = MapOf(ComputeMaps(wrapped_phase, map, window, rect, bitflags, ignore_flag), map);
+
+				std::vector<long long> histogram(bins, 0);
+				float low = std::numeric_limits<float>::max(), high = std::numeric_limits<float>::lowest();
+				double tile_sum = 0;
+				long long count = 0, skipped = 0;
+				bool found = false;
+
+				for(int row = 0; row < values.rows; row++)
+				{
+					const float* src = values.ptr<float>(row);
+					const bitflag_type* flags = masked ? bitflags->ptr<bitflag_type>(rect.y + row) + rect.x : nullptr;
+					for(int col = 0; col < values.cols; col++)
 					{
-						// Compute maximum in the given window
-						double minVal, maxVal;
-						cv::minMaxLoc(window, &minVal, &maxVal);
-						max_px = static_cast<float>(std::max(std::abs(minVal), std::abs(maxVal)));
+						if(masked && (flags[col] & ignore_flag))
+						{
+							skipped++;
+							continue;
+						}
+
+						const float value = src[col];
+						low = std::min(low, value);
+						high = std::max(high, value);
+						tile_sum += value;
+						count++;
+						found |= value < stop_below;
+
+						int bin = static_cast<int>((value - statistics.low) * scale);
+						histogram[std::min(std::max(bin, 0), bins - 1)]++;
 					}
-				});
+				}
+				PU_PROFILE_COUNT("MapStatistics", MaskedPixelsSkipped, skipped);
 
-				return maximum;
+				if(found) stop = true;
+
+				std::lock_guard<std::mutex> lock(mutex);
+				statistics.count += count;
+				statistics.min = std::min(statistics.min, low);
+				statistics.max = std::max(statistics.max, high);
+				sum += tile_sum;
+				for(int bin = 0; bin < bins; bin++)
+				{
+					statistics.histogram[bin] += histogram[bin];
+				}
+			});
+
+			statistics.stopped = stop;
+			if(statistics.count > 0)
+			{
+				statistics.mean = sum / statistics.count;
+			}
+			else
+			{
+				statistics.min = statistics.max = 0;
 			}
+			return statistics;
 		}
 	}
-}
\ No newline at end of file
+}
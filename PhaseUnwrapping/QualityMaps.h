@@ -1,6 +1,10 @@
 #pragma once
 #include "Bitflags.h"
-#include <opencv2\opencv.hpp>
+#include "ValidRegion.h"
+#include <opencv2/opencv.hpp>
+
+#include <limits>
+#include <vector>
 
 namespace pu
 {
@@ -14,7 +18,7 @@ namespace pu
 		/// </summary>
 		/// <param name="wrapped_phase">
 		/// Image with wrapped phase, 1 channel, floating point number, pixel value
-		/// range [0,1].
+		/// range [0,1], or 16-bit fixed point (CV_16UC1, see ToFixed16).
 		/// </param>
 		/// <param name="k">
 		/// Size of the window whole side, odd, greater equal 3. For instance k = 3 
@@ -34,6 +38,16 @@ namespace pu
 		/// Quality values should be read as: 0 = worst, 1 = best.
 		/// </returns>
 		cv::Mat PDV(const cv::Mat& wrapped_phase, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes Phase Derivative variance quality map over rectangular
+		/// window, see PDV. Cost per pixel does not depend on the window size,
+		/// so elongated windows (e.g. 3x15 along fringes) are as cheap as 3x3.
+		/// </summary>
+		/// <param name="window">
+		/// Window width (kx) and height (ky), both odd, greater equal 1.
+		/// </param>
+		cv::Mat PDV(const cv::Mat& wrapped_phase, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
 		
 		/// <summary>
 		/// Computes Maximum Gradient quality map. Maximum gradient is computed as
@@ -42,7 +56,7 @@ namespace pu
 		/// </summary>
 		/// <param name="wrapped_phase">
 		/// Image with wrapped phase, 1 channel, floating point number, pixel value
-		/// range [0,1].
+		/// range [0,1], or 16-bit fixed point (CV_16UC1, see ToFixed16).
 		/// </param>
 		/// <param name="k">
 		/// Size of the window whole side, odd, greater equal 3. For instance k = 3 
@@ -63,29 +77,312 @@ namespace pu
 		/// </returns>
 		cv::Mat MaxAbsGrad(const cv::Mat& wrapped_phase, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
 
+		/// <summary>
+		/// Computes Maximum Gradient quality map over rectangular window, see
+		/// MaxAbsGrad. Cost per pixel grows with width + height, not the area.
+		/// </summary>
+		/// <param name="window">
+		/// Window width (kx) and height (ky), both odd, greater equal 1.
+		/// </param>
+		cv::Mat MaxAbsGrad(const cv::Mat& wrapped_phase, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes Pseudo-correlation quality map: length of the mean of unit
+		/// phasors (cos, sin of the phase) in window of size KxK centered over
+		/// each of the image pixels. Consistent phase gives values close to 1,
+		/// noisy phase close to 0.
+		/// </summary>
+		/// <param name="wrapped_phase">
+		/// Image with wrapped phase, 1 channel, floating point number, pixel value
+		/// range [0,1], or 16-bit fixed point (CV_16UC1, see ToFixed16).
+		/// </param>
+		/// <param name="k">
+		/// Size of the window whole side, odd, greater equal 3.
+		/// </param>
+		/// <param name="bitflags">
+		/// [optional, default = null] Image with bitflags per each pixel in 
+		/// wrapped phase image, same size as wrapped phase, 1 channel, pixel type 
+		/// as defined by bitflag_type typedef.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [optional, default = NoFlag] Bit-or combination of flags which  should 
+		/// be ignored during computations.
+		/// </param>
+		/// <returns>
+		/// Image with Pseudo-correlation, 1 channel, floating point, range [0, 1].
+		/// Quality values should be read as: 0 = worst, 1 = best.
+		/// </returns>
+		cv::Mat PseudoCorrelation(const cv::Mat& wrapped_phase, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes Pseudo-correlation quality map over rectangular window, see
+		/// PseudoCorrelation. Cost per pixel does not depend on the window size.
+		/// </summary>
+		/// <param name="window">
+		/// Window width (kx) and height (ky), both odd, greater equal 1.
+		/// </param>
+		cv::Mat PseudoCorrelation(const cv::Mat& wrapped_phase, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes Second Difference reliability map (Herraez): wrapped second
+		/// differences of phase along the row, the column and both diagonals
+		/// through each pixel, D = sqrt(H^2 + V^2 + D1^2 + D2^2). Second
+		/// differences do not depend on the local fringe slope, only on its
+		/// change, so smooth dense fringes are not penalized as in PDV.
+		/// </summary>
+		/// <param name="wrapped_phase">
+		/// Image with wrapped phase, 1 channel, floating point number, pixel value
+		/// range [0,1], or 16-bit fixed point (CV_16UC1, see ToFixed16).
+		/// </param>
+		/// <param name="bitflags">
+		/// [optional, default = null] Image with bitflags per each pixel in 
+		/// wrapped phase image, same size as wrapped phase, 1 channel, pixel type 
+		/// as defined by bitflag_type typedef.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [optional, default = NoFlag] Bit-or combination of flags which  should 
+		/// be ignored during computations. Differences through ignored pixels
+		/// are left out.
+		/// </param>
+		/// <returns>
+		/// Image with negated D (in cycles), 1 channel, floating point. Missing
+		/// differences (image edges, ignored pixels) are compensated by scaling
+		/// the sum of available ones, pixels with none of them get the worst
+		/// value of the map. Quality values should be read as: lower = worse.
+		/// </returns>
+		cv::Mat SecondDifference(const cv::Mat& wrapped_phase, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Quality maps which can be requested from ComputeMaps, bit-or
+		/// combination
+		/// </summary>
+		enum MapFlag : unsigned
+		{
+			PDVMap = 0x1,
+			MaxAbsGradMap = 0x2,
+			PseudoCorrelationMap = 0x4,
+			SecondDifferenceMap = 0x8,
+			AllMaps = PDVMap | MaxAbsGradMap | PseudoCorrelationMap | SecondDifferenceMap
+		};
+
+		/// <summary>
+		/// Results of ComputeMaps, maps which were not requested are empty
+		/// </summary>
+		struct QualityMapSet
+		{
+			cv::Mat pdv;
+			cv::Mat max_abs_grad;
+			cv::Mat pseudo_correlation;
+			cv::Mat second_difference;
+		};
+
+		/// <summary>
+		/// Computes several quality maps at once. Wrapped gradients (PDV,
+		/// MaxAbsGrad, SecondDifference) and cos/sin planes (PseudoCorrelation)
+		/// are computed once and shared by all requested maps. Each map equals
+		/// the one returned by its own function.
+		/// </summary>
+		/// <param name="wrapped_phase">
+		/// Image with wrapped phase, see PDV.
+		/// </param>
+		/// <param name="maps">
+		/// Bit-or combination of MapFlag values.
+		/// </param>
+		/// <param name="window">
+		/// Window of windowed maps (all but SecondDifference), width (kx) and
+		/// height (ky), both odd, greater equal 1.
+		/// </param>
+		/// <param name="bitflags">
+		/// [optional, default = null] Image with bitflags, see PDV.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [optional, default = NoFlag] Flags ignored during computations.
+		/// </param>
+		QualityMapSet ComputeMaps(const cv::Mat& wrapped_phase, unsigned maps, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes several quality maps at once over valid region only, for
+		/// mostly masked frames. Only valid pixels are visited (windows are
+		/// walked through packed row segments), so the cost scales with the
+		/// region area. At valid pixels maps equal ComputeMaps with bitflags
+		/// masking the rest of the frame, other pixels get the worst value of
+		/// the map. MaxAbsGrad visits every valid window pixel, other maps
+		/// only each window row.
+		/// </summary>
+		/// <param name="wrapped_phase">
+		/// Image with wrapped phase, see PDV.
+		/// </param>
+		/// <param name="maps">
+		/// Bit-or combination of MapFlag values.
+		/// </param>
+		/// <param name="window">
+		/// Window of windowed maps, width (kx) and height (ky), both odd,
+		/// greater equal 1.
+		/// </param>
+		/// <param name="region">
+		/// Valid region, same size as wrapped phase.
+		/// </param>
+		QualityMapSet ComputeMaps(const cv::Mat& wrapped_phase, unsigned maps, cv::Size window, const masks::ValidRegion& region);
+
+		/// <summary>
+		/// Computes several quality maps inside a region of interest only.
+		/// Only the ROI grown by the halo the maps depend on (half of the
+		/// window plus one pixel for gradients) is read, so the cost scales
+		/// with the ROI, not the frame. Maps equal the ROI of ComputeMaps over
+		/// the whole frame, except SecondDifference pixels without any
+		/// difference, which get the worst value within the ROI.
+		/// </summary>
+		/// <param name="wrapped_phase">
+		/// Image with wrapped phase, see PDV.
+		/// </param>
+		/// <param name="maps">
+		/// Bit-or combination of MapFlag values.
+		/// </param>
+		/// <param name="window">
+		/// Window of windowed maps, width (kx) and height (ky), both odd,
+		/// greater equal 1.
+		/// </param>
+		/// <param name="roi">
+		/// Region of interest, clipped to the image, not empty.
+		/// </param>
+		/// <param name="bitflags">
+		/// [optional, default = null] Image with bitflags of the whole frame,
+		/// see PDV.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [optional, default = NoFlag] Flags ignored during computations.
+		/// </param>
+		/// <returns>
+		/// Maps of ROI size.
+		/// </returns>
+		QualityMapSet ComputeMaps(const cv::Mat& wrapped_phase, unsigned maps, cv::Size window, cv::Rect roi, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes PDV inside a region of interest only, see ComputeMaps.
+		/// </summary>
+		cv::Mat PDV(const cv::Mat& wrapped_phase, cv::Size window, cv::Rect roi, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Computes Maximum Gradient inside a region of interest only, see
+		/// ComputeMaps.
+		/// </summary>
+		cv::Mat MaxAbsGrad(const cv::Mat& wrapped_phase, cv::Size window, cv::Rect roi, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Summary of a quality map: extrema, mean and histogram of values of
+		/// pixels which were not ignored, see MapStatistics
+		/// </summary>
+		struct QualityStatistics
+		{
+			/// <summary>
+			/// Number of pixels in statistics
+			/// </summary>
+			long long count = 0;
+
+			float min = 0;
+			float max = 0;
+			double mean = 0;
+
+			/// <summary>
+			/// Histogram of values over [low, high], values outside are
+			/// counted in the first or the last bin
+			/// </summary>
+			std::vector<long long> histogram;
+			float low = 0;
+			float high = 0;
+
+			/// <summary>
+			/// Whether computation stopped early because a value below
+			/// stop_below was found, statistics then cover only the part of
+			/// the ROI processed until then
+			/// </summary>
+			bool stopped = false;
+
+			/// <summary>
+			/// Value below which given fraction of pixels lays, interpolated
+			/// within histogram bin (resolution is range / number of bins),
+			/// e.g. 0.5 for median. 0 for empty statistics.
+			/// </summary>
+			float Percentile(double fraction) const;
+		};
+
+		/// <summary>
+		/// Computes statistics of a single quality map without allocating the
+		/// map: ROI is processed in cache sized tiles (see ComputeMaps with
+		/// ROI) in parallel, each reduced to min, max, sum and histogram right
+		/// after it is computed. Optional early exit for pass/fail checks:
+		/// once a value below stop_below is found no further tiles are
+		/// started.
+		/// </summary>
+		/// <param name="wrapped_phase">
+		/// Image with wrapped phase, see PDV.
+		/// </param>
+		/// <param name="map">
+		/// Single MapFlag value.
+		/// </param>
+		/// <param name="window">
+		/// Window of windowed maps, width (kx) and height (ky), both odd,
+		/// greater equal 1.
+		/// </param>
+		/// <param name="roi">
+		/// [optional, default = empty] Region of interest, empty = whole image.
+		/// </param>
+		/// <param name="bitflags">
+		/// [optional, default = null] Image with bitflags, see PDV. Ignored
+		/// pixels are left out of the statistics.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [optional, default = NoFlag] Flags ignored during computations.
+		/// </param>
+		/// <param name="stop_below">
+		/// [optional, default = -infinity] Quality which stops computation
+		/// when found.
+		/// </param>
+		/// <param name="bins">
+		/// [optional, default = 4096] Number of histogram bins. Histogram
+		/// covers range of the map: [-0.5, 0] for PDV and MaxAbsGrad, [0, 1]
+		/// for PseudoCorrelation, [-2, 0] for SecondDifference (cycles).
+		/// </param>
+		QualityStatistics MapStatistics(const cv::Mat& wrapped_phase, MapFlag map, cv::Size window, cv::Rect roi = cv::Rect(),
+										cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag,
+										float stop_below = -std::numeric_limits<float>::infinity(), int bins = 4096);
+
 		namespace
 		{
 			/// <summary>
-			/// Computes windowed variance within window size of KxK around each 
-			/// pixel.
+			/// Computes windowed variance within window of given size around
+			/// each pixel.
 			/// </summary>
 			/// <param name="image"></param>
-			/// <param name="k"></param>
+			/// <param name="window"></param>
 			/// <param name="bitflags"></param>
 			/// <param name="ignore_flag"></param>
 			/// <returns></returns>
-			cv::Mat WindowedVariance(const cv::Mat& image, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+			cv::Mat WindowedVariance(const cv::Mat& image, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
 
 			/// <summary>
-			/// Computes windowed maximum absolute value within window size of KxK 
-			/// around each pixel.
+			/// Computes windowed maximum absolute value within window of given
+			/// size around each pixel.
 			/// </summary>
 			/// <param name="image"></param>
-			/// <param name="k"></param>
+			/// <param name="window"></param>
+			/// <param name="bitflags"></param>
+			/// <param name="ignore_flag"></param>
+			/// <returns></returns>
+			cv::Mat WindowedMaxAbs(const cv::Mat& image, cv::Size window, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+			/// <summary>
+			/// Computes negated second differences from wrapped phase and its
+			/// wrapped gradients (DxGradient, DyGradient). Pixels without any
+			/// difference are left at 1 for the caller to fill.
+			/// </summary>
+			/// <param name="wrapped_phase"></param>
+			/// <param name="dx"></param>
+			/// <param name="dy"></param>
 			/// <param name="bitflags"></param>
 			/// <param name="ignore_flag"></param>
 			/// <returns></returns>
-			cv::Mat WindowedMaxAbs(const cv::Mat& image, int k, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+			cv::Mat SecondDifferences(const cv::Mat& wrapped_phase, const cv::Mat& dx, const cv::Mat& dy, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
 		}
 	}
 }
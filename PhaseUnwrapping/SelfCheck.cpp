@@ -0,0 +1,1269 @@
+#include "SelfCheck.h"
+#include "BitPlane.h"
+#include "Cache.h"
+#include "Dataset.h"
+#include "Evaluation.h"
+#include "Filters.h"
+#include "IO.h"
+#include "Masks.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "QualityMaps.h"
+#include "Server.h"
+#include "Storage.h"
+#include "Trigonometry.h"
+#include "Unwrappers.h"
+#include "ValidRegion.h"
+#include "WindowKernels.h"
+#include "Wrappers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <sstream>
+
+namespace pu
+{
+	namespace evaluation
+	{
+		namespace
+		{
+			/// <summary>
+			/// Float maps computed in different order (specialized, tiled or
+			/// packed paths), values up to ~1
+			/// </summary>
+			const double KERNEL_TOLERANCE = 1e-5;
+
+			/// <summary>
+			/// Phase from atan2 of differently summed cos/sin, radians or cycles
+			/// </summary>
+			const double PHASE_TOLERANCE = 1e-4;
+
+			/// <summary>
+			/// RMS error of unwrapped phase against reference, radians
+			/// </summary>
+			const double UNWRAP_TOLERANCE = 1e-3;
+
+			/// <summary>
+			/// Drop of the fraction of correctly unwrapped pixels below the one
+			/// of reference, for inputs with residues
+			/// </summary>
+			const double UNWRAP_CORRECT_TOLERANCE = 0.01;
+
+			const double FAILED = std::numeric_limits<double>::infinity();
+
+			/// <summary>
+			/// Generated inputs shared by the checks
+			/// </summary>
+			struct Frames
+			{
+				int rows = 0;
+				int cols = 0;
+				uint64_t seed = 0;
+				cv::Rect whole;
+
+				/// <summary>
+				/// Region of interest away from the frame edges
+				/// </summary>
+				cv::Rect roi;
+
+				/// <summary>
+				/// Peaks surface in radians and its noisy copy wrapped to [0, 1)
+				/// (residues, varying quality)
+				/// </summary>
+				cv::Mat truth;
+				cv::Mat wrapped;
+
+				/// <summary>
+				/// Wrapped values as signed fixed point image (as gradients are),
+				/// scale converts it back
+				/// </summary>
+				cv::Mat fixed;
+				float scale = 1.0f;
+
+				/// <summary>
+				/// Irregular mask (solid blobs and isolated pixels) as Border
+				/// bitflags, 8-bit mask of masked pixels and of valid ones
+				/// </summary>
+				cv::Mat bitflags;
+				cv::Mat flagged;
+				cv::Mat valid;
+
+				cv::Mat cos_plane;
+				cv::Mat sin_plane;
+			};
+
+			Frames MakeFrames(const SelfCheckOptions& options)
+			{
+				Frames frames;
+				const int rows = options.rows, cols = options.cols;
+				frames.rows = rows;
+				frames.cols = cols;
+				frames.seed = options.seed;
+				frames.whole = cv::Rect(0, 0, cols, rows);
+				frames.roi = cv::Rect(cols / 5, rows / 4, cols / 2, rows / 2);
+
+				frames.truth = GenerateSurface(Surface::Peaks, frames.whole, rows, cols);
+				cv::Mat noisy = frames.truth.clone();
+				AddNoise(noisy, NoiseType::Phase, 0.6f, options.seed, cv::Point(0, 0), cols);
+				frames.wrapped = WrapNormalized(noisy);
+
+				frames.scale = 1.0f / 32767.0f;
+				frames.wrapped.convertTo(frames.fixed, CV_16SC1, 32767.0, -16384.0);
+
+				// Mask is made of fringe bands of more noisy copy
+				cv::Mat blobs = frames.truth.clone();
+				AddNoise(blobs, NoiseType::Phase, 1.0f, options.seed + 1, cv::Point(0, 0), cols);
+				blobs = WrapNormalized(blobs);
+				frames.bitflags = cv::Mat(rows, cols, CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1), cv::Scalar(0));
+				frames.flagged = cv::Mat(rows, cols, CV_8UC1, cv::Scalar(0));
+				frames.valid = cv::Mat(rows, cols, CV_8UC1, cv::Scalar(0));
+				for(int row = 0; row < rows; row++)
+				{
+					for(int col = 0; col < cols; col++)
+					{
+						const bool masked = blobs.at<float>(row, col) > 0.85f;
+						frames.bitflags.at<bitflag_type>(row, col) = masked ? Bitflag::Border : Bitflag::NoFlag;
+						frames.flagged.at<unsigned char>(row, col) = masked ? 255 : 0;
+						frames.valid.at<unsigned char>(row, col) = masked ? 0 : 255;
+					}
+				}
+
+				kernels::CosSin(frames.wrapped, frames.cos_plane, frames.sin_plane);
+				return frames;
+			}
+
+			void Add(std::vector<Check>& checks, const std::string& name, double error, double tolerance)
+			{
+				Check check;
+				check.name = name;
+				check.error = error;
+				check.tolerance = tolerance;
+				check.passed = error <= tolerance;
+				checks.push_back(check);
+			}
+
+			void Skip(std::vector<Check>& checks, const std::string& name)
+			{
+				Check check;
+				check.name = name;
+				check.passed = true;
+				check.skipped = true;
+				checks.push_back(check);
+			}
+
+			std::string WindowName(cv::Size window)
+			{
+				return std::to_string(window.width) + "x" + std::to_string(window.height);
+			}
+
+			/// <summary>
+			/// Max abs difference of floating point images at pixels where mask
+			/// (if given) is non zero. Differences are taken modulo period when
+			/// it is positive (phase). Infinity if images differ in size or type
+			/// or a value is NaN.
+			/// </summary>
+			double MaxDifference(const cv::Mat& a, const cv::Mat& b, double period = 0, const cv::Mat& mask = cv::Mat())
+			{
+				if(a.size() != b.size() || a.type() != CV_32FC1 || b.type() != CV_32FC1)
+				{
+					return FAILED;
+				}
+
+				double error = 0;
+				for(int row = 0; row < a.rows; row++)
+				{
+					const float* pa = a.ptr<float>(row);
+					const float* pb = b.ptr<float>(row);
+					const unsigned char* m = mask.empty() ? nullptr : mask.ptr<unsigned char>(row);
+					for(int col = 0; col < a.cols; col++)
+					{
+						if(m && !m[col]) continue;
+
+						double d = std::abs(static_cast<double>(pa[col]) - pb[col]);
+						if(period > 0)
+						{
+							d = std::fmod(d, period);
+							d = std::min(d, period - d);
+						}
+						if(std::isnan(d)) return FAILED;
+						error = std::max(error, d);
+					}
+				}
+				return error;
+			}
+
+			/// <summary>
+			/// Sets thread count for the enclosing scope, the previous setting
+			/// (fixed count or automatic) is restored afterwards
+			/// </summary>
+			class ScopedThreadCount
+			{
+			public:
+				explicit ScopedThreadCount(int threads) : previous(parallel::ThreadCountSetting())
+				{
+					parallel::SetThreadCount(threads);
+				}
+
+				~ScopedThreadCount()
+				{
+					parallel::SetThreadCount(previous);
+				}
+
+				ScopedThreadCount(const ScopedThreadCount&) = delete;
+				ScopedThreadCount& operator=(const ScopedThreadCount&) = delete;
+
+			private:
+				int previous;
+			};
+
+			/// <summary>
+			/// Number of pixels where one of the masks is set and the other not
+			/// </summary>
+			double Mismatches(const cv::Mat& a, const cv::Mat& b)
+			{
+				if(a.size() != b.size() || a.type() != CV_8UC1 || b.type() != CV_8UC1)
+				{
+					return FAILED;
+				}
+
+				double mismatches = 0;
+				for(int row = 0; row < a.rows; row++)
+				{
+					const unsigned char* pa = a.ptr<unsigned char>(row);
+					const unsigned char* pb = b.ptr<unsigned char>(row);
+					for(int col = 0; col < a.cols; col++)
+					{
+						mismatches += (pa[col] != 0) != (pb[col] != 0);
+					}
+				}
+				return mismatches;
+			}
+
+			/// <summary>
+			/// Compare itself: offset of whole cycles plus a fraction is
+			/// removed, a region off by a cycle counts as incorrect
+			/// </summary>
+			void CheckCompare(const Frames& frames, std::vector<Check>& checks)
+			{
+				cv::Mat shifted;
+				frames.truth.convertTo(shifted, CV_32FC1, 1.0, 6.0 * CV_PI + 0.25);
+				const Accuracy offset = Compare(shifted, frames.truth);
+				Add(checks, "Compare offset", std::max(offset.rms, 1.0 - offset.correct), UNWRAP_TOLERANCE);
+
+				// Left third off by a cycle, the rest keeps the offset
+				const int third = frames.cols / 3;
+				cv::Mat wrong = frames.truth.clone();
+				for(int row = 0; row < frames.rows; row++)
+				{
+					for(int col = 0; col < third; col++)
+					{
+						wrong.at<float>(row, col) += static_cast<float>(2.0 * CV_PI);
+					}
+				}
+				const double expected = 1.0 - static_cast<double>(third) / frames.cols;
+				Add(checks, "Compare wrong region", std::abs(Compare(wrong, frames.truth).correct - expected), 0);
+			}
+
+			/// <summary>
+			/// Counter of the stage summed over threads, 0 if stage is unknown
+			/// </summary>
+			long long StageCounter(const profiling::Report& report, const std::string& stage, profiling::Counter counter)
+			{
+				for(const profiling::StageStats& stats : report.stages)
+				{
+					if(stats.name == stage) return stats.counters[counter];
+				}
+				return 0;
+			}
+
+			long long StageCalls(const profiling::Report& report, const std::string& stage)
+			{
+				for(const profiling::StageStats& stats : report.stages)
+				{
+					if(stats.name == stage) return stats.calls;
+				}
+				return 0;
+			}
+
+			/// <summary>
+			/// Masked pixel counters of the kernels (every pixel once, whatever
+			/// the tiling), scope timings and the trace. Counted as differences
+			/// of reports, profiling of the self check itself is not reset.
+			/// </summary>
+			void CheckProfiling(const Frames& frames, std::vector<Check>& checks)
+			{
+				if(!profiling::Enabled())
+				{
+					Skip(checks, "Profiling masked pixels");
+					Skip(checks, "Profiling calls");
+					Skip(checks, "Profiling trace");
+					return;
+				}
+
+				const long long expected = cv::countNonZero(frames.flagged);
+				cv::Mat bitflags = frames.bitflags.clone();
+
+				struct Run
+				{
+					const char* name;
+					const char* stage;
+					std::function<void()> run;
+				};
+
+				const Run runs[] = {
+					{ "WindowedVariance 3x3", "WindowedVariance", [&] { kernels::WindowedVariance<3>(frames.wrapped, &bitflags, Bitflag::Border); } },
+					{ "WindowedVariance 5x3", "WindowedVariance", [&] { kernels::WindowedVariance(frames.wrapped, cv::Size(5, 3), &bitflags, Bitflag::Border); } },
+					{ "PseudoCorrelation 5x3", "PseudoCorrelation", [&] { kernels::PseudoCorrelation(frames.cos_plane, frames.sin_plane, cv::Size(5, 3), &bitflags, Bitflag::Border); } },
+					{ "SecondDifference", "SecondDifference", [&] { quality_maps::SecondDifference(frames.wrapped, &bitflags, Bitflag::Border); } }
+				};
+
+				for(const Run& run : runs)
+				{
+					const long long before = StageCounter(profiling::Collect(), run.stage, profiling::MaskedPixelsSkipped);
+					run.run();
+					const long long after = StageCounter(profiling::Collect(), run.stage, profiling::MaskedPixelsSkipped);
+					Add(checks, std::string("Profiling masked pixels ") + run.name, static_cast<double>(std::abs(after - before - expected)), 0);
+				}
+
+				const long long before = StageCalls(profiling::Collect(), "ComputeMaps");
+				for(int i = 0; i < 3; i++)
+				{
+					quality_maps::PDV(frames.wrapped, 3);
+				}
+				const long long after = StageCalls(profiling::Collect(), "ComputeMaps");
+				Add(checks, "Profiling calls", static_cast<double>(std::abs(after - before - 3)), 0);
+
+				const std::string path = cv::tempfile(".json");
+				double events = 0;
+				if(profiling::ExportChromeTrace(path))
+				{
+					std::ifstream file(path);
+					const std::string trace{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+					for(size_t at = trace.find("\"ComputeMaps\""); at != std::string::npos; at = trace.find("\"ComputeMaps\"", at + 1))
+					{
+						events++;
+					}
+				}
+				std::remove(path.c_str());
+				Add(checks, "Profiling trace", events >= 3 ? 0 : FAILED, 0);
+			}
+
+			void CheckIO(const Frames& frames, std::vector<Check>& checks)
+			{
+				struct FileFormat
+				{
+					const char* name;
+					const char* suffix;
+					io::Format format;
+				};
+
+				const cv::Mat& wrapped = frames.wrapped;
+				for(const FileFormat& file : { FileFormat{ "npy", ".npy", io::Format::Npy }, FileFormat{ "tiff", ".tif", io::Format::Tiff }, FileFormat{ "raw", ".raw", io::Format::Raw } })
+				{
+					const std::string path = cv::tempfile(file.suffix);
+					double error = FAILED;
+					if(io::Write(path, wrapped, file.format))
+					{
+						io::MappedImage mapped = file.format == io::Format::Raw ? io::MapRaw(path, wrapped.rows, wrapped.cols) : io::Map(path);
+						if(!mapped.empty())
+						{
+							cv::Mat whole = mapped.mat.empty() ? mapped.Read(frames.whole) : mapped.mat;
+							error = std::max(MaxDifference(whole, wrapped), MaxDifference(mapped.Read(frames.roi), wrapped(frames.roi)));
+						}
+					}
+					std::remove(path.c_str());
+					Add(checks, std::string("IO ") + file.name, error, 0);
+				}
+			}
+
+			/// <summary>
+			/// Specialized K x K kernels against generic rectangular window ones
+			/// </summary>
+			template<int K>
+			void CheckKernels(const Frames& frames, std::vector<Check>& checks)
+			{
+				const cv::Size window(K, K);
+
+				for(bool masked : { false, true })
+				{
+					const cv::Mat* flags = masked ? &frames.bitflags : nullptr;
+					const std::string name = " " + WindowName(window) + (masked ? " masked" : "");
+
+					Add(checks, "WindowedVariance" + name,
+						MaxDifference(kernels::WindowedVariance<K>(frames.wrapped, flags, Bitflag::Border),
+									  kernels::WindowedVariance(frames.wrapped, window, flags, Bitflag::Border)), KERNEL_TOLERANCE);
+					Add(checks, "WindowedVariance fixed" + name,
+						MaxDifference(kernels::WindowedVariance<K, short>(frames.fixed, flags, Bitflag::Border, frames.scale),
+									  kernels::WindowedVariance<short>(frames.fixed, window, flags, Bitflag::Border, frames.scale)), KERNEL_TOLERANCE);
+					Add(checks, "WindowedMaxAbs" + name,
+						MaxDifference(kernels::WindowedMaxAbs<K>(frames.wrapped, flags, Bitflag::Border),
+									  kernels::WindowedMaxAbs(frames.wrapped, window, flags, Bitflag::Border)), KERNEL_TOLERANCE);
+					Add(checks, "WindowedMaxAbs fixed" + name,
+						MaxDifference(kernels::WindowedMaxAbs<K, short>(frames.fixed, flags, Bitflag::Border, frames.scale),
+									  kernels::WindowedMaxAbs<short>(frames.fixed, window, flags, Bitflag::Border, frames.scale)), KERNEL_TOLERANCE);
+				}
+
+				Add(checks, "MeanPhase " + WindowName(window),
+					MaxDifference(kernels::MeanPhase<K>(frames.cos_plane, frames.sin_plane), kernels::MeanPhase(frames.cos_plane, frames.sin_plane, window), 2 * CV_PI), PHASE_TOLERANCE);
+				Add(checks, "MedianPhase " + WindowName(window),
+					MaxDifference(kernels::MedianPhase<K>(frames.cos_plane, frames.sin_plane), kernels::MedianPhase(frames.cos_plane, frames.sin_plane, window), 2 * CV_PI), PHASE_TOLERANCE);
+			}
+
+			/// <summary>
+			/// Level detection on quantized and continuous phase, tables
+			/// against computed cos and sin
+			/// </summary>
+			void CheckLevels(const Frames& frames, std::vector<Check>& checks)
+			{
+				const int levels = 1024;
+				cv::Mat quantized(frames.rows, frames.cols, CV_32FC1);
+				for(int row = 0; row < frames.rows; row++)
+				{
+					for(int col = 0; col < frames.cols; col++)
+					{
+						const int level = static_cast<int>(std::floor(frames.wrapped.at<float>(row, col) * levels + 0.5f)) % levels;
+						quantized.at<float>(row, col) = static_cast<float>(level) / levels;
+					}
+				}
+
+				// Single pixel between levels (not on a finer grid either)
+				cv::Mat off_level = quantized.clone();
+				off_level.at<float>(frames.rows - 1, frames.cols / 2) += 0.3f / levels;
+
+				Add(checks, "DetectPhaseLevels quantized", std::abs(DetectPhaseLevels(quantized) - levels), 0);
+				Add(checks, "DetectPhaseLevels off level", std::abs(DetectPhaseLevels(off_level)), 0);
+				Add(checks, "DetectPhaseLevels continuous", std::abs(DetectPhaseLevels(frames.wrapped)), 0);
+
+				cv::Mat cos_lut, sin_lut, cos_exact, sin_exact;
+				kernels::CosSin(quantized, cos_lut, sin_lut, levels);
+				kernels::CosSin(quantized, cos_exact, sin_exact);
+				Add(checks, "CosSin lookup", std::max(MaxDifference(cos_lut, cos_exact), MaxDifference(sin_lut, sin_exact)), KERNEL_TOLERANCE);
+
+				const cv::Mat exact = filters::MeanPhaseFilter(quantized, 5);
+				Add(checks, "MeanPhaseFilter detected levels", MaxDifference(filters::MeanPhaseFilter(quantized, 5, -1), exact, 1), PHASE_TOLERANCE);
+				Add(checks, "MeanPhaseFilter fixed point", MaxDifference(filters::MeanPhaseFilter(ToFixed16(quantized), 5), exact, 1), PHASE_TOLERANCE);
+			}
+
+			/// <summary>
+			/// Noise of tiles added in reverse order and noise added with
+			/// different thread counts against noise of the whole frame
+			/// </summary>
+			void CheckNoise(const Frames& frames, std::vector<Check>& checks)
+			{
+				struct Kind
+				{
+					const char* name;
+					NoiseType type;
+				};
+
+				const cv::Size tile(37, 29);
+				for(const Kind& kind : { Kind{ "gaussian", NoiseType::Gaussian }, Kind{ "speckle", NoiseType::Speckle }, Kind{ "phase", NoiseType::Phase } })
+				{
+					cv::Mat whole = frames.truth.clone();
+					AddNoise(whole, kind.type, 0.5f, frames.seed, cv::Point(0, 0), frames.cols);
+
+					cv::Mat tiled = frames.truth.clone();
+					for(int y = (frames.rows - 1) / tile.height * tile.height; y >= 0; y -= tile.height)
+					{
+						for(int x = (frames.cols - 1) / tile.width * tile.width; x >= 0; x -= tile.width)
+						{
+							cv::Mat part = tiled(cv::Rect(cv::Point(x, y), tile) & frames.whole);
+							AddNoise(part, kind.type, 0.5f, frames.seed, cv::Point(x, y), frames.cols);
+						}
+					}
+					Add(checks, std::string("Noise tiles ") + kind.name, MaxDifference(tiled, whole), 0);
+
+					double error = 0;
+					for(int threads : { 1, 3 })
+					{
+						ScopedThreadCount count(threads);
+						cv::Mat noisy = frames.truth.clone();
+						AddNoise(noisy, kind.type, 0.5f, frames.seed, cv::Point(0, 0), frames.cols);
+						error = std::max(error, MaxDifference(noisy, whole));
+					}
+					Add(checks, std::string("Noise threads ") + kind.name, error, 0);
+				}
+			}
+
+			/// <summary>
+			/// Dataset generated in odd bands (residues of each band need the
+			/// halo row of the next one) against the one of a single band and
+			/// against the whole frame computed in memory
+			/// </summary>
+			void CheckDataset(const Frames& frames, std::vector<Check>& checks)
+			{
+				DatasetOptions options;
+				options.rows = frames.rows;
+				options.cols = frames.cols;
+				options.sigma = 0.6f;
+				options.seed = frames.seed;
+
+				const std::string prefix = cv::tempfile();
+				const DatasetFiles whole_files = GetDatasetFiles(prefix + "_whole", options.format);
+				const DatasetFiles band_files = GetDatasetFiles(prefix + "_bands", options.format);
+
+				options.band_rows = frames.rows;
+				bool generated = GenerateDataset(prefix + "_whole", options);
+				options.band_rows = 7;
+				generated = GenerateDataset(prefix + "_bands", options) && generated;
+
+				double bands = FAILED, truth = FAILED, residues = FAILED;
+				if(generated)
+				{
+					// Read may return a view of the mapping, which is closed here
+					auto read = [&](const std::string& path) {
+						io::MappedImage mapped = io::Map(path);
+						return mapped.empty() ? cv::Mat() : mapped.Read(frames.whole).clone();
+					};
+
+					bands = 0;
+					for(auto files : { std::make_pair(whole_files.truth, band_files.truth), std::make_pair(whole_files.wrapped, band_files.wrapped),
+									   std::make_pair(whole_files.noisy, band_files.noisy) })
+					{
+						bands = std::max(bands, MaxDifference(read(files.first), read(files.second)));
+					}
+
+					cv::Mat surface = GenerateSurface(options.surface, frames.whole, frames.rows, frames.cols, options.minVal, options.maxVal);
+					truth = MaxDifference(read(band_files.truth), surface);
+
+					const cv::Mat expected = masks::Residues(read(band_files.noisy));
+					const cv::Mat banded = read(band_files.residues);
+					if(banded.size() == expected.size() && banded.type() == expected.type())
+					{
+						residues = 0;
+						for(int row = 0; row < frames.rows; row++)
+						{
+							for(int col = 0; col < frames.cols; col++)
+							{
+								residues += banded.at<signed char>(row, col) != expected.at<signed char>(row, col);
+							}
+						}
+					}
+				}
+
+				for(const DatasetFiles& files : { whole_files, band_files })
+				{
+					for(const std::string& path : { files.truth, files.wrapped, files.noisy, files.residues })
+					{
+						std::remove(path.c_str());
+					}
+				}
+
+				Add(checks, "Dataset bands", bands, 0);
+				Add(checks, "Dataset truth", truth, 0);
+				Add(checks, "Dataset halo residues", residues, 0);
+			}
+
+			/// <summary>
+			/// Unwrapper against QualityGuided on the noise free surfaces of
+			/// Evaluate. Without residues results are unique up to the offset,
+			/// with them (shears) they depend on the path, so only the fraction
+			/// of correctly unwrapped pixels may not drop below QualityGuided's.
+			/// </summary>
+			void CheckUnwrapper(const Frames& frames, const std::string& method,
+								const std::function<cv::Mat(const cv::Mat& wrapped, const cv::Mat& quality)>& unwrap, std::vector<Check>& checks)
+			{
+				for(Surface surface : Options().surfaces)
+				{
+					const std::string name = method + " " + SurfaceName(surface);
+					cv::Mat truth = GenerateSurface(surface, frames.whole, frames.rows, frames.cols);
+					cv::Mat wrapped = WrapNormalized(truth);
+					cv::Mat quality = quality_maps::PDV(wrapped, 3);
+					cv::Mat reference = unwrappers::QualityGuided(wrapped, quality);
+					cv::Mat unwrapped = unwrap(wrapped, quality);
+
+					if(cv::countNonZero(masks::Residues(wrapped)) == 0)
+					{
+						Add(checks, name, Compare(unwrapped, reference).rms, UNWRAP_TOLERANCE);
+					}
+					else
+					{
+						const double drop = Compare(reference, truth).correct - Compare(unwrapped, truth).correct;
+						Add(checks, name + " correct", std::max(0.0, drop), UNWRAP_CORRECT_TOLERANCE);
+					}
+				}
+			}
+
+			/// <summary>
+			/// Least squares on frames of odd sizes (mirrored DFT instead of
+			/// DCT) against the truth, noise free Peaks has no residues
+			/// </summary>
+			void CheckLeastSquares(const Frames& frames, std::vector<Check>& checks)
+			{
+				for(cv::Size size : { cv::Size(frames.cols, frames.rows), cv::Size(frames.cols - 1, frames.rows), cv::Size(frames.cols, frames.rows - 1), cv::Size(frames.cols - 1, frames.rows - 1) })
+				{
+					cv::Mat truth = GenerateSurface(Surface::Peaks, cv::Rect(cv::Point(0, 0), size), size.height, size.width);
+					Add(checks, "LeastSquares " + std::to_string(size.width) + "x" + std::to_string(size.height),
+						Compare(unwrappers::LeastSquares(WrapNormalized(truth)), truth).rms, UNWRAP_TOLERANCE);
+				}
+			}
+
+			void CheckServer(const Frames& frames, std::vector<Check>& checks)
+			{
+#ifdef _WIN32
+				Skip(checks, "Server frame");
+				Skip(checks, "Server invalid request");
+				Skip(checks, "Server shared memory bounds");
+#else
+				server::ServerOptions options;
+				options.socket_path = cv::tempfile(".sock");
+				options.workers = 2;
+				options.log = false;
+
+				const cv::Mat& wrapped = frames.wrapped;
+				server::Server daemon(options);
+				server::Client client;
+				server::SharedFrame frame;
+				const std::string name = "/pu_selfcheck_" + std::to_string(cv::getTickCount() % 1000000007);
+				if(!daemon.Start() || !client.Connect(options.socket_path) || !frame.Create(name, wrapped.rows, wrapped.cols))
+				{
+					Add(checks, "Server start", FAILED, 0);
+					return;
+				}
+				wrapped.copyTo(frame.Input());
+
+				// Empty frame, and output offset whose end wraps around
+				server::Request empty = frame.MakeRequest(server::Operation::Itoh, 1);
+				empty.rows = 0;
+				server::Request outside = frame.MakeRequest(server::Operation::Itoh, 2);
+				outside.output_offset = std::numeric_limits<uint64_t>::max() & ~uint64_t(63);
+
+				client.Send(frame.MakeRequest(server::Operation::Itoh, 0));
+				client.Send(empty);
+				client.Send(outside);
+
+				// Responses come in order of completion
+				double error = FAILED;
+				server::Status statuses[3] = { server::Status::Stopped, server::Status::Stopped, server::Status::Stopped };
+				for(int i = 0; i < 3; i++)
+				{
+					server::Response response;
+					if(!client.Receive(response) || response.id > 2)
+					{
+						break;
+					}
+					statuses[response.id] = response.status;
+					if(response.id == 0 && response.status == server::Status::Ok)
+					{
+						error = MaxDifference(frame.Output(), unwrappers::Itoh(wrapped));
+					}
+				}
+
+				Add(checks, "Server frame", error, 0);
+				Add(checks, "Server invalid request", statuses[1] == server::Status::InvalidRequest ? 0 : FAILED, 0);
+				Add(checks, "Server shared memory bounds", statuses[2] == server::Status::SharedMemoryError ? 0 : FAILED, 0);
+
+				client.Close();
+				daemon.Stop();
+#endif
+			}
+
+			/// <summary>
+			/// Brute force windowed variance and maximum absolute value over
+			/// pixels of the window which are valid (mask set, or all without
+			/// mask), in double precision
+			/// </summary>
+			void WindowReference(const cv::Mat& image, cv::Size window, const cv::Mat& valid, cv::Mat& variance, cv::Mat& max_abs)
+			{
+				const int kx2 = window.width / 2, ky2 = window.height / 2;
+				variance.create(image.rows, image.cols, CV_32FC1);
+				max_abs.create(image.rows, image.cols, CV_32FC1);
+				for(int row = 0; row < image.rows; row++)
+				{
+					for(int col = 0; col < image.cols; col++)
+					{
+						double n = 0, sum = 0, sqr = 0, m = 0;
+						for(int r = std::max(row - ky2, 0); r <= std::min(row + ky2, image.rows - 1); r++)
+						{
+							for(int c = std::max(col - kx2, 0); c <= std::min(col + kx2, image.cols - 1); c++)
+							{
+								if(!valid.empty() && !valid.at<unsigned char>(r, c)) continue;
+
+								const double v = image.at<float>(r, c);
+								n++;
+								sum += v;
+								sqr += v * v;
+								m = std::max(m, std::abs(v));
+							}
+						}
+						const double mean = n > 0 ? sum / n : 0;
+						variance.at<float>(row, col) = static_cast<float>(n > 0 ? sqr / n - mean * mean : 0);
+						max_abs.at<float>(row, col) = static_cast<float>(m);
+					}
+				}
+			}
+
+			/// <summary>
+			/// Separable rectangular window kernels against brute force, and
+			/// variance never negative
+			/// </summary>
+			void CheckRectangularWindows(const Frames& frames, std::vector<Check>& checks)
+			{
+				for(cv::Size window : { cv::Size(7, 3), cv::Size(3, 11), cv::Size(1, 5), cv::Size(15, 1), cv::Size(11, 9) })
+				{
+					for(bool masked : { false, true })
+					{
+						const cv::Mat* flags = masked ? &frames.bitflags : nullptr;
+						const std::string name = " " + WindowName(window) + (masked ? " masked" : "");
+
+						cv::Mat variance, max_abs;
+						WindowReference(frames.wrapped, window, masked ? frames.valid : cv::Mat(), variance, max_abs);
+
+						const cv::Mat fast = kernels::WindowedVariance(frames.wrapped, window, flags, Bitflag::Border);
+						double lowest = 0;
+						cv::minMaxLoc(fast, &lowest);
+						Add(checks, "Rectangular WindowedVariance" + name, MaxDifference(fast, variance), KERNEL_TOLERANCE);
+						Add(checks, "Rectangular WindowedVariance non negative" + name, std::max(0.0, -lowest), 0);
+						Add(checks, "Rectangular WindowedMaxAbs" + name,
+							MaxDifference(kernels::WindowedMaxAbs(frames.wrapped, window, flags, Bitflag::Border), max_abs), KERNEL_TOLERANCE);
+					}
+				}
+			}
+
+			/// <summary>
+			/// Maps computed together (shared gradients) against the ones
+			/// computed one by one
+			/// </summary>
+			void CheckComputeMaps(const Frames& frames, std::vector<Check>& checks)
+			{
+				cv::Mat bitflags = frames.bitflags.clone();
+				for(cv::Size window : { cv::Size(3, 3), cv::Size(5, 3) })
+				{
+					for(bool masked : { false, true })
+					{
+						cv::Mat* flags = masked ? &bitflags : nullptr;
+						const std::string name = " " + WindowName(window) + (masked ? " masked" : "");
+						const quality_maps::QualityMapSet maps = quality_maps::ComputeMaps(frames.wrapped, quality_maps::AllMaps, window, flags, Bitflag::Border);
+						Add(checks, "ComputeMaps PDV" + name, MaxDifference(maps.pdv, quality_maps::PDV(frames.wrapped, window, flags, Bitflag::Border)), KERNEL_TOLERANCE);
+						Add(checks, "ComputeMaps MaxAbsGrad" + name, MaxDifference(maps.max_abs_grad, quality_maps::MaxAbsGrad(frames.wrapped, window, flags, Bitflag::Border)), KERNEL_TOLERANCE);
+						Add(checks, "ComputeMaps PseudoCorrelation" + name,
+							MaxDifference(maps.pseudo_correlation, quality_maps::PseudoCorrelation(frames.wrapped, window, flags, Bitflag::Border)), KERNEL_TOLERANCE);
+						Add(checks, "ComputeMaps SecondDifference" + name,
+							MaxDifference(maps.second_difference, quality_maps::SecondDifference(frames.wrapped, flags, Bitflag::Border)), KERNEL_TOLERANCE);
+					}
+				}
+			}
+
+			/// <summary>
+			/// RMS of phase difference in cycles, differences wrapped to
+			/// [-0.5, 0.5)
+			/// </summary>
+			double PhaseRms(const cv::Mat& a, const cv::Mat& b)
+			{
+				double sum = 0;
+				for(int row = 0; row < a.rows; row++)
+				{
+					for(int col = 0; col < a.cols; col++)
+					{
+						double d = static_cast<double>(a.at<float>(row, col)) - b.at<float>(row, col);
+						d -= std::floor(d + 0.5);
+						sum += d * d;
+					}
+				}
+				return std::sqrt(sum / a.total());
+			}
+
+			/// <summary>
+			/// Windowed Fourier filter keeps clean fringes, removes most of
+			/// the noise and does not depend on the thread count
+			/// </summary>
+			void CheckWindowedFourier(const Frames& frames, std::vector<Check>& checks)
+			{
+				const cv::Mat clean = WrapNormalized(frames.truth);
+				filters::WindowedFourierOptions options;
+				options.noise_sigma = 0.6;
+
+				Add(checks, "WindowedFourierFilter clean", PhaseRms(filters::WindowedFourierFilter(clean), clean), 1e-3);
+
+				const cv::Mat filtered = filters::WindowedFourierFilter(frames.wrapped, options);
+				Add(checks, "WindowedFourierFilter denoise", PhaseRms(filtered, clean) / PhaseRms(frames.wrapped, clean), 0.3);
+
+				double error = 0;
+				for(int threads : { 1, 3 })
+				{
+					ScopedThreadCount count(threads);
+					error = std::max(error, MaxDifference(filters::WindowedFourierFilter(frames.wrapped, options), filtered));
+				}
+				Add(checks, "WindowedFourierFilter threads", error, 0);
+			}
+
+			void CheckValidRegion(const Frames& frames, std::vector<Check>& checks)
+			{
+				const int rows = frames.rows, cols = frames.cols;
+				const cv::Mat& valid = frames.valid;
+				masks::ValidRegion region(frames.bitflags, Bitflag::Border);
+
+				// Packed index of each pixel, -1 at masked ones
+				std::vector<int> packed(static_cast<size_t>(rows) * cols, -1);
+				double mismatches = 0;
+				int n = 0;
+				for(int index = 0; index < rows * cols; index++)
+				{
+					if(!valid.at<unsigned char>(index / cols, index % cols)) continue;
+
+					mismatches += n >= region.Count() || region.Indices()[n] != index;
+					packed[index] = n++;
+				}
+				mismatches += n != region.Count();
+				Add(checks, "ValidRegion indices", mismatches, 0);
+
+				mismatches = 0;
+				int lower = 0;
+				for(int row = 0; row < rows; row++)
+				{
+					for(int col = 0; col <= cols; col++)
+					{
+						mismatches += region.Lower(row, col) != lower;
+						if(col < cols)
+						{
+							const int index = row * cols + col;
+							mismatches += region.Find(row, col) != packed[index];
+							lower += packed[index] >= 0;
+						}
+					}
+				}
+				Add(checks, "ValidRegion lookup", mismatches, 0);
+
+				mismatches = 0;
+				auto at = [&](int row, int col) {
+					return row < 0 || col < 0 || row >= rows || col >= cols ? -1 : packed[row * cols + col];
+				};
+				for(int i = 0; i < region.Count() && i < n; i++)
+				{
+					const cv::Point p = region.Position(i);
+					const masks::ValidRegion::Neighbours& neighbours = region.Neighbourhood()[i];
+					mismatches += neighbours.left != at(p.y, p.x - 1) || neighbours.right != at(p.y, p.x + 1) ||
+						neighbours.up != at(p.y - 1, p.x) || neighbours.down != at(p.y + 1, p.x);
+				}
+				Add(checks, "ValidRegion neighbours", mismatches, 0);
+
+				cv::Mat expected(rows, cols, CV_32FC1);
+				for(int row = 0; row < rows; row++)
+				{
+					for(int col = 0; col < cols; col++)
+					{
+						expected.at<float>(row, col) = valid.at<unsigned char>(row, col) ? frames.wrapped.at<float>(row, col) : -1.0f;
+					}
+				}
+				Add(checks, "ValidRegion gather scatter", MaxDifference(region.Scatter(region.GatherPhase(frames.wrapped), -1.0f), expected), 0);
+				Add(checks, "ValidRegion mask", Mismatches(region.ToMask(), valid), 0);
+			}
+
+			/// <summary>
+			/// Maps and filters over packed valid pixels against the masked
+			/// (maps) or whole frame (filters, full region) ones
+			/// </summary>
+			void CheckRegionPaths(const Frames& frames, std::vector<Check>& checks)
+			{
+				cv::Mat bitflags = frames.bitflags.clone();
+				const masks::ValidRegion region(bitflags, Bitflag::Border);
+				for(cv::Size window : { cv::Size(3, 3), cv::Size(5, 3) })
+				{
+					const std::string name = " " + WindowName(window);
+					const quality_maps::QualityMapSet masked = quality_maps::ComputeMaps(frames.wrapped, quality_maps::AllMaps, window, &bitflags, Bitflag::Border);
+					const quality_maps::QualityMapSet packed = quality_maps::ComputeMaps(frames.wrapped, quality_maps::AllMaps, window, region);
+					Add(checks, "ComputeMaps region PDV" + name, MaxDifference(packed.pdv, masked.pdv, 0, frames.valid), KERNEL_TOLERANCE);
+					Add(checks, "ComputeMaps region MaxAbsGrad" + name, MaxDifference(packed.max_abs_grad, masked.max_abs_grad, 0, frames.valid), KERNEL_TOLERANCE);
+					Add(checks, "ComputeMaps region PseudoCorrelation" + name, MaxDifference(packed.pseudo_correlation, masked.pseudo_correlation, 0, frames.valid), KERNEL_TOLERANCE);
+					Add(checks, "ComputeMaps region SecondDifference" + name, MaxDifference(packed.second_difference, masked.second_difference, 0, frames.valid), KERNEL_TOLERANCE);
+				}
+
+				const masks::ValidRegion full(frames.wrapped.size());
+				for(cv::Size window : { cv::Size(3, 3), cv::Size(7, 5) })
+				{
+					const std::string name = " " + WindowName(window);
+					Add(checks, "MeanPhaseFilter region" + name,
+						MaxDifference(filters::MeanPhaseFilter(frames.wrapped, window, full), filters::MeanPhaseFilter(frames.wrapped, window), 1), PHASE_TOLERANCE);
+					Add(checks, "MedianPhaseFilter region" + name,
+						MaxDifference(filters::MedianPhaseFilter(frames.wrapped, window, full), filters::MedianPhaseFilter(frames.wrapped, window), 1), PHASE_TOLERANCE);
+				}
+			}
+
+			/// <summary>
+			/// Brute force window test of mask: any pixel set (pixels outside
+			/// count as not set) or all pixels set (pixels outside count as set).
+			/// </summary>
+			cv::Mat MaskWindowReference(const cv::Mat& mask, cv::Size window, bool all)
+			{
+				const int kx2 = window.width / 2, ky2 = window.height / 2;
+				cv::Mat result(mask.rows, mask.cols, CV_8UC1, cv::Scalar(0));
+				for(int row = 0; row < mask.rows; row++)
+				{
+					for(int col = 0; col < mask.cols; col++)
+					{
+						bool any = false, every = true;
+						for(int r = std::max(row - ky2, 0); r <= std::min(row + ky2, mask.rows - 1); r++)
+						{
+							for(int c = std::max(col - kx2, 0); c <= std::min(col + kx2, mask.cols - 1); c++)
+							{
+								bool set = mask.at<unsigned char>(r, c) != 0;
+								any |= set;
+								every &= set;
+							}
+						}
+						result.at<unsigned char>(row, col) = (all ? every : any) ? 255 : 0;
+					}
+				}
+				return result;
+			}
+
+			void CheckBitPlane(const Frames& frames, std::vector<Check>& checks)
+			{
+				const int rows = frames.rows, cols = frames.cols;
+				const cv::Mat& flagged = frames.flagged;
+				masks::BitPlane plane(frames.bitflags, Bitflag::Border);
+
+				Add(checks, "BitPlane pack", Mismatches(plane.ToMask(), flagged) + std::abs(plane.Count() - cv::countNonZero(flagged)), 0);
+
+				// Windows wider than a word and one pixel wide/high ones as well
+				for(cv::Size window : { cv::Size(3, 3), cv::Size(5, 3), cv::Size(1, 7), cv::Size(7, 1), cv::Size(67, 5) })
+				{
+					Add(checks, "BitPlane dilate " + WindowName(window), Mismatches(plane.Dilate(window).ToMask(), MaskWindowReference(flagged, window, false)), 0);
+					Add(checks, "BitPlane erode " + WindowName(window), Mismatches(plane.Erode(window).ToMask(), MaskWindowReference(flagged, window, true)), 0);
+				}
+
+				// Rectangles at every word offset, some crossing plane edges
+				double any_mismatches = 0, count_mismatches = 0;
+				for(int y = -2; y < rows; y += 7)
+				{
+					for(int x = -3; x < cols; x += 5)
+					{
+						for(cv::Size size : { cv::Size(1, 1), cv::Size(9, 2), cv::Size(70, 3) })
+						{
+							const cv::Rect rect = cv::Rect(cv::Point(x, y), size) & cv::Rect(0, 0, cols, rows);
+							const int count = rect.empty() ? 0 : cv::countNonZero(flagged(rect));
+							any_mismatches += plane.AnyInRect(cv::Rect(cv::Point(x, y), size)) != (count > 0);
+							count_mismatches += plane.CountInRect(cv::Rect(cv::Point(x, y), size)) != count;
+						}
+					}
+				}
+				Add(checks, "BitPlane AnyInRect", any_mismatches, 0);
+				Add(checks, "BitPlane CountInRect", count_mismatches, 0);
+
+				cv::Mat marked;
+				plane.Mark(marked, Bitflag::PositiveResidue);
+				if(marked.size() != frames.bitflags.size())
+				{
+					Add(checks, "BitPlane mark", FAILED, 0);
+					return;
+				}
+
+				double mismatches = 0;
+				for(int row = 0; row < rows; row++)
+				{
+					for(int col = 0; col < cols; col++)
+					{
+						const bitflag_type expected = flagged.at<unsigned char>(row, col) ? Bitflag::PositiveResidue : Bitflag::NoFlag;
+						mismatches += marked.at<bitflag_type>(row, col) != expected;
+					}
+				}
+				Add(checks, "BitPlane mark", mismatches, 0);
+			}
+
+			/// <summary>
+			/// Rows split between threads give the same results as serial run
+			/// </summary>
+			void CheckThreads(const Frames& frames, std::vector<Check>& checks)
+			{
+				cv::Mat pdv, mean, median;
+				{
+					ScopedThreadCount serial(1);
+					pdv = quality_maps::PDV(frames.wrapped, 5);
+					mean = filters::MeanPhaseFilter(frames.wrapped, 5);
+					median = filters::MedianPhaseFilter(frames.wrapped, 9);
+				}
+
+				// More threads than the machine may have, so the rows are split
+				// on any machine
+				ScopedThreadCount parallel(4);
+				Add(checks, "Threads PDV", MaxDifference(quality_maps::PDV(frames.wrapped, 5), pdv), 0);
+				Add(checks, "Threads MeanPhaseFilter", MaxDifference(filters::MeanPhaseFilter(frames.wrapped, 5), mean), 0);
+				Add(checks, "Threads MedianPhaseFilter", MaxDifference(filters::MedianPhaseFilter(frames.wrapped, 9), median), 0);
+			}
+
+			/// <summary>
+			/// Largest difference of count, extrema and mean from the ones of
+			/// map pixels where mask is set
+			/// </summary>
+			double StatisticsError(const quality_maps::QualityStatistics& statistics, const cv::Mat& map, const cv::Mat& mask)
+			{
+				long long count = 0;
+				float min = std::numeric_limits<float>::max(), max = -std::numeric_limits<float>::max();
+				double sum = 0;
+				for(int row = 0; row < map.rows; row++)
+				{
+					for(int col = 0; col < map.cols; col++)
+					{
+						if(!mask.at<unsigned char>(row, col)) continue;
+
+						float value = map.at<float>(row, col);
+						min = std::min(min, value);
+						max = std::max(max, value);
+						sum += value;
+						count++;
+					}
+				}
+
+				if(count != statistics.count)
+				{
+					return FAILED;
+				}
+				if(count == 0)
+				{
+					return 0;
+				}
+				return std::max({ static_cast<double>(std::abs(min - statistics.min)),
+								  static_cast<double>(std::abs(max - statistics.max)),
+								  std::abs(sum / count - statistics.mean) });
+			}
+
+			/// <summary>
+			/// ROI maps, statistics and filters against the ROI of whole frame
+			/// results
+			/// </summary>
+			void CheckRoi(const Frames& frames, std::vector<Check>& checks)
+			{
+				const cv::Rect& roi = frames.roi;
+				cv::Mat bitflags = frames.bitflags.clone();
+				for(cv::Size window : { cv::Size(3, 3), cv::Size(5, 3) })
+				{
+					const std::string name = " " + WindowName(window);
+					const quality_maps::QualityMapSet maps = quality_maps::ComputeMaps(frames.wrapped, quality_maps::AllMaps, window);
+					const quality_maps::QualityMapSet roi_maps = quality_maps::ComputeMaps(frames.wrapped, quality_maps::AllMaps, window, roi);
+					Add(checks, "PDV ROI" + name, MaxDifference(quality_maps::PDV(frames.wrapped, window, roi), maps.pdv(roi)), KERNEL_TOLERANCE);
+					Add(checks, "MaxAbsGrad ROI" + name, MaxDifference(quality_maps::MaxAbsGrad(frames.wrapped, window, roi), maps.max_abs_grad(roi)), KERNEL_TOLERANCE);
+					Add(checks, "ComputeMaps ROI PseudoCorrelation" + name, MaxDifference(roi_maps.pseudo_correlation, maps.pseudo_correlation(roi)), KERNEL_TOLERANCE);
+					Add(checks, "ComputeMaps ROI SecondDifference" + name, MaxDifference(roi_maps.second_difference, maps.second_difference(roi)), KERNEL_TOLERANCE);
+
+					// Pixels without any second difference (at the worst value of
+					// the whole frame map) take the worst value of the ROI, the
+					// others the whole frame value
+					const cv::Mat masked = quality_maps::ComputeMaps(frames.wrapped, quality_maps::SecondDifferenceMap, window, &bitflags, Bitflag::Border).second_difference;
+					const cv::Mat roi_masked = quality_maps::ComputeMaps(frames.wrapped, quality_maps::SecondDifferenceMap, window, roi, &bitflags, Bitflag::Border).second_difference;
+					double error = FAILED;
+					if(roi_masked.size() == roi.size())
+					{
+						double frame_worst = 0, roi_worst = 0;
+						cv::minMaxLoc(masked, &frame_worst);
+						cv::minMaxLoc(roi_masked, &roi_worst);
+						error = 0;
+						for(int row = 0; row < roi.height; row++)
+						{
+							for(int col = 0; col < roi.width; col++)
+							{
+								const float value = masked.at<float>(roi.y + row, roi.x + col);
+								const double expected = value == frame_worst ? roi_worst : value;
+								error = std::max(error, std::abs(roi_masked.at<float>(row, col) - expected));
+							}
+						}
+					}
+					Add(checks, "ComputeMaps ROI SecondDifference masked" + name, error, KERNEL_TOLERANCE);
+
+					Add(checks, "MapStatistics" + name,
+						StatisticsError(quality_maps::MapStatistics(frames.wrapped, quality_maps::PDVMap, window, roi), maps.pdv(roi), cv::Mat(roi.height, roi.width, CV_8UC1, cv::Scalar(255))), KERNEL_TOLERANCE);
+					const cv::Mat masked_pdv = quality_maps::PDV(frames.wrapped, window, &bitflags, Bitflag::Border);
+					Add(checks, "MapStatistics masked" + name,
+						StatisticsError(quality_maps::MapStatistics(frames.wrapped, quality_maps::PDVMap, window, roi, &bitflags, Bitflag::Border), masked_pdv(roi), frames.valid(roi)), KERNEL_TOLERANCE);
+				}
+
+				for(cv::Size window : { cv::Size(3, 3), cv::Size(7, 5) })
+				{
+					const std::string name = " " + WindowName(window);
+
+					// ROI filters map phase per pixel instead of min max normalization
+					cv::Mat mean_phase, median_phase;
+					kernels::MeanPhase(frames.cos_plane, frames.sin_plane, window).convertTo(mean_phase, CV_32FC1, 1.0 / (2.0 * CV_PI), 0.5);
+					kernels::MedianPhase(frames.cos_plane, frames.sin_plane, window).convertTo(median_phase, CV_32FC1, 1.0 / (2.0 * CV_PI), 0.5);
+					Add(checks, "MeanPhaseFilter ROI" + name, MaxDifference(filters::MeanPhaseFilter(frames.wrapped, window, roi), mean_phase(roi), 1), PHASE_TOLERANCE);
+					Add(checks, "MedianPhaseFilter ROI" + name, MaxDifference(filters::MedianPhaseFilter(frames.wrapped, window, roi), median_phase(roi), 1), PHASE_TOLERANCE);
+				}
+			}
+
+			/// <summary>
+			/// Integer wrap counts against float unwrapping, and precision of
+			/// the extended range far from zero
+			/// </summary>
+			void CheckExtendedRange(const Frames& frames, std::vector<Check>& checks)
+			{
+				const cv::Mat itoh = unwrappers::Itoh(frames.wrapped);
+				const UnwrappedPhase counts = unwrappers::ItohCounts(frames.wrapped);
+				Add(checks, "ItohCounts", MaxDifference(counts.ToFloat(), itoh), PHASE_TOLERANCE);
+				Add(checks, "ItohCounts 16-bit", MaxDifference(unwrappers::ItohCounts(frames.wrapped, CV_16S).ToFloat(), itoh), PHASE_TOLERANCE);
+
+				// Counts recovered from float result are exact
+				double mismatches = 0;
+				for(int depth : { CV_16S, CV_32S })
+				{
+					cv::Mat recovered, expected;
+					unwrappers::WrapCounts(frames.wrapped, itoh, depth).Wraps().convertTo(recovered, CV_32SC1);
+					counts.Wraps().convertTo(expected, CV_32SC1);
+					for(int row = 0; row < frames.rows; row++)
+					{
+						for(int col = 0; col < frames.cols; col++)
+						{
+							mismatches += recovered.at<int>(row, col) != expected.at<int>(row, col);
+						}
+					}
+				}
+				Add(checks, "WrapCounts", mismatches, 0);
+
+				// Million cycles away, fraction keeps float precision of the
+				// wrapped phase, only the double sum rounds
+				const int shift = 1000000;
+				cv::Mat far;
+				counts.Wraps().convertTo(far, CV_32SC1, 1.0, shift);
+				const UnwrappedPhase shifted(far, frames.wrapped);
+				const cv::Mat near_phase = counts.ToDouble(), far_phase = shifted.ToDouble();
+				double error = 0;
+				for(int row = 0; row < frames.rows; row++)
+				{
+					for(int col = 0; col < frames.cols; col++)
+					{
+						const double expected = near_phase.at<double>(row, col) + 2.0 * CV_PI * shift;
+						error = std::max({ error, std::abs(far_phase.at<double>(row, col) - expected), std::abs(shifted.At(row, col) - expected) });
+					}
+				}
+				Add(checks, "UnwrappedPhase extended range", error, 1e-6);
+			}
+
+			void CheckCache(const Frames& frames, std::vector<Check>& checks)
+			{
+				const cache::CacheOptions previous = cache::Options();
+				cache::CacheOptions memory;
+				memory.memory_capacity = 64 << 20;
+				cache::Configure(memory);
+
+				const cv::Size window(5, 3);
+				cv::Mat first = cache::PDV(frames.wrapped, window);
+				const cache::CacheStatistics before = cache::Statistics();
+				cv::Mat second = cache::PDV(frames.wrapped, window);
+				const cache::CacheStatistics after = cache::Statistics();
+				const bool hit = after.memory_hits == before.memory_hits + 1 && after.misses == before.misses;
+				Add(checks, "Cache hit", hit ? MaxDifference(first, second) : FAILED, 0);
+				Add(checks, "Cache value", MaxDifference(first, quality_maps::PDV(frames.wrapped, window)), 0);
+
+				// Other parameters must not hit the entry
+				cache::PDV(frames.wrapped, cv::Size(3, 5));
+				Add(checks, "Cache key", cache::Statistics().misses == after.misses + 1 ? 0 : FAILED, 0);
+
+				cache::Clear();
+				cache::Configure(previous);
+			}
+
+			/// <summary>
+			/// Brute force median phase, each window gathered and selected
+			/// </summary>
+			cv::Mat MedianReference(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window)
+			{
+				const int kx2 = window.width / 2, ky2 = window.height / 2;
+				const int rows = cos_plane.rows, cols = cos_plane.cols;
+				cv::Mat filtered(rows, cols, CV_32FC1);
+				std::vector<float> re(window.area()), im(window.area());
+				for(int row = 0; row < rows; row++)
+				{
+					for(int col = 0; col < cols; col++)
+					{
+						int n = 0;
+						for(int r = std::max(row - ky2, 0); r <= std::min(row + ky2, rows - 1); r++)
+						{
+							for(int c = std::max(col - kx2, 0); c <= std::min(col + kx2, cols - 1); c++, n++)
+							{
+								re[n] = cos_plane.at<float>(r, c);
+								im[n] = sin_plane.at<float>(r, c);
+							}
+						}
+						filtered.at<float>(row, col) = std::atan2(kernels::Median(im.data(), n), kernels::Median(re.data(), n));
+					}
+				}
+				return filtered;
+			}
+
+			void CheckSlidingMedian(const Frames& frames, std::vector<Check>& checks)
+			{
+				for(cv::Size window : { cv::Size(7, 3), cv::Size(11, 3), cv::Size(3, 15), cv::Size(15, 9) })
+				{
+					Add(checks, "SlidingMedianPhase " + WindowName(window),
+						MaxDifference(kernels::SlidingMedianPhase(frames.cos_plane, frames.sin_plane, window),
+									  MedianReference(frames.cos_plane, frames.sin_plane, window), 2 * CV_PI), PHASE_TOLERANCE);
+				}
+			}
+		}
+
+		std::vector<Check> SelfCheck(const SelfCheckOptions& options)
+		{
+			assert(options.rows >= 16 && options.cols >= 16 && "[SelfCheck] Invalid options");
+
+			PU_PROFILE_SCOPE("SelfCheck");
+
+			std::vector<Check> checks;
+			const Frames frames = MakeFrames(options);
+
+			CheckCompare(frames, checks);
+			CheckProfiling(frames, checks);
+			CheckIO(frames, checks);
+			CheckKernels<3>(frames, checks);
+			CheckKernels<5>(frames, checks);
+			CheckKernels<7>(frames, checks);
+			CheckKernels<9>(frames, checks);
+			CheckLevels(frames, checks);
+			CheckNoise(frames, checks);
+			CheckDataset(frames, checks);
+			CheckLeastSquares(frames, checks);
+			CheckUnwrapper(frames, "BranchCut", [](const cv::Mat& wrapped, const cv::Mat&) { return unwrappers::BranchCut(wrapped); }, checks);
+			CheckUnwrapper(frames, "Auto", [](const cv::Mat& wrapped, const cv::Mat&) {
+				unwrappers::AutoOptions automatic;
+				automatic.log = false;
+				return unwrappers::Auto(wrapped, nullptr, Bitflag::NoFlag, automatic);
+			}, checks);
+			CheckServer(frames, checks);
+			CheckRectangularWindows(frames, checks);
+			CheckComputeMaps(frames, checks);
+			CheckWindowedFourier(frames, checks);
+			CheckValidRegion(frames, checks);
+			CheckRegionPaths(frames, checks);
+			CheckUnwrapper(frames, "QualityGuided region", [](const cv::Mat& wrapped, const cv::Mat& quality) {
+				return unwrappers::QualityGuided(wrapped, quality, masks::ValidRegion(wrapped.size()));
+			}, checks);
+			CheckBitPlane(frames, checks);
+			CheckThreads(frames, checks);
+			CheckUnwrapper(frames, "Pyramid", [](const cv::Mat& wrapped, const cv::Mat&) { return unwrappers::Pyramid(wrapped); }, checks);
+			CheckRoi(frames, checks);
+			CheckExtendedRange(frames, checks);
+			CheckUnwrapper(frames, "MultiSeedQualityGuided", [](const cv::Mat& wrapped, const cv::Mat& quality) {
+				return unwrappers::MultiSeedQualityGuided(wrapped, quality);
+			}, checks);
+			CheckCache(frames, checks);
+			CheckSlidingMedian(frames, checks);
+
+			return checks;
+		}
+
+		std::string FormatChecks(const std::vector<Check>& checks)
+		{
+			std::ostringstream out;
+			char line[256];
+
+			std::snprintf(line, sizeof(line), "%-48s %12s %12s %8s\n", "check", "error", "tolerance", "result");
+			out << line;
+
+			for(const Check& c : checks)
+			{
+				std::snprintf(line, sizeof(line), "%-48s %12.3g %12.3g %8s\n",
+							  c.name.c_str(), c.error, c.tolerance, c.skipped ? "skipped" : c.passed ? "ok" : "FAILED");
+				out << line;
+			}
+
+			return out.str();
+		}
+
+		bool Passed(const std::vector<Check>& checks)
+		{
+			return std::all_of(checks.begin(), checks.end(), [](const Check& c) { return c.passed; });
+		}
+	}
+}
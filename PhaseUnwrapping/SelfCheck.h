@@ -0,0 +1,67 @@
+#pragma once
+#include "TestData.h"
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+namespace pu
+{
+	namespace evaluation
+	{
+		/// <summary>
+		/// Outcome of a single self check
+		/// </summary>
+		struct Check
+		{
+			std::string name;
+
+			/// <summary>
+			/// Measured difference from the reference (max abs difference,
+			/// RMS error or number of mismatches, depending on the check)
+			/// </summary>
+			double error = 0;
+
+			double tolerance = 0;
+
+			bool passed = false;
+
+			/// <summary>
+			/// Check could not run on this platform, counts as passed
+			/// </summary>
+			bool skipped = false;
+		};
+
+		struct SelfCheckOptions
+		{
+			/// <summary>
+			/// Size of generated frames, small enough for the brute force
+			/// references
+			/// </summary>
+			int rows = 96;
+			int cols = 128;
+
+			/// <summary>
+			/// Seed of the noise added to the frames
+			/// </summary>
+			uint64_t seed = DEFAULT_NOISE_SEED;
+		};
+
+		/// <summary>
+		/// Checks fast paths against their references (generic kernels, brute
+		/// force, serial or whole frame results, round trips) on generated
+		/// frames, one check per compared result.
+		/// </summary>
+		std::vector<Check> SelfCheck(const SelfCheckOptions& options = SelfCheckOptions());
+
+		/// <summary>
+		/// Formats checks as text table, one row per check
+		/// </summary>
+		std::string FormatChecks(const std::vector<Check>& checks);
+
+		/// <summary>
+		/// Whether all checks passed (or were skipped)
+		/// </summary>
+		bool Passed(const std::vector<Check>& checks);
+	}
+}
@@ -0,0 +1,676 @@
+#include "Server.h"
+#include "Profiling.h"
+#include "QualityMaps.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace pu
+{
+	namespace server
+	{
+		const char* StatusName(Status status)
+		{
+			switch(status)
+			{
+			case Status::Ok: return "Ok";
+			case Status::Busy: return "Busy";
+			case Status::InvalidRequest: return "InvalidRequest";
+			case Status::SharedMemoryError: return "SharedMemoryError";
+			default: return "Stopped";
+			}
+		}
+
+#ifndef _WIN32
+		namespace
+		{
+			// Broken pipe (client gone) must not kill the daemon
+#ifdef MSG_NOSIGNAL
+			const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+			const int SEND_FLAGS = 0;
+#endif
+
+			double Seconds(int64_t ticks)
+			{
+				return static_cast<double>(ticks) / cv::getTickFrequency();
+			}
+
+			/// <summary>
+			/// Reads exactly size bytes, false on error or end of stream
+			/// </summary>
+			bool ReadAll(int fd, void* buffer, size_t size)
+			{
+				unsigned char* dst = static_cast<unsigned char*>(buffer);
+				while(size > 0)
+				{
+					ssize_t n = ::recv(fd, dst, size, 0);
+					if(n < 0 && errno == EINTR) continue;
+					if(n <= 0) return false;
+					dst += n;
+					size -= static_cast<size_t>(n);
+				}
+				return true;
+			}
+
+			/// <summary>
+			/// Writes exactly size bytes, false on error
+			/// </summary>
+			bool WriteAll(int fd, const void* buffer, size_t size)
+			{
+				const unsigned char* src = static_cast<const unsigned char*>(buffer);
+				while(size > 0)
+				{
+					ssize_t n = ::send(fd, src, size, SEND_FLAGS);
+					if(n < 0 && errno == EINTR) continue;
+					if(n <= 0) return false;
+					src += n;
+					size -= static_cast<size_t>(n);
+				}
+				return true;
+			}
+
+			/// <summary>
+			/// Server side mapping of the client's shared memory object
+			/// </summary>
+			class SharedMapping
+			{
+			public:
+				~SharedMapping()
+				{
+					if(data) munmap(data, size);
+				}
+
+				bool Open(const char* name)
+				{
+					int fd = shm_open(name, O_RDWR, 0);
+					if(fd < 0)
+					{
+						return false;
+					}
+
+					struct stat st;
+					if(fstat(fd, &st) != 0 || st.st_size <= 0)
+					{
+						::close(fd);
+						return false;
+					}
+
+					// Mapping stays valid after closing the descriptor
+					void* view = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+					::close(fd);
+					if(view == MAP_FAILED)
+					{
+						return false;
+					}
+
+					data = static_cast<unsigned char*>(view);
+					size = static_cast<size_t>(st.st_size);
+					return true;
+				}
+
+				unsigned char* data = nullptr;
+				size_t size = 0;
+			};
+
+			uint64_t InputBytes(const Request& request)
+			{
+				return static_cast<uint64_t>(request.rows) * request.cols * CV_ELEM_SIZE(request.type);
+			}
+
+			uint64_t OutputBytes(const Request& request)
+			{
+				return static_cast<uint64_t>(request.rows) * request.cols * sizeof(float);
+			}
+
+			bool IsValid(const Request& request)
+			{
+				return request.rows > 0 && request.cols > 0 &&
+					static_cast<uint64_t>(request.rows) * request.cols <= MAX_FRAME_PIXELS &&
+					(request.type == CV_32FC1 || request.type == CV_16UC1) &&
+					request.operation <= Operation::BranchCut &&
+					std::memchr(request.shm_name, 0, sizeof(request.shm_name)) != nullptr &&
+					request.shm_name[0] == '/' &&
+					request.output_offset >= InputBytes(request) &&
+					request.output_offset % sizeof(float) == 0;
+			}
+
+			cv::Mat Unwrap(Operation operation, const cv::Mat& wrapped, unwrappers::AutoDecision& decision)
+			{
+				switch(operation)
+				{
+				case Operation::Itoh:
+					decision.method = unwrappers::Method::Itoh;
+					return unwrappers::Itoh(wrapped);
+				case Operation::LeastSquares:
+					decision.method = unwrappers::Method::LeastSquares;
+					return unwrappers::LeastSquares(wrapped);
+				case Operation::QualityGuided:
+					decision.method = unwrappers::Method::QualityGuided;
+					return unwrappers::QualityGuided(wrapped, quality_maps::PDV(wrapped, 3));
+				case Operation::BranchCut:
+					decision.method = unwrappers::Method::BranchCut;
+					return unwrappers::BranchCut(wrapped);
+				default:
+				{
+					// Server logs the decision with the rest of the timings
+					unwrappers::AutoOptions options;
+					options.log = false;
+					return unwrappers::Auto(wrapped, nullptr, Bitflag::NoFlag, options, &decision);
+				}
+				}
+			}
+		}
+
+		struct Server::Connection
+		{
+			~Connection()
+			{
+				if(fd >= 0) ::close(fd);
+			}
+
+			/// <summary>
+			/// Sends response, workers of the connection share the socket
+			/// </summary>
+			void Send(const Response& response)
+			{
+				std::lock_guard<std::mutex> lock(write_mutex);
+				WriteAll(fd, &response, sizeof(response));
+			}
+
+			int fd = -1;
+			std::mutex write_mutex;
+
+			/// <summary>
+			/// Set by the reader thread when the client disconnected
+			/// </summary>
+			std::atomic<bool> finished{ false };
+		};
+
+		Server::Server(const ServerOptions & options)
+			: options(options)
+		{
+		}
+
+		Server::~Server()
+		{
+			Stop();
+		}
+
+		bool Server::Start()
+		{
+			assert(options.workers > 0 && options.queue_capacity > 0 && "[Server::Start] Invalid options");
+
+			if(running)
+			{
+				return true;
+			}
+
+			sockaddr_un address;
+			std::memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if(options.socket_path.empty() || options.socket_path.size() >= sizeof(address.sun_path))
+			{
+				return false;
+			}
+			std::memcpy(address.sun_path, options.socket_path.c_str(), options.socket_path.size() + 1);
+
+			int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if(fd < 0)
+			{
+				return false;
+			}
+
+			// Socket file left by previous (killed) instance would fail bind
+			::unlink(options.socket_path.c_str());
+			// Clients make the daemon map and write shared memory of their
+			// choice, so only the owner may connect. Nobody can connect
+			// before listen, so there is no window with default permissions.
+			if(::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+			   ::chmod(options.socket_path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+			   ::listen(fd, SOMAXCONN) != 0)
+			{
+				::close(fd);
+				return false;
+			}
+
+			listen_fd = fd;
+			running = true;
+			acceptor = std::thread(&Server::AcceptLoop, this);
+			for(int i = 0; i < options.workers; i++)
+			{
+				workers.emplace_back(&Server::WorkLoop, this);
+			}
+			return true;
+		}
+
+		void Server::Stop()
+		{
+			if(!running.exchange(false))
+			{
+				return;
+			}
+
+			// Wakes up blocked accept
+			::shutdown(listen_fd, SHUT_RDWR);
+			acceptor.join();
+			::close(listen_fd);
+			listen_fd = -1;
+			::unlink(options.socket_path.c_str());
+
+			// Only reading is shut down, so queued frames still get responses
+			{
+				std::lock_guard<std::mutex> lock(connections_mutex);
+				for(auto& connection : connections)
+				{
+					::shutdown(connection.first->fd, SHUT_RD);
+					connection.second.join();
+				}
+				connections.clear();
+			}
+
+			// Lock makes sure no worker is between checking running and waiting
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+			}
+			queue_ready.notify_all();
+			for(std::thread& worker : workers)
+			{
+				worker.join();
+			}
+			workers.clear();
+		}
+
+		void Server::AcceptLoop()
+		{
+			while(running)
+			{
+				int fd = ::accept(listen_fd, nullptr, nullptr);
+				if(fd < 0)
+				{
+					if(errno == EINTR) continue;
+					break;
+				}
+
+				std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+				connection->fd = fd;
+
+				std::lock_guard<std::mutex> lock(connections_mutex);
+
+				// Readers of closed connections are joined here so they do not pile up
+				for(auto it = connections.begin(); it != connections.end();)
+				{
+					if(it->first->finished)
+					{
+						it->second.join();
+						it = connections.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+
+				connections.emplace_back(connection, std::thread(&Server::ReadLoop, this, connection));
+			}
+		}
+
+		void Server::ReadLoop(std::shared_ptr<Connection> connection)
+		{
+			Request request;
+			while(ReadAll(connection->fd, &request, sizeof(request)))
+			{
+				int64_t received = cv::getTickCount();
+
+				// Stream out of sync, nothing sensible can be read anymore
+				if(request.magic != PROTOCOL_MAGIC)
+				{
+					break;
+				}
+
+				bool queued = false;
+				{
+					std::lock_guard<std::mutex> lock(queue_mutex);
+					if(running && queue.size() < options.queue_capacity)
+					{
+						queue.push_back({ connection, request, received });
+						queued = true;
+					}
+				}
+
+				if(queued)
+				{
+					queue_ready.notify_one();
+					continue;
+				}
+
+				Response response;
+				response.id = request.id;
+				response.status = running ? Status::Busy : Status::Stopped;
+				connection->Send(response);
+			}
+
+			connection->finished = true;
+		}
+
+		void Server::WorkLoop()
+		{
+			while(true)
+			{
+				Job job;
+				{
+					std::unique_lock<std::mutex> lock(queue_mutex);
+					queue_ready.wait(lock, [this] { return !queue.empty() || !running; });
+					if(queue.empty())
+					{
+						return;
+					}
+					job = std::move(queue.front());
+					queue.pop_front();
+				}
+
+				if(!running)
+				{
+					Response response;
+					response.id = job.request.id;
+					response.status = Status::Stopped;
+					job.connection->Send(response);
+					continue;
+				}
+
+				Process(job);
+			}
+		}
+
+		void Server::Process(const Job & job)
+		{
+			PU_PROFILE_SCOPE("Server::Process");
+
+			const Request& request = job.request;
+			Response response;
+			response.id = request.id;
+
+			int64_t start = cv::getTickCount();
+			response.timings.queued = Seconds(start - job.received);
+
+			SharedMapping mapping;
+			if(!IsValid(request))
+			{
+				response.status = Status::InvalidRequest;
+			}
+			else if(!mapping.Open(request.shm_name) || request.output_offset > mapping.size ||
+					OutputBytes(request) > mapping.size - request.output_offset)
+			{
+				response.status = Status::SharedMemoryError;
+			}
+			else
+			{
+				int64_t mapped = cv::getTickCount();
+				response.timings.map = Seconds(mapped - start);
+
+				// Headers over shared memory, input is not copied
+				cv::Mat wrapped{ request.rows, request.cols, request.type, mapping.data };
+				cv::Mat output{ request.rows, request.cols, CV_32FC1, mapping.data + request.output_offset };
+
+				unwrappers::AutoDecision decision;
+				cv::Mat unwrapped = Unwrap(request.operation, wrapped, decision);
+				int64_t computed = cv::getTickCount();
+				response.timings.compute = Seconds(computed - mapped);
+
+				unwrapped.copyTo(output);
+				response.timings.store = Seconds(cv::getTickCount() - computed);
+
+				response.method = decision.method;
+				response.residues = decision.residues;
+			}
+
+			response.timings.total = Seconds(cv::getTickCount() - job.received);
+			job.connection->Send(response);
+
+			if(options.log)
+			{
+				char line[256];
+				std::snprintf(line, sizeof(line), "[Server] frame %llu (%dx%d) %s %s: queued %.2f ms, map %.2f ms, compute %.2f ms, store %.2f ms, total %.2f ms\n",
+							  static_cast<unsigned long long>(request.id), request.cols, request.rows,
+							  unwrappers::MethodName(response.method), StatusName(response.status),
+							  response.timings.queued * 1e3, response.timings.map * 1e3, response.timings.compute * 1e3,
+							  response.timings.store * 1e3, response.timings.total * 1e3);
+				std::clog << line;
+			}
+		}
+
+		SharedFrame::~SharedFrame()
+		{
+			Close();
+		}
+
+		bool SharedFrame::Create(const std::string & name, int rows, int cols, int type)
+		{
+			assert(rows > 0 && cols > 0 && (type == CV_32FC1 || type == CV_16UC1) && "[SharedFrame::Create] Invalid frame");
+
+			Close();
+
+			if(name.empty() || name[0] != '/' || name.size() >= sizeof(Request::shm_name))
+			{
+				return false;
+			}
+
+			// Result starts at cache line boundary
+			size_t input_bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+			size_t offset = (input_bytes + 63) & ~static_cast<size_t>(63);
+			size_t bytes = offset + static_cast<size_t>(rows) * cols * sizeof(float);
+
+			int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+			if(fd < 0)
+			{
+				return false;
+			}
+
+			if(ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+			{
+				::close(fd);
+				shm_unlink(name.c_str());
+				return false;
+			}
+
+			void* view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if(view == MAP_FAILED)
+			{
+				shm_unlink(name.c_str());
+				return false;
+			}
+
+			this->name = name;
+			this->rows = rows;
+			this->cols = cols;
+			this->type = type;
+			data = static_cast<unsigned char*>(view);
+			size = bytes;
+			output_offset = offset;
+			return true;
+		}
+
+		void SharedFrame::Close()
+		{
+			if(!data)
+			{
+				return;
+			}
+
+			munmap(data, size);
+			shm_unlink(name.c_str());
+			data = nullptr;
+			size = 0;
+		}
+
+		Client::~Client()
+		{
+			Close();
+		}
+
+		bool Client::Connect(const std::string & socket_path)
+		{
+			Close();
+
+			sockaddr_un address;
+			std::memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if(socket_path.empty() || socket_path.size() >= sizeof(address.sun_path))
+			{
+				return false;
+			}
+			std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+			int f = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if(f < 0)
+			{
+				return false;
+			}
+
+			if(::connect(f, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				::close(f);
+				return false;
+			}
+
+			fd = f;
+			return true;
+		}
+
+		void Client::Close()
+		{
+			if(fd >= 0)
+			{
+				::close(fd);
+				fd = -1;
+			}
+		}
+
+		bool Client::Send(const Request & request)
+		{
+			return fd >= 0 && WriteAll(fd, &request, sizeof(request));
+		}
+
+		bool Client::Receive(Response & response)
+		{
+			return fd >= 0 && ReadAll(fd, &response, sizeof(response)) && response.magic == PROTOCOL_MAGIC;
+		}
+#else
+		// Unix domain sockets and POSIX shared memory are not available,
+		// everything fails gracefully
+		struct Server::Connection
+		{
+		};
+
+		Server::Server(const ServerOptions & options)
+			: options(options)
+		{
+		}
+
+		Server::~Server()
+		{
+		}
+
+		bool Server::Start()
+		{
+			return false;
+		}
+
+		void Server::Stop()
+		{
+		}
+
+		void Server::AcceptLoop()
+		{
+		}
+
+		void Server::ReadLoop(std::shared_ptr<Connection>)
+		{
+		}
+
+		void Server::WorkLoop()
+		{
+		}
+
+		void Server::Process(const Job &)
+		{
+		}
+
+		SharedFrame::~SharedFrame()
+		{
+		}
+
+		bool SharedFrame::Create(const std::string &, int, int, int)
+		{
+			return false;
+		}
+
+		void SharedFrame::Close()
+		{
+		}
+
+		Client::~Client()
+		{
+		}
+
+		bool Client::Connect(const std::string &)
+		{
+			return false;
+		}
+
+		void Client::Close()
+		{
+		}
+
+		bool Client::Send(const Request &)
+		{
+			return false;
+		}
+
+		bool Client::Receive(Response &)
+		{
+			return false;
+		}
+#endif
+
+		cv::Mat SharedFrame::Input() const
+		{
+			assert(data && "[SharedFrame::Input] Frame not created");
+			return cv::Mat{ rows, cols, type, data };
+		}
+
+		cv::Mat SharedFrame::Output() const
+		{
+			assert(data && "[SharedFrame::Output] Frame not created");
+			return cv::Mat{ rows, cols, CV_32FC1, data + output_offset };
+		}
+
+		Request SharedFrame::MakeRequest(Operation operation, uint64_t id) const
+		{
+			assert(data && "[SharedFrame::MakeRequest] Frame not created");
+
+			Request request;
+			request.operation = operation;
+			request.id = id;
+			request.rows = rows;
+			request.cols = cols;
+			request.type = type;
+			request.output_offset = output_offset;
+			std::memcpy(request.shm_name, name.c_str(), name.size() + 1);
+			return request;
+		}
+	}
+}
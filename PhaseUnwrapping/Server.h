@@ -0,0 +1,336 @@
+#pragma once
+#include "Unwrappers.h"
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pu
+{
+	namespace server
+	{
+		/// <summary>
+		/// Socket used when none is given
+		/// </summary>
+		const char* const DEFAULT_SOCKET_PATH = "/tmp/phase_unwrapping.sock";
+
+		/// <summary>
+		/// First field of every message, guards against foreign peers
+		/// </summary>
+		const uint32_t PROTOCOL_MAGIC = 0x31575550;
+
+		/// <summary>
+		/// Largest frame (rows * cols) the server accepts, keeps byte sizes
+		/// and pixel indices of requests far from overflow
+		/// </summary>
+		const uint64_t MAX_FRAME_PIXELS = uint64_t(1) << 28;
+
+		/// <summary>
+		/// Unwrapping requested for a frame
+		/// </summary>
+		enum class Operation : uint32_t
+		{
+			Auto,
+			Itoh,
+			LeastSquares,
+			QualityGuided,
+			BranchCut
+		};
+
+		/// <summary>
+		/// Outcome of a request
+		/// </summary>
+		enum class Status : uint32_t
+		{
+			Ok,
+
+			/// <summary>
+			/// Queue was full, frame was not processed
+			/// </summary>
+			Busy,
+
+			/// <summary>
+			/// Malformed request (dimensions, type, operation, name)
+			/// </summary>
+			InvalidRequest,
+
+			/// <summary>
+			/// Shared memory object missing or too small
+			/// </summary>
+			SharedMemoryError,
+
+			/// <summary>
+			/// Server stopped before the frame was processed
+			/// </summary>
+			Stopped
+		};
+
+		/// <summary>
+		/// Request message, fixed size, host byte order (both peers run on
+		/// the same machine). Pixels are not sent through the socket, they are
+		/// read from POSIX shared memory object created by the client: wrapped
+		/// phase (range [0, 1] CV_32FC1 or CV_16UC1) at offset 0, unwrapped
+		/// phase (radians, CV_32FC1) is written by the server at output_offset.
+		/// </summary>
+		struct Request
+		{
+			uint32_t magic = PROTOCOL_MAGIC;
+			Operation operation = Operation::Auto;
+
+			/// <summary>
+			/// Chosen by the client, echoed in the response (responses may
+			/// come in different order than requests)
+			/// </summary>
+			uint64_t id = 0;
+
+			int32_t rows = 0;
+			int32_t cols = 0;
+			int32_t type = CV_32FC1;
+			int32_t reserved = 0;
+			uint64_t output_offset = 0;
+
+			/// <summary>
+			/// Name of shared memory object (shm_open), null terminated
+			/// </summary>
+			char shm_name[64] = {};
+		};
+
+		/// <summary>
+		/// Time spent by the frame in each stage on the server, in seconds
+		/// </summary>
+		struct Timings
+		{
+			/// <summary>
+			/// Waiting in the queue for a worker
+			/// </summary>
+			double queued = 0;
+
+			/// <summary>
+			/// Opening and mapping shared memory
+			/// </summary>
+			double map = 0;
+
+			/// <summary>
+			/// Unwrapping, including analysis of Auto
+			/// </summary>
+			double compute = 0;
+
+			/// <summary>
+			/// Storing result into shared memory
+			/// </summary>
+			double store = 0;
+
+			/// <summary>
+			/// From receiving the request to sending the response
+			/// </summary>
+			double total = 0;
+		};
+
+		/// <summary>
+		/// Response message, sent asynchronously when the frame is done
+		/// </summary>
+		struct Response
+		{
+			uint32_t magic = PROTOCOL_MAGIC;
+			Status status = Status::Ok;
+			uint64_t id = 0;
+
+			/// <summary>
+			/// Unwrapper actually used (decided by Auto if requested)
+			/// </summary>
+			unwrappers::Method method = unwrappers::Method::Itoh;
+
+			/// <summary>
+			/// Residues found by the analysis of Operation::Auto, 0 otherwise
+			/// </summary>
+			int32_t residues = 0;
+
+			Timings timings;
+		};
+
+		/// <summary>
+		/// Server configuration
+		/// </summary>
+		struct ServerOptions
+		{
+			/// <summary>
+			/// Unix socket path, the socket is accessible to the owner only
+			/// </summary>
+			std::string socket_path = DEFAULT_SOCKET_PATH;
+
+			/// <summary>
+			/// Number of frames processed concurrently
+			/// </summary>
+			int workers = 2;
+
+			/// <summary>
+			/// Frames waiting for a worker, further requests get Status::Busy
+			/// </summary>
+			size_t queue_capacity = 64;
+
+			/// <summary>
+			/// Whether to write a line per frame to std::clog
+			/// </summary>
+			bool log = true;
+		};
+
+		/// <summary>
+		/// Headless unwrapping daemon. Accepts connections on Unix domain
+		/// socket, each connection may pipeline any number of requests. Reader
+		/// thread per connection queues them, workers process them and send
+		/// responses as they finish. Not available on Windows (Start fails).
+		/// </summary>
+		class Server
+		{
+		public:
+			explicit Server(const ServerOptions& options = ServerOptions());
+			~Server();
+
+			Server(const Server&) = delete;
+			Server& operator=(const Server&) = delete;
+
+			/// <summary>
+			/// Binds the socket (replacing stale one) and starts the threads.
+			/// </summary>
+			/// <returns>
+			/// True on success.
+			/// </returns>
+			bool Start();
+
+			/// <summary>
+			/// Stops accepting, closes connections, answers queued frames with
+			/// Status::Stopped and joins the threads. Safe to call repeatedly.
+			/// </summary>
+			void Stop();
+
+			bool IsRunning() const { return running; }
+
+		private:
+			struct Connection;
+
+			struct Job
+			{
+				std::shared_ptr<Connection> connection;
+				Request request;
+				int64_t received = 0;
+			};
+
+			void AcceptLoop();
+			void ReadLoop(std::shared_ptr<Connection> connection);
+			void WorkLoop();
+			void Process(const Job& job);
+
+			ServerOptions options;
+			std::atomic<bool> running{ false };
+			int listen_fd = -1;
+
+			std::thread acceptor;
+			std::vector<std::thread> workers;
+
+			std::mutex connections_mutex;
+			std::vector<std::pair<std::shared_ptr<Connection>, std::thread>> connections;
+
+			std::mutex queue_mutex;
+			std::condition_variable queue_ready;
+			std::deque<Job> queue;
+		};
+
+		/// <summary>
+		/// Shared memory object holding a frame and room for its result, see
+		/// Request. Created and unlinked (on destruction) by the client.
+		/// </summary>
+		class SharedFrame
+		{
+		public:
+			SharedFrame() = default;
+			~SharedFrame();
+
+			SharedFrame(const SharedFrame&) = delete;
+			SharedFrame& operator=(const SharedFrame&) = delete;
+
+			/// <summary>
+			/// Creates shared memory object (replacing existing one) for the
+			/// frame of given size and type.
+			/// </summary>
+			/// <param name="name">
+			/// Object name, starting with '/', shorter than Request::shm_name.
+			/// </param>
+			/// <returns>
+			/// True on success.
+			/// </returns>
+			bool Create(const std::string& name, int rows, int cols, int type = CV_32FC1);
+
+			/// <summary>
+			/// Unmaps and unlinks the object.
+			/// </summary>
+			void Close();
+
+			/// <summary>
+			/// View of the wrapped phase, to be filled before sending request
+			/// </summary>
+			cv::Mat Input() const;
+
+			/// <summary>
+			/// View of the unwrapped phase, valid after Status::Ok response
+			/// </summary>
+			cv::Mat Output() const;
+
+			/// <summary>
+			/// Request to unwrap this frame
+			/// </summary>
+			Request MakeRequest(Operation operation, uint64_t id) const;
+
+		private:
+			std::string name;
+			unsigned char* data = nullptr;
+			size_t size = 0;
+			size_t output_offset = 0;
+			int rows = 0, cols = 0, type = CV_32FC1;
+		};
+
+		/// <summary>
+		/// Connection to the server. Send and Receive may be used from two
+		/// different threads, but not each of them from several threads.
+		/// </summary>
+		class Client
+		{
+		public:
+			Client() = default;
+			~Client();
+
+			Client(const Client&) = delete;
+			Client& operator=(const Client&) = delete;
+
+			bool Connect(const std::string& socket_path = DEFAULT_SOCKET_PATH);
+			void Close();
+
+			/// <summary>
+			/// Sends request, does not wait for the response.
+			/// </summary>
+			bool Send(const Request& request);
+
+			/// <summary>
+			/// Waits for the next response (of any of the sent requests).
+			/// </summary>
+			/// <returns>
+			/// False when connection was closed.
+			/// </returns>
+			bool Receive(Response& response);
+
+		private:
+			int fd = -1;
+		};
+
+		/// <summary>
+		/// Name of the status, for logs
+		/// </summary>
+		const char* StatusName(Status status);
+	}
+}
@@ -0,0 +1,88 @@
+#include "Storage.h"
+#include "Parallel.h"
+#include "Profiling.h"
+
+namespace pu
+{
+	cv::Mat ToFixed16(const cv::Mat & phase)
+	{
+		assert(!phase.empty() &&
+			   phase.type() == CV_32FC1 &&
+			   "[ToFixed16] Invalid phase image");
+
+		PU_PROFILE_SCOPE("ToFixed16");
+
+		cv::Mat fixed = parallel::Allocate(phase.rows, phase.cols, CV_16UC1);
+		PU_PROFILE_COUNT("ToFixed16", Allocations, 1);
+
+		parallel::ForRows(cv::Range(0, phase.rows), [&](const cv::Range& range) {
+			for(int row = range.start; row < range.end; row++)
+			{
+				const float* src = phase.ptr<float>(row);
+				unsigned short* dst = fixed.ptr<unsigned short>(row);
+				for(int col = 0; col < phase.cols; col++)
+				{
+					// Rounding to 32-bit integer and truncating to 16 bits wraps
+					// phase to [0, 1) so phase 1.0 becomes 0
+					int value = static_cast<int>(std::floor(src[col] * FIXED16_ONE + 0.5f));
+					dst[col] = static_cast<unsigned short>(value & 0xFFFF);
+				}
+			}
+		});
+
+		return fixed;
+	}
+
+	cv::Mat FromFixed16(const cv::Mat & fixed)
+	{
+		assert(!fixed.empty() &&
+			   (fixed.type() == CV_16UC1 || fixed.type() == CV_16SC1) &&
+			   "[FromFixed16] Invalid fixed point image");
+
+		cv::Mat res;
+		fixed.convertTo(res, CV_32F, 1.0 / FIXED16_ONE);
+		return res;
+	}
+
+	cv::Mat ToHalf(const cv::Mat & image)
+	{
+		assert(!image.empty() &&
+			   image.type() == CV_32FC1 &&
+			   "[ToHalf] Invalid image");
+
+		cv::Mat half;
+		cv::convertFp16(image, half);
+		return half;
+	}
+
+	cv::Mat FromHalf(const cv::Mat & half)
+	{
+		assert(!half.empty() &&
+			   half.type() == CV_16SC1 &&
+			   "[FromHalf] Invalid half precision image");
+
+		cv::Mat res;
+		cv::convertFp16(half, res);
+		return res;
+	}
+
+	cv::Mat Store(const cv::Mat & image, PhaseStorage storage)
+	{
+		switch(storage)
+		{
+		case PhaseStorage::Fixed16: return ToFixed16(image);
+		case PhaseStorage::Half: return ToHalf(image);
+		default: return image;
+		}
+	}
+
+	cv::Mat Load(const cv::Mat & image, PhaseStorage storage)
+	{
+		switch(storage)
+		{
+		case PhaseStorage::Fixed16: return FromFixed16(image);
+		case PhaseStorage::Half: return FromHalf(image);
+		default: return image;
+		}
+	}
+}
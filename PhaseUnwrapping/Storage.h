@@ -0,0 +1,95 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+namespace pu
+{
+	/// <summary>
+	/// Value of one full phase cycle (normalized phase 1.0) in 16-bit fixed
+	/// point representation. Normalized phase [0, 1) maps onto whole unsigned
+	/// short range, so phase differences wrap for free on integer overflow.
+	/// </summary>
+	constexpr float FIXED16_ONE = 65536.0f;
+
+	/// <summary>
+	/// Number of distinct 16-bit fixed point phase values
+	/// </summary>
+	constexpr int FIXED16_LEVELS = 65536;
+
+	/// <summary>
+	/// How phase (or quality) images are stored
+	/// </summary>
+	enum class PhaseStorage
+	{
+		/// <summary>
+		/// CV_32FC1, default used by all the algorithms
+		/// </summary>
+		Float32,
+
+		/// <summary>
+		/// CV_16UC1 fixed point for normalized phase, uniform resolution of
+		/// 1/65536 cycle. Signed values (e.g. gradients) are stored as CV_16SC1.
+		/// </summary>
+		Fixed16,
+
+		/// <summary>
+		/// IEEE half precision (as produced by cv::convertFp16, CV_16SC1
+		/// container), suitable for quality maps with arbitrary range. Storage
+		/// format only: no algorithm reads it, images are widened by Load
+		/// first, so it saves memory at rest but not bandwidth of the kernels.
+		/// The container type is shared with fixed point gradients, so it
+		/// cannot be told apart by type.
+		/// </summary>
+		Half
+	};
+
+	/// <summary>
+	/// Converts normalized phase to 16-bit fixed point.
+	/// </summary>
+	/// <param name="phase">
+	/// Image with phase, 1 channel, floating point, values should lay in
+	/// range [0, 1], values outside are wrapped into it.
+	/// </param>
+	/// <returns>
+	/// Image with phase, 1 channel, CV_16UC1, value = phase * 65536 (mod 65536).
+	/// </returns>
+	cv::Mat ToFixed16(const cv::Mat& phase);
+
+	/// <summary>
+	/// Widens 16-bit fixed point image back to floating point.
+	/// </summary>
+	/// <param name="fixed">
+	/// Image, 1 channel, CV_16UC1 (phase) or CV_16SC1 (gradients).
+	/// </param>
+	/// <returns>
+	/// Image, 1 channel, floating point, value = fixed / 65536. Phase lays in
+	/// range [0, 1), gradients in range [-0.5, 0.5).
+	/// </returns>
+	cv::Mat FromFixed16(const cv::Mat& fixed);
+
+	/// <summary>
+	/// Converts floating point image to half precision, for storage only
+	/// (see PhaseStorage::Half).
+	/// </summary>
+	/// <param name="image">
+	/// Image, 1 channel, floating point, arbitrary values.
+	/// </param>
+	/// <returns>
+	/// Image with half precision values in CV_16SC1 container.
+	/// </returns>
+	cv::Mat ToHalf(const cv::Mat& image);
+
+	/// <summary>
+	/// Widens half precision image back to floating point.
+	/// </summary>
+	cv::Mat FromHalf(const cv::Mat& half);
+
+	/// <summary>
+	/// Converts floating point image into given storage.
+	/// </summary>
+	cv::Mat Store(const cv::Mat& image, PhaseStorage storage);
+
+	/// <summary>
+	/// Converts image from given storage into floating point.
+	/// </summary>
+	cv::Mat Load(const cv::Mat& image, PhaseStorage storage);
+}
@@ -1,7 +1,9 @@
 #include "TestData.h"
+#include "Parallel.h"
 #include "Utils.h"
-#include <random>
-#include <mutex>
+#include "Profiling.h"
+
+#include <cfloat>
 
 namespace pu
 {
@@ -9,100 +11,185 @@ namespace pu
 	{
 		float Peak(float x, float y)
 		{
-			return 3.0f * std::powf(1.0f - x, 2.0f) * std::expf(-std::powf(x, 2.0f) - std::powf(y + 1.0f, 2.0f))
-				- 10.0f * (x / 5.0f - std::powf(x, 3.0f) - std::powf(y, 5.0f)) * std::expf(-std::powf(x, 2.0f) - std::powf(y, 2.0f))
-				- 1.0f / 3.0f * std::expf(-std::powf(x + 1.0f, 2.0f) - std::powf(y, 2.0f));
+			// Powers as products, powf with integer exponents does not vectorize
+			float x2 = x * x, y2 = y * y;
+			float y5 = y2 * y2 * y;
+			float x1 = 1.0f - x, xp1 = x + 1.0f, yp1 = y + 1.0f;
+			return 3.0f * x1 * x1 * std::exp(-x2 - yp1 * yp1)
+				- 10.0f * (x / 5.0f - x2 * x - y5) * std::exp(-x2 - y2)
+				- 1.0f / 3.0f * std::exp(-xp1 * xp1 - y2);
 		}
 
-		float Noise()
+		// Number of random values each pixel may draw
+		constexpr uint64_t DRAWS_PER_PIXEL = 4;
+
+		/// <summary>
+		/// SplitMix64 output function, bijective 64-bit mixer
+		/// </summary>
+		inline uint64_t Mix(uint64_t z)
 		{
-			// Random engine with seed so re-launching program will generate same sequence each time
-			static std::mt19937 engine{ 2137 };
-			// Uniformly distributed from 0 to 1
-			static std::uniform_real_distribution<float> distribution(0.f, 1.f);
-			// Bind for ease of use
-			static auto noise = std::bind(distribution, engine);
-
-			return noise();
+			z += 0x9E3779B97F4A7C15ull;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
 		}
-	}
-
-	cv::Mat VerticalPlane(int rows, int cols, float minVal, float maxVal)
-	{
-		assert(rows > 0 && cols > 0 && "[VerticalPlance] Invalid dimensions");
 
-		// Swap values so the natural order is preserved
-		if(minVal > maxVal)
+		/// <summary>
+		/// Counter based generator, random number is a pure function of seed,
+		/// pixel index and draw number (< DRAWS_PER_PIXEL), no state is shared
+		/// </summary>
+		class Noise
 		{
-			std::swap(minVal, maxVal);
-		}
+		public:
+			explicit Noise(uint64_t seed) : key(Mix(seed)) {}
 
-		cv::Mat img{ rows,cols,CV_32FC1, cv::Scalar(0) };
+			/// <summary>
+			/// Uniformly distributed in [0, 1)
+			/// </summary>
+			float Uniform(uint64_t index, uint64_t draw) const
+			{
+				return static_cast<float>(Bits(index, draw) >> 40) * (1.0f / 16777216.0f);
+			}
 
-		// Assign row index to each pixel (scaling will be done later)
-		img.forEach<float>([&](float& px, const int* pos) -> void {
-			px = static_cast<float>(pos[0]);
-		});
+			/// <summary>
+			/// Pair of independent standard normal values (Box-Muller),
+			/// uses draws draw and draw + 1
+			/// </summary>
+			void Gaussian(uint64_t index, uint64_t draw, float& n1, float& n2) const
+			{
+				// Shift to (0, 1] so logarithm is finite
+				float u1 = static_cast<float>((Bits(index, draw) >> 40) + 1) * (1.0f / 16777216.0f);
+				float u2 = Uniform(index, draw + 1);
+				float r = std::sqrt(-2.0f * std::log(u1));
+				float angle = static_cast<float>(2.0 * CV_PI) * u2;
+				n1 = r * std::cos(angle);
+				n2 = r * std::sin(angle);
+			}
 
-		// Scale image so its values run from minVal to maxVal
-		cv::normalize(img, img, minVal, maxVal, cv::NORM_MINMAX);
+			float Gaussian(uint64_t index, uint64_t draw) const
+			{
+				float n1, n2;
+				Gaussian(index, draw, n1, n2);
+				return n1;
+			}
 
-		return img;
-	}
+		private:
+			uint64_t Bits(uint64_t index, uint64_t draw) const
+			{
+				return Mix(key + index * DRAWS_PER_PIXEL + draw);
+			}
 
-	cv::Mat HorizontalPlane(int rows, int cols, float minVal, float maxVal)
-	{
-		assert(rows > 0 && cols > 0 && "[HorizontalPlane] Invalid dimensions");
+			uint64_t key;
+		};
 
-		// Swap values so the natural order is preserved
-		if(minVal > maxVal)
+		/// <summary>
+		/// Runs op(px, index) in parallel for each pixel of floating point
+		/// image (tile at origin of image with image_cols columns), index is
+		/// row major pixel index in the whole image
+		/// </summary>
+		template<typename Op>
+		void ForEachPixel(cv::Mat& img, Op op, cv::Point origin = cv::Point(0, 0), int image_cols = 0)
 		{
-			std::swap(minVal, maxVal);
-		}
+			if(image_cols <= 0) image_cols = img.cols;
 
-		cv::Mat img{ rows,cols,CV_32FC1, cv::Scalar(0) };
-
-		// Assign col index to each pixel (scaling will be done later)
-		img.forEach<float>([&](float& px, const int* pos) -> void {
-			px = static_cast<float>(pos[1]);
-		});
+			parallel::ForRows(cv::Range(0, img.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					float* px = img.ptr<float>(row);
+					uint64_t index = static_cast<uint64_t>(origin.y + row) * image_cols + origin.x;
+					for(int col = 0; col < img.cols; col++)
+					{
+						op(px[col], index + col);
+					}
+				}
+			});
+		}
 
-		// Scale image so its values run from minVal to maxVal
-		cv::normalize(img, img, minVal, maxVal, cv::NORM_MINMAX);
+		/// <summary>
+		/// Evaluates f(row, col) for each pixel of region, in parallel
+		/// </summary>
+		template<typename F>
+		cv::Mat Evaluate(const cv::Rect& region, F f)
+		{
+			cv::Mat img{ region.height, region.width, CV_32FC1 };
+			PU_PROFILE_COUNT("GenerateSurface", Allocations, 1);
+			PU_PROFILE_COUNT("GenerateSurface", PixelsProcessed, region.area());
 
-		return img;
-	}
+			parallel::ForRows(cv::Range(0, region.height), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					float* px = img.ptr<float>(row);
+					for(int col = 0; col < region.width; col++)
+					{
+						px[col] = f(region.y + row, region.x + col);
+					}
+				}
+			});
 
-	cv::Mat ShearPlanes(int rows, int cols, float minVal, float maxVal)
-	{
-		assert(rows > 0 && cols > 0 && "[ShearPlanes] Invalid dimensions");
+			return img;
+		}
 
-		// Swap values so the natural order is preserved
-		if(minVal > maxVal)
+		/// <summary>
+		/// Same linear mapping as cv::normalize with NORM_MINMAX for source
+		/// range [srcMin, srcMax] (constant image maps to dstMin)
+		/// </summary>
+		struct MinMaxMapping
 		{
-			std::swap(minVal, maxVal);
-		}
+			double scale, shift;
 
-		cv::Mat img{ rows,cols,CV_32FC1, cv::Scalar(0) };
+			MinMaxMapping(double srcMin, double srcMax, double dstMin, double dstMax)
+			{
+				scale = srcMax - srcMin > DBL_EPSILON ? (dstMax - dstMin) / (srcMax - srcMin) : 0.0;
+				shift = dstMin - srcMin * scale;
+			}
 
-		// Divide img into left and right planes
-		// Left one will increase values downwards
-		// Right one will increase values upwards
-		// Same value for both plancs will be in the middle row
-		img.forEach<float>([&](float& px, const int* pos) -> void {
-			int row = pos[0], col = pos[1];
-			px = col < img.cols / 2 ? (row - rows / 2) : (rows / 2 - row);
-		});
+			float operator()(double value) const
+			{
+				return static_cast<float>(value * scale + shift);
+			}
+		};
+	}
 
-		// Scale image so its values run from minVal to maxVal
-		cv::normalize(img, img, minVal, maxVal, cv::NORM_MINMAX);
+	cv::Mat VerticalPlane(int rows, int cols, float minVal, float maxVal)
+	{
+		assert(rows > 0 && cols > 0 && "[VerticalPlance] Invalid dimensions");
+		return GenerateSurface(Surface::VerticalPlane, cv::Rect(0, 0, cols, rows), rows, cols, minVal, maxVal);
+	}
 
-		return img;
+	cv::Mat HorizontalPlane(int rows, int cols, float minVal, float maxVal)
+	{
+		assert(rows > 0 && cols > 0 && "[HorizontalPlane] Invalid dimensions");
+		return GenerateSurface(Surface::HorizontalPlane, cv::Rect(0, 0, cols, rows), rows, cols, minVal, maxVal);
+	}
+
+	cv::Mat ShearPlanes(int rows, int cols, float minVal, float maxVal)
+	{
+		assert(rows > 0 && cols > 0 && "[ShearPlanes] Invalid dimensions");
+		return GenerateSurface(Surface::ShearPlanes, cv::Rect(0, 0, cols, rows), rows, cols, minVal, maxVal);
 	}
 
 	cv::Mat SpiralShear(int rows, int cols, float minVal, float maxVal)
 	{
 		assert(rows > 0 && cols > 0 && "[SpiralShear] Invalid dimensions");
+		return GenerateSurface(Surface::SpiralShear, cv::Rect(0, 0, cols, rows), rows, cols, minVal, maxVal);
+	}
+
+	cv::Mat Peaks(int rows, int cols, float minVal, float maxVal)
+	{
+		assert(rows > 0 && cols > 0 && "[Peaks] Invalid dimensions");
+		return GenerateSurface(Surface::Peaks, cv::Rect(0, 0, cols, rows), rows, cols, minVal, maxVal);
+	}
+
+	cv::Mat GenerateSurface(Surface surface, const cv::Rect & region, int rows, int cols, float minVal, float maxVal)
+	{
+		assert(rows > 0 && cols > 0 && "[GenerateSurface] Invalid dimensions");
+		assert(region.x >= 0 && region.y >= 0 &&
+			   region.x + region.width <= cols &&
+			   region.y + region.height <= rows &&
+			   !region.empty() &&
+			   "[GenerateSurface] Region must lay within surface");
+
+		PU_PROFILE_SCOPE("GenerateSurface");
 
 		// Swap values so the natural order is preserved
 		if(minVal > maxVal)
@@ -110,101 +197,182 @@ namespace pu
 			std::swap(minVal, maxVal);
 		}
 
-		cv::Mat img{ rows,cols,CV_32FC1, cv::Scalar(0) };
+		switch(surface)
+		{
+		case Surface::VerticalPlane:
+		{
+			// Row index scaled so values run from minVal to maxVal
+			MinMaxMapping mapping{ 0.0, rows - 1.0, minVal, maxVal };
+			return Evaluate(region, [&](int row, int col) { return mapping(row); });
+		}
+		case Surface::HorizontalPlane:
+		{
+			// Col index scaled so values run from minVal to maxVal
+			MinMaxMapping mapping{ 0.0, cols - 1.0, minVal, maxVal };
+			return Evaluate(region, [&](int row, int col) { return mapping(col); });
+		}
+		case Surface::ShearPlanes:
+		{
+			// Divide img into left and right planes
+			// Left one will increase values downwards
+			// Right one will increase values upwards
+			// Same value for both plancs will be in the middle row
+			int half = rows / 2;
+
+			// Extrema of right plane and, if there is one, left plane
+			double srcMin = half - (rows - 1.0), srcMax = half;
+			if(cols / 2 > 0)
+			{
+				srcMin = std::min(srcMin, -static_cast<double>(half));
+				srcMax = std::max(srcMax, rows - 1.0 - half);
+			}
 
-		// "Thickness" of spiral arm, delta radius 
-		int dR = cols / 8;
+			MinMaxMapping mapping{ srcMin, srcMax, minVal, maxVal };
+			return Evaluate(region, [&](int row, int col) {
+				return mapping(col < cols / 2 ? (row - half) : (half - row));
+			});
+		}
+		case Surface::SpiralShear:
+		{
+			// "Thickness" of spiral arm, delta radius
+			int dR = std::max(cols / 8, 1);
 
-		// Y coordinate of each of spirals' semicircles
-		int centerRow = rows / 2;
+			// Y coordinate of each of spirals' semicircles
+			int centerRow = rows / 2;
 
-		img.forEach<float>([&](float& px, const int* pos) -> void {
-			int row = pos[0], col = pos[1];
+			// Radius of j-th semicircle is dR * (2j + 1), there are only
+			// semicircles with radius less than rows + cols
+			auto radius = [&](long long j) { return dR * (2 * j + 1); };
+			auto radius2 = [&](long long j) { return radius(j) * radius(j); };
 
-			bool isTop = row < (rows / 2);
+			return Evaluate(region, [&](int row, int col) -> float {
+				bool isTop = row < (rows / 2);
 
-			// Move center a bit to the right for top half to the left for bottom one
-			int centerCol = cols / 2 + (isTop ? 1 : -1) * dR;
-			float realMin = isTop ? minVal : maxVal;
-			float realMax = isTop ? maxVal : minVal;
+				// Move center a bit to the right for top half to the left for bottom one
+				int centerCol = cols / 2 + (isTop ? 1 : -1) * dR;
+				float realMin = isTop ? minVal : maxVal;
+				float realMax = isTop ? maxVal : minVal;
 
-			// Squared distance from the center (used to detect whether negative or positive shear should be applied)
-			double dist = std::pow(row - centerRow, 2) + std::pow(col - centerCol, 2);
+				// Squared distance from the center (used to detect whether negative or positive shear should be applied)
+				long long dr = row - centerRow, dc = col - centerCol;
+				long long dist = dr * dr + dc * dc;
 
-			// Scan bigger and bigger semicircles
-			for(int r = dR, i = 0; r < rows + cols; r += 2 * dR, i = !i)
-			{
-				int R = r * r;
-				if(dist < R && i)
-				{
-					px = Scale(row, 0, rows, realMin, realMax);
-					break;
-				}
-				else if(dist < R && !i)
+				// Smallest semicircle containing the pixel, estimated from the
+				// distance and corrected with exact integer comparisons
+				double estimate = (std::sqrt(static_cast<double>(dist)) / dR - 1.0) / 2.0;
+				long long j = std::max(0LL, static_cast<long long>(std::floor(estimate)) + 1);
+				while(j > 0 && dist < radius2(j - 1)) j--;
+				while(dist >= radius2(j)) j++;
+
+				if(radius(j) >= static_cast<long long>(rows) + cols)
 				{
-					px = Scale(row, 0, rows, realMax, realMin);
-					break;
+					return 0.0f;
 				}
-			}
-		});
-
-		return img;
-	}
-
-	cv::Mat Peaks(int rows, int cols, float minVal, float maxVal)
-	{
-		assert(rows > 0 && cols > 0 && "[Peaks] Invalid dimensions");
 
-
-		// Swap values so the natural order is preserved
-		if(minVal > maxVal)
+				// Odd semicircles get negative shear, even ones positive
+				return j % 2 ? Scale(row, 0, rows, realMin, realMax) : Scale(row, 0, rows, realMax, realMin);
+			});
+		}
+		default:
 		{
-			std::swap(minVal, maxVal);
+			// Peak extrema are known so each pixel is scaled on its own
+			MinMaxMapping mapping{ PEAKS_MIN, PEAKS_MAX, minVal, maxVal };
+			return Evaluate(region, [&](int row, int col) {
+				float y = pu::Scale(row, 0, rows - 1, -2.5, 2.5);
+				float x = pu::Scale(col, 0, cols - 1, -2.5, 2.5);
+				return mapping(Peak(x, y));
+			});
+		}
 		}
-
-		cv::Mat img{ rows,cols,CV_32FC1, cv::Scalar(0) };
-
-		img.forEach<float>([&](float& px, const int* pos) -> void {
-			float y = pu::Scale(pos[0], 0, rows - 1, -2.5, 2.5);
-			float x = pu::Scale(pos[1], 0, cols - 1, -2.5, 2.5);
-			px = Peak(x, y);
-		});
-
-		// Scale image so its values run from minVal to maxVal
-		cv::normalize(img, img, minVal, maxVal, cv::NORM_MINMAX);
-
-		return img;
 	}
 
-	void AddSaltPepperNoise(cv::Mat & img, float probability)
+	void AddSaltPepperNoise(cv::Mat & img, float probability, uint64_t seed)
 	{
+		assert(!img.empty() && img.type() == CV_32FC1 && "[AddSaltPepperNoise] Invalid image");
+
+		PU_PROFILE_SCOPE("AddSaltPepperNoise");
+
 		double minVal, maxVal;
 		cv::minMaxIdx(img, &minVal, &maxVal);
 
-		// Dont use opencv's forEach since its mulithreaded and 
-		// will not generate same results every launch
-		std::for_each(img.begin<float>(), img.end<float>(), [&](float& px) -> void {
-			if(Noise() < probability)
+		// Counter based noise does not depend on processing order so it can
+		// run multithreaded and still generate same results every launch
+		Noise noise{ seed };
+		ForEachPixel(img, [&](float& px, uint64_t index) {
+			if(noise.Uniform(index, 0) < probability)
 			{
-				px = Noise() > 0.5 ? minVal : maxVal;
+				px = static_cast<float>(noise.Uniform(index, 1) > 0.5f ? minVal : maxVal);
 			}
 		});
 	}
 
-	void AddRandomNoise(cv::Mat & img, float probability, float magnitude)
+	void AddRandomNoise(cv::Mat & img, float probability, float magnitude, uint64_t seed)
 	{
+		assert(!img.empty() && img.type() == CV_32FC1 && "[AddRandomNoise] Invalid image");
+
+		PU_PROFILE_SCOPE("AddRandomNoise");
+
 		double minVal, maxVal;
 		cv::minMaxIdx(img, &minVal, &maxVal);
 
-		// Dont use opencv's forEach since its mulithreaded and 
-		// will not generate same results every launch
-		std::for_each(img.begin<float>(), img.end<float>(), [&](float& px) -> void {
-			if(Noise() < probability)
+		Noise noise{ seed };
+		ForEachPixel(img, [&](float& px, uint64_t index) {
+			if(noise.Uniform(index, 0) < probability)
 			{
-				px = Scale(Noise(), 0, 1, minVal, maxVal);
+				px = Scale(noise.Uniform(index, 1), 0, 1, minVal, maxVal);
 			}
 		});
 	}
+
+	void AddGaussianNoise(cv::Mat & img, float sigma, uint64_t seed)
+	{
+		AddNoise(img, NoiseType::Gaussian, sigma, seed, cv::Point(0, 0), img.cols);
+	}
+
+	void AddSpeckleNoise(cv::Mat & img, float sigma, uint64_t seed)
+	{
+		AddNoise(img, NoiseType::Speckle, sigma, seed, cv::Point(0, 0), img.cols);
+	}
+
+	void AddPhaseNoise(cv::Mat & img, float sigma, uint64_t seed)
+	{
+		AddNoise(img, NoiseType::Phase, sigma, seed, cv::Point(0, 0), img.cols);
+	}
+
+	void AddNoise(cv::Mat & tile, NoiseType type, float sigma, uint64_t seed, cv::Point origin, int image_cols)
+	{
+		assert(!tile.empty() && tile.type() == CV_32FC1 && "[AddNoise] Invalid image");
+		assert(origin.x >= 0 && origin.y >= 0 && origin.x + tile.cols <= image_cols && "[AddNoise] Tile must lay within image");
+
+		PU_PROFILE_SCOPE("AddNoise");
+
+		Noise noise{ seed };
+		switch(type)
+		{
+		case NoiseType::Gaussian:
+			ForEachPixel(tile, [&](float& px, uint64_t index) {
+				px += sigma * noise.Gaussian(index, 0);
+			}, origin, image_cols);
+			break;
+		case NoiseType::Speckle:
+			ForEachPixel(tile, [&](float& px, uint64_t index) {
+				px *= 1.0f + sigma * noise.Gaussian(index, 0);
+			}, origin, image_cols);
+			break;
+		case NoiseType::Phase:
+			ForEachPixel(tile, [&](float& px, uint64_t index) {
+				// Circular noise is rotation invariant so it can be added in frame
+				// rotated by px, where the signal is 1 + 0i, and the phase error
+				// is simply the angle of the noisy signal
+				float re, im;
+				noise.Gaussian(index, 0, re, im);
+				px += std::atan2(sigma * im, 1.0f + sigma * re);
+			}, origin, image_cols);
+			break;
+		default:
+			break;
+		}
+	}
 }
 
 
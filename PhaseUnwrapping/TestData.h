@@ -1,7 +1,8 @@
 #pragma once
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <cstdint>
 
 namespace pu
 {
@@ -9,6 +10,37 @@ namespace pu
 	constexpr int DEFAULT_TEST_COLS = 64;
 	constexpr float DEFAULT_TEST_MIN = -M_PI * 10;
 	constexpr float DEFAULT_TEST_MAX = M_PI * 10;
+	constexpr uint64_t DEFAULT_NOISE_SEED = 2137;
+
+	/// <summary>
+	/// Extrema of Peak function over [-2.5, 2.5]^2 domain, used to normalize
+	/// Peaks per pixel
+	/// </summary>
+	constexpr float PEAKS_MIN = -6.5511333f;
+	constexpr float PEAKS_MAX = 8.1062136f;
+
+	/// <summary>
+	/// Available test surfaces, see functions of the same names
+	/// </summary>
+	enum class Surface
+	{
+		VerticalPlane,
+		HorizontalPlane,
+		ShearPlanes,
+		SpiralShear,
+		Peaks
+	};
+
+	/// <summary>
+	/// Noise kinds which can be added to tiles of bigger image, see AddNoise
+	/// </summary>
+	enum class NoiseType
+	{
+		None,
+		Gaussian,
+		Speckle,
+		Phase
+	};
 
 	cv::Mat VerticalPlane(
 		int rows = DEFAULT_TEST_ROWS,
@@ -40,13 +72,78 @@ namespace pu
 		float minVal = DEFAULT_TEST_MIN,
 		float maxVal = DEFAULT_TEST_MAX);
 
-	void AddSaltPepperNoise(cv::Mat & img, float probability = 0.01f);
+	/// <summary>
+	/// Computes region of test surface of size rows x cols. Each pixel is
+	/// evaluated with closed form formula (no whole image normalization), so
+	/// regions of arbitrarily large surface can be generated independently
+	/// and in parallel. Functions above return the whole region.
+	/// </summary>
+	/// <param name="surface">
+	/// Surface to generate.
+	/// </param>
+	/// <param name="region">
+	/// Region to generate, must lay within rows x cols.
+	/// </param>
+	/// <returns>
+	/// Image of region size, 1 channel, floating point.
+	/// </returns>
+	cv::Mat GenerateSurface(
+		Surface surface,
+		const cv::Rect& region,
+		int rows,
+		int cols,
+		float minVal = DEFAULT_TEST_MIN,
+		float maxVal = DEFAULT_TEST_MAX);
+
+	// All the noise functions draw from counter based generator keyed by seed
+	// and pixel index, so results are the same for given seed regardless of
+	// number of threads and order in which pixels are processed
+
+	void AddSaltPepperNoise(cv::Mat & img, float probability = 0.01f, uint64_t seed = DEFAULT_NOISE_SEED);
+
+	void AddRandomNoise(cv::Mat & img, float probability = 0.01f, float magnitude = 1.f, uint64_t seed = DEFAULT_NOISE_SEED);
+
+	/// <summary>
+	/// Adds zero mean gaussian noise with standard deviation sigma
+	/// </summary>
+	void AddGaussianNoise(cv::Mat & img, float sigma = 0.1f, uint64_t seed = DEFAULT_NOISE_SEED);
+
+	/// <summary>
+	/// Adds multiplicative noise, px = px * (1 + n), n gaussian with
+	/// standard deviation sigma
+	/// </summary>
+	void AddSpeckleNoise(cv::Mat & img, float sigma = 0.1f, uint64_t seed = DEFAULT_NOISE_SEED);
+
+	/// <summary>
+	/// Adds noise of interferometric signal to (unwrapped, radians) phase:
+	/// result is phase of exp(i * px) with added circular gaussian noise of
+	/// standard deviation sigma (per component). Low sigma gives nearly
+	/// gaussian phase noise, high sigma heavy tails and residues.
+	/// </summary>
+	void AddPhaseNoise(cv::Mat & img, float sigma = 0.3f, uint64_t seed = DEFAULT_NOISE_SEED);
 
-	void AddRandomNoise(cv::Mat & img, float probability = 0.01f, float magnitude = 1.f);
+	/// <summary>
+	/// Adds noise to tile of bigger image. Tile pixels draw the same random
+	/// values as corresponding pixels of the whole image would, so noise of
+	/// tiled image equals noise added to the whole image at once.
+	/// </summary>
+	/// <param name="tile">
+	/// Tile, 1 channel, floating point.
+	/// </param>
+	/// <param name="type">
+	/// Kind of noise, sigma as in AddGaussianNoise, AddSpeckleNoise and
+	/// AddPhaseNoise.
+	/// </param>
+	/// <param name="origin">
+	/// Position of tile top left pixel in the whole image.
+	/// </param>
+	/// <param name="image_cols">
+	/// Number of columns of the whole image.
+	/// </param>
+	void AddNoise(cv::Mat & tile, NoiseType type, float sigma, uint64_t seed, cv::Point origin, int image_cols);
 
 	namespace
 	{
 		inline float Peak(float x, float y);
-		inline static float Noise();
 	}
 }
@@ -0,0 +1,133 @@
+#include "Trigonometry.h"
+#include "Parallel.h"
+#include "Profiling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace pu
+{
+	namespace
+	{
+		// Maximum number of pixels sampled when looking for quantization step
+		constexpr int MAX_DETECTION_SAMPLES = 1 << 20;
+
+		// Values closer than that are considered the same level
+		constexpr double SAME_LEVEL_EPS = 1e-6;
+
+		// Allowed distance from the nearest level, in level steps
+		constexpr double LEVEL_TOLERANCE = 0.02;
+
+		/// <summary>
+		/// Checks that all pixels lay on i / levels. Bands of rows are checked
+		/// in parallel, the first pixel off the levels stops all of them.
+		/// </summary>
+		bool FitsLevels(const cv::Mat& wrapped, int levels)
+		{
+			std::atomic<bool> off{ false };
+
+			parallel::ForRows(cv::Range(0, wrapped.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end && !off.load(std::memory_order_relaxed); row++)
+				{
+					const float* src = wrapped.ptr<float>(row);
+					for(int col = 0; col < wrapped.cols; col++)
+					{
+						double v = static_cast<double>(src[col]) * levels;
+						if(std::abs(v - std::floor(v + 0.5)) > LEVEL_TOLERANCE)
+						{
+							off.store(true, std::memory_order_relaxed);
+							return;
+						}
+					}
+				}
+			});
+
+			return !off;
+		}
+	}
+
+	PhaseLut::PhaseLut(int levels)
+		: levels(levels), cos_table(levels), sin_table(levels)
+	{
+		assert(levels >= 2 &&
+			   levels <= FIXED16_LEVELS &&
+			   "[PhaseLut] Levels must be in range [2, 65536]");
+
+		for(int i = 0; i < levels; i++)
+		{
+			double phase = 2.0 * CV_PI * i / levels;
+			cos_table[i] = static_cast<float>(std::cos(phase));
+			sin_table[i] = static_cast<float>(std::sin(phase));
+		}
+	}
+
+	const PhaseLut& GetPhaseLut(int levels)
+	{
+		static std::mutex mtx;
+		static std::map<int, std::unique_ptr<PhaseLut>> luts;
+
+		std::lock_guard<std::mutex> lock(mtx);
+		auto& lut = luts[levels];
+		if(!lut)
+		{
+			PU_PROFILE_SCOPE("BuildPhaseLut");
+			lut.reset(new PhaseLut(levels));
+		}
+		return *lut;
+	}
+
+	int DetectPhaseLevels(const cv::Mat & wrapped)
+	{
+		assert(!wrapped.empty() &&
+			   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+			   "[DetectPhaseLevels] Invalid wrapped phase image");
+
+		if(wrapped.type() == CV_16UC1)
+		{
+			return FIXED16_LEVELS;
+		}
+
+		PU_PROFILE_SCOPE("DetectPhaseLevels");
+
+		// Distinct values of (strided) sample
+		size_t total = wrapped.total();
+		size_t stride = std::max<size_t>(1, total / MAX_DETECTION_SAMPLES);
+		std::vector<float> values;
+		values.reserve(total / stride + 1);
+		for(size_t i = 0; i < total; i += stride)
+		{
+			int row = static_cast<int>(i / wrapped.cols), col = static_cast<int>(i % wrapped.cols);
+			values.push_back(wrapped.at<float>(row, col));
+		}
+		std::sort(values.begin(), values.end());
+
+		// Smallest gap between distinct values is the quantization step
+		// (or its multiple if some levels are missing in the sample, then
+		// verification below fails and phase is treated as not quantized)
+		double step = 0;
+		for(size_t i = 1; i < values.size(); i++)
+		{
+			double gap = static_cast<double>(values[i]) - values[i - 1];
+			if(gap > SAME_LEVEL_EPS && (step == 0 || gap < step))
+			{
+				step = gap;
+			}
+		}
+
+		if(step == 0)
+		{
+			return 0;
+		}
+
+		int levels = static_cast<int>(std::floor(1.0 / step + 0.5));
+		if(levels < 2 || levels > FIXED16_LEVELS)
+		{
+			return 0;
+		}
+
+		return FitsLevels(wrapped, levels) ? levels : 0;
+	}
+}
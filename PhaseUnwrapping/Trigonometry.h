@@ -0,0 +1,73 @@
+#pragma once
+#include "Storage.h"
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+namespace pu
+{
+	/// <summary>
+	/// Cos and sin tables for quantized normalized phase. Phase is quantized
+	/// with L levels when every value equals i / L for integer i, so there
+	/// are at most L distinct angles (i = L is the same angle as i = 0).
+	/// Tables of 4096 levels (12-bit sensors) fit in L1, 65536 levels in L2.
+	/// </summary>
+	class PhaseLut
+	{
+	public:
+		/// <summary>
+		/// Precomputes tables.
+		/// </summary>
+		/// <param name="levels">
+		/// Number of quantization levels, range [2, 65536].
+		/// </param>
+		explicit PhaseLut(int levels);
+
+		int Levels() const { return levels; }
+
+		/// <summary>
+		/// Table index of normalized phase (range [0, 1]), nearest level.
+		/// </summary>
+		int Index(float phase) const
+		{
+			int i = static_cast<int>(phase * levels + 0.5f);
+			if(i >= levels) i -= levels;
+			if(i < 0) i += levels;
+			return i;
+		}
+
+		float Cos(float phase) const { return cos_table[Index(phase)]; }
+		float Sin(float phase) const { return sin_table[Index(phase)]; }
+
+		/// <summary>
+		/// Tables indexed directly with level (e.g. fixed point phase value)
+		/// </summary>
+		const float* CosTable() const { return cos_table.data(); }
+		const float* SinTable() const { return sin_table.data(); }
+
+	private:
+		int levels;
+		std::vector<float> cos_table, sin_table;
+	};
+
+	/// <summary>
+	/// Returns shared table for given number of levels, built on first use.
+	/// Thread safe, returned reference stays valid for the program lifetime.
+	/// </summary>
+	const PhaseLut& GetPhaseLut(int levels);
+
+	/// <summary>
+	/// Detects quantization of normalized wrapped phase, e.g. phase coming
+	/// from 12-bit sensor scaled to [0, 1] (levels = 4095 or 4096, or less
+	/// after min max normalization).
+	/// </summary>
+	/// <param name="wrapped">
+	/// Image with the wrapped phase, 1 channel, floating point, range [0, 1],
+	/// or 16-bit fixed point (CV_16UC1).
+	/// </param>
+	/// <returns>
+	/// Number of levels L such that every pixel lays (up to float rounding)
+	/// on i / L, or 0 if phase is not quantized with at most 65536 levels.
+	/// </returns>
+	int DetectPhaseLevels(const cv::Mat& wrapped);
+}
@@ -0,0 +1,60 @@
+#include "UnwrappedPhase.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "Storage.h"
+
+namespace pu
+{
+	namespace
+	{
+		template<typename W, typename T>
+		void Reconstruct(const cv::Mat& wraps, const cv::Mat& wrapped, cv::Mat& unwrapped)
+		{
+			parallel::ForRows(cv::Range(0, wraps.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const W* n = wraps.ptr<W>(row);
+					const float* w = wrapped.ptr<float>(row);
+					T* dst = unwrapped.ptr<T>(row);
+					for(int col = 0; col < wraps.cols; col++)
+					{
+						dst[col] = static_cast<T>((n[col] + static_cast<double>(w[col])) * (2.0 * CV_PI) - CV_PI);
+					}
+				}
+			});
+		}
+	}
+
+	UnwrappedPhase::UnwrappedPhase(const cv::Mat & wraps, const cv::Mat & wrapped)
+		: wraps(wraps), wrapped(wrapped.type() == CV_16UC1 ? FromFixed16(wrapped) : wrapped)
+	{
+		assert((wraps.type() == CV_16SC1 || wraps.type() == CV_32SC1) &&
+			   "[UnwrappedPhase] Invalid wrap counts image");
+		assert(this->wrapped.type() == CV_32FC1 && wrapped.size() == wraps.size() &&
+			   "[UnwrappedPhase] Invalid wrapped phase image");
+	}
+
+	double UnwrappedPhase::At(int row, int col) const
+	{
+		double n = wraps.type() == CV_16SC1 ? wraps.at<short>(row, col) : wraps.at<int>(row, col);
+		return (n + wrapped.at<float>(row, col)) * (2.0 * CV_PI) - CV_PI;
+	}
+
+	cv::Mat UnwrappedPhase::ToDouble() const
+	{
+		PU_PROFILE_SCOPE("UnwrappedPhaseToDouble");
+
+		cv::Mat unwrapped = parallel::Allocate(wraps.rows, wraps.cols, CV_64FC1);
+		if(wraps.type() == CV_16SC1) Reconstruct<short, double>(wraps, wrapped, unwrapped);
+		else Reconstruct<int, double>(wraps, wrapped, unwrapped);
+		return unwrapped;
+	}
+
+	cv::Mat UnwrappedPhase::ToFloat() const
+	{
+		cv::Mat unwrapped = parallel::Allocate(wraps.rows, wraps.cols, CV_32FC1);
+		if(wraps.type() == CV_16SC1) Reconstruct<short, float>(wraps, wrapped, unwrapped);
+		else Reconstruct<int, float>(wraps, wrapped, unwrapped);
+		return unwrapped;
+	}
+}
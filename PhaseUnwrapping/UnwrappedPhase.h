@@ -0,0 +1,66 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+namespace pu
+{
+	/// <summary>
+	/// Extended range unwrapped phase: integer number of whole cycles (wrap
+	/// count) plus wrapped phase per pixel, unwrapped = (wraps + wrapped) *
+	/// 2PI - PI radians, as returned by the unwrappers. Float unwrapped phase
+	/// keeps only about 7 significant digits, i.e. its resolution drops to
+	/// milliradians at thousands of radians, while here the fractional part
+	/// keeps float resolution of [0, 1) regardless of the number of cycles.
+	/// Takes 6 (int16 counts) or 8 bytes per pixel, double image is built
+	/// only on demand (ToDouble).
+	/// </summary>
+	class UnwrappedPhase
+	{
+	public:
+		UnwrappedPhase() = default;
+
+		/// <summary>
+		/// Unwrapped phase from its parts.
+		/// </summary>
+		/// <param name="wraps">
+		/// Wrap counts, 1 channel, CV_16SC1 or CV_32SC1.
+		/// </param>
+		/// <param name="wrapped">
+		/// Wrapped phase, 1 channel, floating point, range [0, 1], or 16-bit
+		/// fixed point (CV_16UC1, converted to floating point), same size.
+		/// </param>
+		UnwrappedPhase(const cv::Mat& wraps, const cv::Mat& wrapped);
+
+		cv::Size Size() const { return wraps.size(); }
+		bool Empty() const { return wraps.empty(); }
+
+		/// <summary>
+		/// Wrap counts, CV_16SC1 or CV_32SC1
+		/// </summary>
+		const cv::Mat& Wraps() const { return wraps; }
+
+		/// <summary>
+		/// Wrapped phase in cycles, CV_32FC1
+		/// </summary>
+		const cv::Mat& Wrapped() const { return wrapped; }
+
+		/// <summary>
+		/// Unwrapped phase of the pixel in radians
+		/// </summary>
+		double At(int row, int col) const;
+
+		/// <summary>
+		/// Unwrapped phase in radians, 1 channel, CV_64FC1.
+		/// </summary>
+		cv::Mat ToDouble() const;
+
+		/// <summary>
+		/// Unwrapped phase in radians, 1 channel, CV_32FC1, as returned by
+		/// the unwrappers (precision is lost for large phase).
+		/// </summary>
+		cv::Mat ToFloat() const;
+
+	private:
+		cv::Mat wraps;
+		cv::Mat wrapped;
+	};
+}
@@ -0,0 +1,1469 @@
+#include "Unwrappers.h"
+#include "Gradients.h"
+#include "Masks.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "QualityMaps.h"
+#include "Storage.h"
+#include "Trigonometry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+namespace pu
+{
+	namespace unwrappers
+	{
+		namespace
+		{
+			/// <summary>
+			/// Radians of unwrapped phase given in cycles, inverse of WrapNormalized
+			/// </summary>
+			inline float ToRadians(double cycles)
+			{
+				return static_cast<float>(cycles * 2.0 * CV_PI - CV_PI);
+			}
+
+			/// <summary>
+			/// Wrapped phase in cycles as floating point image
+			/// </summary>
+			cv::Mat Cycles(const cv::Mat& wrapped)
+			{
+				return wrapped.type() == CV_16UC1 ? FromFixed16(wrapped) : wrapped;
+			}
+
+			/// <summary>
+			/// Per pixel (row major) 1 where bitflags contain any of ignore_flag
+			/// </summary>
+			std::vector<unsigned char> Masked(const cv::Mat* bitflags, Bitflag ignore_flag, int rows, int cols)
+			{
+				std::vector<unsigned char> masked(static_cast<size_t>(rows) * cols, 0);
+				if(!bitflags || ignore_flag == Bitflag::NoFlag)
+				{
+					return masked;
+				}
+
+				for(int row = 0; row < rows; row++)
+				{
+					const bitflag_type* flags = bitflags->ptr<bitflag_type>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						masked[static_cast<size_t>(row) * cols + col] = (flags[col] & ignore_flag) != 0;
+					}
+				}
+				return masked;
+			}
+
+			/// <summary>
+			/// Image in radians of unwrapped phase given in cycles (row major)
+			/// </summary>
+			cv::Mat ToImage(const std::vector<double>& cycles, int rows, int cols)
+			{
+				cv::Mat unwrapped{ rows, cols, CV_32FC1 };
+				for(int row = 0; row < rows; row++)
+				{
+					const double* src = cycles.data() + static_cast<size_t>(row) * cols;
+					float* dst = unwrapped.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						dst[col] = ToRadians(src[col]);
+					}
+				}
+				return unwrapped;
+			}
+
+			/// <summary>
+			/// Calls visit with row major index of each 4-neighbour of index
+			/// </summary>
+			template<typename Index, typename Visit>
+			inline void ForEachNeighbour(Index index, int rows, int cols, Visit visit)
+			{
+				const Index width = static_cast<Index>(cols), height = static_cast<Index>(rows);
+				const Index row = index / width, col = index % width;
+				if(col > 0) visit(index - 1);
+				if(col + 1 < width) visit(index + 1);
+				if(row > 0) visit(index - width);
+				if(row + 1 < height) visit(index + width);
+			}
+
+			/// <summary>
+			/// Marks pixels of the segment from a to b as cut (Bresenham). Segments
+			/// are 8-connected, which is enough to stop 4-connected flood fill.
+			/// </summary>
+			void DrawCut(std::vector<unsigned char>& cut, int cols, cv::Point a, cv::Point b)
+			{
+				int dx = std::abs(b.x - a.x), dy = -std::abs(b.y - a.y);
+				int sx = a.x < b.x ? 1 : -1, sy = a.y < b.y ? 1 : -1;
+				int error = dx + dy;
+				while(true)
+				{
+					cut[static_cast<size_t>(a.y) * cols + a.x] = 1;
+					if(a == b) break;
+
+					int twice = 2 * error;
+					if(twice >= dy) { error += dy; a.x += sx; }
+					if(twice <= dx) { error += dx; a.y += sy; }
+				}
+			}
+
+			/// <summary>
+			/// Goldstein branch cuts: residues are gathered into trees by boxes
+			/// growing around every tree member, until total charge of the tree is
+			/// 0 or the box reaches the border (or masked pixel) which discharges it.
+			/// Masked pixels are cuts as well.
+			/// </summary>
+			std::vector<unsigned char> PlaceCuts(const cv::Mat& charges, const std::vector<unsigned char>& masked, int max_box)
+			{
+				const int rows = charges.rows, cols = charges.cols;
+
+				std::vector<unsigned char> cut(masked);
+				std::vector<unsigned char> balanced(cut.size(), 0);
+				std::vector<unsigned char> in_tree(cut.size(), 0);
+				std::vector<cv::Point> tree;
+
+				auto to_border = [&](cv::Point p) {
+					int nearest = std::min(std::min(p.x, cols - 1 - p.x), std::min(p.y, rows - 1 - p.y));
+					cv::Point q = p;
+					if(nearest == p.x) q.x = 0;
+					else if(nearest == cols - 1 - p.x) q.x = cols - 1;
+					else if(nearest == p.y) q.y = 0;
+					else q.y = rows - 1;
+					DrawCut(cut, cols, p, q);
+				};
+
+				for(int row = 0; row < rows; row++)
+				{
+					for(int col = 0; col < cols; col++)
+					{
+						size_t start = static_cast<size_t>(row) * cols + col;
+						int sum = charges.at<signed char>(row, col);
+						if(sum == 0 || balanced[start])
+						{
+							continue;
+						}
+
+						tree.assign(1, cv::Point(col, row));
+						in_tree[start] = 1;
+						balanced[start] = 1;
+
+						for(int box = 3; box <= max_box && sum != 0; box += 2)
+						{
+							const int half = box / 2;
+
+							// Tree grows while being searched
+							for(size_t member = 0; member < tree.size() && sum != 0; member++)
+							{
+								const cv::Point a = tree[member];
+								for(int y = a.y - half; y <= a.y + half && sum != 0; y++)
+								{
+									for(int x = a.x - half; x <= a.x + half; x++)
+									{
+										if(y < 0 || y >= rows || x < 0 || x >= cols)
+										{
+											to_border(a);
+											sum = 0;
+											break;
+										}
+
+										size_t index = static_cast<size_t>(y) * cols + x;
+										if(masked[index])
+										{
+											DrawCut(cut, cols, a, cv::Point(x, y));
+											sum = 0;
+											break;
+										}
+
+										signed char charge = charges.at<signed char>(y, x);
+										if(charge == 0 || in_tree[index])
+										{
+											continue;
+										}
+
+										// Residues of other (balanced) trees join without their charge
+										if(!balanced[index])
+										{
+											sum += charge;
+											balanced[index] = 1;
+										}
+										in_tree[index] = 1;
+										tree.push_back(cv::Point(x, y));
+										DrawCut(cut, cols, a, cv::Point(x, y));
+
+										if(sum == 0) break;
+									}
+								}
+							}
+						}
+
+						if(sum != 0)
+						{
+							to_border(tree.front());
+						}
+
+						for(const cv::Point& p : tree)
+						{
+							in_tree[static_cast<size_t>(p.y) * cols + p.x] = 0;
+						}
+					}
+				}
+
+				return cut;
+			}
+
+			template<typename T>
+			void Integrate(const cv::Mat& wrapped, cv::Mat& unwrapped, double scale)
+			{
+				const int rows = wrapped.rows, cols = wrapped.cols;
+
+				// Unwrapped first column (path start of each row), in cycles
+				std::vector<double> start(rows);
+				start[0] = wrapped.at<T>(0, 0) * scale;
+				for(int row = 1; row < rows; row++)
+				{
+					start[row] = start[row - 1] + Gradient(wrapped.at<T>(row, 0), wrapped.at<T>(row - 1, 0)) * scale;
+				}
+
+				// Rows are independent once the first column is known
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						const T* src = wrapped.ptr<T>(row);
+						float* dst = unwrapped.ptr<float>(row);
+
+						double phase = start[row];
+						dst[0] = ToRadians(phase);
+						for(int col = 1; col < cols; col++)
+						{
+							phase += Gradient(src[col], src[col - 1]) * scale;
+							dst[col] = ToRadians(phase);
+						}
+					}
+				});
+			}
+
+			/// <summary>
+			/// Solves discrete Poisson equation (Laplacian of the solution =
+			/// rho) with Neumann boundary (no gradient across the border), up
+			/// to a constant. Laplacian is diagonal in DCT-II basis of the
+			/// exact size. cv::dct takes even sizes only, so odd ones solve the
+			/// equivalent periodic problem on the mirrored 2 rows x 2 cols
+			/// extension with DFT and keep its first quadrant.
+			/// </summary>
+			cv::Mat SolveNeumannPoisson(const cv::Mat& rho)
+			{
+				const int rows = rho.rows, cols = rho.cols;
+				const bool even = rows % 2 == 0 && cols % 2 == 0;
+				const int n = even ? rows : 2 * rows, m = even ? cols : 2 * cols;
+
+				cv::Mat spectrum;
+				if(even)
+				{
+					cv::dct(rho, spectrum);
+				}
+				else
+				{
+					// Half sample symmetric extension (as complex image), gradients
+					// across its mirror lines are 0 as across the original border
+					cv::Mat extended{ n, m, CV_32FC2, cv::Scalar(0) };
+					parallel::ForRows(cv::Range(0, n), [&](const cv::Range& range) {
+						for(int row = range.start; row < range.end; row++)
+						{
+							const float* src = rho.ptr<float>(row < rows ? row : n - 1 - row);
+							float* dst = extended.ptr<float>(row);
+							for(int col = 0; col < m; col++)
+							{
+								dst[2 * col] = src[col < cols ? col : m - 1 - col];
+							}
+						}
+					});
+					cv::dft(extended, spectrum);
+				}
+
+				// Eigenvalues 2 cos(PI k / rows) - 2 + 2 cos(PI l / cols) - 2 in
+				// both bases, DFT of size 2N has frequencies PI k / N as well
+				std::vector<float> col_terms(m);
+				for(int col = 0; col < m; col++)
+				{
+					col_terms[col] = static_cast<float>(2.0 * std::cos(CV_PI * col / cols));
+				}
+
+				const int channels = spectrum.channels();
+				parallel::ForRows(cv::Range(0, n), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						const float row_term = static_cast<float>(2.0 * std::cos(CV_PI * row / rows)) - 4.0f;
+						float* dst = spectrum.ptr<float>(row);
+						for(int col = 0; col < m; col++)
+						{
+							for(int c = 0; c < channels; c++)
+							{
+								dst[col * channels + c] /= row_term + col_terms[col];
+							}
+						}
+					}
+				});
+
+				// Solution is defined up to a constant
+				for(int c = 0; c < channels; c++)
+				{
+					spectrum.ptr<float>(0)[c] = 0;
+				}
+
+				cv::Mat solution;
+				if(even)
+				{
+					cv::dct(spectrum, solution, cv::DCT_INVERSE);
+					return solution;
+				}
+
+				cv::dft(spectrum, solution, cv::DFT_INVERSE | cv::DFT_SCALE);
+
+				// First quadrant is the original image, imaginary part is 0
+				cv::Mat real{ rows, cols, CV_32FC1 };
+				for(int row = 0; row < rows; row++)
+				{
+					const float* src = solution.ptr<float>(row);
+					float* dst = real.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						dst[col] = src[2 * col];
+					}
+				}
+				return real;
+			}
+		}
+
+		cv::Mat Itoh(const cv::Mat & wrapped)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[Itoh] Invalid wrapped phase image");
+
+			PU_PROFILE_SCOPE("Itoh");
+
+			cv::Mat unwrapped{ wrapped.rows, wrapped.cols, CV_32FC1 };
+			PU_PROFILE_COUNT("Itoh", Allocations, 1);
+			PU_PROFILE_COUNT("Itoh", PixelsProcessed, wrapped.rows * wrapped.cols);
+
+			if(wrapped.type() == CV_16UC1)
+			{
+				Integrate<unsigned short>(wrapped, unwrapped, 1.0 / FIXED16_ONE);
+			}
+			else
+			{
+				Integrate<float>(wrapped, unwrapped, 1.0);
+			}
+
+			return unwrapped;
+		}
+
+		namespace
+		{
+			/// <summary>
+			/// Whole cycles added by Gradient(current, other): -1 when
+			/// current - other exceeds half cycle, +1 below minus half cycle
+			/// </summary>
+			inline int Jump(float current, float other)
+			{
+				float r = current - other;
+				return r > 0.5f ? -1 : r < -0.5f ? 1 : 0;
+			}
+
+			inline int Jump(unsigned short current, unsigned short other)
+			{
+				// Same as wrapping by overflow to short
+				int r = static_cast<int>(current) - other;
+				return r >= 32768 ? -1 : r < -32768 ? 1 : 0;
+			}
+
+			/// <summary>
+			/// Itoh path integration of wrap counts only, wrapped phase of
+			/// type T, counts of type W (saturated)
+			/// </summary>
+			template<typename T, typename W>
+			void IntegrateCounts(const cv::Mat& wrapped, cv::Mat& wraps)
+			{
+				const int rows = wrapped.rows, cols = wrapped.cols;
+
+				std::vector<int> start(rows, 0);
+				for(int row = 1; row < rows; row++)
+				{
+					start[row] = start[row - 1] + Jump(wrapped.at<T>(row, 0), wrapped.at<T>(row - 1, 0));
+				}
+
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						const T* src = wrapped.ptr<T>(row);
+						W* dst = wraps.ptr<W>(row);
+
+						int count = start[row];
+						dst[0] = cv::saturate_cast<W>(count);
+						for(int col = 1; col < cols; col++)
+						{
+							count += Jump(src[col], src[col - 1]);
+							dst[col] = cv::saturate_cast<W>(count);
+						}
+					}
+				});
+			}
+		}
+
+		UnwrappedPhase ItohCounts(const cv::Mat & wrapped, int depth)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[ItohCounts] Invalid wrapped phase image");
+			assert((depth == CV_16S || depth == CV_32S) && "[ItohCounts] Wrap counts must be CV_16S or CV_32S");
+
+			PU_PROFILE_SCOPE("ItohCounts");
+
+			cv::Mat wraps{ wrapped.rows, wrapped.cols, CV_MAKETYPE(depth, 1) };
+			PU_PROFILE_COUNT("ItohCounts", Allocations, 1);
+			PU_PROFILE_COUNT("ItohCounts", PixelsProcessed, wrapped.rows * wrapped.cols);
+
+			if(wrapped.type() == CV_16UC1)
+			{
+				if(depth == CV_16S) IntegrateCounts<unsigned short, short>(wrapped, wraps);
+				else IntegrateCounts<unsigned short, int>(wrapped, wraps);
+			}
+			else
+			{
+				if(depth == CV_16S) IntegrateCounts<float, short>(wrapped, wraps);
+				else IntegrateCounts<float, int>(wrapped, wraps);
+			}
+
+			return UnwrappedPhase(wraps, wrapped);
+		}
+
+		UnwrappedPhase WrapCounts(const cv::Mat & wrapped, const cv::Mat & unwrapped, int depth)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[WrapCounts] Invalid wrapped phase image");
+			assert(unwrapped.type() == CV_32FC1 && unwrapped.size() == wrapped.size() &&
+				   "[WrapCounts] Invalid unwrapped phase image");
+			assert((depth == CV_16S || depth == CV_32S) && "[WrapCounts] Wrap counts must be CV_16S or CV_32S");
+
+			PU_PROFILE_SCOPE("WrapCounts");
+
+			const cv::Mat phase = Cycles(wrapped);
+			cv::Mat wraps = parallel::Allocate(wrapped.rows, wrapped.cols, CV_MAKETYPE(depth, 1));
+
+			parallel::ForRows(cv::Range(0, wrapped.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const float* w = phase.ptr<float>(row);
+					const float* u = unwrapped.ptr<float>(row);
+					for(int col = 0; col < wrapped.cols; col++)
+					{
+						// Float error of unwrapped phase is far below half cycle,
+						// so rounding recovers the exact count
+						double cycles = (u[col] + CV_PI) / (2.0 * CV_PI) - w[col];
+						int count = cvRound(cycles);
+						if(depth == CV_16S) wraps.ptr<short>(row)[col] = cv::saturate_cast<short>(count);
+						else wraps.ptr<int>(row)[col] = count;
+					}
+				}
+			});
+			PU_PROFILE_COUNT("WrapCounts", PixelsProcessed, wrapped.rows * wrapped.cols);
+
+			return UnwrappedPhase(wraps, phase);
+		}
+
+		cv::Mat LeastSquares(const cv::Mat & wrapped, bool congruent)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[LeastSquares] Invalid wrapped phase image");
+
+			PU_PROFILE_SCOPE("LeastSquares");
+
+			const int rows = wrapped.rows, cols = wrapped.cols;
+			cv::Mat phase = Cycles(wrapped);
+
+			cv::Mat rho{ rows, cols, CV_32FC1 };
+			PU_PROFILE_COUNT("LeastSquares", Allocations, 4);
+			PU_PROFILE_COUNT("LeastSquares", PixelsProcessed, rows * cols);
+
+			// Divergence of wrapped gradients, gradients across the border are 0
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const float* current = phase.ptr<float>(row);
+					const float* up = row > 0 ? phase.ptr<float>(row - 1) : nullptr;
+					const float* down = row + 1 < rows ? phase.ptr<float>(row + 1) : nullptr;
+					float* dst = rho.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						float divergence = 0;
+						if(col + 1 < cols) divergence += Gradient(current[col + 1], current[col]);
+						if(col > 0) divergence -= Gradient(current[col], current[col - 1]);
+						if(down) divergence += Gradient(down[col], current[col]);
+						if(up) divergence -= Gradient(current[col], up[col]);
+						dst[col] = divergence;
+					}
+				}
+			});
+
+			const cv::Mat solution = SolveNeumannPoisson(rho);
+
+			// Offset aligning the solution with the wrapped phase: circular mean
+			// of their difference
+			double re = 0, im = 0;
+			for(int row = 0; row < rows; row++)
+			{
+				const float* psi = phase.ptr<float>(row);
+				const float* phi = solution.ptr<float>(row);
+				for(int col = 0; col < cols; col++)
+				{
+					double angle = 2.0 * CV_PI * (psi[col] - phi[col]);
+					re += std::cos(angle);
+					im += std::sin(angle);
+				}
+			}
+			const float offset = static_cast<float>(std::atan2(im, re) / (2.0 * CV_PI));
+
+			cv::Mat unwrapped{ rows, cols, CV_32FC1 };
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const float* psi = phase.ptr<float>(row);
+					const float* phi = solution.ptr<float>(row);
+					float* dst = unwrapped.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						double smooth = static_cast<double>(phi[col]) + offset;
+						dst[col] = ToRadians(congruent ? psi[col] + std::floor(smooth - psi[col] + 0.5) : smooth);
+					}
+				}
+			});
+
+			return unwrapped;
+		}
+
+		cv::Mat QualityGuided(const cv::Mat & wrapped, const cv::Mat & quality, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[QualityGuided] Invalid wrapped phase image");
+			assert(quality.type() == CV_32FC1 &&
+				   quality.size() == wrapped.size() &&
+				   "[QualityGuided] Invalid quality map");
+
+			if(bitflags)
+			{
+				assert(!bitflags->empty() &&
+					   bitflags->type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+					   bitflags->size() == wrapped.size() &&
+					   "[QualityGuided] Invalid bitflags image");
+			}
+
+			PU_PROFILE_SCOPE("QualityGuided");
+
+			const int rows = wrapped.rows, cols = wrapped.cols;
+			cv::Mat phase = Cycles(wrapped);
+			std::vector<unsigned char> masked = Masked(bitflags, ignore_flag, rows, cols);
+
+			PU_PROFILE_COUNT("QualityGuided", Allocations, 2);
+			const size_t total = static_cast<size_t>(rows) * cols;
+			PU_PROFILE_COUNT("QualityGuided", PixelsProcessed, total);
+
+			auto value = [&](size_t index) { return phase.ptr<float>(index / cols)[index % cols]; };
+
+			// Masked pixels get the lowest priority, they are unwrapped last
+			// (or when the flood has to go through them)
+			auto priority = [&](size_t index) {
+				return masked[index] ? std::numeric_limits<float>::lowest() : quality.ptr<float>(index / cols)[index % cols];
+			};
+
+			// Starts from the best pixel
+			size_t seed = 0;
+			for(size_t index = 0; index < total; index++)
+			{
+				if(priority(index) > priority(seed)) seed = index;
+			}
+
+			std::vector<double> unwrapped(total);
+			std::vector<unsigned char> done(unwrapped.size(), 0);
+			std::priority_queue<std::pair<float, size_t>> queue;
+
+			unwrapped[seed] = value(seed);
+			done[seed] = 1;
+			queue.push({ priority(seed), seed });
+
+			// Pixel is unwrapped from the neighbour which pushed it, that is
+			// the best one among unwrapped neighbours
+			while(!queue.empty())
+			{
+				size_t index = queue.top().second;
+				queue.pop();
+
+				float current = value(index);
+				ForEachNeighbour(index, rows, cols, [&](size_t next) {
+					if(done[next]) return;
+					done[next] = 1;
+					unwrapped[next] = unwrapped[index] + Gradient(value(next), current);
+					queue.push({ priority(next), next });
+				});
+			}
+
+			return ToImage(unwrapped, rows, cols);
+		}
+
+		cv::Mat QualityGuided(const cv::Mat & wrapped, const cv::Mat & quality, const masks::ValidRegion & region)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[QualityGuided] Invalid wrapped phase image");
+			assert(quality.type() == CV_32FC1 &&
+				   quality.size() == wrapped.size() &&
+				   "[QualityGuided] Invalid quality map");
+			assert(region.Size() == wrapped.size() &&
+				   "[QualityGuided] Invalid valid region");
+
+			PU_PROFILE_SCOPE("QualityGuided");
+
+			const int count = region.Count();
+			const std::vector<float> phase = region.GatherPhase(wrapped);
+			const std::vector<float> priority = region.Gather<float>(quality);
+			const std::vector<masks::ValidRegion::Neighbours>& neighbours = region.Neighbourhood();
+
+			PU_PROFILE_COUNT("QualityGuided", Allocations, 4);
+			PU_PROFILE_COUNT("QualityGuided", PixelsProcessed, count);
+			PU_PROFILE_COUNT("QualityGuided", MaskedPixelsSkipped, static_cast<long long>(wrapped.rows) * wrapped.cols - count);
+
+			// Seeds of the parts in order of decreasing quality, part is
+			// started from the first of its pixels in this order
+			std::vector<int> order(count);
+			for(int i = 0; i < count; i++) order[i] = i;
+			std::sort(order.begin(), order.end(), [&](int a, int b) { return priority[a] > priority[b]; });
+
+			std::vector<double> unwrapped(count);
+			std::vector<unsigned char> done(count, 0);
+			std::priority_queue<std::pair<float, int>> queue;
+
+			for(int seed : order)
+			{
+				if(done[seed]) continue;
+
+				unwrapped[seed] = phase[seed];
+				done[seed] = 1;
+				queue.push({ priority[seed], seed });
+
+				while(!queue.empty())
+				{
+					int index = queue.top().second;
+					queue.pop();
+
+					const masks::ValidRegion::Neighbours& nb = neighbours[index];
+					for(int next : { nb.left, nb.right, nb.up, nb.down })
+					{
+						if(next < 0 || done[next]) continue;
+						done[next] = 1;
+						unwrapped[next] = unwrapped[index] + Gradient(phase[next], phase[index]);
+						queue.push({ priority[next], next });
+					}
+				}
+			}
+
+			std::vector<float> radians(count);
+			for(int i = 0; i < count; i++)
+			{
+				radians[i] = ToRadians(unwrapped[i]);
+			}
+			return region.Scatter(radians, 0.0f);
+		}
+
+		namespace
+		{
+			/// <summary>
+			/// Pixel state of multi-seed flood: region id + 1 (0 = not
+			/// reached yet) in high half, wrap count in the region's own frame
+			/// in low half. Union-find nodes use the same packing: parent id
+			/// and count offset from the region frame to the parent frame.
+			/// </summary>
+			inline long long Pack(int id, int count)
+			{
+				return static_cast<long long>(static_cast<unsigned long long>(static_cast<unsigned>(id)) << 32 |
+											  static_cast<unsigned>(count));
+			}
+
+			inline int High(long long packed) { return static_cast<int>(static_cast<unsigned long long>(packed) >> 32); }
+			inline int Low(long long packed) { return static_cast<int>(static_cast<unsigned>(packed)); }
+
+			/// <summary>
+			/// Union-find of regions with relative wrap counts: node is parent
+			/// id and offset which converts counts of the region to counts of
+			/// the parent
+			/// </summary>
+			class RegionForest
+			{
+			public:
+				explicit RegionForest(int regions) : parent(regions), offset(regions, 0)
+				{
+					for(int i = 0; i < regions; i++) parent[i] = i;
+				}
+
+				/// <summary>
+				/// Root of region and offset which converts counts of region to
+				/// counts of the root, compresses the path
+				/// </summary>
+				int Find(int region, int& to_root)
+				{
+					if(parent[region] == region)
+					{
+						to_root = 0;
+						return region;
+					}
+
+					int above;
+					int root = Find(parent[region], above);
+					offset[region] += above;
+					parent[region] = root;
+					to_root = offset[region];
+					return root;
+				}
+
+				/// <summary>
+				/// Merges regions given that count c in frame of b equals
+				/// c + shift in frame of a. Returns false when they were already
+				/// merged with different offset (loop around a residue).
+				/// </summary>
+				bool Union(int a, int b, int shift)
+				{
+					int oa, ob;
+					int ra = Find(a, oa), rb = Find(b, ob);
+
+					// Count in root ra = count in root rb + link
+					int link = shift + oa - ob;
+					if(ra == rb) return link == 0;
+
+					parent[rb] = ra;
+					offset[rb] = link;
+					return true;
+				}
+
+			private:
+				std::vector<int> parent;
+				std::vector<int> offset;
+			};
+
+			/// <summary>
+			/// Edge where floods of two regions met, count c in frame of b is
+			/// c + shift in frame of a
+			/// </summary>
+			struct Contact
+			{
+				int bucket;
+				int a;
+				int b;
+				int shift;
+			};
+
+			/// <summary>
+			/// Max priority queue of pixels with quality quantized to buckets,
+			/// push and pop are O(1) amortized
+			/// </summary>
+			class BucketQueue
+			{
+			public:
+				explicit BucketQueue(int buckets) : buckets(buckets) {}
+
+				void Push(int bucket, size_t index)
+				{
+					buckets[bucket].push_back(index);
+					top = std::max(top, bucket);
+				}
+
+				bool Pop(size_t& index)
+				{
+					while(top >= 0 && buckets[top].empty()) top--;
+					if(top < 0) return false;
+					index = buckets[top].back();
+					buckets[top].pop_back();
+					return true;
+				}
+
+			private:
+				std::vector<std::vector<size_t>> buckets;
+				int top = -1;
+			};
+		}
+
+		UnwrappedPhase MultiSeedQualityGuidedCounts(const cv::Mat & wrapped, const cv::Mat & quality, cv::Mat * bitflags, Bitflag ignore_flag, int seeds)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[MultiSeedQualityGuided] Invalid wrapped phase image");
+			assert(quality.type() == CV_32FC1 &&
+				   quality.size() == wrapped.size() &&
+				   "[MultiSeedQualityGuided] Invalid quality map");
+
+			if(bitflags)
+			{
+				assert(!bitflags->empty() &&
+					   bitflags->type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+					   bitflags->size() == wrapped.size() &&
+					   "[MultiSeedQualityGuided] Invalid bitflags image");
+			}
+
+			PU_PROFILE_SCOPE("MultiSeedQualityGuided");
+
+			const int rows = wrapped.rows, cols = wrapped.cols;
+			const size_t total = static_cast<size_t>(rows) * cols;
+			const cv::Mat phase = Cycles(wrapped);
+			const std::vector<unsigned char> masked = Masked(bitflags, ignore_flag, rows, cols);
+			const int threads = parallel::ThreadCount();
+
+			// Quality is quantized to buckets over its range, masked pixels
+			// get bucket 0 (unwrapped last, as in QualityGuided)
+			const int BUCKETS = 1024;
+			float low = std::numeric_limits<float>::max(), high = std::numeric_limits<float>::lowest();
+			for(int row = 0; row < rows; row++)
+			{
+				const float* q = quality.ptr<float>(row);
+				for(int col = 0; col < cols; col++)
+				{
+					if(masked[static_cast<size_t>(row) * cols + col]) continue;
+					low = std::min(low, q[col]);
+					high = std::max(high, q[col]);
+				}
+			}
+			const float scale = high > low ? (BUCKETS - 2) / (high - low) : 0.0f;
+			auto bucket = [&](size_t index) {
+				if(masked[index]) return 0;
+				return 1 + static_cast<int>((quality.ptr<float>(index / cols)[index % cols] - low) * scale);
+			};
+
+			// Seeds are the best pixels of cells of a regular grid, so that
+			// regions start spread over the frame
+			if(seeds <= 0) seeds = threads * 4;
+			const int across = std::max(1, std::min(cols, static_cast<int>(std::ceil(std::sqrt(seeds * static_cast<double>(cols) / rows))))),
+				down = std::max(1, std::min(rows, (seeds + across - 1) / across));
+			std::vector<size_t> seed_pixels;
+			for(int cell = 0; cell < across * down; cell++)
+			{
+				const int r0 = rows * (cell / across) / down, r1 = rows * (cell / across + 1) / down;
+				const int c0 = cols * (cell % across) / across, c1 = cols * (cell % across + 1) / across;
+				size_t best = 0;
+				bool found = false;
+				float best_quality = std::numeric_limits<float>::lowest();
+				for(int row = r0; row < r1; row++)
+				{
+					for(int col = c0; col < c1; col++)
+					{
+						const size_t index = static_cast<size_t>(row) * cols + col;
+						if(!masked[index] && (!found || quality.at<float>(row, col) > best_quality))
+						{
+							best = index;
+							best_quality = quality.at<float>(row, col);
+							found = true;
+						}
+					}
+				}
+				if(found) seed_pixels.push_back(best);
+			}
+			if(seed_pixels.empty()) seed_pixels.push_back(0);
+
+			const int regions = static_cast<int>(seed_pixels.size());
+
+			std::unique_ptr<std::atomic<long long>[]> state(new std::atomic<long long>[total]);
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(size_t i = static_cast<size_t>(range.start) * cols; i < static_cast<size_t>(range.end) * cols; i++)
+				{
+					state[i].store(0, std::memory_order_relaxed);
+				}
+			});
+			for(int region = 0; region < regions; region++)
+			{
+				state[seed_pixels[region]].store(Pack(region + 1, 0));
+			}
+
+			PU_PROFILE_COUNT("MultiSeedQualityGuided", Allocations, 3);
+			PU_PROFILE_COUNT("MultiSeedQualityGuided", PixelsProcessed, total);
+
+			auto value = [&](size_t index) { return phase.ptr<float>(index / cols)[index % cols]; };
+
+			// Each thread floods from its own seeds with its own queue. A
+			// pixel belongs to the region which claims it first (CAS from 0),
+			// edges where the flood reaches a pixel of another region are
+			// kept with the quality of the worse of the two pixels.
+			std::vector<std::vector<Contact>> contacts(threads);
+			parallel::Run(threads, [&](int thread) {
+				BucketQueue queue{ BUCKETS };
+				for(int region = thread; region < regions; region += threads)
+				{
+					queue.Push(bucket(seed_pixels[region]), seed_pixels[region]);
+				}
+
+				std::vector<Contact>& met = contacts[thread];
+				size_t index;
+				while(queue.Pop(index))
+				{
+					const long long own = state[index].load();
+					const int region = High(own) - 1, count = Low(own);
+					const float current = value(index);
+
+					ForEachNeighbour(index, rows, cols, [&](size_t next) {
+						const int next_count = count + Jump(value(next), current);
+						long long expected = 0;
+						if(state[next].compare_exchange_strong(expected, Pack(region + 1, next_count)))
+						{
+							queue.Push(bucket(next), next);
+						}
+						else if(High(expected) - 1 != region)
+						{
+							met.push_back({ std::min(bucket(index), bucket(next)), region, High(expected) - 1, next_count - Low(expected) });
+						}
+					});
+				}
+			});
+
+			// Regions are merged through their best edges first (maximum
+			// spanning tree of region graph), the same preference for good
+			// pixels as the floods have. Offset over a worse edge which does
+			// not agree marks a loop around residues.
+			std::vector<Contact> edges;
+			for(const std::vector<Contact>& met : contacts)
+			{
+				edges.insert(edges.end(), met.begin(), met.end());
+			}
+			std::sort(edges.begin(), edges.end(), [](const Contact& x, const Contact& y) {
+				return std::tie(y.bucket, x.a, x.b, x.shift) < std::tie(x.bucket, y.a, y.b, y.shift);
+			});
+
+			RegionForest forest{ regions };
+			long long loops = 0;
+			for(const Contact& edge : edges)
+			{
+				loops += !forest.Union(edge.a, edge.b, edge.shift);
+			}
+			PU_PROFILE_COUNT("MultiSeedQualityGuided", ResiduesFound, loops);
+
+			// Counts of all regions converted to the frame of their root
+			std::vector<int> offsets(regions);
+			for(int region = 0; region < regions; region++)
+			{
+				forest.Find(region, offsets[region]);
+			}
+
+			cv::Mat wraps{ rows, cols, CV_32SC1 };
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					int* dst = wraps.ptr<int>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						const long long packed = state[static_cast<size_t>(row) * cols + col].load(std::memory_order_relaxed);
+						dst[col] = Low(packed) + offsets[High(packed) - 1];
+					}
+				}
+			});
+
+			return UnwrappedPhase(wraps, phase);
+		}
+
+		cv::Mat MultiSeedQualityGuided(const cv::Mat & wrapped, const cv::Mat & quality, cv::Mat * bitflags, Bitflag ignore_flag, int seeds)
+		{
+			return MultiSeedQualityGuidedCounts(wrapped, quality, bitflags, ignore_flag, seeds).ToFloat();
+		}
+
+		cv::Mat BranchCut(const cv::Mat & wrapped, int max_box, cv::Mat * bitflags, Bitflag ignore_flag)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[BranchCut] Invalid wrapped phase image");
+			assert(max_box >= 3 && "[BranchCut] Box must be at least 3");
+
+			if(bitflags)
+			{
+				assert(!bitflags->empty() &&
+					   bitflags->type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+					   bitflags->size() == wrapped.size() &&
+					   "[BranchCut] Invalid bitflags image");
+			}
+
+			PU_PROFILE_SCOPE("BranchCut");
+
+			const int rows = wrapped.rows, cols = wrapped.cols;
+			cv::Mat phase = Cycles(wrapped);
+			std::vector<unsigned char> cut = PlaceCuts(masks::Residues(wrapped), Masked(bitflags, ignore_flag, rows, cols), max_box);
+
+			PU_PROFILE_COUNT("BranchCut", Allocations, 2);
+			PU_PROFILE_COUNT("BranchCut", PixelsProcessed, cut.size());
+
+			auto value = [&](size_t index) { return phase.ptr<float>(index / cols)[index % cols]; };
+
+			// Start at the centre, or at the first pixel off the cuts if the
+			// centre is cut
+			size_t seed = static_cast<size_t>(rows / 2) * cols + cols / 2;
+			if(cut[seed])
+			{
+				auto uncut = std::find(cut.begin(), cut.end(), 0);
+				if(uncut != cut.end()) seed = static_cast<size_t>(uncut - cut.begin());
+			}
+
+			std::vector<double> unwrapped(cut.size());
+			std::vector<unsigned char> done(cut.size(), 0);
+
+			// Flood fill does not cross the cuts, cut pixels are deferred until
+			// nothing else is reachable and then unwrapped from any neighbour,
+			// which also reaches regions enclosed by cuts
+			std::vector<size_t> queue, deferred;
+			size_t head = 0;
+
+			auto visit = [&](size_t from, size_t next) {
+				if(done[next]) return;
+				done[next] = 1;
+				unwrapped[next] = unwrapped[from] + Gradient(value(next), value(from));
+				(cut[next] ? deferred : queue).push_back(next);
+			};
+
+			unwrapped[seed] = value(seed);
+			done[seed] = 1;
+			(cut[seed] ? deferred : queue).push_back(seed);
+
+			while(head < queue.size() || !deferred.empty())
+			{
+				size_t index;
+				if(head < queue.size())
+				{
+					index = queue[head++];
+				}
+				else
+				{
+					queue.clear();
+					head = 0;
+					index = deferred.back();
+					deferred.pop_back();
+				}
+
+				ForEachNeighbour(index, rows, cols, [&](size_t next) { visit(index, next); });
+			}
+
+			return ToImage(unwrapped, rows, cols);
+		}
+
+		namespace
+		{
+			/// <summary>
+			/// Pyramid level: cos and sin of the phase summed over 2x2 blocks
+			/// of the finer level (unnormalized, only their angle is used)
+			/// </summary>
+			struct PhasorLevel
+			{
+				cv::Mat cos_plane;
+				cv::Mat sin_plane;
+			};
+
+			/// <summary>
+			/// First level summed straight from wrapped phase, so that full
+			/// resolution cos/sin planes are never stored
+			/// </summary>
+			PhasorLevel Downsample(const cv::Mat& wrapped)
+			{
+				const int rows = (wrapped.rows + 1) / 2, cols = (wrapped.cols + 1) / 2;
+				PhasorLevel level{ parallel::Allocate(rows, cols, CV_32FC1), parallel::Allocate(rows, cols, CV_32FC1) };
+
+				const bool fixed = wrapped.type() == CV_16UC1;
+				const PhaseLut* lut = fixed ? &GetPhaseLut(FIXED16_LEVELS) : nullptr;
+
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						float* c = level.cos_plane.ptr<float>(row);
+						float* s = level.sin_plane.ptr<float>(row);
+						for(int r = 2 * row; r < std::min(2 * row + 2, wrapped.rows); r++)
+						{
+							if(fixed)
+							{
+								// Fixed point value is the table index
+								const unsigned short* src = wrapped.ptr<unsigned short>(r);
+								for(int col = 0; col < wrapped.cols; col++)
+								{
+									c[col / 2] += lut->CosTable()[src[col]];
+									s[col / 2] += lut->SinTable()[src[col]];
+								}
+							}
+							else
+							{
+								const float* src = wrapped.ptr<float>(r);
+								for(int col = 0; col < wrapped.cols; col++)
+								{
+									float phase = src[col] * static_cast<float>(CV_PI * 2.0);
+									c[col / 2] += std::cos(phase);
+									s[col / 2] += std::sin(phase);
+								}
+							}
+						}
+					}
+				});
+
+				return level;
+			}
+
+			PhasorLevel Downsample(const PhasorLevel& finer)
+			{
+				const int rows = (finer.cos_plane.rows + 1) / 2, cols = (finer.cos_plane.cols + 1) / 2;
+				PhasorLevel level{ parallel::Allocate(rows, cols, CV_32FC1), parallel::Allocate(rows, cols, CV_32FC1) };
+
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						float* c = level.cos_plane.ptr<float>(row);
+						float* s = level.sin_plane.ptr<float>(row);
+						for(int r = 2 * row; r < std::min(2 * row + 2, finer.cos_plane.rows); r++)
+						{
+							const float* src_c = finer.cos_plane.ptr<float>(r);
+							const float* src_s = finer.sin_plane.ptr<float>(r);
+							for(int col = 0; col < finer.cos_plane.cols; col++)
+							{
+								c[col / 2] += src_c[col];
+								s[col / 2] += src_s[col];
+							}
+						}
+					}
+				});
+
+				return level;
+			}
+
+			/// <summary>
+			/// Wrapped phase of the level in cycles, range [0, 1)
+			/// </summary>
+			cv::Mat LevelPhase(const PhasorLevel& level)
+			{
+				cv::Mat phase = parallel::Allocate(level.cos_plane.rows, level.cos_plane.cols, CV_32FC1);
+				parallel::ForRows(cv::Range(0, phase.rows), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						const float* c = level.cos_plane.ptr<float>(row);
+						const float* s = level.sin_plane.ptr<float>(row);
+						float* dst = phase.ptr<float>(row);
+						for(int col = 0; col < phase.cols; col++)
+						{
+							float cycles = std::atan2(s[col], c[col]) / static_cast<float>(CV_PI * 2.0);
+							dst[col] = cycles < 0.0f ? cycles + 1.0f : cycles;
+						}
+					}
+				});
+				return phase;
+			}
+
+			int LevelCount(cv::Size size, const PyramidOptions& options)
+			{
+				if(options.levels > 0)
+				{
+					return options.levels;
+				}
+
+				int levels = 0;
+				for(int side = std::min(size.width, size.height); side > std::max(options.coarse_size, 1); side = (side + 1) / 2)
+				{
+					levels++;
+				}
+				return levels;
+			}
+
+			/// <summary>
+			/// Levels 1 to levels (level 0 is the wrapped phase itself)
+			/// </summary>
+			std::vector<PhasorLevel> BuildPyramid(const cv::Mat& wrapped, int levels)
+			{
+				std::vector<PhasorLevel> pyramid;
+				pyramid.reserve(levels);
+				pyramid.push_back(Downsample(wrapped));
+				while(static_cast<int>(pyramid.size()) < levels)
+				{
+					pyramid.push_back(Downsample(pyramid.back()));
+				}
+				return pyramid;
+			}
+
+			/// <summary>
+			/// Unwraps phase (cycles) of the coarsest level, result in cycles
+			/// </summary>
+			cv::Mat UnwrapCoarse(const cv::Mat& phase, Method method)
+			{
+				cv::Mat radians;
+				switch(method)
+				{
+				case Method::Itoh: radians = Itoh(phase); break;
+				case Method::LeastSquares: radians = LeastSquares(phase); break;
+				case Method::QualityGuided: radians = QualityGuided(phase, quality_maps::PDV(phase, 3)); break;
+				default: radians = BranchCut(phase); break;
+				}
+
+				cv::Mat cycles;
+				radians.convertTo(cycles, CV_32FC1, 1.0 / (2.0 * CV_PI), 0.5);
+				return cycles;
+			}
+
+			/// <summary>
+			/// Bilinear upsampling with aligned pixel centers (finer pixel row
+			/// r lies at coarser row r / 2 - 1/4), clamped at the edges
+			/// </summary>
+			cv::Mat Upsample(const cv::Mat& coarse, cv::Size size)
+			{
+				cv::Mat fine = parallel::Allocate(size.height, size.width, CV_32FC1);
+
+				// Column positions are the same for all rows
+				std::vector<int> left(size.width), right(size.width);
+				std::vector<float> weight(size.width);
+				for(int col = 0; col < size.width; col++)
+				{
+					float x = std::min(std::max(col * 0.5f - 0.25f, 0.0f), static_cast<float>(coarse.cols - 1));
+					left[col] = static_cast<int>(x);
+					right[col] = std::min(left[col] + 1, coarse.cols - 1);
+					weight[col] = x - left[col];
+				}
+
+				parallel::ForRows(cv::Range(0, size.height), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						float y = std::min(std::max(row * 0.5f - 0.25f, 0.0f), static_cast<float>(coarse.rows - 1));
+						int top = static_cast<int>(y);
+						float wy = y - top;
+						const float* a = coarse.ptr<float>(top);
+						const float* b = coarse.ptr<float>(std::min(top + 1, coarse.rows - 1));
+						float* dst = fine.ptr<float>(row);
+						for(int col = 0; col < size.width; col++)
+						{
+							float upper = a[left[col]] + (a[right[col]] - a[left[col]]) * weight[col];
+							float lower = b[left[col]] + (b[right[col]] - b[left[col]]) * weight[col];
+							dst[col] = upper + (lower - upper) * wy;
+						}
+					}
+				});
+
+				return fine;
+			}
+
+			/// <summary>
+			/// Unwrapped phase (cycles) of the level: wrapped phase plus whole
+			/// cycles closest to the guide. Pixels which are further than a
+			/// quarter of cycle from the guide are uncertain, each refinement
+			/// pass resolves them again against the mean of estimates from
+			/// their certain neighbours (neighbour plus wrapped gradient).
+			/// </summary>
+			cv::Mat Resolve(const cv::Mat& phase, const cv::Mat& guide, int passes)
+			{
+				const int rows = phase.rows, cols = phase.cols;
+				const float uncertain = 0.25f;
+
+				cv::Mat unwrapped = parallel::Allocate(rows, cols, CV_32FC1);
+				cv::Mat distance = parallel::Allocate(rows, cols, CV_32FC1);
+				std::atomic<int> pending{ 0 };
+
+				parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+					int count = 0;
+					for(int row = range.start; row < range.end; row++)
+					{
+						const float* w = phase.ptr<float>(row);
+						const float* g = guide.ptr<float>(row);
+						float* u = unwrapped.ptr<float>(row);
+						float* d = distance.ptr<float>(row);
+						for(int col = 0; col < cols; col++)
+						{
+							u[col] = w[col] + std::floor(g[col] - w[col] + 0.5f);
+							d[col] = std::abs(g[col] - u[col]);
+							count += d[col] > uncertain;
+						}
+					}
+					pending += count;
+				});
+
+				for(int pass = 0; pass < passes && pending > 0; pass++)
+				{
+					// Reads previous pass only, rows are independent
+					cv::Mat next_unwrapped = unwrapped.clone();
+					cv::Mat next_distance = distance.clone();
+					pending = 0;
+
+					parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+						int count = 0;
+						for(int row = range.start; row < range.end; row++)
+						{
+							const float* w = phase.ptr<float>(row);
+							const float* d = distance.ptr<float>(row);
+							for(int col = 0; col < cols; col++)
+							{
+								if(d[col] <= uncertain) continue;
+
+								float sum = 0;
+								int n = 0;
+								auto estimate = [&](int r, int c) {
+									if(r < 0 || c < 0 || r >= rows || c >= cols || distance.at<float>(r, c) > uncertain) return;
+									sum += unwrapped.at<float>(r, c) + Gradient(w[col], phase.at<float>(r, c));
+									n++;
+								};
+								estimate(row - 1, col);
+								estimate(row + 1, col);
+								estimate(row, col - 1);
+								estimate(row, col + 1);
+
+								if(n == 0)
+								{
+									count++;
+									continue;
+								}
+
+								float mean = sum / n;
+								float u = w[col] + std::floor(mean - w[col] + 0.5f);
+								next_unwrapped.at<float>(row, col) = u;
+								next_distance.at<float>(row, col) = std::abs(mean - u);
+								count += std::abs(mean - u) > uncertain;
+							}
+						}
+						pending += count;
+					});
+
+					unwrapped = next_unwrapped;
+					distance = next_distance;
+				}
+
+				return unwrapped;
+			}
+		}
+
+		cv::Mat Pyramid(const cv::Mat & wrapped, const PyramidOptions & options)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[Pyramid] Invalid wrapped phase image");
+
+			PU_PROFILE_SCOPE("Pyramid");
+
+			const int levels = LevelCount(wrapped.size(), options);
+			if(levels == 0)
+			{
+				return UnwrapCoarse(Cycles(wrapped), options.coarse_method) * (2.0 * CV_PI) - CV_PI;
+			}
+
+			std::vector<PhasorLevel> pyramid = BuildPyramid(wrapped, levels);
+			cv::Mat unwrapped = UnwrapCoarse(LevelPhase(pyramid.back()), options.coarse_method);
+
+			for(int level = levels - 1; level >= 0; level--)
+			{
+				cv::Mat phase = level > 0 ? LevelPhase(pyramid[level - 1]) : Cycles(wrapped);
+				unwrapped = Resolve(phase, Upsample(unwrapped, phase.size()), options.refine_passes);
+			}
+
+			PU_PROFILE_COUNT("Pyramid", PixelsProcessed, static_cast<long long>(wrapped.total()));
+
+			cv::Mat radians;
+			unwrapped.convertTo(radians, CV_32FC1, 2.0 * CV_PI, -CV_PI);
+			return radians;
+		}
+
+		cv::Mat PyramidPreview(const cv::Mat & wrapped, const PyramidOptions & options)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[PyramidPreview] Invalid wrapped phase image");
+
+			PU_PROFILE_SCOPE("PyramidPreview");
+
+			const int levels = LevelCount(wrapped.size(), options);
+			cv::Mat phase = levels > 0 ? LevelPhase(BuildPyramid(wrapped, levels).back()) : Cycles(wrapped);
+
+			cv::Mat radians;
+			UnwrapCoarse(phase, options.coarse_method).convertTo(radians, CV_32FC1, 2.0 * CV_PI, -CV_PI);
+			return radians;
+		}
+
+		cv::Mat Auto(const cv::Mat & wrapped, cv::Mat * bitflags, Bitflag ignore_flag, const AutoOptions & options, AutoDecision * decision)
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[Auto] Invalid wrapped phase image");
+
+			PU_PROFILE_SCOPE("Auto");
+
+			const int64_t start = cv::getTickCount();
+			const double total = static_cast<double>(wrapped.total());
+
+			AutoDecision result;
+			result.residues = cv::countNonZero(masks::Residues(wrapped));
+			result.residue_density = result.residues / total;
+
+			if(bitflags)
+			{
+				std::vector<unsigned char> masked = Masked(bitflags, ignore_flag, wrapped.rows, wrapped.cols);
+				result.masked_fraction = std::count(masked.begin(), masked.end(), 1) / total;
+			}
+
+			// Residue free phase integrates to the same result along any path,
+			// so the cheapest one is exact; otherwise the quality map used for
+			// statistics is reused by quality guided unwrapping
+			cv::Mat quality;
+			if(result.residues == 0 && result.masked_fraction == 0)
+			{
+				result.method = Method::Itoh;
+			}
+			else
+			{
+				quality = quality_maps::PDV(wrapped, 3, bitflags, ignore_flag);
+				result.mean_pdv = -cv::mean(quality)[0];
+
+				if(result.masked_fraction == 0 &&
+				   result.residue_density <= options.clean_density &&
+				   result.mean_pdv <= options.clean_pdv)
+				{
+					result.method = Method::LeastSquares;
+				}
+				else if(result.residue_density <= options.moderate_density)
+				{
+					result.method = Method::QualityGuided;
+				}
+				else
+				{
+					result.method = Method::BranchCut;
+				}
+			}
+
+			result.analysis_seconds = static_cast<double>(cv::getTickCount() - start) / cv::getTickFrequency();
+
+			if(options.log)
+			{
+				char line[256];
+				std::snprintf(line, sizeof(line), "[Auto] %s: %d residues (density %.2e), mean PDV %.2e, masked %.1f%%, analysis %.2f ms\n",
+							  MethodName(result.method), result.residues, result.residue_density,
+							  result.mean_pdv, result.masked_fraction * 100.0, result.analysis_seconds * 1e3);
+				std::clog << line;
+			}
+
+			if(decision)
+			{
+				*decision = result;
+			}
+
+			switch(result.method)
+			{
+			case Method::Itoh: return Itoh(wrapped);
+			case Method::LeastSquares: return LeastSquares(wrapped);
+			case Method::QualityGuided: return QualityGuided(wrapped, quality, bitflags, ignore_flag);
+			default: return BranchCut(wrapped, 65, bitflags, ignore_flag);
+			}
+		}
+
+		const char* MethodName(Method method)
+		{
+			switch(method)
+			{
+			case Method::Itoh: return "Itoh";
+			case Method::LeastSquares: return "LeastSquares";
+			case Method::QualityGuided: return "QualityGuided";
+			default: return "BranchCut";
+			}
+		}
+	}
+}
@@ -0,0 +1,365 @@
+#pragma once
+#include "Bitflags.h"
+#include "UnwrappedPhase.h"
+#include "ValidRegion.h"
+#include <opencv2/opencv.hpp>
+
+namespace pu
+{
+	namespace unwrappers
+	{
+		/// <summary>
+		/// Unwraps phase by integrating wrapped gradients along a fixed path
+		/// (Itoh): first column top to bottom, then each row left to right.
+		/// Fast and exact for clean phase, but any residue or noise spike
+		/// corrupts the rest of the path.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, 1 channel, floating point, range [0, 1],
+		/// or 16-bit fixed point (CV_16UC1).
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point, same size
+		/// as wrapped phase. Wrapping the result gives back input phase
+		/// (scaled as in WrapNormalized), i.e. it differs from the original
+		/// phase by multiple of 2PI.
+		/// </returns>
+		cv::Mat Itoh(const cv::Mat& wrapped);
+
+		/// <summary>
+		/// Itoh unwrapping in extended range: integrates whole cycle jumps
+		/// between neighbours (-1, 0 or +1) as integers, so the result keeps
+		/// full precision of wrapped phase at any magnitude and the inner loop
+		/// only compares and adds small integers. Same result as Itoh.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see Itoh.
+		/// </param>
+		/// <param name="depth">
+		/// [default = CV_32S] Type of wrap counts, CV_16S (saturated at
+		/// +-32767 cycles) or CV_32S.
+		/// </param>
+		/// <returns>
+		/// Wrap counts with wrapped phase.
+		/// </returns>
+		UnwrappedPhase ItohCounts(const cv::Mat& wrapped, int depth = CV_32S);
+
+		/// <summary>
+		/// Converts result of any unwrapper to extended range: wrap count is
+		/// the whole number of cycles between unwrapped and wrapped phase.
+		/// Float error of unwrapped phase is far below half cycle (up to
+		/// millions of radians), so counts are exact and precision lost by
+		/// float unwrapped phase is restored from wrapped phase. Results
+		/// which are not congruent (LeastSquares with congruent = false)
+		/// become congruent.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase given to the unwrapper.
+		/// </param>
+		/// <param name="unwrapped">
+		/// Unwrapped phase in radians, 1 channel, floating point, same size.
+		/// </param>
+		/// <param name="depth">
+		/// [default = CV_32S] Type of wrap counts, CV_16S (saturated at
+		/// +-32767 cycles) or CV_32S.
+		/// </param>
+		UnwrappedPhase WrapCounts(const cv::Mat& wrapped, const cv::Mat& unwrapped, int depth = CV_32S);
+
+		/// <summary>
+		/// Unweighted least squares unwrapping (Ghiglia, Romero): solves Poisson
+		/// equation with Neumann boundary whose right side is the divergence of
+		/// wrapped gradients. Cost does not depend on noise. Even sizes are
+		/// solved with DCT, odd ones (which cv::dct does not take) with DFT of
+		/// the mirrored extension, both exactly at the image size.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, 1 channel, floating point, range [0, 1],
+		/// or 16-bit fixed point (CV_16UC1).
+		/// </param>
+		/// <param name="congruent">
+		/// [default = true] Whether to make the solution congruent with the
+		/// wrapped phase (add whole number of cycles to wrapped phase so it is
+		/// closest to the smooth solution), exact for residue free phase.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point.
+		/// </returns>
+		cv::Mat LeastSquares(const cv::Mat& wrapped, bool congruent = true);
+
+		/// <summary>
+		/// Quality guided flood fill unwrapping: pixels are unwrapped in
+		/// order of decreasing quality, starting from the best one, so errors
+		/// are confined to low quality regions.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="quality">
+		/// Quality map, 1 channel, floating point, same size, higher is
+		/// better (e.g. quality_maps::PDV).
+		/// </param>
+		/// <param name="bitflags">
+		/// [default = nullptr] Optional bitflags image, same size.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [default = NoFlag] Pixels with these flags are unwrapped last, from
+		/// already unwrapped neighbours.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point.
+		/// </returns>
+		cv::Mat QualityGuided(const cv::Mat& wrapped, const cv::Mat& quality, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Quality guided unwrapping of valid region only, see QualityGuided.
+		/// Flood goes through packed neighbours of valid pixels, so the cost
+		/// scales with the region area. Each 4-connected part of the region
+		/// starts from its own best pixel (parts are not related, each has
+		/// its own offset of whole cycles).
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="quality">
+		/// Quality map, 1 channel, floating point, same size, higher is
+		/// better (e.g. quality_maps::ComputeMaps over the region).
+		/// </param>
+		/// <param name="region">
+		/// Valid region, same size.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point, 0 outside
+		/// of the region.
+		/// </returns>
+		cv::Mat QualityGuided(const cv::Mat& wrapped, const cv::Mat& quality, const masks::ValidRegion& region);
+
+		/// <summary>
+		/// Quality guided unwrapping grown from many seeds at once, one
+		/// flood per thread on the shared frame (no tiles, so no seams).
+		/// Seeds are the best pixels of cells of a regular grid, every
+		/// thread floods its seeds in order of decreasing quality from its
+		/// own bucket queue (quality quantized to 1024 levels). Pixels are
+		/// claimed by an atomic compare-and-swap of their packed region and
+		/// wrap count, so threads never lock. Edges where floods of two
+		/// regions meet give their relative offset of whole cycles, regions
+		/// are then merged in a union-find through their best edges first
+		/// (worse edges which disagree go around residues). For residue free
+		/// phase the result equals QualityGuided up to whole cycles, for
+		/// noisy phase the partition into regions (and so the result in noisy
+		/// areas) may differ between runs.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="quality">
+		/// Quality map, 1 channel, floating point, same size, higher is
+		/// better.
+		/// </param>
+		/// <param name="bitflags">
+		/// [default = nullptr] Optional bitflags image, same size.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [default = NoFlag] Pixels with these flags are unwrapped last.
+		/// </param>
+		/// <param name="seeds">
+		/// [default = 0] Number of seeds, 0 = four per thread.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point.
+		/// </returns>
+		cv::Mat MultiSeedQualityGuided(const cv::Mat& wrapped, const cv::Mat& quality, cv::Mat* bitflags = nullptr,
+									   Bitflag ignore_flag = Bitflag::NoFlag, int seeds = 0);
+
+		/// <summary>
+		/// MultiSeedQualityGuided in extended range, wrap counts are what
+		/// the floods compute, see UnwrappedPhase.
+		/// </summary>
+		UnwrappedPhase MultiSeedQualityGuidedCounts(const cv::Mat& wrapped, const cv::Mat& quality, cv::Mat* bitflags = nullptr,
+													Bitflag ignore_flag = Bitflag::NoFlag, int seeds = 0);
+
+		/// <summary>
+		/// Goldstein branch cut unwrapping: residues are connected with cuts
+		/// into charge balanced trees (or to the image border) using growing
+		/// boxes, then phase is flood filled without crossing the cuts. Robust
+		/// for heavy noise, cut pixels are unwrapped last from neighbours.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="max_box">
+		/// [default = 65] Largest box (side) searched for balancing residues,
+		/// trees still unbalanced are connected to the border.
+		/// </param>
+		/// <param name="bitflags">
+		/// [default = nullptr] Optional bitflags image, same size.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [default = NoFlag] Pixels with these flags are treated as cuts.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point.
+		/// </returns>
+		cv::Mat BranchCut(const cv::Mat& wrapped, int max_box = 65, cv::Mat* bitflags = nullptr, Bitflag ignore_flag = Bitflag::NoFlag);
+
+		/// <summary>
+		/// Unwrapper chosen by Auto
+		/// </summary>
+		enum class Method
+		{
+			Itoh,
+			LeastSquares,
+			QualityGuided,
+			BranchCut
+		};
+
+		/// <summary>
+		/// Thresholds used by Auto
+		/// </summary>
+		struct AutoOptions
+		{
+			/// <summary>
+			/// Largest residue density (residues per pixel) considered clean,
+			/// least squares is used up to it
+			/// </summary>
+			double clean_density = 1e-4;
+
+			/// <summary>
+			/// Largest residue density for quality guided unwrapping, above
+			/// it branch cuts are used
+			/// </summary>
+			double moderate_density = 5e-3;
+
+			/// <summary>
+			/// Largest mean phase derivative variance (in cycles^2, k = 3)
+			/// of frame considered clean
+			/// </summary>
+			double clean_pdv = 2e-3;
+
+			/// <summary>
+			/// Whether to write the decision to std::clog
+			/// </summary>
+			bool log = true;
+		};
+
+		/// <summary>
+		/// Frame statistics and decision made by Auto
+		/// </summary>
+		struct AutoDecision
+		{
+			Method method = Method::Itoh;
+			int residues = 0;
+			double residue_density = 0;
+			double mean_pdv = 0;
+			double masked_fraction = 0;
+
+			/// <summary>
+			/// Time spent on analysis (not unwrapping), in seconds
+			/// </summary>
+			double analysis_seconds = 0;
+		};
+
+		/// <summary>
+		/// Settings of Pyramid and PyramidPreview
+		/// </summary>
+		struct PyramidOptions
+		{
+			/// <summary>
+			/// Number of 2x2 downsampling steps, 0 = as many as needed for the
+			/// smaller side of the coarsest level to be at most coarse_size
+			/// </summary>
+			int levels = 0;
+
+			/// <summary>
+			/// Largest smaller side of the coarsest level when levels = 0
+			/// </summary>
+			int coarse_size = 128;
+
+			/// <summary>
+			/// Unwrapper of the coarsest level (PDV quality for QualityGuided)
+			/// </summary>
+			Method coarse_method = Method::QualityGuided;
+
+			/// <summary>
+			/// Passes per level which re-resolve pixels far from the guide
+			/// (more than a quarter of cycle) from their confident neighbours
+			/// </summary>
+			int refine_passes = 2;
+		};
+
+		/// <summary>
+		/// Coarse to fine unwrapping. Wrapped phase is downsampled in complex
+		/// domain (cos and sin summed over 2x2 blocks, as in MeanPhaseFilter),
+		/// the coarsest level is unwrapped with options.coarse_method and each
+		/// finer level only chooses whole number of cycles per pixel: the one
+		/// closest to bilinearly upsampled coarser result. Besides the small
+		/// coarse unwrap the cost is linear in pixels and fully parallel, so
+		/// it is cheaper than any unwrapper on the full frame. Phase must be
+		/// smooth enough not to alias at the coarsest level (gradients below
+		/// 0.5 / 2^levels cycles per pixel), no mask support.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="options">
+		/// [default = PyramidOptions()] Levels and coarse unwrapper.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point, congruent
+		/// with wrapped phase.
+		/// </returns>
+		cv::Mat Pyramid(const cv::Mat& wrapped, const PyramidOptions& options = PyramidOptions());
+
+		/// <summary>
+		/// Coarsest level of Pyramid only, for previews: downsampling and
+		/// unwrapping of a small image.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="options">
+		/// [default = PyramidOptions()] Levels and coarse unwrapper.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians at the coarsest level (size halved,
+		/// rounded up, per level), 1 channel, floating point.
+		/// </returns>
+		cv::Mat PyramidPreview(const cv::Mat& wrapped, const PyramidOptions& options = PyramidOptions());
+
+		/// <summary>
+		/// Picks the fastest adequate unwrapper from cheap frame statistics:
+		/// residue free unmasked frames are integrated along rows (any path
+		/// gives the same result), clean ones solved with least squares,
+		/// moderately noisy or masked ones quality guided (PDV computed
+		/// for the statistics is reused as quality) and heavily noisy ones
+		/// with branch cuts.
+		/// </summary>
+		/// <param name="wrapped">
+		/// Image with wrapped phase, see LeastSquares.
+		/// </param>
+		/// <param name="bitflags">
+		/// [default = nullptr] Optional bitflags image, same size.
+		/// </param>
+		/// <param name="ignore_flag">
+		/// [default = NoFlag] Flags of masked pixels.
+		/// </param>
+		/// <param name="options">
+		/// [default = AutoOptions()] Decision thresholds.
+		/// </param>
+		/// <param name="decision">
+		/// [default = nullptr] Receives statistics and the decision.
+		/// </param>
+		/// <returns>
+		/// Unwrapped phase in radians, 1 channel, floating point.
+		/// </returns>
+		cv::Mat Auto(const cv::Mat& wrapped,
+					 cv::Mat* bitflags = nullptr,
+					 Bitflag ignore_flag = Bitflag::NoFlag,
+					 const AutoOptions& options = AutoOptions(),
+					 AutoDecision* decision = nullptr);
+
+		/// <summary>
+		/// Name of the method, for logs
+		/// </summary>
+		const char* MethodName(Method method);
+	}
+}
@@ -1,6 +1,6 @@
 #pragma once
 #include <cmath>
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 
 namespace pu
 {
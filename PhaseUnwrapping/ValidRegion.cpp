@@ -0,0 +1,165 @@
+#include "ValidRegion.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "Storage.h"
+
+#include <algorithm>
+
+namespace pu
+{
+	namespace masks
+	{
+		ValidRegion::ValidRegion(cv::Size size)
+			: size(size)
+		{
+			assert(size.width > 0 && size.height > 0 && "[ValidRegion] Invalid size");
+
+			Build(nullptr, Bitflag::NoFlag);
+		}
+
+		ValidRegion::ValidRegion(const cv::Mat & bitflags, Bitflag ignore_flag)
+			: size(bitflags.size())
+		{
+			assert(!bitflags.empty() &&
+				   bitflags.type() == CV_MAKETYPE(cv::DataType<bitflag_type>::type, 1) &&
+				   "[ValidRegion] Invalid bitflags image");
+
+			Build(&bitflags, ignore_flag);
+		}
+
+		double ValidRegion::Fraction() const
+		{
+			return size.area() > 0 ? static_cast<double>(indices.size()) / size.area() : 0.0;
+		}
+
+		void ValidRegion::Build(const cv::Mat* bitflags, Bitflag ignore_flag)
+		{
+			PU_PROFILE_SCOPE("ValidRegion");
+
+			const int rows = size.height, cols = size.width;
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag;
+
+			// Runs of each row are independent, rows are scanned in parallel
+			std::vector<std::vector<Run>> row_lists(rows);
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const bitflag_type* flags = masked ? bitflags->ptr<bitflag_type>(row) : nullptr;
+					auto valid = [&](int col) { return !(flags && (flags[col] & ignore_flag)); };
+
+					int col = 0;
+					while(col < cols)
+					{
+						// Skip masked pixels, then extend the run over valid ones
+						while(col < cols && !valid(col)) col++;
+						if(col == cols) break;
+
+						Run run{ row, col, col, 0 };
+						while(col < cols && valid(col)) col++;
+						run.end = col;
+						row_lists[row].push_back(run);
+					}
+				}
+			});
+
+			// Runs are concatenated in row order, offsets are their packed
+			// indices
+			runs.clear();
+			row_runs.assign(rows + 1, 0);
+			row_first.assign(rows + 1, 0);
+			int count = 0;
+			for(int row = 0; row < rows; row++)
+			{
+				row_runs[row] = static_cast<int>(runs.size());
+				row_first[row] = count;
+				for(Run run : row_lists[row])
+				{
+					run.offset = count;
+					count += run.end - run.begin;
+					runs.push_back(run);
+				}
+				std::vector<Run>().swap(row_lists[row]);
+			}
+			row_runs[rows] = static_cast<int>(runs.size());
+			row_first[rows] = count;
+
+			indices.resize(count);
+			parallel::ForRows(cv::Range(0, static_cast<int>(runs.size())), [&](const cv::Range& range) {
+				for(int r = range.start; r < range.end; r++)
+				{
+					const Run& run = runs[r];
+					for(int c = run.begin; c < run.end; c++)
+					{
+						indices[run.offset + c - run.begin] = run.row * cols + c;
+					}
+				}
+			});
+
+			// Horizontal neighbours are consecutive within runs, vertical ones
+			// are found by binary search in the runs of adjacent rows
+			neighbours.resize(indices.size());
+			parallel::ForRows(cv::Range(0, static_cast<int>(runs.size())), [&](const cv::Range& range) {
+				for(int r = range.start; r < range.end; r++)
+				{
+					const Run& run = runs[r];
+					for(int col = run.begin; col < run.end; col++)
+					{
+						int i = run.offset + col - run.begin;
+						neighbours[i].left = col > run.begin ? i - 1 : -1;
+						neighbours[i].right = col + 1 < run.end ? i + 1 : -1;
+						neighbours[i].up = Find(run.row - 1, col);
+						neighbours[i].down = Find(run.row + 1, col);
+					}
+				}
+			});
+
+			PU_PROFILE_COUNT("ValidRegion", PixelsProcessed, static_cast<long long>(rows) * cols);
+			PU_PROFILE_COUNT("ValidRegion", MaskedPixelsSkipped, static_cast<long long>(rows) * cols - Count());
+		}
+
+		std::vector<float> ValidRegion::GatherPhase(const cv::Mat & wrapped) const
+		{
+			assert(!wrapped.empty() &&
+				   (wrapped.type() == CV_32FC1 || wrapped.type() == CV_16UC1) &&
+				   "[ValidRegion::GatherPhase] Invalid wrapped phase image");
+
+			if(wrapped.type() == CV_32FC1)
+			{
+				return Gather<float>(wrapped);
+			}
+
+			std::vector<unsigned short> fixed = Gather<unsigned short>(wrapped);
+			std::vector<float> phase(fixed.size());
+			for(size_t i = 0; i < fixed.size(); i++)
+			{
+				phase[i] = fixed[i] / FIXED16_ONE;
+			}
+			return phase;
+		}
+
+		cv::Mat ValidRegion::Scatter(const std::vector<float>& values, float background) const
+		{
+			assert(values.size() == indices.size() && "[ValidRegion::Scatter] Invalid number of values");
+
+			cv::Mat image{ size.height, size.width, CV_32FC1, cv::Scalar(background) };
+			parallel::ForRows(cv::Range(0, static_cast<int>(runs.size())), [&](const cv::Range& range) {
+				for(int r = range.start; r < range.end; r++)
+				{
+					const Run& run = runs[r];
+					std::copy(values.begin() + run.offset, values.begin() + run.offset + (run.end - run.begin), image.ptr<float>(run.row) + run.begin);
+				}
+			});
+			return image;
+		}
+
+		cv::Mat ValidRegion::ToMask() const
+		{
+			cv::Mat mask{ size.height, size.width, CV_8UC1, cv::Scalar(0) };
+			for(const Run& run : runs)
+			{
+				std::fill(mask.ptr<unsigned char>(run.row) + run.begin, mask.ptr<unsigned char>(run.row) + run.end, 255);
+			}
+			return mask;
+		}
+	}
+}
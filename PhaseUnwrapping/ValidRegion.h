@@ -0,0 +1,176 @@
+#pragma once
+#include "Bitflags.h"
+#include "Parallel.h"
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace pu
+{
+	namespace masks
+	{
+		/// <summary>
+		/// Compacted valid (not masked) part of the frame: run-length rows,
+		/// packed list of valid pixels in row major order with packed indices
+		/// of their 4-neighbours. Any row segment is located in the packed
+		/// list by binary search over the runs of the row, so memory follows
+		/// the valid region, not the frame. Values of valid pixels are
+		/// kept in packed arrays (see Gather, Scatter), so algorithms iterate
+		/// only valid pixels and their cost scales with the object area, not
+		/// the frame area. Building the region is linear in the frame area,
+		/// the same region is meant to be reused for all frames of a mask.
+		/// </summary>
+		class ValidRegion
+		{
+		public:
+			/// <summary>
+			/// Valid pixels [begin, end) of the row, the first of them is at
+			/// packed index offset
+			/// </summary>
+			struct Run
+			{
+				int row;
+				int begin;
+				int end;
+				int offset;
+			};
+
+			/// <summary>
+			/// Packed indices of 4-neighbours, -1 when not valid (masked or
+			/// outside of the frame)
+			/// </summary>
+			struct Neighbours
+			{
+				int left;
+				int right;
+				int up;
+				int down;
+			};
+
+			ValidRegion() = default;
+
+			/// <summary>
+			/// Whole frame valid
+			/// </summary>
+			explicit ValidRegion(cv::Size size);
+
+			/// <summary>
+			/// Pixels without any of ignore_flag in bitflags are valid.
+			/// </summary>
+			/// <param name="bitflags">
+			/// Bitflags image, 1 channel, bitflag_type pixels.
+			/// </param>
+			/// <param name="ignore_flag">
+			/// Flags of masked pixels.
+			/// </param>
+			ValidRegion(const cv::Mat& bitflags, Bitflag ignore_flag);
+
+			cv::Size Size() const { return size; }
+
+			/// <summary>
+			/// Number of valid pixels
+			/// </summary>
+			int Count() const { return static_cast<int>(indices.size()); }
+
+			bool Empty() const { return indices.empty(); }
+
+			/// <summary>
+			/// Valid part of the frame, range [0, 1]
+			/// </summary>
+			double Fraction() const;
+
+			const std::vector<Run>& Runs() const { return runs; }
+
+			/// <summary>
+			/// Runs of the row are Runs()[RowRuns(row), RowRuns(row + 1))
+			/// </summary>
+			int RowRuns(int row) const { return row_runs[row]; }
+
+			/// <summary>
+			/// Row major indices (row * cols + col) of valid pixels
+			/// </summary>
+			const std::vector<int>& Indices() const { return indices; }
+
+			const std::vector<Neighbours>& Neighbourhood() const { return neighbours; }
+
+			cv::Point Position(int i) const { return cv::Point(indices[i] % size.width, indices[i] / size.width); }
+
+			/// <summary>
+			/// Packed index of the first valid pixel at (row, col) or right of
+			/// it in the same row (the first one of the next row if none), so
+			/// valid pixels of row segment [begin, end) are packed indices
+			/// [Lower(row, begin), Lower(row, end)). Column range [0, cols].
+			/// </summary>
+			int Lower(int row, int col) const
+			{
+				// First run of the row ending right of col
+				const auto first = runs.begin() + row_runs[row], last = runs.begin() + row_runs[row + 1];
+				const auto run = std::upper_bound(first, last, col, [](int c, const Run& r) { return c < r.end; });
+				return run == last ? row_first[row + 1] : run->offset + std::max(0, col - run->begin);
+			}
+
+			bool Contains(int row, int col) const
+			{
+				return row >= 0 && col >= 0 && row < size.height && col < size.width && Lower(row, col + 1) != Lower(row, col);
+			}
+
+			/// <summary>
+			/// Packed index of the pixel, -1 when not valid
+			/// </summary>
+			int Find(int row, int col) const
+			{
+				return Contains(row, col) ? Lower(row, col) : -1;
+			}
+
+			/// <summary>
+			/// Packed values of valid pixels of image of type T.
+			/// </summary>
+			template<typename T>
+			std::vector<T> Gather(const cv::Mat& image) const
+			{
+				assert(image.size() == size && "[ValidRegion::Gather] Invalid image size");
+
+				std::vector<T> values(indices.size());
+				parallel::ForRows(cv::Range(0, static_cast<int>(runs.size())), [&](const cv::Range& range) {
+					for(int r = range.start; r < range.end; r++)
+					{
+						const Run& run = runs[r];
+						const T* src = image.ptr<T>(run.row);
+						std::copy(src + run.begin, src + run.end, values.begin() + run.offset);
+					}
+				});
+				return values;
+			}
+
+			/// <summary>
+			/// Packed wrapped phase in cycles, of floating point or 16-bit fixed
+			/// point (CV_16UC1) phase image.
+			/// </summary>
+			std::vector<float> GatherPhase(const cv::Mat& wrapped) const;
+
+			/// <summary>
+			/// Frame sized floating point image with packed values at valid
+			/// pixels and background elsewhere.
+			/// </summary>
+			cv::Mat Scatter(const std::vector<float>& values, float background = 0.0f) const;
+
+			/// <summary>
+			/// Mask image, CV_8UC1, 255 at valid pixels, 0 elsewhere.
+			/// </summary>
+			cv::Mat ToMask() const;
+
+		private:
+			void Build(const cv::Mat* bitflags, Bitflag ignore_flag);
+
+			cv::Size size;
+			std::vector<Run> runs;
+			std::vector<int> row_runs;
+			std::vector<int> indices;
+			std::vector<Neighbours> neighbours;
+
+			// Packed index of the first valid pixel of each row (rows + 1)
+			std::vector<int> row_first;
+		};
+	}
+}
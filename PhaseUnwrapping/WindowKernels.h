@@ -0,0 +1,1165 @@
+#pragma once
+#include "BitPlane.h"
+#include "Bitflags.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "Trigonometry.h"
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace pu
+{
+	/// <summary>
+	/// Window kernels specialized at compile time for window size K.
+	/// Each kernel runs in two passes per output row: column pass which
+	/// reduces K window rows (fewer at top and bottom edges) into row buffer
+	/// and row pass which reduces K neighbouring columns of that buffer.
+	/// Interior columns and rows use fixed K loops (fully unrolled, no
+	/// clipping) only the border ones use clipped, runtime sized loops.
+	/// Results match the generic implementations up to float rounding.
+	/// </summary>
+	namespace kernels
+	{
+		/// <summary>
+		/// Whether there is specialized kernel for the given window size.
+		/// </summary>
+		inline bool IsSpecialized(int k)
+		{
+			return k == 3 || k == 5 || k == 7 || k == 9;
+		}
+
+		/// <summary>
+		/// Recomputes phase (range [0, 1]) into its cos and sin planes.
+		/// Phase is either floating point or 16-bit fixed point (CV_16UC1).
+		/// Fixed point phase and floating point phase with levels > 0 (see
+		/// DetectPhaseLevels) are looked up in PhaseLut tables, otherwise
+		/// cos and sin are computed.
+		/// </summary>
+		inline void CosSin(const cv::Mat& wrapped, cv::Mat& cos_plane, cv::Mat& sin_plane, int levels = 0)
+		{
+			cos_plane.create(wrapped.rows, wrapped.cols, CV_32FC1);
+			sin_plane.create(wrapped.rows, wrapped.cols, CV_32FC1);
+
+			const bool fixed = wrapped.type() == CV_16UC1;
+			const PhaseLut* lut = nullptr;
+			if(fixed) lut = &GetPhaseLut(FIXED16_LEVELS);
+			else if(levels > 0) lut = &GetPhaseLut(levels);
+
+			parallel::ForRows(cv::Range(0, wrapped.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					float* c = cos_plane.ptr<float>(row);
+					float* s = sin_plane.ptr<float>(row);
+
+					if(fixed)
+					{
+						// Fixed point value is the table index
+						const unsigned short* src = wrapped.ptr<unsigned short>(row);
+						const float* cos_table = lut->CosTable();
+						const float* sin_table = lut->SinTable();
+						for(int col = 0; col < wrapped.cols; col++)
+						{
+							c[col] = cos_table[src[col]];
+							s[col] = sin_table[src[col]];
+						}
+					}
+					else if(lut)
+					{
+						const float* src = wrapped.ptr<float>(row);
+						const float* cos_table = lut->CosTable();
+						const float* sin_table = lut->SinTable();
+						for(int col = 0; col < wrapped.cols; col++)
+						{
+							int i = lut->Index(src[col]);
+							c[col] = cos_table[i];
+							s[col] = sin_table[i];
+						}
+					}
+					else
+					{
+						const float* src = wrapped.ptr<float>(row);
+						for(int col = 0; col < wrapped.cols; col++)
+						{
+							float phase = src[col] * static_cast<float>(CV_PI * 2.0);
+							c[col] = std::cos(phase);
+							s[col] = std::sin(phase);
+						}
+					}
+				}
+			});
+		}
+
+		/// <summary>
+		/// Median of n values, values are reordered. For even n average
+		/// of two middle elements is taken.
+		/// </summary>
+		inline float Median(float* values, int n)
+		{
+			float* mid = values + n / 2;
+			std::nth_element(values, mid, values + n);
+			float median = *mid;
+
+			// Lower middle element is the largest one before mid
+			if(n % 2 == 0)
+			{
+				median = (median + *std::max_element(values, mid)) / 2.0f;
+			}
+
+			return median;
+		}
+
+		namespace detail
+		{
+			/// <summary>
+			/// Pointers to first and last window row for output row, n = number
+			/// of rows actually in the window (less than K at image edges).
+			/// </summary>
+			template<typename T>
+			int WindowRows(const cv::Mat& image, int row, int k2, const T** rows_ptr)
+			{
+				int first = std::max(row - k2, 0);
+				int last = std::min(row + k2, image.rows - 1);
+				for(int r = first; r <= last; r++)
+				{
+					rows_ptr[r - first] = image.ptr<T>(r);
+				}
+				return last - first + 1;
+			}
+
+			/// <summary>
+			/// Column pass for sums: sum, sum of squares and number of valid
+			/// (not ignored) pixels in columns [begin, end) of the window rows.
+			/// N > 0 is compile time number of rows, N = 0 means runtime n.
+			/// </summary>
+			template<int N, typename T>
+			void ColumnSums(const T* const* src, const bitflag_type* const* flags, bitflag_type ignore,
+							int n, int begin, int end, float* sum, float* sqr, float* cnt)
+			{
+				const int count = N > 0 ? N : n;
+				if(flags)
+				{
+					for(int col = begin; col < end; col++)
+					{
+						float s = 0, q = 0, c = 0;
+						for(int i = 0; i < count; i++)
+						{
+							// Branch free weight so the loop vectorizes
+							float w = (flags[i][col] & ignore) ? 0.0f : 1.0f;
+							float v = static_cast<float>(src[i][col]) * w;
+							s += v;
+							q += v * v;
+							c += w;
+						}
+						sum[col] = s;
+						sqr[col] = q;
+						cnt[col] = c;
+					}
+				}
+				else
+				{
+					for(int col = begin; col < end; col++)
+					{
+						float s = 0, q = 0;
+						for(int i = 0; i < count; i++)
+						{
+							float v = static_cast<float>(src[i][col]);
+							s += v;
+							q += v * v;
+						}
+						sum[col] = s;
+						sqr[col] = q;
+						cnt[col] = static_cast<float>(count);
+					}
+				}
+			}
+
+			/// <summary>
+			/// Column pass for maximum absolute value of columns [begin, end),
+			/// ignored pixels count as 0
+			/// </summary>
+			template<int N, typename T>
+			void ColumnMaxAbs(const T* const* src, const bitflag_type* const* flags, bitflag_type ignore,
+							  int n, int begin, int end, float* max)
+			{
+				const int count = N > 0 ? N : n;
+				for(int col = begin; col < end; col++)
+				{
+					float m = 0;
+					for(int i = 0; i < count; i++)
+					{
+						float v = std::abs(static_cast<float>(src[i][col]));
+						if(flags && (flags[i][col] & ignore)) v = 0.0f;
+						m = std::max(m, v);
+					}
+					max[col] = m;
+				}
+			}
+
+			/// <summary>
+			/// Column pass for cos/sin sums of columns [begin, end)
+			/// </summary>
+			template<int N>
+			void ColumnCosSin(const float* const* cos_rows, const float* const* sin_rows, int n, int begin, int end, float* cos_sum, float* sin_sum)
+			{
+				const int count = N > 0 ? N : n;
+				for(int col = begin; col < end; col++)
+				{
+					float c = 0, s = 0;
+					for(int i = 0; i < count; i++)
+					{
+						c += cos_rows[i][col];
+						s += sin_rows[i][col];
+					}
+					cos_sum[col] = c;
+					sin_sum[col] = s;
+				}
+			}
+
+			/// <summary>
+			/// Calls column pass with compile time row count for interior rows
+			/// </summary>
+			template<int K, typename Fixed, typename Runtime>
+			void DispatchRows(int n, Fixed fixed, Runtime runtime)
+			{
+				if(n == K) fixed();
+				else runtime();
+			}
+
+			/// <summary>
+			/// Kind of 64-column block of window rows
+			/// </summary>
+			enum class Block
+			{
+				/// <summary>
+				/// No ignored pixel in the block
+				/// </summary>
+				Clean,
+
+				/// <summary>
+				/// Some pixels ignored, column pass tests flags
+				/// </summary>
+				Mixed,
+
+				/// <summary>
+				/// All pixels of each column ignored in all window rows
+				/// </summary>
+				Ignored
+			};
+
+			/// <summary>
+			/// Bit planes classifying 64-column blocks of K window rows: any
+			/// marks columns with an ignored pixel in some window row, all the
+			/// ones ignored in every window row. Returns false (planes left
+			/// empty) when no pixel is ignored at all. The plane of ignored
+			/// pixels themselves is kept in ignored if given.
+			/// </summary>
+			inline bool WindowRowsMask(const cv::Mat& bitflags, Bitflag ignore_flag, int k,
+									   masks::BitPlane& any, masks::BitPlane& all, masks::BitPlane* ignored = nullptr)
+			{
+				masks::BitPlane plane{ bitflags, ignore_flag };
+				if(!plane.Any()) return false;
+
+				any = plane.Dilate(cv::Size(1, k));
+				all = plane.Erode(cv::Size(1, k));
+				if(ignored) *ignored = std::move(plane);
+				return true;
+			}
+
+			/// <summary>
+			/// Splits columns [begin, end) of the row into runs of whole words
+			/// of the same Block kind and calls pass(first, last, block) for
+			/// each, so clean runs keep the branch free unmasked column pass
+			/// and fully ignored runs need only to be zeroed.
+			/// </summary>
+			template<typename Pass>
+			void ColumnBlocks(const masks::BitPlane& any, const masks::BitPlane& all, int row, int begin, int end, Pass pass)
+			{
+				const int bits = masks::BitPlane::WORD_BITS;
+				const int words = (end + bits - 1) / bits;
+				const masks::BitPlane::word_type* any_row = any.Row(row);
+				const masks::BitPlane::word_type* all_row = all.Row(row);
+
+				auto kind = [&](int w) {
+					if(any_row[w] == 0) return Block::Clean;
+					if(all_row[w] == any.WordMask(w)) return Block::Ignored;
+					return Block::Mixed;
+				};
+
+				for(int w = begin / bits; w < words;)
+				{
+					Block block = kind(w);
+					int next = w + 1;
+					while(next < words && kind(next) == block) next++;
+
+					pass(std::max(w * bits, begin), std::min(next * bits, end), block);
+					w = next;
+				}
+			}
+
+			/// <summary>
+			/// Runs row pass for columns [begin, end) of the row, split into
+			/// border columns (clipped window, runtime bounds) and interior
+			/// columns (fixed K window, no bounds). border(col, first, count),
+			/// interior(col) where window columns are [first, first + count)
+			/// and [col - K / 2, col + K / 2].
+			/// </summary>
+			template<int K, typename Border, typename Interior>
+			void RowPass(int cols, int begin, int end, Border border, Interior interior)
+			{
+				constexpr int k2 = K / 2;
+
+				auto clipped = [&](int col) {
+					int first = std::max(col - k2, 0);
+					int last = std::min(col + k2, cols - 1);
+					border(col, first, last - first + 1);
+				};
+
+				for(int col = begin; col < std::min(k2, end); col++)
+				{
+					clipped(col);
+				}
+
+				for(int col = std::max(begin, k2); col < std::min(end, cols - k2); col++)
+				{
+					interior(col);
+				}
+
+				for(int col = std::max(begin, std::max(cols - k2, k2)); col < end; col++)
+				{
+					clipped(col);
+				}
+			}
+		}
+
+		/// <summary>
+		/// Windowed variance, see quality_maps::WindowedVariance. Image pixels
+		/// are of type T, widened to float and multiplied by scale (for fixed
+		/// point images).
+		/// </summary>
+		template<int K, typename T = float>
+		cv::Mat WindowedVariance(const cv::Mat& image, const cv::Mat* bitflags, Bitflag ignore_flag, float scale = 1.0f)
+		{
+			constexpr int k2 = K / 2;
+			const int rows = image.rows, cols = image.cols;
+			masks::BitPlane any, all, ignored;
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag &&
+				detail::WindowRowsMask(*bitflags, ignore_flag, K, any, all, &ignored);
+
+			cv::Mat variance = parallel::Allocate(rows, cols, CV_32FC1);
+
+			const cv::Size tile = parallel::TileSize(image.size(), static_cast<int>(sizeof(T) + sizeof(bitflag_type) + sizeof(float)));
+			parallel::ForTiles(image.size(), tile, [&](const cv::Rect& rect) {
+				// Column pass covers the tile and the halo read by its row pass
+				const int begin = std::max(rect.x - k2, 0), end = std::min(rect.x + rect.width + k2, cols);
+				// Column pass results for single output row of the tile
+				std::vector<float> sum(cols), sqr(cols), cnt(cols);
+				const T* src[K];
+				const bitflag_type* flags[K];
+
+				for(int row = rect.y; row < rect.y + rect.height; row++)
+				{
+					int n = detail::WindowRows(image, row, k2, src);
+					if(masked)
+					{
+						detail::WindowRows(*bitflags, row, k2, flags);
+					}
+
+					auto column_pass = [&](int first, int last, const bitflag_type* const* f) {
+						detail::DispatchRows<K>(n,
+							[&] { detail::ColumnSums<K>(src, f, ignore_flag, n, first, last, sum.data(), sqr.data(), cnt.data()); },
+							[&] { detail::ColumnSums<0>(src, f, ignore_flag, n, first, last, sum.data(), sqr.data(), cnt.data()); });
+					};
+
+					if(masked)
+					{
+						detail::ColumnBlocks(any, all, row, begin, end, [&](int first, int last, detail::Block block) {
+							if(block == detail::Block::Ignored)
+							{
+								std::fill(sum.begin() + first, sum.begin() + last, 0.0f);
+								std::fill(sqr.begin() + first, sqr.begin() + last, 0.0f);
+								std::fill(cnt.begin() + first, cnt.begin() + last, 0.0f);
+							}
+							else
+							{
+								column_pass(first, last, block == detail::Block::Mixed ? flags : nullptr);
+							}
+						});
+					}
+					else
+					{
+						column_pass(begin, end, nullptr);
+					}
+
+					float* dst = variance.ptr<float>(row);
+					auto finish = [&](int col, float s, float q, float c) {
+						// To avoid division by zero and also to zero empty windows
+						float m = c > 0 ? 1.0f / c : 0.0f;
+						s *= m * scale;
+						q *= m * scale * scale;
+
+						// Rounding may leave tiny negative values, clamped the
+						// same as in the generic path
+						dst[col] = std::max(q - s * s, 0.0f);
+					};
+
+					detail::RowPass<K>(cols, rect.x, rect.x + rect.width,
+						[&](int col, int first, int count) {
+							float s = 0, q = 0, c = 0;
+							for(int j = first; j < first + count; j++)
+							{
+								s += sum[j]; q += sqr[j]; c += cnt[j];
+							}
+							finish(col, s, q, c);
+						},
+						[&](int col) {
+							float s = 0, q = 0, c = 0;
+							for(int j = col - k2; j <= col + k2; j++)
+							{
+								s += sum[j]; q += sqr[j]; c += cnt[j];
+							}
+							finish(col, s, q, c);
+						});
+				}
+
+				PU_PROFILE_COUNT("WindowedVariance", MaskedPixelsSkipped, masked ? ignored.CountInRect(rect) : 0);
+				PU_PROFILE_WORK(static_cast<long long>(rect.area()));
+			});
+
+			return variance;
+		}
+
+		/// <summary>
+		/// Windowed maximum absolute value, see quality_maps::WindowedMaxAbs.
+		/// Image pixels are of type T, widened to float and multiplied by scale.
+		/// </summary>
+		template<int K, typename T = float>
+		cv::Mat WindowedMaxAbs(const cv::Mat& image, const cv::Mat* bitflags, Bitflag ignore_flag, float scale = 1.0f)
+		{
+			constexpr int k2 = K / 2;
+			const int rows = image.rows, cols = image.cols;
+			masks::BitPlane any, all;
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag &&
+				detail::WindowRowsMask(*bitflags, ignore_flag, K, any, all);
+
+			cv::Mat maximum = parallel::Allocate(rows, cols, CV_32FC1);
+
+			const cv::Size tile = parallel::TileSize(image.size(), static_cast<int>(sizeof(T) + sizeof(bitflag_type) + sizeof(float)));
+			parallel::ForTiles(image.size(), tile, [&](const cv::Rect& rect) {
+				// Column pass covers the tile and the halo read by its row pass
+				const int begin = std::max(rect.x - k2, 0), end = std::min(rect.x + rect.width + k2, cols);
+				std::vector<float> colmax(cols);
+				const T* src[K];
+				const bitflag_type* flags[K];
+
+				for(int row = rect.y; row < rect.y + rect.height; row++)
+				{
+					int n = detail::WindowRows(image, row, k2, src);
+					if(masked)
+					{
+						detail::WindowRows(*bitflags, row, k2, flags);
+					}
+
+					auto column_pass = [&](int first, int last, const bitflag_type* const* f) {
+						detail::DispatchRows<K>(n,
+							[&] { detail::ColumnMaxAbs<K>(src, f, ignore_flag, n, first, last, colmax.data()); },
+							[&] { detail::ColumnMaxAbs<0>(src, f, ignore_flag, n, first, last, colmax.data()); });
+					};
+
+					if(masked)
+					{
+						detail::ColumnBlocks(any, all, row, begin, end, [&](int first, int last, detail::Block block) {
+							if(block == detail::Block::Ignored)
+							{
+								std::fill(colmax.begin() + first, colmax.begin() + last, 0.0f);
+							}
+							else
+							{
+								column_pass(first, last, block == detail::Block::Mixed ? flags : nullptr);
+							}
+						});
+					}
+					else
+					{
+						column_pass(begin, end, nullptr);
+					}
+
+					float* dst = maximum.ptr<float>(row);
+					detail::RowPass<K>(cols, rect.x, rect.x + rect.width,
+						[&](int col, int first, int count) {
+							dst[col] = *std::max_element(colmax.data() + first, colmax.data() + first + count) * scale;
+						},
+						[&](int col) {
+							float m = colmax[col - k2];
+							for(int j = col - k2 + 1; j <= col + k2; j++)
+							{
+								m = std::max(m, colmax[j]);
+							}
+							dst[col] = m * scale;
+						});
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(rect.area()));
+			});
+
+			return maximum;
+		}
+
+		/// <summary>
+		/// Mean phase filter before normalization (atan2 of window cos/sin
+		/// sums, range [-PI, PI]), see filters::MeanPhaseFilter
+		/// </summary>
+		template<int K>
+		cv::Mat MeanPhase(const cv::Mat& cos_plane, const cv::Mat& sin_plane)
+		{
+			constexpr int k2 = K / 2;
+			const int rows = cos_plane.rows, cols = cos_plane.cols;
+
+			cv::Mat filtered = parallel::Allocate(rows, cols, CV_32FC1);
+
+			const cv::Size tile = parallel::TileSize(cos_plane.size(), static_cast<int>(3 * sizeof(float)));
+			parallel::ForTiles(cos_plane.size(), tile, [&](const cv::Rect& rect) {
+				// Column pass covers the tile and the halo read by its row pass
+				const int begin = std::max(rect.x - k2, 0), end = std::min(rect.x + rect.width + k2, cols);
+				std::vector<float> cos_sum(cols), sin_sum(cols);
+				const float* cos_rows[K];
+				const float* sin_rows[K];
+
+				for(int row = rect.y; row < rect.y + rect.height; row++)
+				{
+					int n = detail::WindowRows(cos_plane, row, k2, cos_rows);
+					detail::WindowRows(sin_plane, row, k2, sin_rows);
+
+					detail::DispatchRows<K>(n,
+						[&] { detail::ColumnCosSin<K>(cos_rows, sin_rows, n, begin, end, cos_sum.data(), sin_sum.data()); },
+						[&] { detail::ColumnCosSin<0>(cos_rows, sin_rows, n, begin, end, cos_sum.data(), sin_sum.data()); });
+
+					// Mean is not needed, atan2 does not depend on the scale
+					float* dst = filtered.ptr<float>(row);
+					detail::RowPass<K>(cols, rect.x, rect.x + rect.width,
+						[&](int col, int first, int count) {
+							float c = 0, s = 0;
+							for(int j = first; j < first + count; j++)
+							{
+								c += cos_sum[j]; s += sin_sum[j];
+							}
+							dst[col] = std::atan2(s, c);
+						},
+						[&](int col) {
+							float c = 0, s = 0;
+							for(int j = col - k2; j <= col + k2; j++)
+							{
+								c += cos_sum[j]; s += sin_sum[j];
+							}
+							dst[col] = std::atan2(s, c);
+						});
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(rect.area()));
+			});
+
+			return filtered;
+		}
+
+		/// <summary>
+		/// Median phase filter before normalization (atan2 of window cos/sin
+		/// medians, range [-PI, PI]), see filters::MedianPhaseFilter
+		/// </summary>
+		template<int K>
+		cv::Mat MedianPhase(const cv::Mat& cos_plane, const cv::Mat& sin_plane)
+		{
+			constexpr int k2 = K / 2;
+			const int rows = cos_plane.rows, cols = cos_plane.cols;
+
+			cv::Mat filtered = parallel::Allocate(rows, cols, CV_32FC1);
+
+			const cv::Size tile = parallel::TileSize(cos_plane.size(), static_cast<int>(3 * sizeof(float)));
+			parallel::ForTiles(cos_plane.size(), tile, [&](const cv::Rect& rect) {
+				// Window values live on the stack
+				std::array<float, K * K> re, im;
+				const float* cos_rows[K];
+				const float* sin_rows[K];
+
+				for(int row = rect.y; row < rect.y + rect.height; row++)
+				{
+					int n = detail::WindowRows(cos_plane, row, k2, cos_rows);
+					detail::WindowRows(sin_plane, row, k2, sin_rows);
+
+					float* dst = filtered.ptr<float>(row);
+					detail::RowPass<K>(cols, rect.x, rect.x + rect.width,
+						[&](int col, int first, int count) {
+							int m = 0;
+							for(int i = 0; i < n; i++)
+							{
+								for(int j = first; j < first + count; j++, m++)
+								{
+									re[m] = cos_rows[i][j];
+									im[m] = sin_rows[i][j];
+								}
+							}
+							dst[col] = std::atan2(Median(im.data(), m), Median(re.data(), m));
+						},
+						[&](int col) {
+							if(n == K)
+							{
+								for(int i = 0; i < K; i++)
+								{
+									for(int j = 0; j < K; j++)
+									{
+										re[i * K + j] = cos_rows[i][col - k2 + j];
+										im[i * K + j] = sin_rows[i][col - k2 + j];
+									}
+								}
+								dst[col] = std::atan2(Median(im.data(), K * K), Median(re.data(), K * K));
+							}
+							else
+							{
+								int m = 0;
+								for(int i = 0; i < n; i++)
+								{
+									for(int j = col - k2; j <= col + k2; j++, m++)
+									{
+										re[m] = cos_rows[i][j];
+										im[m] = sin_rows[i][j];
+									}
+								}
+								dst[col] = std::atan2(Median(im.data(), m), Median(re.data(), m));
+							}
+						});
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(rect.area()));
+			});
+
+			return filtered;
+		}
+	
+
+		namespace detail
+		{
+			/// <summary>
+			/// Number of window pixels inside the image along one axis, for each
+			/// window position (less than window at the edges)
+			/// </summary>
+			inline std::vector<float> ClippedCounts(int length, int window)
+			{
+				const int half = window / 2;
+				std::vector<float> counts(length);
+				for(int i = 0; i < length; i++)
+				{
+					counts[i] = static_cast<float>(std::min(i + half, length - 1) - std::max(i - half, 0) + 1);
+				}
+				return counts;
+			}
+
+			/// <summary>
+			/// Image widened to float and multiplied by scale (absolute value if
+			/// requested), pixels with ignore_flag set to 0
+			/// </summary>
+			template<typename T>
+			cv::Mat Widen(const cv::Mat& image, const cv::Mat* bitflags, Bitflag ignore_flag, float scale, bool absolute)
+			{
+				cv::Mat values = parallel::Allocate(image.rows, image.cols, CV_32FC1);
+
+				parallel::ForRows(cv::Range(0, image.rows), [&](const cv::Range& range) {
+					for(int row = range.start; row < range.end; row++)
+					{
+						const T* src = image.ptr<T>(row);
+						const bitflag_type* flags = bitflags ? bitflags->ptr<bitflag_type>(row) : nullptr;
+						float* dst = values.ptr<float>(row);
+						for(int col = 0; col < image.cols; col++)
+						{
+							float v = static_cast<float>(src[col]) * scale;
+							if(absolute) v = std::abs(v);
+							if(flags && (flags[col] & ignore_flag)) v = 0.0f;
+							dst[col] = v;
+						}
+					}
+				});
+
+				return values;
+			}
+
+			/// <summary>
+			/// 1 for pixels without ignore_flag, 0 for ignored ones. Number of
+			/// ignored pixels is counted on the way into ignored if given.
+			/// </summary>
+			inline cv::Mat ValidWeights(const cv::Mat& bitflags, Bitflag ignore_flag, long long* ignored = nullptr)
+			{
+				cv::Mat weights = parallel::Allocate(bitflags.rows, bitflags.cols, CV_32FC1);
+				std::atomic<long long> count{ 0 };
+
+				parallel::ForRows(cv::Range(0, bitflags.rows), [&](const cv::Range& range) {
+					long long n = 0;
+					for(int row = range.start; row < range.end; row++)
+					{
+						const bitflag_type* flags = bitflags.ptr<bitflag_type>(row);
+						float* dst = weights.ptr<float>(row);
+						for(int col = 0; col < bitflags.cols; col++)
+						{
+							const bool skip = (flags[col] & ignore_flag) != 0;
+							dst[col] = skip ? 0.0f : 1.0f;
+							n += skip;
+						}
+					}
+					count.fetch_add(n, std::memory_order_relaxed);
+				});
+
+				if(ignored) *ignored = count.load(std::memory_order_relaxed);
+				return weights;
+			}
+
+			/// <summary>
+			/// Unnormalized window sums, pixels outside of the image count as 0
+			/// (so clipped windows sum only the pixels inside)
+			/// </summary>
+			inline void WindowSums(const cv::Mat& src, cv::Mat& dst, cv::Size window, bool squares = false)
+			{
+				if(squares)
+				{
+					cv::sqrBoxFilter(src, dst, CV_32F, window, cv::Point(-1, -1), false, cv::BORDER_CONSTANT);
+				}
+				else
+				{
+					cv::boxFilter(src, dst, CV_32F, window, cv::Point(-1, -1), false, cv::BORDER_CONSTANT);
+				}
+			}
+		}
+
+		/// <summary>
+		/// Windowed variance over rectangular window (width x height) of any
+		/// size. Sums come from separable box filters (running sums along rows
+		/// and columns), so the cost per pixel does not depend on the window
+		/// area. Image pixels are of type T, widened to float and multiplied by
+		/// scale.
+		/// </summary>
+		template<typename T = float>
+		cv::Mat WindowedVariance(const cv::Mat& image, cv::Size window, const cv::Mat* bitflags, Bitflag ignore_flag, float scale = 1.0f)
+		{
+			const int rows = image.rows, cols = image.cols;
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag;
+
+			// Ignored pixels are zeroed, so they add nothing to the sums
+			cv::Mat values = detail::Widen<T>(image, masked ? bitflags : nullptr, ignore_flag, scale, false);
+
+			cv::Mat sum, sqr, cnt;
+			long long skipped = 0;
+			detail::WindowSums(values, sum, window);
+			detail::WindowSums(values, sqr, window, true);
+			if(masked)
+			{
+				detail::WindowSums(detail::ValidWeights(*bitflags, ignore_flag, &skipped), cnt, window);
+			}
+
+			// Without mask the count is product of clipped extents
+			const std::vector<float> row_counts = detail::ClippedCounts(rows, window.height);
+			const std::vector<float> col_counts = detail::ClippedCounts(cols, window.width);
+
+			cv::Mat variance = parallel::Allocate(rows, cols, CV_32FC1);
+
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					const float* s = sum.ptr<float>(row);
+					const float* q = sqr.ptr<float>(row);
+					const float* c = masked ? cnt.ptr<float>(row) : nullptr;
+					float* dst = variance.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						float window_count = row_counts[row] * col_counts[col];
+						float n = c ? std::round(c[col]) : window_count;
+
+						// To avoid division by zero and also to zero empty windows
+						float m = n > 0 ? 1.0f / n : 0.0f;
+						float mean = s[col] * m;
+
+						// Running sums may leave tiny negative values
+						dst[col] = std::max(q[col] * m - mean * mean, 0.0f);
+					}
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * cols);
+			});
+
+			PU_PROFILE_COUNT("WindowedVariance", MaskedPixelsSkipped, skipped);
+
+			return variance;
+		}
+
+		/// <summary>
+		/// Windowed maximum absolute value over rectangular window (width x
+		/// height) of any size, as dilation with rectangular element (row and
+		/// column passes, cost grows with width + height, not the area).
+		/// Ignored pixels count as 0.
+		/// </summary>
+		template<typename T = float>
+		cv::Mat WindowedMaxAbs(const cv::Mat& image, cv::Size window, const cv::Mat* bitflags, Bitflag ignore_flag, float scale = 1.0f)
+		{
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag;
+			cv::Mat values = detail::Widen<T>(image, masked ? bitflags : nullptr, ignore_flag, scale, true);
+
+			// Values are not negative, so 0 outside of the image changes nothing
+			cv::Mat maximum;
+			cv::dilate(values, maximum, cv::getStructuringElement(cv::MORPH_RECT, window),
+					   cv::Point(-1, -1), 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+
+			PU_PROFILE_WORK(static_cast<long long>(image.rows) * image.cols);
+			return maximum;
+		}
+
+		/// <summary>
+		/// Mean phase filter before normalization over rectangular window of any
+		/// size, window cos/sin sums come from box filters (cost independent of
+		/// the window area)
+		/// </summary>
+		inline cv::Mat MeanPhase(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window)
+		{
+			cv::Mat cos_sum, sin_sum;
+			detail::WindowSums(cos_plane, cos_sum, window);
+			detail::WindowSums(sin_plane, sin_sum, window);
+
+			// Cos sums are no longer needed, result is written over them
+			parallel::ForRows(cv::Range(0, cos_sum.rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					float* c = cos_sum.ptr<float>(row);
+					const float* s = sin_sum.ptr<float>(row);
+					for(int col = 0; col < cos_sum.cols; col++)
+					{
+						c[col] = std::atan2(s[col], c[col]);
+					}
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * cos_sum.cols);
+			});
+
+			return cos_sum;
+		}
+
+		/// <summary>
+		/// Window width from which MedianPhase uses the sliding median. Gather
+		/// cost grows with window area, sliding cost with window height only,
+		/// they break even at about this width for any height.
+		/// </summary>
+		constexpr int SLIDING_MEDIAN_WIDTH = 7;
+
+		namespace detail
+		{
+			/// <summary>
+			/// Exact order statistics of a plane over window sliding along the
+			/// columns of a band of rows. Values of the band are kept sorted
+			/// (moving the band a row down drops the leaving row and merges the
+			/// sorted entering one), columns inside the window are counted in
+			/// a Fenwick tree indexed by rank in the band, so moving the window
+			/// one column costs O(rows log(band size)) instead of a new gather.
+			/// </summary>
+			class SlidingOrder
+			{
+			public:
+				/// <summary>
+				/// Band of at most band_rows rows of the plane
+				/// </summary>
+				SlidingOrder(const cv::Mat& plane, int band_rows)
+					: plane(plane), band_rows(band_rows), cols(plane.cols),
+					  rank(static_cast<size_t>(band_rows) * plane.cols)
+				{
+				}
+
+				/// <summary>
+				/// Moves band to rows [first, last] and clears window counts.
+				/// Bands must move down (first and last do not decrease).
+				/// </summary>
+				void SetBand(int first, int last)
+				{
+					if(band_first < 0 || first > band_last)
+					{
+						sorted.clear();
+						band_first = band_last = first - 1;
+					}
+
+					// Rows leaving the band, by slot
+					if(first > band_first)
+					{
+						const int leaving_first = band_first, leaving_last = first - 1;
+						auto leaving = [&](const Entry& entry) {
+							int slot_row = entry.slot / cols;
+							for(int r = leaving_first; r <= leaving_last; r++)
+							{
+								if(r % band_rows == slot_row) return true;
+							}
+							return false;
+						};
+						sorted.erase(std::remove_if(sorted.begin(), sorted.end(), leaving), sorted.end());
+					}
+
+					for(int r = band_last + 1; r <= last; r++)
+					{
+						const float* values = plane.ptr<float>(r);
+						const int offset = (r % band_rows) * cols;
+
+						entering.resize(cols);
+						for(int col = 0; col < cols; col++)
+						{
+							entering[col] = Entry{ values[col], offset + col };
+						}
+						std::sort(entering.begin(), entering.end());
+
+						merged.resize(sorted.size() + entering.size());
+						std::merge(sorted.begin(), sorted.end(), entering.begin(), entering.end(), merged.begin());
+						sorted.swap(merged);
+					}
+
+					band_first = first;
+					band_last = last;
+
+					for(size_t i = 0; i < sorted.size(); i++)
+					{
+						rank[sorted[i].slot] = static_cast<int>(i) + 1;
+					}
+
+					tree.assign(sorted.size() + 1, 0);
+					top = 1;
+					while(top * 2 <= static_cast<int>(sorted.size())) top *= 2;
+				}
+
+				/// <summary>
+				/// Adds (count = 1) or removes (count = -1) band column from
+				/// the window
+				/// </summary>
+				void Update(int col, int count)
+				{
+					const int size = static_cast<int>(sorted.size());
+					for(int r = band_first; r <= band_last; r++)
+					{
+						for(int i = rank[(r % band_rows) * cols + col]; i <= size; i += i & -i)
+						{
+							tree[i] += count;
+						}
+					}
+				}
+
+				/// <summary>
+				/// Median of n values in the window, same as Median
+				/// </summary>
+				float Median(int n) const
+				{
+					float median = Select(n / 2);
+					if(n % 2 == 0)
+					{
+						median = (median + Select(n / 2 - 1)) / 2.0f;
+					}
+					return median;
+				}
+
+			private:
+				struct Entry
+				{
+					float value;
+					int slot;
+
+					bool operator<(const Entry& other) const
+					{
+						return value < other.value || (value == other.value && slot < other.slot);
+					}
+				};
+
+				/// <summary>
+				/// k-th smallest (from 0) value in the window
+				/// </summary>
+				float Select(int k) const
+				{
+					const int size = static_cast<int>(sorted.size());
+					int position = 0;
+					for(int step = top; step > 0; step /= 2)
+					{
+						if(position + step <= size && tree[position + step] <= k)
+						{
+							position += step;
+							k -= tree[position];
+						}
+					}
+					return sorted[position].value;
+				}
+
+				const cv::Mat& plane;
+				const int band_rows;
+				const int cols;
+
+				int band_first = -1;
+				int band_last = -1;
+
+				// Band entries in increasing order, slot = (row % band_rows) * cols + col
+				std::vector<Entry> sorted;
+				std::vector<Entry> entering;
+				std::vector<Entry> merged;
+
+				// 1 based rank in sorted of each slot, Fenwick tree of window counts by rank
+				std::vector<int> rank;
+				std::vector<int> tree;
+				int top = 1;
+			};
+		}
+
+		/// <summary>
+		/// Exact median phase filter before normalization over rectangular
+		/// window of any size, with windows slid along the rows (see
+		/// detail::SlidingOrder). Cost per pixel grows with window height
+		/// only, results are equal to MedianPhase.
+		/// </summary>
+		inline cv::Mat SlidingMedianPhase(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window)
+		{
+			const int kx2 = window.width / 2, ky2 = window.height / 2;
+			const int rows = cos_plane.rows, cols = cos_plane.cols;
+
+			cv::Mat filtered = parallel::Allocate(rows, cols, CV_32FC1);
+
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				detail::SlidingOrder re(cos_plane, window.height), im(sin_plane, window.height);
+
+				for(int row = range.start; row < range.end; row++)
+				{
+					const int first_row = std::max(row - ky2, 0), last_row = std::min(row + ky2, rows - 1);
+					const int height = last_row - first_row + 1;
+					re.SetBand(first_row, last_row);
+					im.SetBand(first_row, last_row);
+
+					for(int col = 0; col < std::min(kx2, cols); col++)
+					{
+						re.Update(col, 1);
+						im.Update(col, 1);
+					}
+
+					float* dst = filtered.ptr<float>(row);
+					for(int col = 0; col < cols; col++)
+					{
+						if(col + kx2 < cols)
+						{
+							re.Update(col + kx2, 1);
+							im.Update(col + kx2, 1);
+						}
+						if(col - kx2 - 1 >= 0)
+						{
+							re.Update(col - kx2 - 1, -1);
+							im.Update(col - kx2 - 1, -1);
+						}
+
+						const int n = height * (std::min(col + kx2, cols - 1) - std::max(col - kx2, 0) + 1);
+						dst[col] = std::atan2(im.Median(n), re.Median(n));
+					}
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * cols);
+			});
+
+			return filtered;
+		}
+
+		/// <summary>
+		/// Median phase filter before normalization over rectangular window of
+		/// any size. Median is not separable, narrow windows are gathered
+		/// whole, from SLIDING_MEDIAN_WIDTH on SlidingMedianPhase is used.
+		/// </summary>
+		inline cv::Mat MedianPhase(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window)
+		{
+			if(window.width >= SLIDING_MEDIAN_WIDTH)
+			{
+				return SlidingMedianPhase(cos_plane, sin_plane, window);
+			}
+
+			const int kx2 = window.width / 2, ky2 = window.height / 2;
+			const int rows = cos_plane.rows, cols = cos_plane.cols;
+
+			cv::Mat filtered = parallel::Allocate(rows, cols, CV_32FC1);
+
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				std::vector<float> re(window.area()), im(window.area());
+
+				for(int row = range.start; row < range.end; row++)
+				{
+					const int first_row = std::max(row - ky2, 0), last_row = std::min(row + ky2, rows - 1);
+					float* dst = filtered.ptr<float>(row);
+
+					for(int col = 0; col < cols; col++)
+					{
+						const int first_col = std::max(col - kx2, 0), last_col = std::min(col + kx2, cols - 1);
+
+						int m = 0;
+						for(int r = first_row; r <= last_row; r++)
+						{
+							const float* c = cos_plane.ptr<float>(r);
+							const float* s = sin_plane.ptr<float>(r);
+							for(int j = first_col; j <= last_col; j++, m++)
+							{
+								re[m] = c[j];
+								im[m] = s[j];
+							}
+						}
+						dst[col] = std::atan2(Median(im.data(), m), Median(re.data(), m));
+					}
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * cols);
+			});
+
+			return filtered;
+		}
+	
+
+		/// <summary>
+		/// Pseudo-correlation over rectangular window of any size: length of
+		/// the mean unit phasor (window cos/sin sums from box filters divided
+		/// by number of pixels), range [0, 1]. Ignored pixels are left out of
+		/// the sums and the count, windows with no pixel left give 0.
+		/// </summary>
+		inline cv::Mat PseudoCorrelation(const cv::Mat& cos_plane, const cv::Mat& sin_plane, cv::Size window, const cv::Mat* bitflags, Bitflag ignore_flag)
+		{
+			const int rows = cos_plane.rows, cols = cos_plane.cols;
+			const bool masked = bitflags && ignore_flag != Bitflag::NoFlag;
+
+			cv::Mat cos_sum, sin_sum, cnt;
+			long long skipped = 0;
+			if(masked)
+			{
+				// Zero phasors of ignored pixels, so they add nothing to the sums
+				cv::Mat weights = detail::ValidWeights(*bitflags, ignore_flag, &skipped);
+				detail::WindowSums(cos_plane.mul(weights), cos_sum, window);
+				detail::WindowSums(sin_plane.mul(weights), sin_sum, window);
+				detail::WindowSums(weights, cnt, window);
+			}
+			else
+			{
+				detail::WindowSums(cos_plane, cos_sum, window);
+				detail::WindowSums(sin_plane, sin_sum, window);
+			}
+
+			const std::vector<float> row_counts = detail::ClippedCounts(rows, window.height);
+			const std::vector<float> col_counts = detail::ClippedCounts(cols, window.width);
+
+			// Cos sums are no longer needed, result is written over them
+			parallel::ForRows(cv::Range(0, rows), [&](const cv::Range& range) {
+				for(int row = range.start; row < range.end; row++)
+				{
+					float* c = cos_sum.ptr<float>(row);
+					const float* s = sin_sum.ptr<float>(row);
+					const float* w = masked ? cnt.ptr<float>(row) : nullptr;
+					for(int col = 0; col < cols; col++)
+					{
+						float window_count = row_counts[row] * col_counts[col];
+						float n = w ? std::round(w[col]) : window_count;
+						float m = n > 0 ? 1.0f / n : 0.0f;
+						c[col] = std::sqrt(c[col] * c[col] + s[col] * s[col]) * m;
+					}
+				}
+
+				PU_PROFILE_WORK(static_cast<long long>(range.end - range.start) * cols);
+			});
+
+			PU_PROFILE_COUNT("PseudoCorrelation", MaskedPixelsSkipped, skipped);
+
+			return cos_sum;
+		}
+	}
+}
@@ -1,21 +1,37 @@
 #include "Wrappers.h"
+#include "Parallel.h"
+#include "Profiling.h"
+#include "Storage.h"
 
 namespace pu
 {
 	float Wrap(float phase)
 	{
-		return std::atan2f(std::sinf(phase), std::cosf(phase));
+		// Subtract whole cycles counted from -PI, no trigonometry needed
+		double cycles = std::floor((static_cast<double>(phase) + CV_PI) / (2.0 * CV_PI));
+		return static_cast<float>(phase - cycles * 2.0 * CV_PI);
 	}
 
 	cv::Mat Wrap(const cv::Mat & phase, bool normalize)
 	{
+		PU_PROFILE_SCOPE("Wrap");
+
 		// Create image same size as input
-		cv::Mat res{ phase.rows, phase.cols, CV_32FC1, cv::Scalar(0.0) };
+		cv::Mat res = parallel::Allocate(phase.rows, phase.cols, CV_32FC1);
+		PU_PROFILE_COUNT("Wrap", Allocations, 1);
+		PU_PROFILE_COUNT("Wrap", PixelsProcessed, phase.rows * phase.cols);
 
 		// Wrap each pixel
-		res.forEach<float>([&](float & px, const int * pos) -> void {
-			int row = pos[0], col = pos[1];
-			px = Wrap(phase.at<float>(row, col));
+		parallel::ForRows(cv::Range(0, phase.rows), [&](const cv::Range& range) {
+			for(int row = range.start; row < range.end; row++)
+			{
+				const float* src = phase.ptr<float>(row);
+				float* dst = res.ptr<float>(row);
+				for(int col = 0; col < phase.cols; col++)
+				{
+					dst[col] = Wrap(src[col]);
+				}
+			}
 		});
 
 		// Normalize if necessary
@@ -27,4 +43,75 @@ namespace pu
 		return res;
 	}
 
+	cv::Mat WrapNormalized(const cv::Mat & phase)
+	{
+		assert(!phase.empty() &&
+			   phase.type() == CV_32FC1 &&
+			   "[WrapNormalized] Invalid phase image");
+
+		PU_PROFILE_SCOPE("WrapNormalized");
+
+		cv::Mat res = parallel::Allocate(phase.rows, phase.cols, CV_32FC1);
+		PU_PROFILE_COUNT("WrapNormalized", Allocations, 1);
+		PU_PROFILE_COUNT("WrapNormalized", PixelsProcessed, phase.rows * phase.cols);
+
+		parallel::ForRows(cv::Range(0, phase.rows), [&](const cv::Range& range) {
+			for(int row = range.start; row < range.end; row++)
+			{
+				const float* src = phase.ptr<float>(row);
+				float* dst = res.ptr<float>(row);
+				for(int col = 0; col < phase.cols; col++)
+				{
+					// Fractional part of cycles counted from -PI
+					double cycles = (static_cast<double>(src[col]) + CV_PI) / (2.0 * CV_PI);
+					float frac = static_cast<float>(cycles - std::floor(cycles));
+
+					// Rounding up to 1.0 is the same angle as 0.0
+					dst[col] = frac < 1.0f ? frac : 0.0f;
+				}
+			}
+		});
+
+		return res;
+	}
+
+	cv::Mat Wrap(const cv::Mat & phase, cv::Rect roi, bool normalize)
+	{
+		roi &= cv::Rect(0, 0, phase.cols, phase.rows);
+		assert(roi.area() > 0 && "[Wrap] ROI does not overlap the image");
+
+		return normalize ? WrapNormalized(phase(roi)) : Wrap(phase(roi), false);
+	}
+
+	cv::Mat WrapFixed16(const cv::Mat & phase)
+	{
+		assert(!phase.empty() &&
+			   phase.type() == CV_32FC1 &&
+			   "[WrapFixed16] Invalid phase image");
+
+		PU_PROFILE_SCOPE("WrapFixed16");
+
+		cv::Mat res = parallel::Allocate(phase.rows, phase.cols, CV_16UC1);
+		PU_PROFILE_COUNT("WrapFixed16", Allocations, 1);
+		PU_PROFILE_COUNT("WrapFixed16", PixelsProcessed, phase.rows * phase.cols);
+
+		parallel::ForRows(cv::Range(0, phase.rows), [&](const cv::Range& range) {
+			for(int row = range.start; row < range.end; row++)
+			{
+				const float* src = phase.ptr<float>(row);
+				unsigned short* dst = res.ptr<unsigned short>(row);
+				for(int col = 0; col < phase.cols; col++)
+				{
+					// Cycles counted from -PI, fractional part is the wrapped phase
+					double cycles = (static_cast<double>(src[col]) + CV_PI) / (2.0 * CV_PI);
+					double frac = cycles - std::floor(cycles);
+					int value = static_cast<int>(frac * FIXED16_ONE + 0.5);
+					dst[col] = static_cast<unsigned short>(value & 0xFFFF);
+				}
+			}
+		});
+
+		return res;
+	}
+
 }
@@ -1,5 +1,5 @@
 #pragma once
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 
 namespace pu
 {
@@ -10,7 +10,7 @@ namespace pu
 	/// Phase to wrap, arbitrary value, in radians.
 	/// </param>
 	/// <returns>
-	/// Wrapped phase in radians in range [-PI, PI].
+	/// Wrapped phase in radians in range [-PI, PI).
 	/// </returns>
 	float Wrap(float phase);
 
@@ -30,5 +30,52 @@ namespace pu
 	/// was set values lay in range [0, 1] otherwise [-PI, PI].
 	/// </returns>
 	cv::Mat Wrap(const cv::Mat& phase, bool normalize = true);
+
+	/// <summary>
+	/// Wraps phase image into normalized range per pixel, value =
+	/// (Wrap(phase) + PI) / 2PI. Unlike Wrap(phase, true) result does not
+	/// depend on image extrema, so tiles of bigger image can be wrapped
+	/// independently.
+	/// </summary>
+	/// <param name="phase">
+	/// Image to wrap, 1 channel, floating point, arbitrary values in radians.
+	/// </param>
+	/// <returns>
+	/// Wrapped phase image, 1 channel, floating point, range [0, 1).
+	/// </returns>
+	cv::Mat WrapNormalized(const cv::Mat& phase);
+
+	/// <summary>
+	/// Wraps region of interest of phase image only, pixels outside of it
+	/// are not read.
+	/// </summary>
+	/// <param name="phase">
+	/// Image to wrap, 1 channel, floating point, arbitrary values in radians.
+	/// </param>
+	/// <param name="roi">
+	/// Region of interest, clipped to the image, not empty.
+	/// </param>
+	/// <param name="normalize">
+	/// [default = true] Whether to map values to [0, 1) range. Mapping is
+	/// done per pixel as in WrapNormalized, min max normalization of Wrap
+	/// would depend on the rest of the frame.
+	/// </param>
+	/// <returns>
+	/// Wrapped phase image of ROI size, 1 channel, floating point.
+	/// </returns>
+	cv::Mat Wrap(const cv::Mat& phase, cv::Rect roi, bool normalize = true);
+
+	/// <summary>
+	/// Wraps whole phase image straight into 16-bit fixed point. Unlike
+	/// normalized Wrap no min max rescaling is done, phase -PI maps to 0 and
+	/// full cycle onto 65536 (see ToFixed16).
+	/// </summary>
+	/// <param name="phase">
+	/// Image to wrap, 1 channel, floating point, arbitrary values in radians.
+	/// </param>
+	/// <returns>
+	/// Wrapped phase image, 1 channel, CV_16UC1.
+	/// </returns>
+	cv::Mat WrapFixed16(const cv::Mat& phase);
 	
 }
\ No newline at end of file
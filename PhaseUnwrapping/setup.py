@@ -0,0 +1,66 @@
+# Builds phase_unwrapping Python module: pip install ./PhaseUnwrapping
+# Check the installed module with: python PhaseUnwrapping/test_bindings.py
+#
+# OpenCV is found with pkg-config (opencv4), or given explicitly through
+# OPENCV_INCLUDE_DIR, OPENCV_LIB_DIR and OPENCV_LIBS (comma separated, e.g.
+# opencv_world3416 on Windows).
+import glob
+import os
+import subprocess
+import sys
+
+from pybind11.setup_helpers import Pybind11Extension, build_ext
+from setuptools import setup
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+
+def opencv_flags():
+    include_dirs = [d for d in os.environ.get("OPENCV_INCLUDE_DIR", "").split(os.pathsep) if d]
+    library_dirs = [d for d in os.environ.get("OPENCV_LIB_DIR", "").split(os.pathsep) if d]
+    libraries = [l for l in os.environ.get("OPENCV_LIBS", "").split(",") if l]
+    if include_dirs or libraries:
+        return include_dirs, library_dirs, libraries
+
+    try:
+        cflags = subprocess.check_output(["pkg-config", "--cflags", "opencv4"], text=True).split()
+        libs = subprocess.check_output(["pkg-config", "--libs", "opencv4"], text=True).split()
+    except (OSError, subprocess.CalledProcessError):
+        sys.exit("OpenCV not found, set OPENCV_INCLUDE_DIR, OPENCV_LIB_DIR and OPENCV_LIBS")
+
+    include_dirs = [f[2:] for f in cflags if f.startswith("-I")]
+    library_dirs = [f[2:] for f in libs if f.startswith("-L")]
+    libraries = [f[2:] for f in libs if f.startswith("-l")]
+    return include_dirs, library_dirs, libraries
+
+
+# Everything except the command line tool
+sources = sorted(
+    os.path.relpath(path, here)
+    for path in glob.glob(os.path.join(here, "*.cpp"))
+    if os.path.basename(path) != "Main.cpp"
+)
+
+include_dirs, library_dirs, libraries = opencv_flags()
+if sys.platform != "win32":
+    libraries += ["pthread"]
+    if sys.platform.startswith("linux"):
+        libraries += ["rt"]
+
+setup(
+    name="phase_unwrapping",
+    version="0.1.0",
+    description="Phase unwrapping algorithms with zero copy NumPy interface",
+    ext_modules=[
+        Pybind11Extension(
+            "phase_unwrapping",
+            sources,
+            include_dirs=[here] + include_dirs,
+            library_dirs=library_dirs,
+            libraries=libraries,
+            cxx_std=14,
+        )
+    ],
+    cmdclass={"build_ext": build_ext},
+    zip_safe=False,
+)
@@ -0,0 +1,72 @@
+# Smoke test of the built phase_unwrapping module:
+#   pip install ./PhaseUnwrapping && python PhaseUnwrapping/test_bindings.py
+#
+# Unwraps a smooth surface (no residues) with each binding and checks the
+# result against the surface up to a constant, runs the rectangular window
+# and cache paths on the same array.
+import sys
+
+import numpy as np
+
+import phase_unwrapping as pu
+
+
+def surface(rows=96, cols=128):
+    y, x = np.mgrid[0:rows, 0:cols].astype(np.float32)
+    return (0.002 * (x - 60) ** 2 + 0.15 * y + 0.0015 * x * y).astype(np.float32)
+
+
+def check_unwrapped(name, unwrapped, truth):
+    diff = np.asarray(unwrapped, dtype=np.float64) - truth
+    error = np.abs(diff - diff.flat[0]).max()
+    print(f"{name}: max error {error:.2e} rad")
+    assert error < 1e-3, name
+
+
+def main():
+    truth = surface()
+    wrapped = pu.wrap_normalized(truth)
+    assert wrapped.dtype == np.float32 and wrapped.shape == truth.shape
+    assert 0.0 <= wrapped.min() and wrapped.max() <= 1.0
+
+    square = pu.pdv(wrapped, 3)
+    rectangular = pu.pdv(wrapped, (5, 3))
+    assert square.shape == rectangular.shape == truth.shape
+    assert np.array_equal(pu.pdv(wrapped, (3, 3)), square)
+    pu.max_abs_grad(wrapped, (3, 5))
+    pu.pseudo_correlation(wrapped, (5, 1))
+    pu.mean_phase_filter(wrapped, (7, 3))
+    pu.median_phase_filter(wrapped, (3, 7))
+    for bad in (2, (4, 3), (3,)):
+        try:
+            pu.pdv(wrapped, bad)
+        except ValueError:
+            continue
+        raise AssertionError(f"window {bad} accepted")
+
+    check_unwrapped("itoh", pu.itoh(wrapped), truth)
+    check_unwrapped("least_squares", pu.least_squares(wrapped), truth)
+    check_unwrapped("quality_guided", pu.quality_guided(wrapped, square), truth)
+    check_unwrapped("multi_seed_quality_guided", pu.multi_seed_quality_guided(wrapped, square, seeds=4), truth)
+
+    # Second call of each cached binding has to hit and return the same data
+    pu.set_cache(memory_capacity=64 << 20)
+    try:
+        first = [pu.pdv(wrapped, (5, 3)), pu.mean_phase_filter(wrapped, 5), pu.quality_guided(wrapped, square)]
+        misses = pu.cache_statistics()["misses"]
+        second = [pu.pdv(wrapped, (5, 3)), pu.mean_phase_filter(wrapped, 5), pu.quality_guided(wrapped, square)]
+        statistics = pu.cache_statistics()
+        assert statistics["misses"] == misses and statistics["memory_hits"] >= 3, statistics
+        for a, b in zip(first, second):
+            assert np.array_equal(a, b)
+        print("cache:", statistics)
+    finally:
+        pu.clear_cache()
+        pu.set_cache()
+
+    print("ok")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())